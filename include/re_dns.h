@@ -204,6 +204,26 @@ struct dnsc_conf {
 	bool     getaddrinfo;   /* use getaddrinfo (by default disabled) */
 };
 
+/** DNS Client statistics */
+struct dnsc_stats {
+	uint32_t hits;       /**< Queries answered from the cache        */
+	uint32_t misses;     /**< Queries sent to the DNS servers        */
+	uint32_t coalesced;  /**< Queries attached to one in flight      */
+	uint32_t stale;      /**< Queries answered with expired entries  */
+};
+
+/**
+ * Blocking name resolver, called from the getaddrinfo worker threads
+ *
+ * @param rrl  List to append the A or AAAA records to
+ * @param name Name to resolve
+ * @param type DNS_TYPE_A or DNS_TYPE_AAAA
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+typedef int(dnsc_resolv_h)(struct list *rrl, const char *name,
+			   uint16_t type);
+
 int  dnsc_alloc(struct dnsc **dcpp, const struct dnsc_conf *conf,
 		const struct sa *srvv, uint32_t srvc);
 int  dnsc_conf_set(struct dnsc *dnsc, const struct dnsc_conf *conf);
@@ -222,8 +242,14 @@ int  dnsc_notify(struct dns_query **qp, struct dnsc *dnsc, const char *name,
 		 dns_query_h *qh, void *arg);
 void dnsc_cache_flush(struct dnsc *dnsc);
 void dnsc_cache_max(struct dnsc *dnsc, uint32_t max);
+void dnsc_cache_stale(struct dnsc *dnsc, uint32_t max);
+void dnsc_cache_limit(struct dnsc *dnsc, size_t max);
+int  dnsc_stats(const struct dnsc *dnsc, struct dnsc_stats *stats);
 void dnsc_getaddrinfo(struct dnsc *dnsc, bool active);
 bool dnsc_getaddrinfo_enabled(struct dnsc *dnsc);
+void dnsc_getaddrinfo_pool(struct dnsc *dnsc, uint16_t workers,
+			   uint32_t timeout);
+void dnsc_getaddrinfo_resolver(struct dnsc *dnsc, dnsc_resolv_h *resolvh);
 
 
 /* DNS System functions */
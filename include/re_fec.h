@@ -0,0 +1,68 @@
+/**
+ * @file re_fec.h  Interface to RTP Forward Error Correction (RFC 5109)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+struct fec_enc;
+struct fec_dec;
+struct rtp_header;
+
+
+enum {
+	FEC_HDR_SIZE  = 10,  /**< ULPFEC header size                    */
+	FEC_MASK_BITS = 48,  /**< Max. media packets per FEC packet     */
+};
+
+/** Packet mask layout used by the FEC encoder */
+enum fec_mask {
+	FEC_MASK_INTERLEAVED,  /**< FEC j protects media i, i % m == j  */
+	FEC_MASK_BLOCK,        /**< FEC j protects a consecutive block  */
+};
+
+/** Decoded ULPFEC header with a single protection level */
+struct fec_hdr {
+	bool     l;          /**< Long mask (48 bits)                   */
+	uint8_t  b0;         /**< P, X and CC recovery bits             */
+	uint8_t  b1;         /**< Marker and PT recovery bits           */
+	uint16_t sn_base;    /**< Lowest protected sequence number      */
+	uint32_t ts_rec;     /**< Timestamp recovery                    */
+	uint16_t len_rec;    /**< Length recovery                       */
+	uint16_t prot_len;   /**< Level 0 protection length [bytes]     */
+	uint64_t mask;       /**< Level 0 mask, bit 47 is SN base       */
+};
+
+/** FEC decoder statistics */
+struct fec_stats {
+	uint32_t media;      /**< Media packets stored                  */
+	uint32_t fec;        /**< FEC packets received                  */
+	uint32_t recovered;  /**< Media packets recovered               */
+	uint32_t expired;    /**< FEC packets dropped without use       */
+};
+
+
+/**
+ * Defines the FEC recovery handler
+ *
+ * @param hdr RTP header of the recovered packet
+ * @param mb  Recovered packet, positioned at the RTP payload
+ * @param arg Handler argument
+ */
+typedef void (fec_recover_h)(const struct rtp_header *hdr, struct mbuf *mb,
+			     void *arg);
+
+int  fec_hdr_decode(struct fec_hdr *hdr, struct mbuf *mb);
+int  fec_encode(struct mbuf *mb, struct mbuf * const *pktv, size_t pktc);
+
+int  fec_enc_alloc(struct fec_enc **encp, uint8_t k, uint8_t m,
+		   enum fec_mask type);
+int  fec_enc_put(struct fec_enc *enc, const struct mbuf *mb);
+int  fec_enc_get(struct fec_enc *enc, struct mbuf **mbp);
+
+int  fec_dec_alloc(struct fec_dec **decp, fec_recover_h *recoverh,
+		   void *arg);
+int  fec_dec_media(struct fec_dec *dec, const struct rtp_header *hdr,
+		   const struct mbuf *mb);
+int  fec_dec_fec(struct fec_dec *dec, const struct rtp_header *hdr,
+		 struct mbuf *mb);
+void fec_dec_stats(const struct fec_dec *dec, struct fec_stats *stats);
+int  fec_dec_debug(struct re_printf *pf, const struct fec_dec *dec);
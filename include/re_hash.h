@@ -8,8 +8,18 @@
 struct hash;
 struct pl;
 
+/**
+ * Defines the hash key handler, returns the key of a hashed element
+ *
+ * @param le List element
+ *
+ * @return Hash key
+ */
+typedef uint32_t (hash_key_h)(const struct le *le);
+
 
 int  hash_alloc(struct hash **hp, uint32_t bsize);
+int  hash_alloc_auto(struct hash **hp, uint32_t bsize, hash_key_h *keyh);
 void hash_append(struct hash *h, uint32_t key, struct le *le, void *data);
 void hash_unlink(struct le *le);
 struct le *hash_lookup(const struct hash *h, uint32_t key, list_apply_h *ah,
@@ -107,6 +107,17 @@ struct http_conf {
 	uint32_t idle_timeout;  /* in [ms] */
 };
 
+/** Http Client connection pool statistics */
+struct http_pool_stats {
+	uint32_t conns;         /**< Open connections                    */
+	uint32_t queued;        /**< Requests waiting for a connection   */
+	uint64_t conn_new;      /**< Connections opened                  */
+	uint64_t conn_reused;   /**< Requests sent on an idle connection */
+	uint64_t pipelined;     /**< Requests sent behind another one    */
+	uint64_t waited;        /**< Requests that had to wait           */
+	uint64_t tls_resumed;   /**< Connections with a resumed session  */
+};
+
 
 typedef bool(http_hdr_h)(const struct http_hdr *hdr, void *arg);
 
@@ -156,6 +167,10 @@ void http_client_set_laddr(struct http_cli *cli, const struct sa *addr);
 void http_client_set_laddr6(struct http_cli *cli, const struct sa *addr);
 void http_client_set_bufsize_max(struct http_cli *cli, size_t max_size);
 size_t http_client_get_bufsize_max(struct http_cli *cli);
+int http_client_set_pool(struct http_cli *cli, uint32_t max_conns,
+			 uint32_t pipeline);
+int http_client_pool_stats(const struct http_cli *cli,
+			   struct http_pool_stats *stats);
 
 #ifdef USE_TLS
 int http_client_set_tls(struct http_cli *cli, struct tls *tls);
@@ -211,6 +226,11 @@ int  http_reply(struct http_conn *conn, uint16_t scode, const char *reason,
 int  http_creply(struct http_conn *conn, uint16_t scode, const char *reason,
 		 const char *ctype, const char *fmt, ...);
 int  http_ereply(struct http_conn *conn, uint16_t scode, const char *reason);
+int  http_sreply(struct http_conn *conn, uint16_t scode, const char *reason,
+		 int64_t clen, http_bodyh *bodyh, void *arg,
+		 const char *fmt, ...);
+int  http_freply(struct http_conn *conn, uint16_t scode, const char *reason,
+		 const char *ctype, const char *path);
 
 
 /* Authentication */
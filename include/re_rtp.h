@@ -202,6 +202,44 @@ struct rtcp_stats {
 	uint32_t rtt;           /**< Current Round-Trip Time in [us] */
 };
 
+/** TWCC packet status, one per transport-wide sequence number */
+struct twcc_status {
+	uint16_t seq;    /**< Transport-wide sequence number          */
+	bool recv;       /**< True if the packet was received         */
+	int64_t rx;      /**< Remote receive time in [us], if received */
+	uint64_t tx;     /**< Local send time in [us], 0 if unknown   */
+	size_t size;     /**< Packet size in [bytes], 0 if unknown    */
+};
+
+/** RTP Retransmission history configuration */
+struct rtp_hist_conf {
+	uint32_t max_age;       /**< Max. packet age in [ms], 0 for default */
+	size_t max_bytes;       /**< Max. stored bytes, 0 for default       */
+	uint32_t min_interval;  /**< Min. resend interval per packet [ms]   */
+	uint32_t rtx_bitrate;   /**< Resend budget in [bit/s], 0=unlimited  */
+	uint8_t rtx_pt;         /**< RTX payload type, 0 for plain resend   */
+	uint32_t rtx_ssrc;      /**< RTX SSRC (RFC 4588)                    */
+};
+
+/** RTP Retransmission history statistics */
+struct rtp_hist_stats {
+	uint32_t stored;     /**< Packets stored                       */
+	uint32_t resent;     /**< Packets retransmitted                */
+	uint32_t missing;    /**< Requests for packets not in history  */
+	uint32_t throttled;  /**< Requests dropped by interval/budget  */
+};
+
+/** RTP Pacer statistics */
+struct rtp_pacer_stats {
+	uint32_t queued;      /**< Packets currently queued            */
+	size_t bytes;         /**< Bytes currently queued              */
+	uint32_t sent;        /**< Packets sent                        */
+	uint32_t overflow;    /**< Packets sent early on full queue    */
+	uint64_t delay;       /**< Current max. queue delay in [us]    */
+	uint64_t delay_avg;   /**< Average queue delay in [us]         */
+	uint64_t delay_max;   /**< Max. queue delay in [us]            */
+};
+
 struct sa;
 struct re_printf;
 struct rtp_sock;
@@ -228,6 +266,17 @@ typedef void (rtp_recv_h)(const struct sa *src, const struct rtp_header *hdr,
 typedef void (rtcp_recv_h)(const struct sa *src, struct rtcp_msg *msg,
 			   void *arg);
 
+
+/**
+ * Defines the TWCC packet status handler
+ *
+ * @param st   Packet status
+ * @param arg  Handler argument
+ *
+ * @return True to stop traversing, otherwise false
+ */
+typedef bool (twcc_status_h)(const struct twcc_status *st, void *arg);
+
 /* RTP api */
 int   rtp_alloc(struct rtp_sock **rsp);
 int   rtp_listen(struct rtp_sock **rsp, int proto, const struct sa *ip,
@@ -254,6 +303,25 @@ uint16_t rtp_sess_seq(const struct rtp_sock *rs);
 const struct sa *rtp_local(const struct rtp_sock *rs);
 int rtp_clear(struct rtp_sock *rs);
 
+/* Retransmission history api */
+int   rtp_hist_enable(struct rtp_sock *rs, const struct rtp_hist_conf *conf);
+int   rtp_hist_resend(struct rtp_sock *rs, uint16_t seq);
+int   rtp_hist_stats(const struct rtp_sock *rs, struct rtp_hist_stats *stats);
+
+/* Pacer api */
+int   rtp_pacer_enable(struct rtp_sock *rs, uint32_t bitrate);
+void  rtp_pacer_set_bitrate(struct rtp_sock *rs, uint32_t bitrate);
+void  rtp_pacer_set_prio(struct rtp_sock *rs, uint8_t pt, bool prio);
+int   rtp_pacer_stats(const struct rtp_sock *rs,
+		      struct rtp_pacer_stats *stats);
+
+/* Transport-wide Congestion Control api */
+int   rtp_twcc_enable(struct rtp_sock *rs, uint8_t extid, uint32_t interval);
+int   rtp_twcc_recv(struct rtp_sock *rs, uint16_t seq, uint32_t ssrc);
+uint16_t rtp_twcc_next_seq(struct rtp_sock *rs);
+int   rtp_twcc_apply(struct rtp_sock *rs, const struct twcc *twcc,
+		     twcc_status_h *sh, void *arg);
+
 /* RTCP session api */
 void  rtcp_start(struct rtp_sock *rs, const char *cname,
 		 const struct sa *peer);
@@ -267,9 +335,12 @@ int   rtcp_send_app(struct rtp_sock *rs, const char name[4],
 		    const uint8_t *data, size_t len);
 int   rtcp_send_fir(struct rtp_sock *rs, uint32_t ssrc);
 int   rtcp_send_nack(struct rtp_sock *rs, uint16_t fsn, uint16_t blp);
+int   rtcp_send_gnack(struct rtp_sock *rs, uint32_t ssrc, uint16_t pid,
+		      uint16_t blp);
 int   rtcp_send_pli(struct rtp_sock *rs, uint32_t fb_ssrc);
 int   rtcp_send_fir_rfc5104(struct rtp_sock *rs, uint32_t ssrc,
 			    uint8_t fir_seqn);
+int   rtcp_send_twcc(struct rtp_sock *rs);
 int   rtcp_debug(struct re_printf *pf, const struct rtp_sock *rs);
 void *rtcp_sock(const struct rtp_sock *rs);
 int   rtcp_stats(struct rtp_sock *rs, uint32_t ssrc, struct rtcp_stats *stats);
@@ -283,6 +354,8 @@ const char *rtcp_type_name(enum rtcp_type type);
 const char *rtcp_sdes_name(enum rtcp_sdes_type sdes);
 bool rtp_is_rtcp_packet(const struct mbuf *mb);
 void rtcp_calc_rtt(uint32_t *rtt, uint32_t lsr, uint32_t dlsr);
+int  rtcp_twcc_encode(struct mbuf *mb, struct rtp_sock *rs);
+int  rtcp_twcc_apply(const struct twcc *twcc, twcc_status_h *sh, void *arg);
 
 
 /**
@@ -221,12 +221,12 @@ struct sip_msg {
 	struct pl maxfwd;      /**< Cached Max-Forwards header           */
 	struct pl expires;     /**< Cached Expires header                */
 	struct pl clen;        /**< Cached Content-Length header         */
-	struct hash *hdrht;    /**< Hash-table with all SIP headers      */
 	struct mbuf *mb;       /**< Buffer containing the SIP message    */
 	void *sock;            /**< Transport socket                     */
 	uint64_t tag;          /**< Opaque tag                           */
 	enum sip_transp tp;    /**< SIP Transport                        */
 	bool req;              /**< True if Request, False if Response  */
+	bool lazy;             /**< Structured fields not yet decoded    */
 };
 
 /** SIP Loop-state */
@@ -257,6 +257,14 @@ struct sip_uas_auth {
 	bool stale;
 };
 
+/** SIP overload control configuration */
+struct sip_overload_conf {
+	uint32_t lag_min;      /**< Loop lag where rejection starts [ms] */
+	uint32_t lag_max;      /**< Loop lag where all are rejected [ms] */
+	uint32_t strans_max;   /**< Server transaction limit, 0 for none */
+	uint32_t retry_after;  /**< Retry-After in 503 responses [s]     */
+};
+
 struct sip;
 struct sip_lsnr;
 struct sip_request;
@@ -265,6 +273,7 @@ struct sip_auth;
 struct sip_dialog;
 struct sip_keepalive;
 struct sip_uas_auth;
+struct sip_shard;
 struct dnsc;
 
 typedef bool(sip_msg_h)(const struct sip_msg *msg, void *arg);
@@ -288,6 +297,7 @@ typedef void(sip_trace_h)(bool tx, enum sip_transp tp,
 			  const uint8_t *pkt, size_t len, void *arg);
 typedef int (sip_uas_auth_h)(uint8_t *ha1, const struct pl *user,
 			     const char *realm, void *arg);
+typedef void(sip_shard_h)(struct sip *sip, void *arg);
 
 
 /* sip */
@@ -306,6 +316,20 @@ int  sip_send_conn(struct sip *sip, void *sock, enum sip_transp tp,
 void sip_set_trace_handler(struct sip *sip, sip_trace_h *traceh);
 
 
+/* overload */
+int  sip_overload_set(struct sip *sip, const struct sip_overload_conf *conf);
+uint32_t sip_overload_level(const struct sip *sip);
+uint32_t sip_overload_rejected(const struct sip *sip);
+
+
+/* shard */
+int  sip_shard_alloc(struct sip_shard **shp, uint32_t n);
+int  sip_shard_attach(struct sip_shard *sh, uint32_t idx, struct sip *sip);
+uint32_t sip_shard_index(const struct sip_shard *sh, const struct pl *callid);
+int  sip_shard_exec(struct sip_shard *sh, const struct pl *callid,
+		    sip_shard_h *h, void *arg);
+
+
 /* transport */
 int  sip_transp_add(struct sip *sip, enum sip_transp tp,
 		    const struct sa *laddr, ...);
@@ -406,6 +430,8 @@ bool sip_dialog_cmp_half(const struct sip_dialog *dlg,
 
 /* msg */
 int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb);
+int sip_msg_decode_lazy(struct sip_msg **msgp, struct mbuf *mb);
+int sip_msg_parse(struct sip_msg *msg);
 const struct sip_hdr *sip_msg_hdr(const struct sip_msg *msg,
 				  enum sip_hdrid id);
 const struct sip_hdr *sip_msg_hdr_apply(const struct sip_msg *msg,
@@ -74,6 +74,16 @@ int sipevent_notifyf(struct sipnot *sipnot, struct mbuf **mbp,
 		     uint32_t retry_after, const char *fmt, ...);
 
 
+/* Notify fan-out */
+
+struct sipevent_fanout;
+
+int sipevent_fanout_alloc(struct sipevent_fanout **fop, uint32_t rate);
+int sipevent_fanout(struct sipevent_fanout *fo, struct sipnot * const *notv,
+		    size_t notc, struct mbuf *mb, enum sipevent_subst state);
+uint32_t sipevent_fanout_pending(const struct sipevent_fanout *fo);
+
+
 /* Subscriber */
 
 struct sipsub;
@@ -8,6 +8,7 @@ struct tls;
 struct tls_conn;
 struct tcp_conn;
 struct udp_sock;
+struct re_async;
 
 
 /** Defines the TLS method */
@@ -83,6 +84,8 @@ int tls_reuse_session(const struct tls_conn *tc);
 bool tls_session_reused(const struct tls_conn *tc);
 int tls_update_sessions(const struct tls_conn *tc);
 void tls_set_posthandshake_auth(struct tls *tls, int value);
+int tls_set_async(struct tls *tls, struct re_async *async);
+uint64_t tls_async_ops(const struct tls *tls);
 
 /* TCP */
 
@@ -104,6 +107,24 @@ typedef void (dtls_close_h)(int err, void *arg);
 
 struct dtls_sock;
 
+/** Protection of a listening DTLS Socket */
+struct dtls_listen_conf {
+	bool cookie;            /**< Stateless HelloVerifyRequest cookies */
+	uint32_t key_lifetime;  /**< Cookie key rotation [ms], 0 default  */
+	uint32_t hs_rate;       /**< New handshakes per second, 0 no limit */
+	uint32_t hs_burst;      /**< Token bucket size, 0 for hs_rate     */
+	uint32_t hs_pending;    /**< Max pending handshakes, 0 no limit   */
+};
+
+/** Handshake counters of a listening DTLS Socket */
+struct dtls_listen_stats {
+	uint64_t hello_verify;  /**< HelloVerifyRequests sent             */
+	uint64_t verified;      /**< ClientHellos with a valid cookie     */
+	uint64_t rejected;      /**< Dropped, malformed or over the limit */
+	uint64_t completed;     /**< Accepted handshakes completed        */
+	uint32_t pending;       /**< Accepted handshakes in progress      */
+};
+
 int dtls_listen(struct dtls_sock **sockp, const struct sa *laddr,
 		struct udp_sock *us, uint32_t htsize, int layer,
 		dtls_conn_h *connh, void *arg);
@@ -125,6 +146,10 @@ void dtls_set_peer(struct tls_conn *tc, const struct sa *peer);
 void dtls_recv_packet(struct dtls_sock *sock, const struct sa *src,
 		      struct mbuf *mb);
 void dtls_set_single(struct dtls_sock *sock, bool single);
+int dtls_set_listen_conf(struct dtls_sock *sock,
+			 const struct dtls_listen_conf *conf);
+int dtls_listen_stats(const struct dtls_sock *sock,
+		      struct dtls_listen_stats *stats);
 
 
 struct x509_st;
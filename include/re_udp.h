@@ -24,6 +24,8 @@ typedef void (udp_error_h)(int err, void *arg);
 
 int  udp_listen(struct udp_sock **usp, const struct sa *local,
 		udp_recv_h *rh, void *arg);
+int  udp_listen_shared(struct udp_sock **usp, const struct sa *local,
+		       udp_recv_h *rh, void *arg);
 int  udp_alloc_sockless(struct udp_sock **usp,
 			udp_send_h *sendh, udp_recv_h *recvh, void *arg);
 int  udp_alloc_fd(struct udp_sock **usp, re_sock_t fd,
@@ -69,3 +71,17 @@ int udp_send_helper(struct udp_sock *us, const struct sa *dst,
 void udp_recv_helper(struct udp_sock *us, const struct sa *src,
 		     struct mbuf *mb, struct udp_helper *uh);
 struct udp_helper *udp_helper_find(const struct udp_sock *us, int layer);
+void udp_helper_set_classes(struct udp_helper *uh, unsigned classes);
+
+
+/** Packet classes by the first byte of a datagram (RFC 7983) */
+enum udp_pkt_class {
+	UDP_PKT_STUN  = 1<<0,  /**< 0 - 3                          */
+	UDP_PKT_ZRTP  = 1<<1,  /**< 16 - 19                        */
+	UDP_PKT_DTLS  = 1<<2,  /**< 20 - 63                        */
+	UDP_PKT_TURN  = 1<<3,  /**< 64 - 79, TURN ChannelData      */
+	UDP_PKT_RTP   = 1<<4,  /**< 128 - 191, RTP and RTCP        */
+	UDP_PKT_OTHER = 1<<5,  /**< Empty or unassigned first byte */
+};
+
+enum udp_pkt_class udp_pkt_classify(const struct mbuf *mb);
@@ -43,6 +43,23 @@ struct websock_hdr {
 	uint8_t mkey[4];
 };
 
+/** permessage-deflate settings (RFC 7692) */
+struct websock_deflate {
+	int level;                       /**< 1-9, 0 for the zlib default */
+	uint8_t server_max_window_bits;  /**< 9-15, 0 for 15              */
+	uint8_t client_max_window_bits;  /**< 9-15, 0 for 15              */
+	bool server_no_context_takeover;
+	bool client_no_context_takeover;
+};
+
+/** permessage-deflate statistics */
+struct websock_deflate_stats {
+	uint64_t tx_raw;    /**< Message bytes before compression  */
+	uint64_t tx_comp;   /**< Compressed message bytes sent     */
+	uint64_t rx_comp;   /**< Compressed message bytes received */
+	uint64_t rx_raw;    /**< Message bytes after decompression */
+};
+
 struct websock;
 struct websock_conn;
 
@@ -78,9 +95,14 @@ int websock_close(struct websock_conn *conn, enum websock_scode scode,
 		  const char *fmt, ...);
 const struct sa *websock_peer(const struct websock_conn *conn);
 struct tcp_conn *websock_tcp(const struct websock_conn *conn);
+void websock_mask(uint8_t *dst, const uint8_t *src, size_t n,
+		  const uint8_t *mkey, size_t pos);
 
 typedef void (websock_shutdown_h)(void *arg);
 
 int  websock_alloc(struct websock **sockp, websock_shutdown_h *shuth,
 		   void *arg);
 void websock_shutdown(struct websock *sock);
+int  websock_deflate(struct websock *sock, const struct websock_deflate *conf);
+int  websock_deflate_stats(const struct websock_conn *conn,
+			   struct websock_deflate_stats *stats);
@@ -0,0 +1,765 @@
+/**
+ * @file aesni.c  AES-NI accelerated CTR and GCM
+ *
+ * The round keys are expanded once at allocation, and the keystream and
+ * GHASH are computed with the AES-NI and PCLMULQDQ instructions. Setting
+ * a new IV is a few stores, so short packets avoid the per-call setup of
+ * the generic cipher path. Availability is checked at runtime via CPUID.
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_aes.h>
+#include "aesni.h"
+
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_AESNI 1
+#endif
+
+
+#ifdef HAVE_AESNI
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+
+#define TARGET __attribute__((target("aes,pclmul,ssse3")))
+
+
+enum {
+	AESNI_MAX_RK = 15,  /**< Round keys for AES-256              */
+	GCM_IV_LEN   = 12,  /**< Supported GCM IV length             */
+
+	CPUID_SSSE3  = 1 << 9,
+	CPUID_PCLMUL = 1 << 1,
+	CPUID_AES    = 1 << 25,
+};
+
+
+/** Defines the AES-NI cipher state */
+struct aesni {
+	uint8_t rk[AESNI_MAX_RK][AES_BLOCK_SIZE];  /**< Round keys       */
+	uint8_t hv[4][AES_BLOCK_SIZE]; /**< H^1..H^4, byte reversed      */
+	uint8_t ekj0[AES_BLOCK_SIZE];  /**< Encrypted GCM pre-counter    */
+	uint8_t ctr[AES_BLOCK_SIZE];   /**< Next counter, byte reversed  */
+	uint8_t ks[AES_BLOCK_SIZE];    /**< Keystream of partial block   */
+	uint8_t y[AES_BLOCK_SIZE];     /**< GHASH state, byte reversed   */
+	uint8_t gbuf[AES_BLOCK_SIZE];  /**< Partial GHASH input block    */
+	size_t ks_off;                 /**< Used keystream bytes         */
+	size_t glen;                   /**< Bytes in partial GHASH block */
+	uint64_t aad_len;              /**< GCM AAD length [bytes]       */
+	uint64_t txt_len;              /**< GCM text length [bytes]      */
+	unsigned nr;                   /**< Number of rounds             */
+	enum aes_mode mode;            /**< Cipher mode                  */
+	bool txt;                      /**< GCM text phase has started   */
+};
+
+
+static void destructor(void *arg)
+{
+	struct aesni *ni = arg;
+
+	mem_secclean(ni, sizeof(*ni));
+}
+
+
+/**
+ * Check if the CPU supports the AES-NI fast path
+ *
+ * @return True if supported, otherwise false
+ */
+bool aesni_supported(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return false;
+
+	return (c & CPUID_AES) && (c & CPUID_PCLMUL) && (c & CPUID_SSSE3);
+}
+
+
+static inline TARGET __m128i bswap128(__m128i x)
+{
+	const __m128i mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+					  8, 9, 10, 11, 12, 13, 14, 15);
+
+	return _mm_shuffle_epi8(x, mask);
+}
+
+
+static inline TARGET __m128i load(const uint8_t *p)
+{
+	return _mm_loadu_si128((const void *)p);
+}
+
+
+static inline TARGET void store(uint8_t *p, __m128i x)
+{
+	_mm_storeu_si128((void *)p, x);
+}
+
+
+static inline TARGET void keys_load(__m128i *rk, const struct aesni *ni)
+{
+	for (unsigned i=0; i<=ni->nr; i++)
+		rk[i] = load(ni->rk[i]);
+}
+
+
+static inline TARGET __m128i encrypt_block(const __m128i *rk, unsigned nr,
+					   __m128i b)
+{
+	b = _mm_xor_si128(b, rk[0]);
+
+	for (unsigned r=1; r<nr; r++)
+		b = _mm_aesenc_si128(b, rk[r]);
+
+	return _mm_aesenclast_si128(b, rk[nr]);
+}
+
+
+/* CTR increments the whole block, GCM the lower 32 bits only */
+static inline TARGET __m128i ctr_next(__m128i c, enum aes_mode mode)
+{
+	if (mode == AES_MODE_GCM)
+		return _mm_add_epi32(c, _mm_set_epi32(0, 0, 0, 1));
+
+	c = _mm_add_epi64(c, _mm_set_epi64x(0, 1));
+	if (!_mm_cvtsi128_si64(c))
+		c = _mm_add_epi64(c, _mm_set_epi64x(1, 0));
+
+	return c;
+}
+
+
+/* SubWord() using the S-box of AESKEYGENASSIST */
+static TARGET uint32_t sub_word(uint32_t w)
+{
+	__m128i x = _mm_set_epi32(0, 0, (int)w, 0);
+
+	return (uint32_t)_mm_cvtsi128_si32(_mm_aeskeygenassist_si128(x, 0));
+}
+
+
+/* Key expansion (FIPS-197 5.2), words in little-endian byte order */
+static void key_expand(struct aesni *ni, const uint8_t *key, unsigned nk)
+{
+	uint32_t w[4 * AESNI_MAX_RK];
+	const unsigned n = 4 * (ni->nr + 1);
+	uint32_t rcon = 0x01;
+
+	memcpy(w, key, nk * sizeof(uint32_t));
+
+	for (unsigned i=nk; i<n; i++) {
+
+		uint32_t t = w[i-1];
+
+		if (i % nk == 0) {
+			t = sub_word(t >> 8 | t << 24) ^ rcon;
+			rcon = (rcon << 1) ^ ((rcon & 0x80) ? 0x11b : 0);
+		}
+		else if (nk > 6 && i % nk == 4) {
+			t = sub_word(t);
+		}
+
+		w[i] = w[i-nk] ^ t;
+	}
+
+	memcpy(ni->rk, w, n * sizeof(uint32_t));
+	mem_secclean(w, sizeof(w));
+}
+
+
+/*
+ * Carry-less multiplication in GF(2^128) on byte reversed operands,
+ * with shift and reduction (Intel, "Carry-Less Multiplication
+ * Instruction and its Usage for Computing the GCM Mode", Algorithms 1
+ * and 5). The 256-bit products are linear, so several of them can be
+ * added before a single reduction.
+ */
+static inline TARGET void clmul(__m128i a, __m128i b, __m128i *lo,
+				__m128i *hi)
+{
+	__m128i t4, t5;
+
+	t4 = _mm_clmulepi64_si128(a, b, 0x10);
+	t5 = _mm_clmulepi64_si128(a, b, 0x01);
+	t4 = _mm_xor_si128(t4, t5);
+
+	*lo = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00),
+			    _mm_slli_si128(t4, 8));
+	*hi = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11),
+			    _mm_srli_si128(t4, 8));
+}
+
+
+static inline TARGET __m128i reduce(__m128i t3, __m128i t6)
+{
+	__m128i t2, t4, t5, t7, t8, t9;
+
+	/* shift the 256-bit product left by one bit */
+	t7 = _mm_srli_epi32(t3, 31);
+	t8 = _mm_srli_epi32(t6, 31);
+	t3 = _mm_slli_epi32(t3, 1);
+	t6 = _mm_slli_epi32(t6, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	t3 = _mm_or_si128(t3, t7);
+	t6 = _mm_or_si128(t6, t8);
+	t6 = _mm_or_si128(t6, t9);
+
+	/* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+	t7 = _mm_slli_epi32(t3, 31);
+	t8 = _mm_slli_epi32(t3, 30);
+	t9 = _mm_slli_epi32(t3, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	t3 = _mm_xor_si128(t3, t7);
+
+	t2 = _mm_srli_epi32(t3, 1);
+	t4 = _mm_srli_epi32(t3, 2);
+	t5 = _mm_srli_epi32(t3, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	t3 = _mm_xor_si128(t3, t2);
+
+	return _mm_xor_si128(t6, t3);
+}
+
+
+static inline TARGET __m128i gfmul(__m128i a, __m128i b)
+{
+	__m128i lo, hi;
+
+	clmul(a, b, &lo, &hi);
+
+	return reduce(lo, hi);
+}
+
+
+static TARGET void ghash_update(struct aesni *ni, const uint8_t *p,
+				size_t len)
+{
+	const __m128i h = load(ni->hv[0]);
+	__m128i y = load(ni->y);
+
+	if (ni->glen) {
+		size_t n = min(len, AES_BLOCK_SIZE - ni->glen);
+
+		memcpy(ni->gbuf + ni->glen, p, n);
+		ni->glen += n;
+		p   += n;
+		len -= n;
+
+		if (ni->glen < AES_BLOCK_SIZE)
+			return;
+
+		y = gfmul(_mm_xor_si128(y, bswap128(load(ni->gbuf))), h);
+		ni->glen = 0;
+	}
+
+	/* Y = (Y + X0)H^4 + X1H^3 + X2H^2 + X3H, one reduction */
+	if (len >= 4 * AES_BLOCK_SIZE) {
+
+		const __m128i h2 = load(ni->hv[1]);
+		const __m128i h3 = load(ni->hv[2]);
+		const __m128i h4 = load(ni->hv[3]);
+
+		for (; len >= 4 * AES_BLOCK_SIZE;
+		     len -= 4 * AES_BLOCK_SIZE) {
+
+			__m128i lo, hi, l, u;
+
+			clmul(_mm_xor_si128(y, bswap128(load(p))), h4,
+			      &lo, &hi);
+
+			clmul(bswap128(load(p + 16)), h3, &l, &u);
+			lo = _mm_xor_si128(lo, l);
+			hi = _mm_xor_si128(hi, u);
+
+			clmul(bswap128(load(p + 32)), h2, &l, &u);
+			lo = _mm_xor_si128(lo, l);
+			hi = _mm_xor_si128(hi, u);
+
+			clmul(bswap128(load(p + 48)), h, &l, &u);
+			lo = _mm_xor_si128(lo, l);
+			hi = _mm_xor_si128(hi, u);
+
+			y = reduce(lo, hi);
+			p += 4 * AES_BLOCK_SIZE;
+		}
+	}
+
+	for (; len >= AES_BLOCK_SIZE; len -= AES_BLOCK_SIZE) {
+		y = gfmul(_mm_xor_si128(y, bswap128(load(p))), h);
+		p += AES_BLOCK_SIZE;
+	}
+
+	if (len) {
+		memcpy(ni->gbuf, p, len);
+		ni->glen = len;
+	}
+
+	store(ni->y, y);
+}
+
+
+/* Zero-pad a partial GHASH block */
+static void ghash_pad(struct aesni *ni)
+{
+	static const uint8_t zero[AES_BLOCK_SIZE];
+
+	if (ni->glen)
+		ghash_update(ni, zero, AES_BLOCK_SIZE - ni->glen);
+}
+
+
+static TARGET void ctr_xor(struct aesni *ni, uint8_t *out, const uint8_t *in,
+			   size_t len)
+{
+	__m128i rk[AESNI_MAX_RK];
+	const unsigned nr = ni->nr;
+	__m128i c;
+
+	/* use up the keystream of a previous partial block */
+	while (len && ni->ks_off < AES_BLOCK_SIZE) {
+		*out++ = *in++ ^ ni->ks[ni->ks_off++];
+		--len;
+	}
+
+	if (!len)
+		return;
+
+	keys_load(rk, ni);
+	c = load(ni->ctr);
+
+	/* four blocks in parallel to hide the AESENC latency */
+	for (; len >= 4 * AES_BLOCK_SIZE; len -= 4 * AES_BLOCK_SIZE) {
+
+		__m128i b0, b1, b2, b3;
+
+		b0 = bswap128(c);
+		c  = ctr_next(c, ni->mode);
+		b1 = bswap128(c);
+		c  = ctr_next(c, ni->mode);
+		b2 = bswap128(c);
+		c  = ctr_next(c, ni->mode);
+		b3 = bswap128(c);
+		c  = ctr_next(c, ni->mode);
+
+		b0 = _mm_xor_si128(b0, rk[0]);
+		b1 = _mm_xor_si128(b1, rk[0]);
+		b2 = _mm_xor_si128(b2, rk[0]);
+		b3 = _mm_xor_si128(b3, rk[0]);
+
+		for (unsigned r=1; r<nr; r++) {
+			b0 = _mm_aesenc_si128(b0, rk[r]);
+			b1 = _mm_aesenc_si128(b1, rk[r]);
+			b2 = _mm_aesenc_si128(b2, rk[r]);
+			b3 = _mm_aesenc_si128(b3, rk[r]);
+		}
+
+		b0 = _mm_aesenclast_si128(b0, rk[nr]);
+		b1 = _mm_aesenclast_si128(b1, rk[nr]);
+		b2 = _mm_aesenclast_si128(b2, rk[nr]);
+		b3 = _mm_aesenclast_si128(b3, rk[nr]);
+
+		store(out,      _mm_xor_si128(b0, load(in)));
+		store(out + 16, _mm_xor_si128(b1, load(in + 16)));
+		store(out + 32, _mm_xor_si128(b2, load(in + 32)));
+		store(out + 48, _mm_xor_si128(b3, load(in + 48)));
+
+		in  += 4 * AES_BLOCK_SIZE;
+		out += 4 * AES_BLOCK_SIZE;
+	}
+
+	for (; len >= AES_BLOCK_SIZE; len -= AES_BLOCK_SIZE) {
+
+		__m128i b = encrypt_block(rk, nr, bswap128(c));
+
+		c = ctr_next(c, ni->mode);
+		store(out, _mm_xor_si128(b, load(in)));
+
+		in  += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+
+	if (len) {
+		store(ni->ks, encrypt_block(rk, nr, bswap128(c)));
+		c = ctr_next(c, ni->mode);
+
+		for (size_t i=0; i<len; i++)
+			out[i] = in[i] ^ ni->ks[i];
+
+		ni->ks_off = len;
+	}
+
+	store(ni->ctr, c);
+}
+
+
+/* GHASH key H = E(K, 0^128) and its powers */
+static TARGET void gcm_init(struct aesni *ni)
+{
+	__m128i rk[AESNI_MAX_RK];
+	__m128i h, hn;
+
+	keys_load(rk, ni);
+	h = bswap128(encrypt_block(rk, ni->nr, _mm_setzero_si128()));
+	mem_secclean(rk, sizeof(rk));
+
+	hn = h;
+	store(ni->hv[0], h);
+
+	for (size_t i=1; i<RE_ARRAY_SIZE(ni->hv); i++) {
+		hn = gfmul(hn, h);
+		store(ni->hv[i], hn);
+	}
+}
+
+
+/**
+ * Allocate a new AES-NI cipher state
+ *
+ * @param nip      Pointer to allocated state
+ * @param mode     AES mode
+ * @param key      Encryption key
+ * @param key_bits Key size in bits
+ * @param iv       Optional initial vector
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aesni_alloc(struct aesni **nip, enum aes_mode mode,
+		const uint8_t *key, size_t key_bits, const uint8_t *iv)
+{
+	struct aesni *ni;
+
+	if (!nip || !key)
+		return EINVAL;
+
+	if (key_bits != 128 && key_bits != 192 && key_bits != 256)
+		return ENOTSUP;
+
+	if (mode != AES_MODE_CTR && mode != AES_MODE_GCM)
+		return ENOTSUP;
+
+	ni = mem_zalloc(sizeof(*ni), destructor);
+	if (!ni)
+		return ENOMEM;
+
+	ni->mode   = mode;
+	ni->nr     = (unsigned)key_bits / 32 + 6;
+	ni->ks_off = AES_BLOCK_SIZE;
+
+	key_expand(ni, key, (unsigned)key_bits / 32);
+
+	if (mode == AES_MODE_GCM)
+		gcm_init(ni);
+
+	if (iv)
+		aesni_set_iv(ni, iv);
+
+	*nip = ni;
+
+	return 0;
+}
+
+
+static TARGET void iv_load(struct aesni *ni, const uint8_t *iv)
+{
+	uint8_t blk[AES_BLOCK_SIZE];
+	__m128i c;
+
+	if (ni->mode == AES_MODE_GCM) {
+		__m128i rk[AESNI_MAX_RK];
+
+		/* J0 = IV || 0^31 || 1 */
+		memcpy(blk, iv, GCM_IV_LEN);
+		memset(blk + GCM_IV_LEN, 0, AES_BLOCK_SIZE - GCM_IV_LEN);
+		blk[AES_BLOCK_SIZE - 1] = 0x01;
+
+		keys_load(rk, ni);
+		store(ni->ekj0, encrypt_block(rk, ni->nr, load(blk)));
+
+		c = ctr_next(bswap128(load(blk)), ni->mode);
+
+		memset(ni->y, 0, sizeof(ni->y));
+		ni->glen    = 0;
+		ni->aad_len = 0;
+		ni->txt_len = 0;
+		ni->txt     = false;
+	}
+	else {
+		c = bswap128(load(iv));
+	}
+
+	store(ni->ctr, c);
+	ni->ks_off = AES_BLOCK_SIZE;
+}
+
+
+/**
+ * Set a new initial vector, a 96-bit nonce for GCM
+ *
+ * @param ni AES-NI cipher state
+ * @param iv Initial vector
+ */
+void aesni_set_iv(struct aesni *ni, const uint8_t *iv)
+{
+	if (!ni || !iv)
+		return;
+
+	iv_load(ni, iv);
+}
+
+
+static int gcm_aad(struct aesni *ni, const uint8_t *in, size_t len)
+{
+	/* all AAD must come before the text */
+	if (ni->txt)
+		return EPROTO;
+
+	ghash_update(ni, in, len);
+	ni->aad_len += len;
+
+	return 0;
+}
+
+
+static void gcm_text_begin(struct aesni *ni)
+{
+	if (ni->txt)
+		return;
+
+	ghash_pad(ni);
+	ni->txt = true;
+}
+
+
+/**
+ * Encrypt data, or add AAD for GCM if the output buffer is NULL
+ *
+ * @param ni  AES-NI cipher state
+ * @param out Output buffer, may be the same as the input buffer
+ * @param in  Input buffer
+ * @param len Number of bytes
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aesni_encr(struct aesni *ni, uint8_t *out, const uint8_t *in,
+	       size_t len)
+{
+	if (!ni || !in)
+		return EINVAL;
+
+	if (ni->mode == AES_MODE_CTR) {
+		if (!out)
+			return EINVAL;
+
+		ctr_xor(ni, out, in, len);
+		return 0;
+	}
+
+	if (!out)
+		return gcm_aad(ni, in, len);
+
+	gcm_text_begin(ni);
+	ctr_xor(ni, out, in, len);
+	ghash_update(ni, out, len);
+	ni->txt_len += len;
+
+	return 0;
+}
+
+
+/**
+ * Decrypt data, or add AAD for GCM if the output buffer is NULL
+ *
+ * @param ni  AES-NI cipher state
+ * @param out Output buffer, may be the same as the input buffer
+ * @param in  Input buffer
+ * @param len Number of bytes
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aesni_decr(struct aesni *ni, uint8_t *out, const uint8_t *in,
+	       size_t len)
+{
+	if (!ni || !in)
+		return EINVAL;
+
+	if (ni->mode == AES_MODE_CTR) {
+		if (!out)
+			return EINVAL;
+
+		ctr_xor(ni, out, in, len);
+		return 0;
+	}
+
+	if (!out)
+		return gcm_aad(ni, in, len);
+
+	/* hash the ciphertext before it is decrypted in-place */
+	gcm_text_begin(ni);
+	ghash_update(ni, in, len);
+	ctr_xor(ni, out, in, len);
+	ni->txt_len += len;
+
+	return 0;
+}
+
+
+static TARGET void tag_calc(struct aesni *ni, uint8_t *tag)
+{
+	uint8_t lenv[AES_BLOCK_SIZE];
+	const uint64_t aad_bits = ni->aad_len * 8;
+	const uint64_t txt_bits = ni->txt_len * 8;
+
+	ghash_pad(ni);
+
+	for (int i=0; i<8; i++) {
+		lenv[i]     = (uint8_t)(aad_bits >> (56 - 8*i));
+		lenv[i + 8] = (uint8_t)(txt_bits >> (56 - 8*i));
+	}
+
+	ghash_update(ni, lenv, sizeof(lenv));
+
+	store(tag, _mm_xor_si128(bswap128(load(ni->y)), load(ni->ekj0)));
+}
+
+
+/**
+ * Get the GCM authentication tag
+ *
+ * @param ni     AES-NI cipher state
+ * @param tag    Authentication tag
+ * @param taglen Length of Authentication tag
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aesni_get_authtag(struct aesni *ni, uint8_t *tag, size_t taglen)
+{
+	uint8_t t[AES_BLOCK_SIZE];
+
+	if (!ni || !tag || !taglen || taglen > sizeof(t))
+		return EINVAL;
+
+	if (ni->mode != AES_MODE_GCM)
+		return ENOTSUP;
+
+	tag_calc(ni, t);
+	memcpy(tag, t, taglen);
+
+	return 0;
+}
+
+
+/**
+ * Authenticate a GCM decryption tag
+ *
+ * @param ni     AES-NI cipher state
+ * @param tag    Authentication tag
+ * @param taglen Length of Authentication tag
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @retval EAUTH if authentication failed
+ */
+int aesni_authenticate(struct aesni *ni, const uint8_t *tag, size_t taglen)
+{
+	uint8_t t[AES_BLOCK_SIZE];
+
+	if (!ni || !tag || !taglen || taglen > sizeof(t))
+		return EINVAL;
+
+	if (ni->mode != AES_MODE_GCM)
+		return ENOTSUP;
+
+	tag_calc(ni, t);
+
+	return mem_seccmp(t, tag, taglen) ? EAUTH : 0;
+}
+
+
+#else
+
+
+bool aesni_supported(void)
+{
+	return false;
+}
+
+
+int aesni_alloc(struct aesni **nip, enum aes_mode mode,
+		const uint8_t *key, size_t key_bits, const uint8_t *iv)
+{
+	(void)nip;
+	(void)mode;
+	(void)key;
+	(void)key_bits;
+	(void)iv;
+
+	return ENOSYS;
+}
+
+
+void aesni_set_iv(struct aesni *ni, const uint8_t *iv)
+{
+	(void)ni;
+	(void)iv;
+}
+
+
+int aesni_encr(struct aesni *ni, uint8_t *out, const uint8_t *in,
+	       size_t len)
+{
+	(void)ni;
+	(void)out;
+	(void)in;
+	(void)len;
+
+	return ENOSYS;
+}
+
+
+int aesni_decr(struct aesni *ni, uint8_t *out, const uint8_t *in,
+	       size_t len)
+{
+	(void)ni;
+	(void)out;
+	(void)in;
+	(void)len;
+
+	return ENOSYS;
+}
+
+
+int aesni_get_authtag(struct aesni *ni, uint8_t *tag, size_t taglen)
+{
+	(void)ni;
+	(void)tag;
+	(void)taglen;
+
+	return ENOSYS;
+}
+
+
+int aesni_authenticate(struct aesni *ni, const uint8_t *tag, size_t taglen)
+{
+	(void)ni;
+	(void)tag;
+	(void)taglen;
+
+	return ENOSYS;
+}
+
+
+#endif
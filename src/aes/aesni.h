@@ -0,0 +1,20 @@
+/**
+ * @file aesni.h  AES-NI accelerated CTR and GCM -- internal interface
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+struct aesni;
+
+bool aesni_supported(void);
+int  aesni_alloc(struct aesni **nip, enum aes_mode mode,
+		 const uint8_t *key, size_t key_bits, const uint8_t *iv);
+void aesni_set_iv(struct aesni *ni, const uint8_t *iv);
+int  aesni_encr(struct aesni *ni, uint8_t *out, const uint8_t *in,
+		size_t len);
+int  aesni_decr(struct aesni *ni, uint8_t *out, const uint8_t *in,
+		size_t len);
+int  aesni_get_authtag(struct aesni *ni, uint8_t *tag, size_t taglen);
+int  aesni_authenticate(struct aesni *ni, const uint8_t *tag,
+			size_t taglen);
@@ -11,10 +11,12 @@
 #include <re_fmt.h>
 #include <re_mem.h>
 #include <re_aes.h>
+#include "../aesni.h"
 
 
 struct aes {
 	EVP_CIPHER_CTX *ctx;
+	struct aesni *ni;   /**< AES-NI fast path, NULL for EVP */
 	enum aes_mode mode;
 	bool encr;
 };
@@ -73,6 +75,8 @@ static void destructor(void *arg)
 
 	if (st->ctx)
 		EVP_CIPHER_CTX_free(st->ctx);
+
+	mem_deref(st->ni);
 }
 
 
@@ -98,6 +102,15 @@ int aes_alloc(struct aes **aesp, enum aes_mode mode,
 	st->mode = mode;
 	st->encr = true;
 
+	/* use the AES-NI path if available, EVP otherwise */
+	if (aesni_supported()) {
+		err = aesni_alloc(&st->ni, mode, key, key_bits, iv);
+		if (err != ENOTSUP)
+			goto out;
+
+		err = 0;
+	}
+
 	st->ctx = EVP_CIPHER_CTX_new();
 	if (!st->ctx) {
 		ERR_clear_error();
@@ -128,6 +141,11 @@ void aes_set_iv(struct aes *aes, const uint8_t *iv)
 	if (!aes || !iv)
 		return;
 
+	if (aes->ni) {
+		aesni_set_iv(aes->ni, iv);
+		return;
+	}
+
 	r = EVP_CipherInit_ex(aes->ctx, NULL, NULL, NULL, iv, -1);
 	if (!r)
 		ERR_clear_error();
@@ -141,6 +159,9 @@ int aes_encr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len)
 	if (!aes || !in)
 		return EINVAL;
 
+	if (aes->ni)
+		return aesni_encr(aes->ni, out, in, len);
+
 	if (!set_crypt_dir(aes, true))
 		return EPROTO;
 
@@ -160,6 +181,9 @@ int aes_decr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len)
 	if (!aes || !in)
 		return EINVAL;
 
+	if (aes->ni)
+		return aesni_decr(aes->ni, out, in, len);
+
 	if (!set_crypt_dir(aes, false))
 		return EPROTO;
 
@@ -188,6 +212,9 @@ int aes_get_authtag(struct aes *aes, uint8_t *tag, size_t taglen)
 	if (!aes || !tag || !taglen)
 		return EINVAL;
 
+	if (aes->ni)
+		return aesni_get_authtag(aes->ni, tag, taglen);
+
 	switch (aes->mode) {
 
 	case AES_MODE_GCM:
@@ -228,6 +255,9 @@ int aes_authenticate(struct aes *aes, const uint8_t *tag, size_t taglen)
 	if (!aes || !tag || !taglen)
 		return EINVAL;
 
+	if (aes->ni)
+		return aesni_authenticate(aes->ni, tag, taglen);
+
 	switch (aes->mode) {
 
 	case AES_MODE_GCM:
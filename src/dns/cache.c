@@ -0,0 +1,364 @@
+/**
+ * @file dns/cache.c  DNS Answer Cache
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_tmr.h>
+#include <re_sa.h>
+#include <re_dns.h>
+#include "dns.h"
+
+
+/*
+ * Answers are kept in one hash table, one LRU list and one list sorted
+ * by removal time, so a single timer expires all entries. An entry is
+ * a single allocation holding the name, and owns the Resource Records
+ * moved over from the query. Hits reference the entry, not each record.
+ */
+struct dns_cache {
+	struct hash *ht;
+	struct list lru;      /* Least recently used first   */
+	struct list expl;     /* Earliest removal time first */
+	struct tmr tmr;
+	size_t size;          /* Accounted size [bytes]      */
+	size_t size_max;      /* Max. size, 0 is no limit    */
+	uint64_t stale;       /* Stale period [ms]           */
+};
+
+
+static void ent_destructor(void *arg)
+{
+	struct dns_cache_ent *ent = arg;
+
+	hash_unlink(&ent->he);
+	list_unlink(&ent->le_lru);
+	list_unlink(&ent->le_exp);
+
+	for (int i = 0; i < RRLV_MAX; i++)
+		list_flush(&ent->rrlv[i]);
+}
+
+
+/* Pending cache hits may still hold a reference to the entry */
+static void ent_remove(struct dns_cache *c, struct dns_cache_ent *ent)
+{
+	hash_unlink(&ent->he);
+	list_unlink(&ent->le_lru);
+	list_unlink(&ent->le_exp);
+
+	c->size -= ent->size;
+	mem_deref(ent);
+}
+
+
+static void destructor(void *arg)
+{
+	struct dns_cache *c = arg;
+
+	tmr_cancel(&c->tmr);
+	dns_cache_flush(c);
+	mem_deref(c->ht);
+}
+
+
+static size_t rr_size(const struct dnsrr *rr)
+{
+	size_t sz = sizeof(*rr) + str_len(rr->name);
+
+	switch (rr->type) {
+
+	case DNS_TYPE_NS:
+		sz += str_len(rr->rdata.ns.nsdname);
+		break;
+
+	case DNS_TYPE_CNAME:
+		sz += str_len(rr->rdata.cname.cname);
+		break;
+
+	case DNS_TYPE_SOA:
+		sz += str_len(rr->rdata.soa.mname);
+		sz += str_len(rr->rdata.soa.rname);
+		break;
+
+	case DNS_TYPE_PTR:
+		sz += str_len(rr->rdata.ptr.ptrdname);
+		break;
+
+	case DNS_TYPE_MX:
+		sz += str_len(rr->rdata.mx.exchange);
+		break;
+
+	case DNS_TYPE_TXT:
+		sz += str_len(rr->rdata.txt.data);
+		break;
+
+	case DNS_TYPE_SRV:
+		sz += str_len(rr->rdata.srv.target);
+		break;
+
+	case DNS_TYPE_NAPTR:
+		sz += str_len(rr->rdata.naptr.flags);
+		sz += str_len(rr->rdata.naptr.services);
+		sz += str_len(rr->rdata.naptr.regexp);
+		sz += str_len(rr->rdata.naptr.replace);
+		break;
+	}
+
+	return sz;
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct dns_cache *c = arg;
+	uint64_t now = tmr_jiffies();
+	struct dns_cache_ent *ent;
+
+	while ((ent = list_ledata(list_head(&c->expl)))) {
+
+		if (ent->removes > now) {
+			tmr_start(&c->tmr, ent->removes - now, tmr_handler, c);
+			break;
+		}
+
+		ent_remove(c, ent);
+	}
+}
+
+
+static void exp_insert(struct dns_cache *c, struct dns_cache_ent *ent)
+{
+	struct le *le;
+
+	/* most entries have similar TTLs, so search from the end */
+	for (le = list_tail(&c->expl); le; le = le->prev) {
+
+		const struct dns_cache_ent *e = le->data;
+
+		if (e->removes <= ent->removes)
+			break;
+	}
+
+	if (le)
+		list_insert_after(&c->expl, le, &ent->le_exp, ent);
+	else
+		list_prepend(&c->expl, &ent->le_exp, ent);
+
+	if (c->expl.head == &ent->le_exp) {
+		uint64_t now = tmr_jiffies();
+
+		tmr_start(&c->tmr, ent->removes > now ? ent->removes - now : 0,
+			  tmr_handler, c);
+	}
+}
+
+
+struct ent_key {
+	const char *name;
+	uint16_t type;
+	uint16_t dnsclass;
+};
+
+
+static bool ent_cmp_handler(struct le *le, void *arg)
+{
+	const struct dns_cache_ent *ent = le->data;
+	const struct ent_key *key = arg;
+
+	return ent->type == key->type && ent->dnsclass == key->dnsclass &&
+		!str_casecmp(ent->name, key->name);
+}
+
+
+static struct dns_cache_ent *ent_find(const struct dns_cache *c,
+				      const struct ent_key *key)
+{
+	return list_ledata(hash_lookup(c->ht, hash_joaat_str_ci(key->name),
+				       ent_cmp_handler, (void *)key));
+}
+
+
+int dns_cache_alloc(struct dns_cache **cp, uint32_t hash_size,
+		    size_t size_max)
+{
+	struct dns_cache *c;
+	int err;
+
+	if (!cp)
+		return EINVAL;
+
+	c = mem_zalloc(sizeof(*c), destructor);
+	if (!c)
+		return ENOMEM;
+
+	err = hash_alloc(&c->ht, hash_size);
+	if (err)
+		goto out;
+
+	tmr_init(&c->tmr);
+	c->size_max = size_max;
+
+ out:
+	if (err)
+		mem_deref(c);
+	else
+		*cp = c;
+
+	return err;
+}
+
+
+void dns_cache_flush(struct dns_cache *c)
+{
+	struct dns_cache_ent *ent;
+
+	if (!c)
+		return;
+
+	while ((ent = list_ledata(list_head(&c->lru))))
+		ent_remove(c, ent);
+
+	tmr_cancel(&c->tmr);
+}
+
+
+void dns_cache_set_stale(struct dns_cache *c, uint64_t stale)
+{
+	if (!c)
+		return;
+
+	c->stale = stale;
+}
+
+
+void dns_cache_set_max(struct dns_cache *c, size_t size_max)
+{
+	if (!c)
+		return;
+
+	c->size_max = size_max;
+
+	while (c->size_max && c->size > c->size_max && c->lru.head)
+		ent_remove(c, c->lru.head->data);
+}
+
+
+/**
+ * Store an answer, moving the Resource Records over from the lists.
+ * An existing entry for the same question is replaced.
+ *
+ * @param c        DNS Cache
+ * @param name     Question name
+ * @param type     Question type
+ * @param dnsclass Question class
+ * @param hdr      Reply header
+ * @param rrlv     Answer, authority and additional records
+ * @param ttl      Time to live in [ms]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dns_cache_insert(struct dns_cache *c, const char *name, uint16_t type,
+		     uint16_t dnsclass, const struct dnshdr *hdr,
+		     struct list * const *rrlv, uint64_t ttl)
+{
+	struct ent_key key = {name, type, dnsclass};
+	struct dns_cache_ent *ent;
+	size_t nlen = str_len(name);
+
+	if (!c || !name || !hdr || !rrlv)
+		return EINVAL;
+
+	ent = ent_find(c, &key);
+	if (ent)
+		ent_remove(c, ent);
+
+	ent = mem_zalloc(sizeof(*ent) + nlen + 1, ent_destructor);
+	if (!ent)
+		return ENOMEM;
+
+	memcpy(ent->name, name, nlen + 1);
+
+	ent->hdr      = *hdr;
+	ent->type     = type;
+	ent->dnsclass = dnsclass;
+	ent->expires  = tmr_jiffies() + ttl;
+	ent->removes  = ent->expires + c->stale;
+	ent->size     = sizeof(*ent) + nlen;
+
+	for (int i = 0; i < RRLV_MAX; i++) {
+
+		struct le *le;
+
+		while ((le = list_head(rrlv[i]))) {
+
+			struct dnsrr *rr = le->data;
+
+			list_unlink(le);
+			list_append(&ent->rrlv[i], le, rr);
+			ent->size += rr_size(rr);
+		}
+	}
+
+	hash_append(c->ht, hash_joaat_str_ci(name), &ent->he, ent);
+	list_append(&c->lru, &ent->le_lru, ent);
+	exp_insert(c, ent);
+
+	c->size += ent->size;
+
+	while (c->size_max && c->size > c->size_max && c->lru.head)
+		ent_remove(c, c->lru.head->data);
+
+	return 0;
+}
+
+
+/**
+ * Find a cached answer
+ *
+ * @param c        DNS Cache
+ * @param name     Question name
+ * @param type     Question type
+ * @param dnsclass Question class
+ * @param stale    True to find an expired answer, false for a valid one
+ *
+ * @return Cache entry if found, otherwise NULL
+ */
+struct dns_cache_ent *dns_cache_lookup(struct dns_cache *c, const char *name,
+				       uint16_t type, uint16_t dnsclass,
+				       bool stale)
+{
+	struct ent_key key = {name, type, dnsclass};
+	struct dns_cache_ent *ent;
+	uint64_t now;
+
+	if (!c || !name)
+		return NULL;
+
+	ent = ent_find(c, &key);
+	if (!ent)
+		return NULL;
+
+	now = tmr_jiffies();
+
+	if (stale ? now < ent->expires || now >= ent->removes :
+	    now >= ent->expires)
+		return NULL;
+
+	list_unlink(&ent->le_lru);
+	list_append(&c->lru, &ent->le_lru, ent);
+
+	return ent;
+}
+
+
+size_t dns_cache_size(const struct dns_cache *c)
+{
+	return c ? c->size : 0;
+}
@@ -24,6 +24,7 @@
 #include <re_dns.h>
 #include <re_net.h>
 #include <re_main.h>
+#include "dns.h"
 
 
 #define DEBUG_MODULE "dnsc"
@@ -41,7 +42,10 @@ enum {
 	RR_MAX = 32,
 	CACHE_TTL_MAX = 1800,
 	GETADDRINFO_TTL = 60,
-	RRLV_MAX = 3
+	UDP_TIMEOUT = 500,
+	CACHE_SIZE_MAX = 1024 * 1024,
+	GAI_WORKERS = 4,
+	GAI_TIMEOUT = 10 * 1000,
 };
 
 
@@ -62,11 +66,13 @@ struct dns_query {
 	struct le le;
 	struct le le_hdl;
 	struct le le_tc;
+	struct le le_wait;
+	struct list waitl;     /* coalesced queries */
 	struct dnshdr hdr;
 	struct tmr tmr;
-	struct tmr tmr_ttl;
 	struct mbuf mb;
 	struct list *rrlv[RRLV_MAX];
+	struct dns_cache_ent *ent; /* cache hit */
 	char *name;
 	const struct sa *srvv;
 	const uint32_t *srvc;
@@ -78,6 +84,7 @@ struct dns_query {
 	uint16_t type;
 	uint16_t dnsclass;
 	uint8_t opcode;
+	int proto;
 	dns_query_h *qh;
 	void *arg;
 };
@@ -88,7 +95,6 @@ struct dnsquery {
 	char *name;
 	uint16_t type;
 	uint16_t dnsclass;
-	bool cache;
 };
 
 
@@ -97,11 +103,16 @@ struct dnsc {
 	struct tmr hdl_tmr;
 	struct list hdl_cache;
 	struct hash *ht_query;
-	struct hash *ht_query_cache;
+	struct dns_cache *cache;
 	struct hash *ht_tcpconn;
 	struct udp_sock *us;
 	struct udp_sock *us6;
 	struct sa srvv[SRVC_MAX];
+	struct dnsc_stats stats;
+	struct dns_gai *gai;
+	dnsc_resolv_h *resolvh;
+	uint32_t gai_timeout;
+	uint16_t gai_workers;
 	uint32_t srvc;
 };
 
@@ -118,6 +129,9 @@ static const struct dnsc_conf default_conf = {
 
 static void tcpconn_close(struct tcpconn *tc, int err);
 static int  send_tcp(struct dns_query *q);
+static int  query_send(struct dns_query *q);
+static void query_handler(struct dns_query *q, int err, struct list *ansl,
+			  struct list *authl, struct list *addl);
 static void udp_timeout_handler(void *arg);
 
 
@@ -146,12 +160,43 @@ static void query_abort(struct dns_query *q)
 }
 
 
+/*
+ * The application cancelled a query which others are waiting for, so
+ * hand the request over to the first of them.
+ */
+static void query_promote(struct dns_query *q)
+{
+	struct dns_query *f = list_ledata(list_head(&q->waitl));
+	struct le *le;
+	int err;
+
+	list_unlink(&f->le_wait);
+
+	while ((le = list_head(&q->waitl))) {
+		list_unlink(le);
+		list_append(&f->waitl, le, le->data);
+	}
+
+	hash_append(f->dnsc->ht_query, hash_joaat_str_ci(f->name), &f->le, f);
+
+	err = query_send(f);
+	if (err) {
+		query_handler(f, err, NULL, NULL, NULL);
+		mem_deref(f);
+	}
+}
+
+
 static void query_destructor(void *data)
 {
 	struct dns_query *q = data;
 
 	query_abort(q);
-	tmr_cancel(&q->tmr_ttl);
+	list_unlink(&q->le_wait);
+
+	if (!list_isempty(&q->waitl))
+		query_promote(q);
+
 	mbuf_reset(&q->mb);
 	mem_deref(q->name);
 	list_unlink(&q->le_hdl);
@@ -160,15 +205,22 @@ static void query_destructor(void *data)
 		(void)list_apply(q->rrlv[i], true, rr_unlink_handler, NULL);
 		mem_deref(q->rrlv[i]);
 	}
+
+	mem_deref(q->ent);
 }
 
 
-static void query_handler(struct dns_query *q, int err, struct list *ansl,
-			  struct list *authl, struct list *addl)
+/* Call the handlers of a query and of all queries coalesced with it */
+static void query_answer(struct dns_query *q, int err, struct list *ansl,
+			 struct list *authl, struct list *addl)
 {
+	struct le *le;
+
 	/* deref here - before calling handler */
-	if (q->qp)
+	if (q->qp) {
 		*q->qp = NULL;
+		q->qp = NULL;
+	}
 
 	/* The handler must only be called _once_ */
 	if (q->qh) {
@@ -176,6 +228,53 @@ static void query_handler(struct dns_query *q, int err, struct list *ansl,
 		q->qh = NULL;
 	}
 
+	while ((le = list_head(&q->waitl))) {
+		struct dns_query *f = le->data;
+
+		list_unlink(le);
+
+		f->hdr = q->hdr;
+		query_handler(f, err, ansl, authl, addl);
+		mem_deref(f);
+	}
+}
+
+
+/* Answer with an expired cache entry, if there is one (RFC 8767) */
+static bool query_stale(struct dns_query *q)
+{
+	struct dns_cache_ent *ent;
+
+	if (!q->qh && list_isempty(&q->waitl))
+		return false;
+
+	ent = dns_cache_lookup(q->dnsc->cache, q->name, q->type, q->dnsclass,
+			       true);
+	if (!ent)
+		return false;
+
+	DEBUG_INFO("serve stale %s. (id: %d)\n", q->name, q->id);
+
+	q->dnsc->stats.stale += (q->qh ? 1 : 0) + list_count(&q->waitl);
+
+	/* a handler may flush the cache */
+	mem_ref(ent);
+
+	q->hdr = ent->hdr;
+	query_answer(q, 0, &ent->rrlv[0], &ent->rrlv[1], &ent->rrlv[2]);
+
+	mem_deref(ent);
+
+	return true;
+}
+
+
+static void query_handler(struct dns_query *q, int err, struct list *ansl,
+			  struct list *authl, struct list *addl)
+{
+	if (!err || !query_stale(q))
+		query_answer(q, err, ansl, authl, addl);
+
 	/* in case we have more (than one) q refs */
 	query_abort(q);
 }
@@ -198,7 +297,7 @@ static bool query_cmp_handler(struct le *le, void *arg)
 	struct dns_query *q = le->data;
 	struct dnsquery *dq = arg;
 
-	if (!dq->cache && q->id != dq->hdr.id)
+	if (q->id != dq->hdr.id)
 		return false;
 
 	if (q->opcode != dq->hdr.opcode)
@@ -217,17 +316,6 @@ static bool query_cmp_handler(struct le *le, void *arg)
 }
 
 
-static void ttl_timeout_handler(void *arg)
-{
-	struct dns_query *q = arg;
-
-	DEBUG_INFO("ttl cache delete (id: %d): %s.\t%s\t%s\n", q->id, q->name,
-		   dns_rr_classname(q->dnsclass), dns_rr_typename(q->type));
-
-	mem_deref(q);
-}
-
-
 static int reply_recv(struct dnsc *dnsc, struct mbuf *mb)
 {
 	struct dns_query *q = NULL;
@@ -241,7 +329,6 @@ static int reply_recv(struct dnsc *dnsc, struct mbuf *mb)
 
 	ttl = dnsc->conf.cache_ttl_max;
 	dq.name = NULL;
-	dq.cache = false;
 
 	if (dns_hdr_decode(mb, &dq.hdr) || !dq.hdr.qr) {
 		err = EBADMSG;
@@ -339,26 +426,29 @@ static int reply_recv(struct dnsc *dnsc, struct mbuf *mb)
 		goto out;
 	}
 
-	/* Cache negative answer with SOA minimum value (RFC 2308) */
+	/*
+	 * Cache NXDOMAIN and NODATA answers with the SOA TTL, limited by
+	 * the SOA minimum value (RFC 2308)
+	 */
 	if (!dq.hdr.nans && dq.hdr.nauth) {
 		const struct dnsrr *rr = list_ledata(list_head(q->rrlv[1]));
 
-		if (!rr || rr->type != DNS_TYPE_SOA) {
+		if (!rr || rr->type != DNS_TYPE_SOA ||
+		    (dq.hdr.rcode != DNS_RCODE_OK &&
+		     dq.hdr.rcode != DNS_RCODE_NAME_ERR)) {
 			mem_deref(q);
 			goto out;
 		}
 
-		if (rr->rdata.soa.ttlmin < dnsc->conf.cache_ttl_max)
-			ttl = rr->rdata.soa.ttlmin;
+		ttl = MIN(ttl, rr->rdata.soa.ttlmin);
 	}
 
-	/* Cache DNS query with TTL timeout */
-	hash_append(dnsc->ht_query_cache, hash_joaat_str_ci(q->name), &q->le,
-		    q);
+	/* Cache DNS answer with TTL timeout */
 	DEBUG_INFO("cache %s. (id: %d) %d secs\n", q->name, q->id, ttl);
 	/* Fallback to 100ms for faster unit tests */
-	tmr_start(&q->tmr_ttl, ttl > 1 ? ttl * 1000 : 100,
-		  ttl_timeout_handler, q);
+	(void)dns_cache_insert(dnsc->cache, q->name, q->type, q->dnsclass,
+			       &q->hdr, q->rrlv, ttl > 1 ? ttl * 1000 : 100);
+	mem_deref(q);
 
  out:
 	mem_deref(dq.name);
@@ -699,6 +789,9 @@ static void udp_timeout_handler(void *arg)
 	if (q->ntx >= NTX_MAX)
 		goto out;
 
+	/* answer stale data now, and keep trying to refresh it */
+	(void)query_stale(q);
+
 	err = send_udp(q);
 	if (err)
 		goto out;
@@ -714,55 +807,46 @@ static void udp_timeout_handler(void *arg)
 }
 
 
+/* Answer all pending cache hits in one go */
 static void hdl_tmr_cache(void *arg)
 {
 	struct list *l = arg;
 	struct le *le;
 
-	LIST_FOREACH(l, le) {
+	while ((le = list_head(l))) {
 		struct dns_query *q = le->data;
+		struct dns_cache_ent *ent = q->ent;
 #if DEBUG_LEVEL > 5
 		struct le *re_rr;
 		DEBUG_INFO("--- ANSWER SECTION (CACHED) id: %d ---\n",
 			   q->id);
-		LIST_FOREACH(q->rrlv[0], re_rr) {
+		LIST_FOREACH(&ent->rrlv[0], re_rr) {
 			struct dnsrr *rr = re_rr->data;
 			DEBUG_INFO("%H\n", dns_rr_print, rr);
 		}
 #endif
-		query_handler(q, 0, q->rrlv[0], q->rrlv[1], q->rrlv[2]);
+		list_unlink(le);
+		query_handler(q, 0, &ent->rrlv[0], &ent->rrlv[1],
+			      &ent->rrlv[2]);
+		mem_deref(q);
 	}
-	list_flush(l);
 }
 
 
 static bool query_cache_handler(struct dns_query *q)
 {
-	struct dnsquery dq;
-	const struct dns_query *qc = NULL;
-	struct le *le;
+	struct dns_cache_ent *ent;
 
-	dq.hdr	    = q->hdr;
-	dq.type	    = q->type;
-	dq.dnsclass = q->dnsclass;
-	dq.name	    = q->name;
-	dq.cache    = true;
-
-	qc = list_ledata(hash_lookup(q->dnsc->ht_query_cache,
-				     hash_joaat_str_ci(q->name),
-				     query_cmp_handler, &dq));
-	if (!qc)
+	ent = dns_cache_lookup(q->dnsc->cache, q->name, q->type, q->dnsclass,
+			       false);
+	if (!ent)
 		return false;
 
+	++q->dnsc->stats.hits;
 
-	for (int i = 0; i < RRLV_MAX; i++) {
-		LIST_FOREACH(qc->rrlv[i], le)
-		{
-			struct dnsrr *rr = le->data;
-			mem_ref(rr);
-		}
-		q->rrlv[i] = mem_ref(qc->rrlv[i]);
-	}
+	/* the cached reply carries the rcode, e.g. NXDOMAIN */
+	q->hdr = ent->hdr;
+	q->ent = mem_ref(ent);
 
 	hash_unlink(&q->le);
 	list_append(&q->dnsc->hdl_cache, &q->le_hdl, q);
@@ -792,9 +876,9 @@ static bool getaddr_dup(struct le *le, void *arg)
 }
 
 
-static int async_getaddrinfo(void *arg)
+static int getaddrinfo_resolv(struct list *rrl, const char *name,
+			      uint16_t type)
 {
-	struct dns_query *q = arg;
 	int err;
 	struct addrinfo *res0 = NULL;
 	struct addrinfo *res;
@@ -803,13 +887,13 @@ static int async_getaddrinfo(void *arg)
 
 	memset(&hints, 0, sizeof(hints));
 
-	if (q->type == DNS_TYPE_A)
+	if (type == DNS_TYPE_A)
 		hints.ai_family = AF_INET;
-	if (q->type == DNS_TYPE_AAAA)
+	if (type == DNS_TYPE_AAAA)
 		hints.ai_family = AF_INET6;
 	hints.ai_flags = AI_ADDRCONFIG;
 
-	err = getaddrinfo(q->name, NULL, &hints, &res0);
+	err = getaddrinfo(name, NULL, &hints, &res0);
 	if (err)
 		return EADDRNOTAVAIL;
 
@@ -822,7 +906,7 @@ static int async_getaddrinfo(void *arg)
 			goto out;
 		}
 
-		str_dup(&rr->name, q->name);
+		str_dup(&rr->name, name);
 
 		rr->dnsclass = DNS_CLASS_IN;
 		rr->ttl	     = GETADDRINFO_TTL;
@@ -845,18 +929,18 @@ static int async_getaddrinfo(void *arg)
 			sa_in6(&sa, rr->rdata.aaaa.addr);
 		}
 
-		le = list_apply(q->rrlv[0], false, getaddr_dup, rr);
+		le = list_apply(rrl, false, getaddr_dup, rr);
 		if (le) {
 			mem_deref(rr);
 			continue;
 		}
 
-		list_append(q->rrlv[0], &rr->le_priv, rr);
+		list_append(rrl, &rr->le_priv, rr);
 	}
 
 out:
 	if (err)
-		list_flush(q->rrlv[0]);
+		list_flush(rrl);
 
 	freeaddrinfo(res0);
 
@@ -864,44 +948,162 @@ out:
 }
 
 
-static void getaddrinfo_h(int err, void *arg)
+/* called once per lookup, for all queries waiting for it */
+static void getaddrinfo_h(int err, const char *name, uint16_t type,
+			  struct list *rrl, struct list *waitl, void *arg)
 {
-	struct dns_query *q = arg;
-	const bool cache = q->dnsc->conf.cache_ttl_max > 0;
+	struct dnsc *dnsc = arg;
+	struct list nol = LIST_INIT;
+	struct dnshdr hdr;
+	struct le *le;
 
-	DEBUG_INFO("--- ANSWER SECTION (getaddrinfo) id: %d %s ---\n", q->id,
-		   cache ? "(caching)" : "");
+	DEBUG_INFO("--- ANSWER SECTION (getaddrinfo) %s ---\n", name);
 
 	if (!err) {
-		struct le *le;
-		LIST_FOREACH(q->rrlv[0], le)
+		LIST_FOREACH(rrl, le)
 		{
 			DEBUG_INFO("%H%s\n", dns_rr_print, le->data);
 		}
 	}
 
-	query_handler(q, err, q->rrlv[0], q->rrlv[1], q->rrlv[2]);
+	while ((le = list_head(waitl))) {
+		struct dns_query *q = le->data;
+
+		list_unlink(le);
 
-	if (err || !cache) {
+		query_handler(q, err, rrl, &nol, &nol);
 		mem_deref(q);
-		return;
 	}
 
-	hash_append(q->dnsc->ht_query_cache, hash_joaat_str_ci(q->name),
-		    &q->le, q);
-	tmr_start(&q->tmr_ttl, GETADDRINFO_TTL * 1000, ttl_timeout_handler, q);
+	if (!err && dnsc->conf.cache_ttl_max > 0) {
+
+		struct list *rrlv[RRLV_MAX] = {rrl, &nol, &nol};
+
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.qr   = true;
+		hdr.nq   = 1;
+		hdr.nans = list_count(rrl);
+
+		(void)dns_cache_insert(dnsc->cache, name, type, DNS_CLASS_IN,
+				       &hdr, rrlv, GETADDRINFO_TTL * 1000);
+	}
+}
+
+
+/* the lookup goes on and its answer is still cached */
+static void getaddrinfo_timeout_handler(void *arg)
+{
+	struct dns_query *q = arg;
+
+	DEBUG_NOTICE("getaddrinfo timeout %s.\n", q->name);
+
+	list_unlink(&q->le_wait);
+
+	query_handler(q, ETIMEDOUT, NULL, NULL, NULL);
+	mem_deref(q);
+}
+
+
+static bool query_coalesce_handler(struct le *le, void *arg)
+{
+	const struct dns_query *l = le->data;
+	const struct dns_query *q = arg;
+
+	return l != q && l->proto == q->proto && l->srvv == q->srvv &&
+		l->opcode == q->opcode && l->type == q->type &&
+		l->dnsclass == q->dnsclass && !str_casecmp(l->name, q->name);
+}
+
+
+/*
+ * Attach a query to an identical one which is already in flight, the
+ * answer is then delivered to both.
+ */
+static bool query_coalesce(struct dns_query *q)
+{
+	struct dns_query *l;
+
+	if (q->opcode != DNS_OPCODE_QUERY || q->type == DNS_QTYPE_AXFR)
+		return false;
+
+	l = list_ledata(hash_lookup(q->dnsc->ht_query,
+				    hash_joaat_str_ci(q->name),
+				    query_coalesce_handler, q));
+	if (!l)
+		return false;
+
+	DEBUG_INFO("coalesce %s. (id: %d) with id: %d\n", q->name, q->id,
+		   l->id);
+
+	hash_unlink(&q->le);
+	list_append(&l->waitl, &q->le_wait, q);
+	++q->dnsc->stats.coalesced;
+
+	return true;
+}
+
+
+static int query_send(struct dns_query *q)
+{
+	int err;
+
+	switch (q->proto) {
+
+	case IPPROTO_TCP:
+		err = send_tcp(q);
+		if (err)
+			break;
+
+		tmr_start(&q->tmr, 60 * 1000, tcp_timeout_handler, q);
+		break;
+
+	case IPPROTO_UDP:
+		err = send_udp(q);
+		if (err)
+			break;
+
+		tmr_start(&q->tmr, UDP_TIMEOUT, udp_timeout_handler, q);
+		break;
+
+	default:
+		err = EPROTONOSUPPORT;
+		break;
+	}
+
+	return err;
 }
 
 
 static int query_getaddrinfo(struct dns_query *q)
 {
+	struct dnsc *dnsc = q->dnsc;
 	int err;
 
-	err = re_thread_async(async_getaddrinfo, getaddrinfo_h, q);
+	if (!dnsc->gai) {
+		err = dns_gai_alloc(&dnsc->gai, dnsc->gai_workers,
+				    getaddrinfo_h, dnsc);
+		if (err) {
+			DEBUG_WARNING("getaddrinfo pool: %m\n", err);
+			return err;
+		}
+	}
+
+	err = dns_gai_lookup(dnsc->gai, q->name, q->type, dnsc->resolvh,
+			     &q->le_wait, q);
 	if (err)
-		DEBUG_WARNING("re_thread_async: %m\n", err);
+		return err;
 
-	return err;
+	/* later queries for the same name wait for the same lookup */
+	if (q->le_wait.prev)
+		++dnsc->stats.coalesced;
+	else
+		++dnsc->stats.misses;
+
+	if (dnsc->gai_timeout)
+		tmr_start(&q->tmr, dnsc->gai_timeout,
+			  getaddrinfo_timeout_handler, q);
+
+	return 0;
 }
 
 
@@ -927,7 +1129,6 @@ static int query(struct dns_query **qp, struct dnsc *dnsc, uint8_t opcode,
 
 	hash_append(dnsc->ht_query, hash_joaat_str_ci(name), &q->le, q);
 	tmr_init(&q->tmr);
-	tmr_init(&q->tmr_ttl);
 	mbuf_init(&q->mb);
 
 	err = str_dup(&q->name, name);
@@ -978,6 +1179,13 @@ static int query(struct dns_query **qp, struct dnsc *dnsc, uint8_t opcode,
 		goto out;
 	}
 
+	if (proto != IPPROTO_TCP && proto != IPPROTO_UDP) {
+		err = EPROTONOSUPPORT;
+		goto error;
+	}
+
+	q->proto = proto;
+
 	if (proto == IPPROTO_TCP)
 		q->mb.pos += 2;
 
@@ -1000,31 +1208,20 @@ static int query(struct dns_query **qp, struct dnsc *dnsc, uint8_t opcode,
 			goto error;
 	}
 
-	switch (proto) {
-
-	case IPPROTO_TCP:
+	if (proto == IPPROTO_TCP) {
 		q->mb.pos = 0;
 		(void)mbuf_write_u16(&q->mb, htons((uint16_t)q->mb.end - 2));
+	}
 
-		err = send_tcp(q);
-		if (err)
-			goto error;
-
-		tmr_start(&q->tmr, 60 * 1000, tcp_timeout_handler, q);
-		break;
-
-	case IPPROTO_UDP:
-		err = send_udp(q);
-		if (err)
-			goto error;
-
-		tmr_start(&q->tmr, 500, udp_timeout_handler, q);
-		break;
+	/* the request is kept encoded, in case it has to be taken over */
+	if (query_coalesce(q))
+		goto out;
 
-	default:
-		err = EPROTONOSUPPORT;
+	err = query_send(q);
+	if (err)
 		goto error;
-	}
+
+	++dnsc->stats.misses;
 
 out:
 	if (qp) {
@@ -1131,12 +1328,12 @@ static void dnsc_destructor(void *data)
 
 	(void)hash_apply(dnsc->ht_query, query_close_handler, NULL);
 	hash_flush(dnsc->ht_tcpconn);
-	hash_flush(dnsc->ht_query_cache);
 	tmr_cancel(&dnsc->hdl_tmr);
 
+	mem_deref(dnsc->gai);
 	mem_deref(dnsc->ht_tcpconn);
 	mem_deref(dnsc->ht_query);
-	mem_deref(dnsc->ht_query_cache);
+	mem_deref(dnsc->cache);
 	mem_deref(dnsc->us6);
 	mem_deref(dnsc->us);
 }
@@ -1192,7 +1389,8 @@ int dnsc_alloc(struct dnsc **dcpp, const struct dnsc_conf *conf,
 	if (err)
 		goto out;
 
-	err = hash_alloc(&dnsc->ht_query_cache, dnsc->conf.query_hash_size);
+	err = dns_cache_alloc(&dnsc->cache, dnsc->conf.query_hash_size,
+			      CACHE_SIZE_MAX);
 	if (err)
 		goto out;
 
@@ -1203,6 +1401,10 @@ int dnsc_alloc(struct dnsc **dcpp, const struct dnsc_conf *conf,
 	tmr_init(&dnsc->hdl_tmr);
 	list_init(&dnsc->hdl_cache);
 
+	dnsc->resolvh     = getaddrinfo_resolv;
+	dnsc->gai_workers = GAI_WORKERS;
+	dnsc->gai_timeout = GAI_TIMEOUT;
+
  out:
 	if (err)
 		mem_deref(dnsc);
@@ -1237,20 +1439,15 @@ int dnsc_conf_set(struct dnsc *dnsc, const struct dnsc_conf *conf)
 	list_flush(&dnsc->hdl_cache);
 
 	hash_flush(dnsc->ht_tcpconn);
-	hash_flush(dnsc->ht_query_cache);
+	dns_cache_flush(dnsc->cache);
 
 	dnsc->ht_query = mem_deref(dnsc->ht_query);
-	dnsc->ht_query_cache = mem_deref(dnsc->ht_query_cache);
 	dnsc->ht_tcpconn = mem_deref(dnsc->ht_tcpconn);
 
 	err = hash_alloc(&dnsc->ht_query, dnsc->conf.query_hash_size);
 	if (err)
 		return err;
 
-	err = hash_alloc(&dnsc->ht_query_cache, dnsc->conf.query_hash_size);
-	if (err)
-		return err;
-
 	err = hash_alloc(&dnsc->ht_tcpconn, dnsc->conf.tcp_hash_size);
 	return err;
 }
@@ -1293,7 +1490,7 @@ void dnsc_cache_flush(struct dnsc *dnsc)
 	if (!dnsc)
 		return;
 
-	hash_flush(dnsc->ht_query_cache);
+	dns_cache_flush(dnsc->cache);
 }
 
 
@@ -1315,6 +1512,57 @@ void dnsc_cache_max(struct dnsc *dnsc, uint32_t max)
 }
 
 
+/**
+ * Set how long expired cache entries are kept, to answer from them when
+ * the DNS servers do not respond (RFC 8767)
+ *
+ * @param dnsc DNS Client
+ * @param max  Value in [s] and 0 to disable (default)
+ */
+void dnsc_cache_stale(struct dnsc *dnsc, uint32_t max)
+{
+	if (!dnsc)
+		return;
+
+	dns_cache_set_stale(dnsc->cache, max * 1000ULL);
+}
+
+
+/**
+ * Set the memory limit of the DNS cache, the least recently used
+ * answers are removed first
+ *
+ * @param dnsc DNS Client
+ * @param max  Max. size in [bytes], 0 for no limit (default is 1 MB)
+ */
+void dnsc_cache_limit(struct dnsc *dnsc, size_t max)
+{
+	if (!dnsc)
+		return;
+
+	dns_cache_set_max(dnsc->cache, max);
+}
+
+
+/**
+ * Get DNS Client statistics
+ *
+ * @param dnsc  DNS Client
+ * @param stats Returned statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dnsc_stats(const struct dnsc *dnsc, struct dnsc_stats *stats)
+{
+	if (!dnsc || !stats)
+		return EINVAL;
+
+	*stats = dnsc->stats;
+
+	return 0;
+}
+
+
 /**
  * Enable/Disable getaddrinfo usage
  *
@@ -1344,3 +1592,40 @@ bool dnsc_getaddrinfo_enabled(struct dnsc *dnsc)
 
 	return dnsc->conf.getaddrinfo;
 }
+
+
+/**
+ * Set the getaddrinfo resolver pool size and lookup timeout. Lookups
+ * of the same name share one worker, further names wait in a queue.
+ * The pool size applies from the first getaddrinfo lookup on.
+ *
+ * @param dnsc    DNS Client
+ * @param workers Number of resolver threads
+ * @param timeout Query timeout in [ms], 0 to wait for the resolver
+ */
+void dnsc_getaddrinfo_pool(struct dnsc *dnsc, uint16_t workers,
+			   uint32_t timeout)
+{
+	if (!dnsc)
+		return;
+
+	if (workers)
+		dnsc->gai_workers = workers;
+
+	dnsc->gai_timeout = timeout;
+}
+
+
+/**
+ * Set the resolver used in getaddrinfo mode
+ *
+ * @param dnsc    DNS Client
+ * @param resolvh Blocking resolver, NULL for the system getaddrinfo()
+ */
+void dnsc_getaddrinfo_resolver(struct dnsc *dnsc, dnsc_resolv_h *resolvh)
+{
+	if (!dnsc)
+		return;
+
+	dnsc->resolvh = resolvh ? resolvh : getaddrinfo_resolv;
+}
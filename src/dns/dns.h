@@ -14,3 +14,52 @@ int get_windns(char *domain, size_t dsize, struct sa *nav, uint32_t *n);
 #ifdef DARWIN
 int get_darwin_dns(char *domain, size_t dsize, struct sa *nsv, uint32_t *n);
 #endif
+
+
+/* Answer cache */
+
+enum {
+	RRLV_MAX = 3,  /* answer, authority and additional records */
+};
+
+struct dns_cache;
+
+struct dns_cache_ent {
+	struct le he;
+	struct le le_lru;
+	struct le le_exp;
+	struct list rrlv[RRLV_MAX];
+	struct dnshdr hdr;
+	uint64_t expires;     /* End of TTL [ms]       */
+	uint64_t removes;     /* End of stale time [ms] */
+	size_t size;
+	uint16_t type;
+	uint16_t dnsclass;
+	char name[];
+};
+
+int  dns_cache_alloc(struct dns_cache **cp, uint32_t hash_size,
+		     size_t size_max);
+void dns_cache_flush(struct dns_cache *c);
+void dns_cache_set_stale(struct dns_cache *c, uint64_t stale);
+void dns_cache_set_max(struct dns_cache *c, size_t size_max);
+int  dns_cache_insert(struct dns_cache *c, const char *name, uint16_t type,
+		      uint16_t dnsclass, const struct dnshdr *hdr,
+		      struct list * const *rrlv, uint64_t ttl);
+struct dns_cache_ent *dns_cache_lookup(struct dns_cache *c, const char *name,
+				       uint16_t type, uint16_t dnsclass,
+				       bool stale);
+size_t dns_cache_size(const struct dns_cache *c);
+
+
+/* getaddrinfo resolver pool */
+
+struct dns_gai;
+
+typedef void(dns_gai_h)(int err, const char *name, uint16_t type,
+			struct list *rrl, struct list *waitl, void *arg);
+
+int dns_gai_alloc(struct dns_gai **gaip, uint16_t workers, dns_gai_h *h,
+		  void *arg);
+int dns_gai_lookup(struct dns_gai *gai, const char *name, uint16_t type,
+		   dnsc_resolv_h *resolvh, struct le *le, void *data);
@@ -0,0 +1,299 @@
+/**
+ * @file dns/gai.c  DNS getaddrinfo Resolver Pool
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_sa.h>
+#include <re_tmr.h>
+#include <re_dns.h>
+#include <re_async.h>
+#include "dns.h"
+
+
+/*
+ * Blocking lookups run on a dedicated set of worker threads, so they
+ * never hold up other async work. At most one job per worker is handed
+ * to the threads, the remaining jobs wait in a queue. Lookups for the
+ * same name share one job. A job whose waiters are all gone before it
+ * was started is dropped without using a worker.
+ *
+ * Freeing the resolver pool does not wait for lookups in progress. The
+ * running jobs are detached and the worker threads are released when
+ * the last of them has finished.
+ */
+struct gai_pool {
+	struct re_async *async;
+	struct tmr tmr;
+	uint32_t running;     /* Jobs handed to the workers */
+};
+
+struct dns_gai {
+	struct gai_pool *pool;
+	struct hash *ht;      /* All jobs, by name         */
+	struct list jobq;     /* Jobs not yet started      */
+	struct list runl;     /* Jobs handed to the workers */
+	dns_gai_h *h;
+	void *arg;
+	uint16_t workers;
+};
+
+struct gai_job {
+	struct le he;
+	struct le le;
+	struct list waitl;
+	struct list rrl;      /* Written by the worker thread */
+	struct dns_gai *gai;  /* NULL if detached          */
+	struct gai_pool *pool;
+	dnsc_resolv_h *resolvh;
+	char *name;
+	uint16_t type;
+};
+
+
+static void job_destructor(void *arg)
+{
+	struct gai_job *job = arg;
+
+	hash_unlink(&job->he);
+	list_unlink(&job->le);
+	list_clear(&job->waitl);
+	list_flush(&job->rrl);
+	mem_deref(job->name);
+}
+
+
+static void pool_destructor(void *arg)
+{
+	struct gai_pool *pool = arg;
+
+	tmr_cancel(&pool->tmr);
+	mem_deref(pool->async);
+}
+
+
+static void pool_release(void *arg)
+{
+	mem_deref(arg);
+}
+
+
+static void destructor(void *arg)
+{
+	struct dns_gai *gai = arg;
+	struct le *le;
+
+	/* the workers still use the running jobs, detach them */
+	while ((le = list_head(&gai->runl))) {
+		struct gai_job *job = le->data;
+
+		list_unlink(&job->le);
+		hash_unlink(&job->he);
+		list_clear(&job->waitl);
+		job->gai = NULL;
+	}
+
+	hash_flush(gai->ht);
+	mem_deref(gai->ht);
+
+	/* otherwise released by the last detached job */
+	if (gai->pool && !gai->pool->running)
+		mem_deref(gai->pool);
+}
+
+
+/* called by a worker thread */
+static int job_work(void *arg)
+{
+	struct gai_job *job = arg;
+
+	return job->resolvh(&job->rrl, job->name, job->type);
+}
+
+
+static void job_start(struct dns_gai *gai);
+
+
+static void job_handler(int err, void *arg)
+{
+	struct gai_job *job = arg;
+	struct dns_gai *gai = job->gai;
+	struct gai_pool *pool = job->pool;
+
+	--pool->running;
+
+	if (!gai) {
+		mem_deref(job);
+
+		/* not from here, the async object is still in use */
+		if (!pool->running)
+			tmr_start(&pool->tmr, 0, pool_release, pool);
+
+		return;
+	}
+
+	list_unlink(&job->le);
+	hash_unlink(&job->he);
+
+	gai->h(err, job->name, job->type, &job->rrl, &job->waitl, gai->arg);
+
+	mem_deref(job);
+
+	job_start(gai);
+}
+
+
+static void job_start(struct dns_gai *gai)
+{
+	struct gai_pool *pool = gai->pool;
+	struct gai_job *job;
+
+	while (pool->running < gai->workers &&
+	       (job = list_ledata(list_head(&gai->jobq)))) {
+
+		int err;
+
+		list_unlink(&job->le);
+
+		if (list_isempty(&job->waitl)) {
+			mem_deref(job);
+			continue;
+		}
+
+		job->pool = pool;
+
+		err = re_async(pool->async, 0, job_work, job_handler, job);
+		if (err) {
+			hash_unlink(&job->he);
+			gai->h(err, job->name, job->type, NULL, &job->waitl,
+			       gai->arg);
+			mem_deref(job);
+			continue;
+		}
+
+		list_append(&gai->runl, &job->le, job);
+		++pool->running;
+	}
+}
+
+
+static bool job_cmp_handler(struct le *le, void *arg)
+{
+	const struct gai_job *job = le->data;
+	const struct gai_job *key = arg;
+
+	return job->type == key->type && !str_casecmp(job->name, key->name);
+}
+
+
+/**
+ * Allocate a getaddrinfo resolver pool
+ *
+ * @param gaip    Pointer to allocated resolver pool
+ * @param workers Number of worker threads
+ * @param h       Handler called once per finished lookup
+ * @param arg     Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dns_gai_alloc(struct dns_gai **gaip, uint16_t workers, dns_gai_h *h,
+		  void *arg)
+{
+	struct dns_gai *gai;
+	int err;
+
+	if (!gaip || !workers || !h)
+		return EINVAL;
+
+	gai = mem_zalloc(sizeof(*gai), destructor);
+	if (!gai)
+		return ENOMEM;
+
+	err = hash_alloc(&gai->ht, 64);
+	if (err)
+		goto out;
+
+	gai->pool = mem_zalloc(sizeof(*gai->pool), pool_destructor);
+	if (!gai->pool) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	tmr_init(&gai->pool->tmr);
+
+	err = re_async_alloc(&gai->pool->async, workers);
+	if (err)
+		goto out;
+
+	gai->workers = workers;
+	gai->h       = h;
+	gai->arg     = arg;
+
+ out:
+	if (err)
+		mem_deref(gai);
+	else
+		*gaip = gai;
+
+	return err;
+}
+
+
+/**
+ * Look up a name, or wait for a lookup of the same name in progress.
+ * The caller removes its list element from the waiting list to stop
+ * waiting.
+ *
+ * @param gai     Resolver pool
+ * @param name    Name to look up
+ * @param type    DNS_TYPE_A or DNS_TYPE_AAAA
+ * @param resolvh Blocking resolver, called from a worker thread
+ * @param le      List element of the caller
+ * @param data    Caller data, found in the waiting list
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dns_gai_lookup(struct dns_gai *gai, const char *name, uint16_t type,
+		   dnsc_resolv_h *resolvh, struct le *le, void *data)
+{
+	struct gai_job key = {.name = (char *)name, .type = type};
+	struct gai_job *job;
+	int err;
+
+	if (!gai || !name || !resolvh || !le)
+		return EINVAL;
+
+	job = list_ledata(hash_lookup(gai->ht, hash_joaat_str_ci(name),
+				      job_cmp_handler, &key));
+	if (job) {
+		list_append(&job->waitl, le, data);
+		return 0;
+	}
+
+	job = mem_zalloc(sizeof(*job), job_destructor);
+	if (!job)
+		return ENOMEM;
+
+	err = str_dup(&job->name, name);
+	if (err) {
+		mem_deref(job);
+		return err;
+	}
+
+	job->gai     = gai;
+	job->resolvh = resolvh;
+	job->type    = type;
+
+	hash_append(gai->ht, hash_joaat_str_ci(name), &job->he, job);
+	list_append(&gai->jobq, &job->le, job);
+	list_append(&job->waitl, le, data);
+
+	job_start(gai);
+
+	return 0;
+}
@@ -0,0 +1,478 @@
+/**
+ * @file fec/dec.c  ULPFEC decoder
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_rtp.h>
+#include <re_rtpext.h>
+#include <re_fec.h>
+#include "fec.h"
+
+
+#define DEBUG_MODULE "fec_dec"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	DEC_SIZE    = 128,  /**< Media ring size (power of two)      */
+	DEC_FEC_MAX =  32,  /**< Max. number of stored FEC packets   */
+};
+
+
+/** One stored media packet */
+struct dec_media {
+	struct mbuf *mb;        /**< Complete RTP packet, NULL if empty */
+	uint16_t seq;           /**< RTP sequence number                */
+};
+
+/** One stored FEC packet */
+struct dec_fec {
+	struct le le;           /**< Linked list element                */
+	struct fec_hdr hdr;     /**< FEC header                         */
+	uint8_t *payload;       /**< Level 0 payload                    */
+};
+
+/**
+ * Defines a FEC decoder
+ *
+ * Received media packets are kept in a ring indexed by sequence number.
+ * Each FEC packet is kept until all but one of its protected packets are
+ * present, and the missing packet is then reconstructed.
+ */
+struct fec_dec {
+	struct dec_media mediav[DEC_SIZE];  /**< Media packet ring      */
+	struct list fecl;                   /**< Stored FEC packets     */
+	uint16_t seq_max;                   /**< Highest media seq.     */
+	bool started;                       /**< Media seq. is valid    */
+	uint32_t ssrc;                      /**< SSRC of media stream   */
+	fec_recover_h *recoverh;            /**< Recovery handler       */
+	void *arg;                          /**< Handler argument       */
+	struct fec_stats stats;             /**< Statistics             */
+};
+
+
+static void fec_destructor(void *data)
+{
+	struct dec_fec *fec = data;
+
+	list_unlink(&fec->le);
+	mem_deref(fec->payload);
+}
+
+
+static void dec_flush(struct fec_dec *dec)
+{
+	for (size_t i=0; i<DEC_SIZE; i++)
+		dec->mediav[i].mb = mem_deref(dec->mediav[i].mb);
+
+	list_flush(&dec->fecl);
+	dec->started = false;
+}
+
+
+static void destructor(void *data)
+{
+	struct fec_dec *dec = data;
+
+	dec_flush(dec);
+}
+
+
+/**
+ * Allocate a new FEC decoder
+ *
+ * Recovered packets are passed to the recovery handler in the same form
+ * as received packets, and can be put into a jitter buffer with
+ * jbuf_put() before the next jbuf_get().
+ *
+ * @param decp     Pointer to allocated FEC decoder
+ * @param recoverh Recovery handler
+ * @param arg      Handler argument
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int fec_dec_alloc(struct fec_dec **decp, fec_recover_h *recoverh, void *arg)
+{
+	struct fec_dec *dec;
+
+	if (!decp || !recoverh)
+		return EINVAL;
+
+	dec = mem_zalloc(sizeof(*dec), destructor);
+	if (!dec)
+		return ENOMEM;
+
+	dec->recoverh = recoverh;
+	dec->arg      = arg;
+
+	*decp = dec;
+
+	return 0;
+}
+
+
+static struct dec_media *media_find(struct fec_dec *dec, uint16_t seq)
+{
+	struct dec_media *media = &dec->mediav[seq & (DEC_SIZE - 1)];
+
+	return (media->mb && media->seq == seq) ? media : NULL;
+}
+
+
+static void media_store(struct fec_dec *dec, uint16_t seq, struct mbuf *mb)
+{
+	struct dec_media *media = &dec->mediav[seq & (DEC_SIZE - 1)];
+
+	mem_deref(media->mb);
+	media->mb  = mem_ref(mb);
+	media->seq = seq;
+
+	if (!dec->started || fec_seq_less(dec->seq_max, seq)) {
+		dec->seq_max = seq;
+		dec->started = true;
+	}
+}
+
+
+/* Is the sequence number too old to be found in the media ring? */
+static bool seq_expired(const struct fec_dec *dec, uint16_t seq)
+{
+	return dec->started &&
+		fec_seq_less(seq, (uint16_t)(dec->seq_max - DEC_SIZE + 1));
+}
+
+
+static void ssrc_check(struct fec_dec *dec, uint32_t ssrc)
+{
+	if (dec->ssrc == ssrc)
+		return;
+
+	if (dec->started || dec->fecl.head) {
+		DEBUG_INFO("ssrc changed %u %u\n", dec->ssrc, ssrc);
+	}
+
+	dec_flush(dec);
+	dec->ssrc = ssrc;
+}
+
+
+static int recover(struct fec_dec *dec, const struct dec_fec *fec,
+		   uint16_t seq)
+{
+	struct rtp_header hdr;
+	struct mbuf *mb;
+	uint8_t *p;
+	uint8_t b0 = fec->hdr.b0, b1 = fec->hdr.b1;
+	uint32_t ts = fec->hdr.ts_rec;
+	uint16_t len = fec->hdr.len_rec;
+	int err;
+
+	mb = mbuf_alloc(RTP_HEADER_SIZE + fec->hdr.prot_len);
+	if (!mb)
+		return ENOMEM;
+
+	p = mb->buf;
+	memcpy(p + RTP_HEADER_SIZE, fec->payload, fec->hdr.prot_len);
+
+	for (uint16_t off=0; off<FEC_MASK_BITS; off++) {
+
+		const struct dec_media *media;
+		const uint8_t *q;
+		size_t qlen;
+
+		if (!(fec->hdr.mask & fec_mask_bit(off)))
+			continue;
+
+		if ((uint16_t)(fec->hdr.sn_base + off) == seq)
+			continue;
+
+		media = media_find(dec, fec->hdr.sn_base + off);
+		q    = media->mb->buf;
+		qlen = media->mb->end - RTP_HEADER_SIZE;
+
+		if (qlen > fec->hdr.prot_len) {
+			err = EBADMSG;
+			goto out;
+		}
+
+		b0  ^= q[0];
+		b1  ^= q[1];
+		ts  ^= fec_pkt_ts(q);
+		len ^= (uint16_t)qlen;
+
+		fec_xor(p + RTP_HEADER_SIZE, q + RTP_HEADER_SIZE, qlen);
+	}
+
+	if (len > fec->hdr.prot_len) {
+		err = EBADMSG;
+		goto out;
+	}
+
+	p[0] = 0x80 | (b0 & 0x3f);
+	p[1] = b1;
+	p[2] = seq >> 8;
+	p[3] = seq & 0xff;
+	p[4] = ts >> 24;
+	p[5] = (ts >> 16) & 0xff;
+	p[6] = (ts >> 8) & 0xff;
+	p[7] = ts & 0xff;
+	p[8] = dec->ssrc >> 24;
+	p[9] = (dec->ssrc >> 16) & 0xff;
+	p[10] = (dec->ssrc >> 8) & 0xff;
+	p[11] = dec->ssrc & 0xff;
+
+	mb->pos = 0;
+	mb->end = RTP_HEADER_SIZE + len;
+
+	err = rtp_hdr_decode(&hdr, mb);
+	if (err)
+		goto out;
+
+	media_store(dec, seq, mb);
+	++dec->stats.recovered;
+
+	dec->recoverh(&hdr, mb, dec->arg);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/*
+ * Check one FEC packet against the media ring. Returns true if the
+ * FEC packet is done with, either used or unusable.
+ */
+static bool fec_check(struct fec_dec *dec, struct dec_fec *fec,
+		      bool *recovered)
+{
+	uint16_t missing = 0, nmissing = 0;
+	int err;
+
+	for (uint16_t off=0; off<FEC_MASK_BITS; off++) {
+
+		uint16_t seq = fec->hdr.sn_base + off;
+
+		if (!(fec->hdr.mask & fec_mask_bit(off)))
+			continue;
+
+		if (media_find(dec, seq))
+			continue;
+
+		if (seq_expired(dec, seq)) {
+			++dec->stats.expired;
+			return true;
+		}
+
+		missing = seq;
+		if (++nmissing > 1)
+			return false;
+	}
+
+	if (!nmissing)
+		return true;
+
+	err = recover(dec, fec, missing);
+	if (err) {
+		DEBUG_INFO("recover seq=%u failed (%m)\n", missing, err);
+		return err != ENOMEM;
+	}
+
+	*recovered = true;
+
+	return true;
+}
+
+
+static void process(struct fec_dec *dec)
+{
+	bool recovered;
+
+	/* a recovered packet can make another FEC packet usable */
+	do {
+		struct le *le = dec->fecl.head;
+
+		recovered = false;
+
+		while (le) {
+			struct dec_fec *fec = le->data;
+
+			le = le->next;
+
+			if (fec_check(dec, fec, &recovered))
+				mem_deref(fec);
+
+			if (recovered)
+				break;
+		}
+
+	} while (recovered);
+}
+
+
+/**
+ * Pass a received media packet to the FEC decoder
+ *
+ * The packet is given as passed to the RTP receive handler, i.e. the RTP
+ * header must be present in the buffer in front of the current position.
+ *
+ * @param dec FEC decoder
+ * @param hdr RTP header
+ * @param mb  RTP packet, positioned at the RTP payload
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int fec_dec_media(struct fec_dec *dec, const struct rtp_header *hdr,
+		  const struct mbuf *mb)
+{
+	struct mbuf *cp;
+	size_t hlen;
+	int err;
+
+	if (!dec || !hdr || !mb)
+		return EINVAL;
+
+	hlen = RTP_HEADER_SIZE + hdr->cc * sizeof(uint32_t);
+	if (hdr->ext)
+		hlen += RTPEXT_HDR_SIZE + hdr->x.len * sizeof(uint32_t);
+
+	if (mb->pos < hlen)
+		return EINVAL;
+
+	ssrc_check(dec, hdr->ssrc);
+
+	if (media_find(dec, hdr->seq))
+		return EALREADY;
+
+	cp = mbuf_alloc(hlen + mbuf_get_left(mb));
+	if (!cp)
+		return ENOMEM;
+
+	err = mbuf_write_mem(cp, mb->buf + mb->pos - hlen,
+			     hlen + mbuf_get_left(mb));
+	if (err)
+		goto out;
+
+	media_store(dec, hdr->seq, cp);
+	++dec->stats.media;
+
+	process(dec);
+
+ out:
+	mem_deref(cp);
+
+	return err;
+}
+
+
+/**
+ * Pass a received ULPFEC packet to the FEC decoder
+ *
+ * @param dec FEC decoder
+ * @param hdr RTP header of the FEC packet
+ * @param mb  FEC packet, positioned at the FEC header
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int fec_dec_fec(struct fec_dec *dec, const struct rtp_header *hdr,
+		struct mbuf *mb)
+{
+	struct dec_fec *fec;
+	int err;
+
+	if (!dec || !hdr || !mb)
+		return EINVAL;
+
+	ssrc_check(dec, hdr->ssrc);
+
+	fec = mem_zalloc(sizeof(*fec), fec_destructor);
+	if (!fec)
+		return ENOMEM;
+
+	err = fec_hdr_decode(&fec->hdr, mb);
+	if (err)
+		goto out;
+
+	if (mbuf_get_left(mb) < fec->hdr.prot_len) {
+		err = EBADMSG;
+		goto out;
+	}
+
+	++dec->stats.fec;
+
+	if (seq_expired(dec, fec->hdr.sn_base + FEC_MASK_BITS - 1)) {
+		++dec->stats.expired;
+		goto out;
+	}
+
+	fec->payload = mem_alloc(fec->hdr.prot_len, NULL);
+	if (!fec->payload) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mbuf_read_mem(mb, fec->payload, fec->hdr.prot_len);
+	if (err)
+		goto out;
+
+	if (list_count(&dec->fecl) >= DEC_FEC_MAX) {
+		mem_deref(list_ledata(dec->fecl.head));
+		++dec->stats.expired;
+	}
+
+	list_append(&dec->fecl, &fec->le, fec);
+
+	process(dec);
+
+	return 0;
+
+ out:
+	mem_deref(fec);
+
+	return err;
+}
+
+
+/**
+ * Get the FEC decoder statistics
+ *
+ * @param dec   FEC decoder
+ * @param stats Returned statistics
+ */
+void fec_dec_stats(const struct fec_dec *dec, struct fec_stats *stats)
+{
+	if (!dec || !stats)
+		return;
+
+	*stats = dec->stats;
+}
+
+
+/**
+ * Print the FEC decoder status
+ *
+ * @param pf  Print handler
+ * @param dec FEC decoder
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int fec_dec_debug(struct re_printf *pf, const struct fec_dec *dec)
+{
+	if (!dec)
+		return 0;
+
+	return re_hprintf(pf, "--- FEC decoder ---\n"
+			  " ssrc=%08x fec_pending=%u\n"
+			  " media=%u fec=%u recovered=%u expired=%u\n",
+			  dec->ssrc, list_count(&dec->fecl),
+			  dec->stats.media, dec->stats.fec,
+			  dec->stats.recovered, dec->stats.expired);
+}
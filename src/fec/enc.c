@@ -0,0 +1,249 @@
+/**
+ * @file fec/enc.c  ULPFEC encoder
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_rtp.h>
+#include <re_fec.h>
+#include "fec.h"
+
+
+#define DEBUG_MODULE "fec_enc"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/**
+ * Defines a FEC encoder
+ *
+ * Media packets are collected into groups of up to k packets. A group is
+ * closed when it is full, on a marker bit or on a sequence discontinuity,
+ * and then protected by up to m FEC packets.
+ */
+struct fec_enc {
+	struct mbuf *pktv[FEC_MASK_BITS];  /**< Media packets of the group */
+	struct mbuf *outv[FEC_MASK_BITS];  /**< Pending FEC packets        */
+	size_t n;                          /**< Media packets in group     */
+	size_t outi;                       /**< Next pending FEC packet    */
+	size_t outc;                       /**< Number of FEC packets      */
+	uint8_t k;                         /**< Max. media packets / group */
+	uint8_t m;                         /**< Max. FEC packets / group   */
+	enum fec_mask type;                /**< Packet mask layout         */
+};
+
+
+static void group_clear(struct fec_enc *enc)
+{
+	for (size_t i=0; i<enc->n; i++)
+		enc->pktv[i] = mem_deref(enc->pktv[i]);
+
+	enc->n = 0;
+}
+
+
+static void out_clear(struct fec_enc *enc)
+{
+	for (size_t i=enc->outi; i<enc->outc; i++)
+		enc->outv[i] = mem_deref(enc->outv[i]);
+
+	enc->outi = enc->outc = 0;
+}
+
+
+static void destructor(void *data)
+{
+	struct fec_enc *enc = data;
+
+	group_clear(enc);
+	out_clear(enc);
+}
+
+
+/**
+ * Allocate a new FEC encoder
+ *
+ * @param encp Pointer to allocated FEC encoder
+ * @param k    Number of media packets per group (1 - FEC_MASK_BITS)
+ * @param m    Number of FEC packets per full group (1 - k)
+ * @param type Packet mask layout
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int fec_enc_alloc(struct fec_enc **encp, uint8_t k, uint8_t m,
+		  enum fec_mask type)
+{
+	struct fec_enc *enc;
+
+	if (!encp || !k || k > FEC_MASK_BITS || !m || m > k)
+		return EINVAL;
+
+	enc = mem_zalloc(sizeof(*enc), destructor);
+	if (!enc)
+		return ENOMEM;
+
+	enc->k    = k;
+	enc->m    = m;
+	enc->type = type;
+
+	*encp = enc;
+
+	return 0;
+}
+
+
+static bool mask_match(const struct fec_enc *enc, size_t m, size_t i,
+		       size_t j)
+{
+	switch (enc->type) {
+
+	case FEC_MASK_BLOCK:
+		return i * m / enc->n == j;
+
+	case FEC_MASK_INTERLEAVED:
+	default:
+		return i % m == j;
+	}
+}
+
+
+static int group_protect(struct fec_enc *enc)
+{
+	struct mbuf *subv[FEC_MASK_BITS];
+	size_t m;
+	int err = 0;
+
+	if (!enc->n)
+		return 0;
+
+	/* scale down the number of FEC packets for short groups */
+	m = (enc->m * enc->n + enc->k - 1) / enc->k;
+
+	if (enc->outi < enc->outc) {
+		DEBUG_INFO("dropping %zu unsent FEC packets\n",
+			   enc->outc - enc->outi);
+	}
+
+	out_clear(enc);
+
+	for (size_t j=0; j<m; j++) {
+
+		struct mbuf *mb;
+		size_t subc = 0;
+
+		for (size_t i=0; i<enc->n; i++) {
+			if (mask_match(enc, m, i, j))
+				subv[subc++] = enc->pktv[i];
+		}
+
+		if (!subc)
+			continue;
+
+		mb = mbuf_alloc(FEC_PRESZ + FEC_HDR_SIZE + FEC_LVL_LSIZE +
+				mbuf_get_left(enc->pktv[0]));
+		if (!mb) {
+			err = ENOMEM;
+			break;
+		}
+
+		mb->pos = mb->end = FEC_PRESZ;
+
+		err = fec_encode(mb, subv, subc);
+		if (err) {
+			mem_deref(mb);
+			break;
+		}
+
+		mb->pos = FEC_PRESZ;
+		enc->outv[enc->outc++] = mb;
+	}
+
+	group_clear(enc);
+
+	return err;
+}
+
+
+/**
+ * Add an outgoing media packet to the FEC encoder
+ *
+ * @param enc FEC encoder
+ * @param mb  RTP packet, positioned at the RTP header
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int fec_enc_put(struct fec_enc *enc, const struct mbuf *mb)
+{
+	struct mbuf *cp;
+	const uint8_t *p;
+	size_t len;
+	int err;
+
+	if (!enc || !mb)
+		return EINVAL;
+
+	len = mbuf_get_left(mb);
+	if (len < RTP_HEADER_SIZE)
+		return EBADMSG;
+
+	p = mbuf_buf(mb);
+
+	/* a group covers consecutive sequence numbers only */
+	if (enc->n) {
+		const uint8_t *last = mbuf_buf(enc->pktv[enc->n - 1]);
+
+		if (fec_pkt_seq(p) != (uint16_t)(fec_pkt_seq(last) + 1)) {
+			err = group_protect(enc);
+			if (err)
+				return err;
+		}
+	}
+
+	cp = mbuf_alloc(len);
+	if (!cp)
+		return ENOMEM;
+
+	(void)mbuf_write_mem(cp, p, len);
+	cp->pos = 0;
+
+	enc->pktv[enc->n++] = cp;
+
+	if (enc->n >= enc->k || (p[1] & 0x80))
+		return group_protect(enc);
+
+	return 0;
+}
+
+
+/**
+ * Get the next pending FEC packet from the FEC encoder
+ *
+ * The returned buffer contains the ULPFEC payload with headroom for the
+ * RTP header, and can be passed directly to rtp_send() using the FEC
+ * payload type.
+ *
+ * @param enc FEC encoder
+ * @param mbp Pointer to returned FEC payload, owned by the caller
+ *
+ * @return 0 for success, ENOENT if no FEC packet is pending
+ */
+int fec_enc_get(struct fec_enc *enc, struct mbuf **mbp)
+{
+	if (!enc || !mbp)
+		return EINVAL;
+
+	if (enc->outi >= enc->outc)
+		return ENOENT;
+
+	*mbp = enc->outv[enc->outi];
+	enc->outv[enc->outi++] = NULL;
+
+	if (enc->outi >= enc->outc)
+		enc->outi = enc->outc = 0;
+
+	return 0;
+}
@@ -0,0 +1,227 @@
+/**
+ * @file fec/fec.c  ULPFEC header and XOR parity (RFC 5109)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_rtp.h>
+#include <re_fec.h>
+#include "fec.h"
+
+
+/*
+ * FEC Header (RFC 5109 7.3) followed by one Level Header (7.4):
+ *
+ *   0                   1                   2                   3
+ *   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *  |E|L|P|X|  CC   |M| PT recovery |            SN base            |
+ *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *  |                          TS recovery                          |
+ *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *  |        length recovery        |       Protection Length       |
+ *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *  |             mask              |     mask cont. (present only  |
+ *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *  |        when L = 1)            |
+ *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ */
+
+
+/**
+ * XOR a buffer into another buffer
+ *
+ * @param dst Destination buffer
+ * @param src Source buffer
+ * @param n   Number of bytes
+ */
+void fec_xor(uint8_t *dst, const uint8_t *src, size_t n)
+{
+#if defined(__SSE2__)
+	for (; n >= 16; n -= 16, dst += 16, src += 16) {
+		__m128i a = _mm_loadu_si128((const void *)dst);
+		__m128i b = _mm_loadu_si128((const void *)src);
+
+		_mm_storeu_si128((void *)dst, _mm_xor_si128(a, b));
+	}
+#elif defined(__ARM_NEON)
+	for (; n >= 16; n -= 16, dst += 16, src += 16)
+		vst1q_u8(dst, veorq_u8(vld1q_u8(dst), vld1q_u8(src)));
+#endif
+
+	for (; n >= 8; n -= 8, dst += 8, src += 8) {
+		uint64_t a, b;
+
+		memcpy(&a, dst, 8);
+		memcpy(&b, src, 8);
+		a ^= b;
+		memcpy(dst, &a, 8);
+	}
+
+	while (n--)
+		*dst++ ^= *src++;
+}
+
+
+static int hdr_encode(struct mbuf *mb, const struct fec_hdr *hdr)
+{
+	int err;
+
+	err  = mbuf_write_u8(mb, (hdr->l ? 0x40 : 0x00) | (hdr->b0 & 0x3f));
+	err |= mbuf_write_u8(mb, hdr->b1);
+	err |= mbuf_write_u16(mb, htons(hdr->sn_base));
+	err |= mbuf_write_u32(mb, htonl(hdr->ts_rec));
+	err |= mbuf_write_u16(mb, htons(hdr->len_rec));
+	err |= mbuf_write_u16(mb, htons(hdr->prot_len));
+	err |= mbuf_write_u16(mb, htons((uint16_t)(hdr->mask >> 32)));
+
+	if (hdr->l)
+		err |= mbuf_write_u32(mb, htonl((uint32_t)hdr->mask));
+
+	return err;
+}
+
+
+/**
+ * Decode a ULPFEC header and its level 0 header
+ *
+ * @param hdr Decoded FEC header
+ * @param mb  Buffer positioned at the FEC header, on success positioned
+ *            at the level 0 payload
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int fec_hdr_decode(struct fec_hdr *hdr, struct mbuf *mb)
+{
+	uint8_t b;
+
+	if (!hdr || !mb)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < FEC_HDR_SIZE + FEC_LVL_SIZE)
+		return EBADMSG;
+
+	b = mbuf_read_u8(mb);
+
+	/* E bit is reserved for extensions */
+	if (b & 0x80)
+		return EPROTO;
+
+	hdr->l        = (b >> 6) & 0x01;
+	hdr->b0       = b & 0x3f;
+	hdr->b1       = mbuf_read_u8(mb);
+	hdr->sn_base  = ntohs(mbuf_read_u16(mb));
+	hdr->ts_rec   = ntohl(mbuf_read_u32(mb));
+	hdr->len_rec  = ntohs(mbuf_read_u16(mb));
+	hdr->prot_len = ntohs(mbuf_read_u16(mb));
+	hdr->mask     = (uint64_t)ntohs(mbuf_read_u16(mb)) << 32;
+
+	if (hdr->l) {
+		if (mbuf_get_left(mb) < FEC_LVL_LSIZE - FEC_LVL_SIZE)
+			return EBADMSG;
+
+		hdr->mask |= ntohl(mbuf_read_u32(mb));
+	}
+
+	if (!hdr->mask)
+		return EBADMSG;
+
+	return 0;
+}
+
+
+/**
+ * Encode one ULPFEC packet protecting a set of RTP packets
+ *
+ * The FEC header, level header and level 0 payload are written at the
+ * current position. All packets must belong to the same RTP stream and
+ * be within FEC_MASK_BITS sequence numbers of each other.
+ *
+ * @param mb   Buffer to write the FEC payload to
+ * @param pktv RTP packets to protect, positioned at the RTP header
+ * @param pktc Number of RTP packets
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int fec_encode(struct mbuf *mb, struct mbuf * const *pktv, size_t pktc)
+{
+	struct fec_hdr hdr;
+	size_t plen = 0, i;
+	uint8_t *payload;
+	int err;
+
+	if (!mb || !pktv || !pktc)
+		return EINVAL;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	for (i=0; i<pktc; i++) {
+
+		const struct mbuf *pkt = pktv[i];
+		uint16_t seq;
+
+		if (!pkt || mbuf_get_left(pkt) < RTP_HEADER_SIZE)
+			return EINVAL;
+
+		seq = fec_pkt_seq(mbuf_buf(pkt));
+
+		if (!i || fec_seq_less(seq, hdr.sn_base))
+			hdr.sn_base = seq;
+
+		plen = max(plen, mbuf_get_left(pkt) - RTP_HEADER_SIZE);
+	}
+
+	if (plen > 0xffff)
+		return EOVERFLOW;
+
+	for (i=0; i<pktc; i++) {
+
+		const uint8_t *p = mbuf_buf(pktv[i]);
+		size_t len = mbuf_get_left(pktv[i]) - RTP_HEADER_SIZE;
+		uint16_t off = fec_pkt_seq(p) - hdr.sn_base;
+
+		if (off >= FEC_MASK_BITS)
+			return ERANGE;
+
+		if (hdr.mask & fec_mask_bit(off))
+			return EALREADY;
+
+		hdr.mask    |= fec_mask_bit(off);
+		hdr.b0      ^= p[0];
+		hdr.b1      ^= p[1];
+		hdr.ts_rec  ^= fec_pkt_ts(p);
+		hdr.len_rec ^= (uint16_t)len;
+	}
+
+	hdr.l = (hdr.mask & 0xffffffff) != 0;
+	hdr.prot_len = (uint16_t)plen;
+
+	err = hdr_encode(mb, &hdr);
+	if (err)
+		return err;
+
+	if (!plen)
+		return 0;
+
+	err = mbuf_fill(mb, 0x00, plen);
+	if (err)
+		return err;
+
+	payload = mb->buf + mb->pos - plen;
+
+	for (i=0; i<pktc; i++) {
+		fec_xor(payload, mbuf_buf(pktv[i]) + RTP_HEADER_SIZE,
+			mbuf_get_left(pktv[i]) - RTP_HEADER_SIZE);
+	}
+
+	return 0;
+}
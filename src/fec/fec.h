@@ -0,0 +1,42 @@
+/**
+ * @file fec.h  RTP Forward Error Correction -- internal interface
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+enum {
+	FEC_LVL_SIZE  = 4,   /**< Level header with short mask      */
+	FEC_LVL_LSIZE = 8,   /**< Level header with long mask       */
+	FEC_PRESZ     = 64,  /**< Headroom for the RTP header       */
+};
+
+
+/** Is x less than y? */
+static inline bool fec_seq_less(uint16_t x, uint16_t y)
+{
+	return ((int16_t)(x - y)) < 0;
+}
+
+
+/** Mask bit of the packet at offset off from the SN base */
+static inline uint64_t fec_mask_bit(uint16_t off)
+{
+	return (uint64_t)1 << (FEC_MASK_BITS - 1 - off);
+}
+
+
+static inline uint16_t fec_pkt_seq(const uint8_t *p)
+{
+	return (uint16_t)(p[2] << 8 | p[3]);
+}
+
+
+static inline uint32_t fec_pkt_ts(const uint8_t *p)
+{
+	return (uint32_t)p[4] << 24 | (uint32_t)p[5] << 16 |
+		(uint32_t)p[6] << 8 | p[7];
+}
+
+
+void fec_xor(uint8_t *dst, const uint8_t *src, size_t n);
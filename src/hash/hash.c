@@ -9,12 +9,32 @@
 #include <re_mbuf.h>
 #include <re_list.h>
 #include <re_hash.h>
+#include <re_sys.h>
+
+
+enum {
+	SEG_BITS  = 6,
+	SEG_SIZE  = 1 << SEG_BITS,
+	LOAD_MAX  = 4,         /* chain length which triggers a split */
+	BSIZE_MAX = 1u << 24,
+};
 
 
 /** Defines a hashmap table */
 struct hash {
 	struct list *bucket;  /**< Bucket with linked lists */
 	uint32_t bsize;       /**< Bucket size              */
+
+	/* Auto-resizing (linear hashing) */
+	hash_key_h *keyh;     /**< Element key handler       */
+	struct list **segv;   /**< Bucket segments           */
+	uint32_t segc;        /**< Allocated segments        */
+	uint32_t mask;        /**< Mask of the current round */
+	uint32_t split;       /**< Next bucket to split      */
+	uint32_t seed;        /**< Random bucket index seed  */
+	uint32_t count;       /**< Elements at last recount  */
+	uint32_t appends;     /**< Appends since recount     */
+	uint32_t splits;      /**< Total number of splits    */
 };
 
 
@@ -22,10 +42,140 @@ static void hash_destructor(void *data)
 {
 	struct hash *h = data;
 
+	for (uint32_t i=0; i<h->segc; i++)
+		mem_deref(h->segv[i]);
+
+	mem_deref(h->segv);
 	mem_deref(h->bucket);
 }
 
 
+static inline struct list *bucket(const struct hash *h, uint32_t i)
+{
+	if (!h->keyh)
+		return &h->bucket[i];
+
+	return &h->segv[i >> SEG_BITS][i & (SEG_SIZE - 1)];
+}
+
+
+/*
+ * Mix the key with the random seed of an auto-resizing table, so that
+ * keys sharing a bucket cannot be chosen in advance.
+ */
+static inline uint32_t key_mix(const struct hash *h, uint32_t key)
+{
+	key ^= h->seed;
+	key ^= key >> 16;
+	key *= 0x85ebca6b;
+	key ^= key >> 13;
+	key *= 0xc2b2ae35;
+	key ^= key >> 16;
+
+	return key;
+}
+
+
+static inline uint32_t bucket_idx(const struct hash *h, uint32_t key)
+{
+	uint32_t i;
+
+	if (!h->keyh)
+		return key & (h->bsize - 1);
+
+	key = key_mix(h, key);
+
+	i = key & h->mask;
+	if (i < h->split)
+		i = key & (h->mask << 1 | 1);
+
+	return i;
+}
+
+
+static int seg_add(struct hash *h)
+{
+	struct list **segv;
+	struct list *seg;
+
+	if ((h->segc & (h->segc - 1)) == 0) {
+
+		segv = mem_reallocarray(h->segv, h->segc ? h->segc * 2 : 1,
+					sizeof(*segv), NULL);
+		if (!segv)
+			return ENOMEM;
+
+		h->segv = segv;
+	}
+
+	seg = mem_zalloc(SEG_SIZE * sizeof(*seg), NULL);
+	if (!seg)
+		return ENOMEM;
+
+	h->segv[h->segc++] = seg;
+
+	return 0;
+}
+
+
+/*
+ * Count the elements of an auto-resizing table. Elements may be unlinked
+ * without the table knowing, so the count is refreshed once per bsize
+ * appends, which spreads its cost over those appends.
+ */
+static void recount(struct hash *h)
+{
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < h->bsize; i++)
+		n += list_count(bucket(h, i));
+
+	h->count   = n;
+	h->appends = 0;
+}
+
+
+/*
+ * Split one bucket of an auto-resizing table. Only the elements of that
+ * bucket are visited, so growing never stalls on a full rehash.
+ */
+static void split(struct hash *h)
+{
+	uint32_t mask = h->mask << 1 | 1;
+	struct list *src, *dst;
+	struct le *le;
+
+	if (h->bsize >= BSIZE_MAX)
+		return;
+
+	if (h->bsize >= h->segc * SEG_SIZE && seg_add(h))
+		return;
+
+	src = bucket(h, h->split);
+	dst = bucket(h, h->bsize);
+
+	le = list_head(src);
+	while (le) {
+		struct le *next = le->next;
+
+		if ((key_mix(h, h->keyh(le)) & mask) != h->split) {
+			list_unlink(le);
+			list_append(dst, le, le->data);
+		}
+
+		le = next;
+	}
+
+	++h->bsize;
+	++h->splits;
+
+	if (++h->split > h->mask) {
+		h->mask  = mask;
+		h->split = 0;
+	}
+}
+
+
 /**
  * Allocate a new hashmap table
  *
@@ -68,6 +218,60 @@ int hash_alloc(struct hash **hp, uint32_t bsize)
 }
 
 
+/**
+ * Allocate a new auto-resizing hashmap table
+ *
+ * The table grows by linear hashing: when an append makes a bucket chain
+ * longer than the maximum load, and the table holds more elements than
+ * the maximum load per bucket, the next bucket in turn is split in two.
+ * Keys are mixed with a random per-table seed before picking a bucket,
+ * so colliding keys lengthen their own chain but do not grow the table.
+ * The key handler must return the same key that the element was added
+ * with. Since elements can move between buckets on hash_append(), do not
+ * append to the table while traversing one of its bucket lists.
+ *
+ * @param hp     Address of hashmap pointer
+ * @param bsize  Initial bucket size (power of 2)
+ * @param keyh   Element key handler
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int hash_alloc_auto(struct hash **hp, uint32_t bsize, hash_key_h *keyh)
+{
+	struct hash *h;
+	int err = 0;
+
+	if (!hp || !bsize || !keyh)
+		return EINVAL;
+
+	if (bsize & (bsize-1))
+		return EINVAL;
+
+	h = mem_zalloc(sizeof(*h), hash_destructor);
+	if (!h)
+		return ENOMEM;
+
+	h->keyh  = keyh;
+	h->bsize = bsize;
+	h->mask  = bsize - 1;
+	h->seed  = rand_u32();
+
+	while (h->segc * SEG_SIZE < bsize) {
+		err = seg_add(h);
+		if (err)
+			goto out;
+	}
+
+ out:
+	if (err)
+		mem_deref(h);
+	else
+		*hp = h;
+
+	return err;
+}
+
+
 /**
  * Add an element to the hashmap table
  *
@@ -78,10 +282,25 @@ int hash_alloc(struct hash **hp, uint32_t bsize)
  */
 void hash_append(struct hash *h, uint32_t key, struct le *le, void *data)
 {
+	struct list *lst;
+
 	if (!h || !le)
 		return;
 
-	list_append(&h->bucket[key & (h->bsize-1)], le, data);
+	lst = bucket(h, bucket_idx(h, key));
+
+	list_append(lst, le, data);
+
+	if (!h->keyh)
+		return;
+
+	if (++h->appends >= h->bsize)
+		recount(h);
+
+	/* grow by the live load, not by the chain of colliding keys */
+	if (h->count + h->appends > LOAD_MAX * h->bsize &&
+	    list_count(lst) > LOAD_MAX)
+		split(h);
 }
 
 
@@ -112,7 +331,7 @@ struct le *hash_lookup(const struct hash *h, uint32_t key, list_apply_h *ah,
 	if (!h || !ah)
 		return NULL;
 
-	return list_apply(&h->bucket[key & (h->bsize-1)], true, ah, arg);
+	return list_apply(bucket(h, bucket_idx(h, key)), true, ah, arg);
 }
 
 
@@ -134,7 +353,7 @@ struct le *hash_apply(const struct hash *h, list_apply_h *ah, void *arg)
 		return NULL;
 
 	for (i=0; (i<h->bsize) && !le; i++)
-		le = list_apply(&h->bucket[i], true, ah, arg);
+		le = list_apply(bucket(h, i), true, ah, arg);
 
 	return le;
 }
@@ -153,7 +372,7 @@ struct list *hash_list_idx(const struct hash *h, uint32_t i)
 	if (!h || i >= h->bsize)
 		return NULL;
 
-	return &h->bucket[i];
+	return bucket(h, i);
 }
 
 
@@ -167,7 +386,7 @@ struct list *hash_list_idx(const struct hash *h, uint32_t i)
  */
 struct list *hash_list(const struct hash *h, uint32_t key)
 {
-	return h ? &h->bucket[key & (h->bsize - 1)] : NULL;
+	return h ? bucket(h, bucket_idx(h, key)) : NULL;
 }
 
 
@@ -197,7 +416,7 @@ void hash_flush(struct hash *h)
 		return;
 
 	for (i=0; i<h->bsize; i++)
-		list_flush(&h->bucket[i]);
+		list_flush(bucket(h, i));
 }
 
 
@@ -214,7 +433,7 @@ void hash_clear(struct hash *h)
 		return;
 
 	for (i=0; i<h->bsize; i++)
-		list_clear(&h->bucket[i]);
+		list_clear(bucket(h, i));
 }
 
 
@@ -246,19 +465,29 @@ uint32_t hash_valid_size(uint32_t size)
  */
 int hash_debug(struct re_printf *pf, struct hash *h)
 {
+	uint32_t n = 0, used = 0, max = 0;
 	int err;
 
 	if (!h)
 		return EINVAL;
 
-	err = re_hprintf(pf, "hash (bsize %u) list entries:\n", h->bsize);
 	for (uint32_t i = 0; i < h->bsize; i++) {
-		struct le *he = hash_list_idx(h, i)->head;
+		uint32_t c = list_count(bucket(h, i));
 
-		if (!he)
-			continue;
+		n += c;
+		used += c ? 1 : 0;
+		max = MAX(max, c);
+	}
+
+	err = re_hprintf(pf, "hash (bsize %u%s) entries %u, load %u.%02u,"
+			 " used %u, longest %u, splits %u\n",
+			 h->bsize, h->keyh ? " auto" : "", n,
+			 n / h->bsize, n % h->bsize * 100 / h->bsize,
+			 used, max, h->splits);
 
-		uint32_t c = list_count(he->list);
+	err |= re_hprintf(pf, "list entries:\n");
+	for (uint32_t i = 0; i < h->bsize; i++) {
+		uint32_t c = list_count(bucket(h, i));
 		if (!c)
 			continue;
 
@@ -38,12 +38,15 @@ enum {
 	CONN_BSIZE   = 256,
 	QUERY_HASH_SIZE = 16,
 	TCP_HASH_SIZE = 2,
+	POOL_BSIZE   = 16,
 };
 
 struct http_cli {
 	struct http_conf conf;
+	struct http_pool_stats stats;
 	struct list reql;
 	struct hash *ht_conn;
+	struct hash *ht_pool;
 	struct dnsc *dnsc;
 	struct tls *tls;
 	char *tlshn;
@@ -54,20 +57,39 @@ struct http_cli {
 	struct sa laddr6;
 #endif
 	size_t bufsize_max;
+	uint32_t max_conns;   /* Per server address, 0 is no limit */
+	uint32_t pipeline;    /* Max. requests in flight per connection */
 };
 
 struct conn;
 
+/*
+ * Connections to one server address. With a connection limit, requests
+ * beyond it are pipelined on busy connections if enabled, or wait in a
+ * FIFO queue for a connection to become idle or to close.
+ */
+struct http_pool {
+	struct le he;
+	struct tmr tmr;
+	struct list waitq;    /* Requests waiting for a connection */
+	struct sa addr;
+	uint32_t nconn;
+	bool secure;
+};
+
 struct http_req {
 	struct http_chunk chunk;
 	struct sa srvv[16];
 	struct le le;
+	struct le le_q;       /* Pool wait queue or pipelined list */
 	struct http_req **reqp;
 	struct http_cli *cli;
 	struct http_msg *msg;
 	struct dns_query *dq;
 	struct dns_query *dq6;
 	struct conn *conn;
+	struct conn *pconn;   /* Pipelined on, not the owner */
+	struct http_pool *pool;
 	struct mbuf *mbreq;
 	struct mbuf *mb;
 	char *host;
@@ -81,6 +103,7 @@ struct http_req {
 	bool chunked;
 	bool secure;
 	bool close;
+	bool pipe;            /* May be pipelined */
 	http_bodyh *bodyh;
 };
 
@@ -97,6 +120,9 @@ struct conn {
 	struct sa addr;
 	struct le he;
 	struct http_req *req;
+	struct list pipel;    /* Requests sent after the current one */
+	struct http_pool *pool;
+	struct http_cli *cli;
 	struct tls_conn *sc;
 	struct tcp_conn *tc;
 	uint64_t usec;
@@ -106,7 +132,9 @@ struct conn {
 static void req_close(struct http_req *req, int err,
 		      const struct http_msg *msg);
 static int req_connect(struct http_req *req);
+static int conn_connect(struct http_req *req, bool fifo);
 static void timeout_handler(void *arg);
+static void pool_kick(struct http_pool *pool);
 
 
 static void cli_destructor(void *arg)
@@ -123,6 +151,8 @@ static void cli_destructor(void *arg)
 
 	hash_flush(cli->ht_conn);
 	mem_deref(cli->ht_conn);
+	hash_clear(cli->ht_pool);
+	mem_deref(cli->ht_pool);
 	mem_deref(cli->cert);
 	mem_deref(cli->key);
 	mem_deref(cli->dnsc);
@@ -131,10 +161,23 @@ static void cli_destructor(void *arg)
 }
 
 
+static void req_unqueue(struct http_req *req)
+{
+	/* the response to a pipelined request is still coming */
+	if (req->pconn && req->pconn->req)
+		req->pconn->req->close = true;
+
+	req->pconn = NULL;
+	list_unlink(&req->le_q);
+	req->pool = mem_deref(req->pool);
+}
+
+
 static void req_destructor(void *arg)
 {
 	struct http_req *req = arg;
 
+	req_unqueue(req);
 	list_unlink(&req->le);
 	mem_deref(req->msg);
 	mem_deref(req->dq);
@@ -149,11 +192,28 @@ static void req_destructor(void *arg)
 static void conn_destructor(void *arg)
 {
 	struct conn *conn = arg;
+	struct http_req *req;
 
 	tmr_cancel(&conn->tmr);
 	hash_unlink(&conn->he);
 	mem_deref(conn->sc);
 	mem_deref(conn->tc);
+
+	/* pipelined requests without response go back to the queue */
+	while ((req = list_ledata(list_tail(&conn->pipel)))) {
+
+		list_unlink(&req->le_q);
+		req->pconn = NULL;
+		req->pool  = mem_ref(conn->pool);
+		mbuf_set_pos(req->mbreq, 0);
+		list_prepend(&conn->pool->waitq, &req->le_q, req);
+	}
+
+	if (conn->pool) {
+		--conn->pool->nconn;
+		pool_kick(conn->pool);
+		mem_deref(conn->pool);
+	}
 }
 
 
@@ -165,24 +225,34 @@ static void conn_idle(struct conn *conn)
 	if (!conn)
 		return;
 
-	req = conn->req;
-	if (!req)
-		goto out;
+	cli = conn->cli;
 
-	cli = req->cli;
-	if (!cli)
-		goto out;
+	/* the next pipelined request gets the response that follows */
+	req = list_ledata(list_head(&conn->pipel));
+	if (req) {
+		list_unlink(&req->le_q);
+		req->pconn = NULL;
+		req->conn  = conn;
+		conn->req  = req;
 
-	tmr_start(&conn->tmr, cli->conf.idle_timeout, timeout_handler, conn);
+		tmr_start(&conn->tmr, cli->conf.recv_timeout,
+			  timeout_handler, conn);
+		return;
+	}
 
- out:
 	conn->req = NULL;
+
+	tmr_start(&conn->tmr, cli->conf.idle_timeout, timeout_handler, conn);
+
+	if (!list_isempty(&conn->pool->waitq))
+		pool_kick(conn->pool);
 }
 
 
 static void req_close(struct http_req *req, int err,
 		      const struct http_msg *msg)
 {
+	req_unqueue(req);
 	list_unlink(&req->le);
 	req->dq = mem_deref(req->dq);
 	req->dq6 = mem_deref(req->dq6);
@@ -447,6 +517,11 @@ static void estab_handler(void *arg)
 	if (!req || !req->cli)
 		return;
 
+#ifdef USE_TLS
+	if (conn->sc && tls_session_reused(conn->sc))
+		++conn->cli->stats.tls_resumed;
+#endif
+
 	err = send_req_buf(conn);
 	if (err) {
 		try_next(conn, err);
@@ -466,6 +541,7 @@ static void recv_handler(struct mbuf *mb, void *arg)
 	const struct http_hdr *hdr;
 	struct conn *conn = arg;
 	struct http_req *req = conn->req;
+	struct mbuf *rest = NULL;
 	size_t pos;
 	bool last;
 	int err;
@@ -475,8 +551,10 @@ static void recv_handler(struct mbuf *mb, void *arg)
 
 	if (req->msg) {
 		err = req_recv(req, mb, &last);
-		if (err || last)
+		if (err || last) {
+			rest = mb;
 			goto out;
+		}
 
 		return;
 	}
@@ -528,13 +606,31 @@ static void recv_handler(struct mbuf *mb, void *arg)
 		req->rx_len = req->msg->clen;
 
 	err = req_recv(req, req->mb, &last);
-	if (err || last)
+	if (err || last) {
+		rest = req->mb;
 		goto out;
+	}
 
 	return;
 
  out:
+	/* the response to the next pipelined request may follow */
+	if (err || !last || !mbuf_get_left(rest)) {
+		req_close(req, err, req->msg);
+		return;
+	}
+
+	rest = mem_ref(rest);
+	mem_ref(conn);
+
 	req_close(req, err, req->msg);
+
+	/* a reference of its own means the connection was dropped */
+	if (mem_nrefs(conn) > 1 && conn->req && conn->tc)
+		recv_handler(rest, conn);
+
+	mem_deref(conn);
+	mem_deref(rest);
 }
 
 
@@ -561,51 +657,228 @@ static bool conn_cmp(struct le *le, void *arg)
 }
 
 
-static int conn_connect(struct http_req *req)
+static bool conn_pipe_cmp(struct le *le, void *arg)
+{
+	const struct conn *conn = le->data;
+	const struct http_req *req = arg;
+	const struct http_req *head = conn->req;
+	uint32_t n = 1;
+
+	if (!sa_cmp(&req->srvv[req->srvc], &conn->addr, SA_ALL))
+		return false;
+
+	if (req->secure != !!conn->sc)
+		return false;
+
+	/* the current request must have been sent completely */
+	if (!head || !head->pipe || head->close || head->connh ||
+	    mbuf_get_left(head->mbreq))
+		return false;
+
+	for (le = conn->pipel.head; le; le = le->next) {
+
+		const struct http_req *preq = le->data;
+
+		if (!preq->pipe)
+			return false;
+
+		++n;
+	}
+
+	return n < req->cli->pipeline;
+}
+
+
+static struct conn *conn_find(struct http_req *req, list_apply_h *cmph)
+{
+	const struct sa *addr = &req->srvv[req->srvc];
+
+	return list_ledata(hash_lookup(req->cli->ht_conn,
+				       sa_hash(addr, SA_ALL), cmph, req));
+}
+
+
+static void pool_destructor(void *arg)
+{
+	struct http_pool *pool = arg;
+
+	tmr_cancel(&pool->tmr);
+	hash_unlink(&pool->he);
+}
+
+
+static bool pool_cmp(struct le *le, void *arg)
+{
+	const struct http_pool *pool = le->data;
+	const struct http_req *req = arg;
+
+	return pool->secure == req->secure &&
+		sa_cmp(&req->srvv[req->srvc], &pool->addr, SA_ALL);
+}
+
+
+/* returns a new reference */
+static struct http_pool *pool_get(struct http_req *req)
+{
+	const struct sa *addr = &req->srvv[req->srvc];
+	struct http_pool *pool;
+
+	pool = list_ledata(hash_lookup(req->cli->ht_pool,
+				       sa_hash(addr, SA_ALL), pool_cmp, req));
+	if (pool)
+		return mem_ref(pool);
+
+	pool = mem_zalloc(sizeof(*pool), pool_destructor);
+	if (!pool)
+		return NULL;
+
+	pool->addr   = *addr;
+	pool->secure = req->secure;
+
+	hash_append(req->cli->ht_pool, sa_hash(addr, SA_ALL), &pool->he,
+		    pool);
+
+	return pool;
+}
+
+
+static bool pool_ready(const struct http_pool *pool, struct http_req *req)
+{
+	const uint32_t max = req->cli->max_conns;
+
+	if (!max || pool->nconn < max)
+		return true;
+
+	return conn_find(req, conn_cmp) || conn_find(req, conn_pipe_cmp);
+}
+
+
+static void pool_handler(void *arg)
+{
+	struct http_pool *pool = mem_ref(arg);
+	struct http_req *req;
+
+	while ((req = list_ledata(list_head(&pool->waitq)))) {
+
+		int err;
+
+		if (!pool_ready(pool, req))
+			break;
+
+		list_unlink(&req->le_q);
+		req->pool = mem_deref(req->pool);
+
+		err = conn_connect(req, false);
+		if (err)
+			req_close(req, err, NULL);
+	}
+
+	mem_deref(pool);
+}
+
+
+static void pool_kick(struct http_pool *pool)
+{
+	tmr_start(&pool->tmr, 0, pool_handler, pool);
+}
+
+
+/* Send the request behind the one in progress */
+static int conn_pipeline(struct conn *conn, struct http_req *req)
 {
+	int err;
+
+	err = tcp_send(conn->tc, req->mbreq);
+	if (err)
+		return err;
+
+	/* sent, kept for a resend on another connection */
+	req->mbreq->pos = req->mbreq->end;
+
+	req->pconn = conn;
+	list_append(&conn->pipel, &req->le_q, req);
+
+	++conn->usec;
+	++conn->cli->stats.pipelined;
+
+	return 0;
+}
+
+
+static int conn_connect(struct http_req *req, bool fifo)
+{
+	struct http_cli *cli = req->cli;
+	struct http_pool *pool;
 	struct sa *laddr = NULL;
+	struct conn *conn;
 	int err = 0;
 
-	if (!req || !req->cli)
-		return EINVAL;
-
 	const struct sa *addr = &req->srvv[req->srvc];
-	struct conn *conn = list_ledata(hash_lookup(req->cli->ht_conn,
-				       sa_hash(addr, SA_ALL), conn_cmp, req));
+
+	pool = pool_get(req);
+	if (!pool)
+		return ENOMEM;
+
+	/* first come, first served */
+	if (fifo && !list_isempty(&pool->waitq))
+		goto queue;
+
+	conn = conn_find(req, conn_cmp);
 	if (conn) {
+		/* send_req_buf() sends the request of the connection */
+		conn->req = req;
+
 		err = send_req_buf(conn);
 		if (!err) {
-			tmr_start(&conn->tmr, req->cli->conf.recv_timeout,
+			tmr_start(&conn->tmr, cli->conf.recv_timeout,
 				  timeout_handler, conn);
 
 			req->conn = conn;
-			conn->req = req;
 
 			++conn->usec;
+			++cli->stats.conn_reused;
 
 			if (mbuf_get_left(req->mbreq))
 				tcp_set_send(conn->tc, send_req_handler);
 
+			mem_deref(pool);
 			return 0;
 		}
 
 		mem_deref(conn);
 	}
 
+	if (cli->max_conns && pool->nconn >= cli->max_conns) {
+
+		conn = conn_find(req, conn_pipe_cmp);
+		if (conn) {
+			mem_deref(pool);
+			return conn_pipeline(conn, req);
+		}
+
+		goto queue;
+	}
+
 	conn = mem_zalloc(sizeof(*conn), conn_destructor);
-	if (!conn)
+	if (!conn) {
+		mem_deref(pool);
 		return ENOMEM;
+	}
 
-	hash_append(req->cli->ht_conn, sa_hash(addr, SA_ALL), &conn->he, conn);
+	hash_append(cli->ht_conn, sa_hash(addr, SA_ALL), &conn->he, conn);
 
 	conn->addr = *addr;
 	conn->usec = 1;
+	conn->cli  = cli;
+	conn->pool = pool;
+	++pool->nconn;
+	++cli->stats.conn_new;
 
 	if (sa_af(&conn->addr) == AF_INET)
-		laddr = &req->cli->laddr;
+		laddr = &cli->laddr;
 #ifdef HAVE_INET6
 	else if (sa_af(&conn->addr) == AF_INET6)
-		laddr = &req->cli->laddr6;
+		laddr = &cli->laddr6;
 #endif
 
 	if (sa_isset(laddr, SA_ADDR))
@@ -620,13 +893,13 @@ static int conn_connect(struct http_req *req)
 #ifdef USE_TLS
 	if (req->secure) {
 
-		err = tls_start_tcp(&conn->sc, req->cli->tls, conn->tc, 0);
+		err = tls_start_tcp(&conn->sc, cli->tls, conn->tc, 0);
 		if (err)
 			goto out;
 
-		if (req->cli->tlshn)
+		if (cli->tlshn)
 			err  = tls_set_verify_server(conn->sc,
-					req->cli->tlshn);
+					cli->tlshn);
 		else
 			err  = tls_set_verify_server(conn->sc, req->host);
 
@@ -635,7 +908,7 @@ static int conn_connect(struct http_req *req)
 	}
 #endif
 
-	tmr_start(&conn->tmr, req->cli->conf.conn_timeout, timeout_handler,
+	tmr_start(&conn->tmr, cli->conf.conn_timeout, timeout_handler,
 		  conn);
 
 	if (!err) {
@@ -648,6 +921,13 @@ out:
 		mem_deref(conn);
 
 	return err;
+
+ queue:
+	req->pool = pool;
+	list_append(&pool->waitq, &req->le_q, req);
+	++cli->stats.waited;
+
+	return 0;
 }
 
 
@@ -661,7 +941,7 @@ static int req_connect(struct http_req *req)
 
 		req->mb = mem_deref(req->mb);
 
-		err = conn_connect(req);
+		err = conn_connect(req, true);
 		if (!err)
 			break;
 	}
@@ -818,6 +1098,8 @@ int http_request(struct http_req **reqp, struct http_cli *cli, const char *met,
 	req->datah  = datah;
 	req->bodyh  = bodyh;
 	req->arg    = arg;
+	req->pipe   = !bodyh && (!str_casecmp(met, "GET") ||
+				 !str_casecmp(met, "HEAD"));
 
 	err = pl_strdup(&req->host, &http_uri.host);
 	if (err)
@@ -922,6 +1204,7 @@ void http_req_set_conn_handler(struct http_req *req, http_conn_h *connh)
 		return;
 
 	req->connh = connh;
+	req->pipe  = false;
 }
 
 
@@ -961,6 +1244,10 @@ int http_client_alloc(struct http_cli **clip, struct dnsc *dnsc)
 	if (err)
 		goto out;
 
+	err = hash_alloc(&cli->ht_pool, POOL_BSIZE);
+	if (err)
+		goto out;
+
 #ifdef USE_TLS
 	err = tls_alloc(&cli->tls, TLS_METHOD_SSLV23, NULL, NULL);
 	if (err)
@@ -1276,3 +1563,66 @@ size_t http_client_get_bufsize_max(struct http_cli *cli)
 
 	return cli->bufsize_max;
 }
+
+
+/**
+ * Limit the connections of an HTTP Client per server address. Requests
+ * beyond the limit wait for a connection in order, or are pipelined on
+ * a busy connection. Only GET and HEAD requests without a body handler
+ * are pipelined. New connections resume TLS sessions if enabled with
+ * http_client_set_session_reuse().
+ *
+ * @param cli       HTTP Client
+ * @param max_conns Max. connections per server address, 0 is no limit
+ * @param pipeline  Max. requests in flight per connection, 0 or 1 to
+ *                  disable pipelining
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_client_set_pool(struct http_cli *cli, uint32_t max_conns,
+			 uint32_t pipeline)
+{
+	if (!cli)
+		return EINVAL;
+
+	cli->max_conns = max_conns;
+	cli->pipeline  = pipeline;
+
+	return 0;
+}
+
+
+static bool pool_stats_handler(struct le *le, void *arg)
+{
+	const struct http_pool *pool = le->data;
+	struct http_pool_stats *stats = arg;
+
+	stats->conns  += pool->nconn;
+	stats->queued += (uint32_t)list_count(&pool->waitq);
+
+	return false;
+}
+
+
+/**
+ * Get the connection pool statistics of an HTTP Client
+ *
+ * @param cli   HTTP Client
+ * @param stats Returned statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_client_pool_stats(const struct http_cli *cli,
+			   struct http_pool_stats *stats)
+{
+	if (!cli || !stats)
+		return EINVAL;
+
+	*stats = cli->stats;
+	stats->conns  = 0;
+	stats->queued = 0;
+
+	(void)hash_apply(cli->ht_pool, pool_stats_handler, stats);
+
+	return 0;
+}
@@ -5,6 +5,7 @@
  */
 
 #include <string.h>
+#include <stdio.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
@@ -16,6 +17,7 @@
 #include <re_tcp.h>
 #include <re_tls.h>
 #include <re_msg.h>
+#include <re_sys.h>
 #include <re_http.h>
 
 
@@ -23,6 +25,9 @@ enum {
 	TIMEOUT_IDLE = 600000,
 	TIMEOUT_INIT = 10000,
 	BUFSIZE_MAX  = 524288,
+	CHUNK_SIZE   = 16384,
+	CHUNK_HDR    = 12,      /* room for the chunk size line */
+	CHUNK_BURST  = 8,
 };
 
 struct http_sock {
@@ -34,15 +39,32 @@ struct http_sock {
 	void *arg;
 };
 
+/*
+ * Pipelined requests are handled one at a time. The next request is
+ * taken from the receive buffer once the final response to the current
+ * one has been sent, or queued in the case of a streamed body.
+ */
 struct http_conn {
 	struct le le;
 	struct tmr tmr;
+	struct tmr tmr_pipe;
 	struct sa peer;
 	struct http_sock *sock;
 	struct tcp_conn *tc;
 	struct tls_conn *sc;
 	struct mbuf *mb;
+	struct mbuf *mbs;        /* Streamed body chunk, reused        */
+	http_bodyh *bodyh;
+	void *body_arg;
+	void *body_ref;          /* Owned body state, e.g. open file   */
 	struct tmr verify_cert_tmr;
+	bool busy;               /* Final response not sent yet        */
+	bool close;              /* Close once the response is sent    */
+	bool head;               /* HEAD request, no body is sent      */
+	bool v11;                /* HTTP/1.1 request, chunked allowed  */
+	bool chunked;
+	bool crlf;               /* Previous chunk is not terminated   */
+	bool cert_ok;            /* Client certificate verified        */
 };
 
 
@@ -75,9 +97,12 @@ static void conn_destructor(void *arg)
 
 	list_unlink(&conn->le);
 	tmr_cancel(&conn->tmr);
+	tmr_cancel(&conn->tmr_pipe);
 	mem_deref(conn->sc);
 	mem_deref(conn->tc);
 	mem_deref(conn->mb);
+	mem_deref(conn->mbs);
+	mem_deref(conn->body_ref);
 }
 
 
@@ -85,6 +110,9 @@ static void conn_close(struct http_conn *conn)
 {
 	list_unlink(&conn->le);
 	tmr_cancel(&conn->tmr);
+	tmr_cancel(&conn->tmr_pipe);
+	conn->bodyh    = NULL;
+	conn->body_ref = mem_deref(conn->body_ref);
 	conn->sc = mem_deref(conn->sc);
 	conn->tc = mem_deref(conn->tc);
 	conn->sock = NULL;
@@ -136,6 +164,7 @@ static int http_verify_handler(int ok, void *arg)
 
 	if (ok) {
 		d->err = 0;
+		d->conn->cert_ok = true;
 	}
 	else {
 		d->err = EACCES;
@@ -163,6 +192,10 @@ static enum re_https_verify_msg verify_msg(struct http_conn *conn,
 
 	res = conn->sock->verifyh(conn, msg, conn->sock->arg);
 
+	/* a kept-alive connection asks for the certificate only once */
+	if (res == HTTPS_MSG_REQUEST_CERT && conn->cert_ok)
+		res = HTTPS_MSG_OK;
+
 	if (res == HTTPS_MSG_REQUEST_CERT) {
 
 		d = mem_zalloc(sizeof(*conn), verify_msg_destructor);
@@ -203,45 +236,67 @@ out:
 }
 
 
-static void recv_handler(struct mbuf *mb, void *arg)
+static void close_send_handler(void *arg)
 {
 	struct http_conn *conn = arg;
-	int err = 0;
 
-	if (conn->mb) {
-
-		const size_t len = mbuf_get_left(mb), pos = conn->mb->pos;
+	conn_close(conn);
+	mem_deref(conn);
+}
 
-		if ((mbuf_get_left(conn->mb) + len) > BUFSIZE_MAX) {
-			err = EOVERFLOW;
-			goto out;
-		}
 
-		conn->mb->pos = conn->mb->end;
+static void pipe_handler(void *arg);
 
-		err = mbuf_write_mem(conn->mb, mbuf_buf(mb), len);
-		if (err)
-			goto out;
 
-		conn->mb->pos = pos;
-	}
-	else {
-		conn->mb = mem_ref(mb);
+/* The final response to the current request has been sent or queued */
+static void reply_done(struct http_conn *conn)
+{
+	if (conn->close) {
+		/* close once the send queue has drained */
+		if (tcp_set_send(conn->tc, close_send_handler))
+			http_conn_close(conn);
+		return;
 	}
 
-	while (conn->mb) {
+	conn->busy = false;
+
+	if (mbuf_get_left(conn->mb))
+		tmr_start(&conn->tmr_pipe, 0, pipe_handler, conn);
+}
+
+
+static void req_start(struct http_conn *conn, const struct http_msg *msg)
+{
+	conn->v11  = !pl_strcmp(&msg->ver, "1.1");
+	conn->head = !pl_strcmp(&msg->met, "HEAD");
+
+	if (conn->v11)
+		conn->close = http_msg_hdr_has_value(msg, HTTP_HDR_CONNECTION,
+						     "close");
+	else
+		conn->close = !http_msg_hdr_has_value(msg, HTTP_HDR_CONNECTION,
+						      "keep-alive");
+}
+
+
+static int conn_process(struct http_conn *conn)
+{
+	int err = 0;
+
+	while (conn->mb && !conn->busy) {
 		size_t end, pos = conn->mb->pos;
+		enum re_https_verify_msg res;
 		struct http_msg *msg;
+		struct mbuf *mb;
 
 		err = http_msg_decode(&msg, conn->mb, true);
 		if (err) {
 			if (err == ENODATA) {
 				conn->mb->pos = pos;
 				err = 0;
-				break;
 			}
 
-			goto out;
+			break;
 		}
 
 		if (mbuf_get_left(conn->mb) < msg->clen) {
@@ -263,7 +318,7 @@ static void recv_handler(struct mbuf *mb, void *arg)
 			if (!mbn) {
 				mem_deref(msg);
 				err = ENOMEM;
-				goto out;
+				break;
 			}
 
 			(void)mbuf_write_mem(mbn, mb->buf + mb->end,
@@ -277,19 +332,71 @@ static void recv_handler(struct mbuf *mb, void *arg)
 			conn->mb = mem_deref(conn->mb);
 		}
 
-		if (verify_msg(conn, msg) == HTTPS_MSG_OK) {
+		req_start(conn, msg);
+
+		res = verify_msg(conn, msg);
+		if (res == HTTPS_MSG_OK) {
+			conn->busy = true;
 			conn->sock->reqh(conn, msg, conn->sock->arg);
 			mem_deref(msg);
 		}
+		else if (res == HTTPS_MSG_REQUEST_CERT) {
+			conn->busy = true;
+		}
 
 		if (!conn->tc) {
 			err = ENOTCONN;
-			goto out;
+			break;
 		}
 
 		tmr_start(&conn->tmr, TIMEOUT_IDLE, timeout_handler, conn);
 	}
 
+	return err;
+}
+
+
+static void pipe_handler(void *arg)
+{
+	struct http_conn *conn = arg;
+	int err;
+
+	err = conn_process(conn);
+	if (err) {
+		conn_close(conn);
+		mem_deref(conn);
+	}
+}
+
+
+static void recv_handler(struct mbuf *mb, void *arg)
+{
+	struct http_conn *conn = arg;
+	int err = 0;
+
+	if (conn->mb) {
+
+		const size_t len = mbuf_get_left(mb), pos = conn->mb->pos;
+
+		if ((mbuf_get_left(conn->mb) + len) > BUFSIZE_MAX) {
+			err = EOVERFLOW;
+			goto out;
+		}
+
+		conn->mb->pos = conn->mb->end;
+
+		err = mbuf_write_mem(conn->mb, mbuf_buf(mb), len);
+		if (err)
+			goto out;
+
+		conn->mb->pos = pos;
+	}
+	else {
+		conn->mb = mem_ref(mb);
+	}
+
+	err = conn_process(conn);
+
  out:
 	if (err) {
 		conn_close(conn);
@@ -599,6 +706,9 @@ static int http_vreply(struct http_conn *conn, uint16_t scode,
 	if (!conn->tc)
 		return ENOTCONN;
 
+	if (conn->bodyh)
+		return EBUSY;
+
 	mb = mbuf_alloc(8192);
 	if (!mb)
 		return ENOMEM;
@@ -617,6 +727,10 @@ static int http_vreply(struct http_conn *conn, uint16_t scode,
 	if (err)
 		goto out;
 
+	/* after 101 the connection is no longer HTTP */
+	if (scode >= 200)
+		reply_done(conn);
+
  out:
 	mem_deref(mb);
 
@@ -717,3 +831,265 @@ int http_ereply(struct http_conn *conn, uint16_t scode, const char *reason)
 			   scode, reason,
 			   scode, reason);
 }
+
+
+static int body_end(struct http_conn *conn)
+{
+	int err = 0;
+
+	if (conn->chunked && !conn->head) {
+		struct mbuf *mb = conn->mbs;
+
+		mbuf_rewind(mb);
+		err = mbuf_printf(mb, "%s0\r\n\r\n", conn->crlf ? "\r\n" : "");
+		mb->pos = 0;
+		if (!err)
+			err = tcp_send(conn->tc, mb);
+	}
+
+	conn->bodyh    = NULL;
+	conn->body_arg = NULL;
+	conn->body_ref = mem_deref(conn->body_ref);
+
+	(void)tcp_set_send(conn->tc, NULL);
+
+	if (!err)
+		reply_done(conn);
+
+	return err;
+}
+
+
+/* Send the next chunks while the send queue is empty */
+static int body_send(struct http_conn *conn)
+{
+	struct mbuf *mb = conn->mbs;
+	int err = 0;
+
+	if (conn->head)
+		return body_end(conn);
+
+	for (int i=0; i<CHUNK_BURST && !tcp_sendq_used(conn->tc); i++) {
+
+		size_t len;
+
+		mb->pos = CHUNK_HDR;
+		mb->end = CHUNK_HDR;
+
+		if (!conn->bodyh(mb, conn->body_arg) || !conn->tc)
+			return conn->tc ? body_end(conn) : ENOTCONN;
+
+		len = mb->end - CHUNK_HDR;
+		if (!len)
+			continue;
+
+		mb->pos = CHUNK_HDR;
+
+		if (conn->chunked) {
+			char hdr[CHUNK_HDR + 1];
+			int n;
+
+			/* the size line also ends the previous chunk */
+			n = re_snprintf(hdr, sizeof(hdr), "%s%zx\r\n",
+					conn->crlf ? "\r\n" : "", len);
+			if (n < 0)
+				return ERANGE;
+
+			mb->pos -= n;
+			memcpy(mb->buf + mb->pos, hdr, n);
+			conn->crlf = true;
+		}
+
+		err = tcp_send(conn->tc, mb);
+		if (err)
+			break;
+	}
+
+	tmr_start(&conn->tmr, TIMEOUT_IDLE, timeout_handler, conn);
+
+	return err;
+}
+
+
+static void body_send_handler(void *arg)
+{
+	struct http_conn *conn = arg;
+	int err;
+
+	err = body_send(conn);
+	if (err) {
+		conn_close(conn);
+		mem_deref(conn);
+	}
+}
+
+
+static int http_vsreply(struct http_conn *conn, uint16_t scode,
+			const char *reason, int64_t clen, http_bodyh *bodyh,
+			void *arg, const char *fmt, va_list ap)
+{
+	struct mbuf *mb;
+	int err;
+
+	if (!conn || !scode || !reason || !bodyh)
+		return EINVAL;
+
+	if (!conn->tc)
+		return ENOTCONN;
+
+	if (conn->bodyh)
+		return EBUSY;
+
+	mb = mbuf_alloc(CHUNK_HDR + CHUNK_SIZE);
+	if (!mb)
+		return ENOMEM;
+
+	/* without chunked encoding the end of the body is the close */
+	conn->chunked = clen < 0 && conn->v11;
+	conn->crlf    = false;
+	if (clen < 0 && !conn->v11)
+		conn->close = true;
+
+	err = mbuf_printf(mb, "HTTP/1.1 %u %s\r\n", scode, reason);
+	if (fmt)
+		err |= mbuf_vprintf(mb, fmt, ap);
+	if (clen >= 0)
+		err |= mbuf_printf(mb, "Content-Length: %lli\r\n", clen);
+	else if (conn->chunked)
+		err |= mbuf_write_str(mb, "Transfer-Encoding: chunked\r\n");
+	err |= mbuf_write_str(mb, "\r\n");
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+
+	err = tcp_send(conn->tc, mb);
+	if (err)
+		goto out;
+
+	mem_deref(conn->mbs);
+	conn->mbs      = mem_ref(mb);
+	conn->bodyh    = bodyh;
+	conn->body_arg = arg;
+
+	err = tcp_set_send(conn->tc, body_send_handler);
+	if (err)
+		conn->bodyh = NULL;
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/**
+ * Send an HTTP response with a streamed body. The header is sent
+ * first, then the body handler is called each time the connection can
+ * take more data, until it returns 0. The body is never buffered as a
+ * whole.
+ *
+ * The body handler appends at most mbuf_get_space() bytes to the
+ * buffer. Without a content length the body is sent with chunked
+ * transfer encoding, or followed by a close for HTTP/1.0 clients.
+ *
+ * @param conn   HTTP connection
+ * @param scode  Response status code
+ * @param reason Response reason phrase
+ * @param clen   Content length, or -1 if not known
+ * @param bodyh  Body handler
+ * @param arg    Handler argument
+ * @param fmt    Formatted HTTP headers, without the empty line
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_sreply(struct http_conn *conn, uint16_t scode, const char *reason,
+		int64_t clen, http_bodyh *bodyh, void *arg,
+		const char *fmt, ...)
+{
+	va_list ap;
+	int err;
+
+	va_start(ap, fmt);
+	err = http_vsreply(conn, scode, reason, clen, bodyh, arg, fmt, ap);
+	va_end(ap);
+
+	return err;
+}
+
+
+static void file_destructor(void *arg)
+{
+	FILE **fp = arg;
+
+	if (*fp)
+		(void)fclose(*fp);
+}
+
+
+static size_t file_body_handler(struct mbuf *mb, void *arg)
+{
+	FILE **fp = arg;
+	size_t n;
+
+	n = fread(mbuf_buf(mb), 1, mbuf_get_space(mb), *fp);
+
+	mb->pos += n;
+	mb->end  = mb->pos;
+
+	return n;
+}
+
+
+/**
+ * Send an HTTP response with the content of a file, read while
+ * sending
+ *
+ * @param conn   HTTP connection
+ * @param scode  Response status code
+ * @param reason Response reason phrase
+ * @param ctype  Content type
+ * @param path   File path
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_freply(struct http_conn *conn, uint16_t scode, const char *reason,
+		const char *ctype, const char *path)
+{
+	FILE **fp;
+	long size;
+	int err;
+
+	if (!conn || !ctype || !path)
+		return EINVAL;
+
+	if (conn->bodyh)
+		return EBUSY;
+
+	fp = mem_zalloc(sizeof(*fp), file_destructor);
+	if (!fp)
+		return ENOMEM;
+
+	err = fs_fopen(fp, path, "rb");
+	if (err)
+		goto out;
+
+	if (fseek(*fp, 0, SEEK_END) || (size = ftell(*fp)) < 0 ||
+	    fseek(*fp, 0, SEEK_SET)) {
+		err = errno;
+		goto out;
+	}
+
+	err = http_sreply(conn, scode, reason, size, file_body_handler, fp,
+			  "Content-Type: %s\r\n", ctype);
+	if (err)
+		goto out;
+
+	conn->body_ref = fp;
+	fp = NULL;
+
+ out:
+	mem_deref(fp);
+
+	return err;
+}
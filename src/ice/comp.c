@@ -138,6 +138,8 @@ int icem_comp_alloc(struct icem_comp **cp, struct icem *icem, int id,
 	if (err)
 		goto out;
 
+	udp_helper_set_classes(comp->uh, UDP_PKT_STUN);
+
 	err = udp_local_get(comp->sock, &local);
 	if (err)
 		goto out;
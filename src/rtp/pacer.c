@@ -0,0 +1,455 @@
+/**
+ * @file pacer.c  RTP send-side packet pacer
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_sys.h>
+#include <re_sa.h>
+#include <re_tmr.h>
+#include <re_thread.h>
+#include <re_rtp.h>
+#include "rtcp.h"
+
+
+#define DEBUG_MODULE "pacer"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	PACER_QSIZE     =  512,  /**< Queue size per priority (power of 2) */
+	PACER_INTERVAL  =    5,  /**< Drain interval in [ms]               */
+	PACER_BURST     =    5,  /**< Max. burst in [ms] at target bitrate */
+	PACER_MAX_DELAY =  250,  /**< Max. queue delay in [ms]             */
+	PACER_BATCH     =   64,  /**< Max. packets sent per batch          */
+	PACER_PRESZ     =   64,  /**< Headroom for queued packets          */
+	PACER_MTU       = 1500,  /**< Min. burst in [bytes]                */
+};
+
+
+/** One queued packet */
+struct pacer_ent {
+	struct mbuf *mb;   /**< RTP packet              */
+	uint64_t ts;       /**< Enqueue time in [us]    */
+};
+
+/** Packet queue (ring) */
+struct pacer_queue {
+	struct pacer_ent *entv;
+	uint32_t head;
+	uint32_t count;
+};
+
+/** RTP send-side pacer */
+struct rtp_pacer {
+	struct rtp_sock *rs;                   /**< Parent RTP Socket      */
+	struct tmr tmr;                        /**< Drain timer            */
+	mtx_t *lock;                           /**< Protects the queues    */
+	struct pacer_queue qv[RTP_PRIO_MAX];   /**< Queues per priority    */
+	struct sa dst;                         /**< Destination            */
+	uint32_t bitrate;                      /**< Target bitrate [bit/s] */
+	int64_t budget;                        /**< Send budget [bytes]    */
+	uint64_t budget_ts;                    /**< Last refill in [us]    */
+	uint32_t prio_pt[4];                   /**< High priority PT bits  */
+	size_t bytes;                          /**< Queued bytes           */
+	struct rtp_pacer_stats stats;          /**< Statistics             */
+};
+
+
+static void destructor(void *data)
+{
+	struct rtp_pacer *pc = data;
+
+	tmr_cancel(&pc->tmr);
+
+	for (int p = 0; p < RTP_PRIO_MAX; p++) {
+
+		struct pacer_queue *q = &pc->qv[p];
+
+		for (uint32_t i = 0; q->entv && i < q->count; i++)
+			mem_deref(q->entv[(q->head + i) &
+					  (PACER_QSIZE - 1)].mb);
+
+		mem_deref(q->entv);
+	}
+
+	mem_deref(pc->lock);
+}
+
+
+static void refill(struct rtp_pacer *pc, uint64_t now)
+{
+	const int64_t cap = MAX((int64_t)pc->bitrate / 8 * PACER_BURST / 1000,
+				PACER_MTU);
+
+	const uint64_t add = (now - pc->budget_ts) * pc->bitrate / 8000000;
+
+	pc->budget += (int64_t)add;
+
+	/* keep the time not yet worth a whole byte */
+	if (pc->budget < cap) {
+		pc->budget_ts += add * 8000000 / pc->bitrate;
+	}
+	else {
+		pc->budget    = cap;
+		pc->budget_ts = now;
+	}
+}
+
+
+static void push(struct pacer_queue *q, struct mbuf *mb, uint64_t now)
+{
+	struct pacer_ent *ent = &q->entv[(q->head + q->count) &
+					 (PACER_QSIZE - 1)];
+
+	ent->mb = mb;
+	ent->ts = now;
+	++q->count;
+}
+
+
+static struct mbuf *pop(struct rtp_pacer *pc, struct pacer_queue *q,
+			uint64_t now)
+{
+	struct pacer_ent *ent = &q->entv[q->head];
+	struct mbuf *mb = ent->mb;
+	uint64_t delay = now - ent->ts;
+
+	ent->mb = NULL;
+	q->head = (q->head + 1) & (PACER_QSIZE - 1);
+	--q->count;
+
+	pc->bytes  -= mbuf_get_left(mb);
+	pc->budget -= (int64_t)mbuf_get_left(mb);
+
+	/* EWMA with a gain of 1/16 */
+	pc->stats.delay_avg = (pc->stats.delay_avg * 15 + delay) / 16;
+	pc->stats.delay_max = MAX(pc->stats.delay_max, delay);
+	++pc->stats.sent;
+
+	return mb;
+}
+
+
+static struct pacer_queue *first_queue(struct rtp_pacer *pc)
+{
+	for (int p = 0; p < RTP_PRIO_MAX; p++) {
+		if (pc->qv[p].count)
+			return &pc->qv[p];
+	}
+
+	return NULL;
+}
+
+
+static struct pacer_queue *next_queue(struct rtp_pacer *pc, uint64_t now)
+{
+	for (int p = 0; p < RTP_PRIO_MAX; p++) {
+
+		struct pacer_queue *q = &pc->qv[p];
+
+		if (!q->count)
+			continue;
+
+		/* over budget, unless the queue delay limit is reached */
+		if (pc->budget <= 0 &&
+		    now - q->entv[q->head].ts < PACER_MAX_DELAY * 1000)
+			continue;
+
+		return q;
+	}
+
+	return NULL;
+}
+
+
+static void send_batch(struct rtp_pacer *pc, struct mbuf **mbv, size_t n,
+		       const struct sa *dst)
+{
+	for (size_t i = 0; i < n; i++) {
+		(void)rtp_sock_send(pc->rs, dst, mbv[i]);
+		mem_deref(mbv[i]);
+	}
+}
+
+
+static void drain(struct rtp_pacer *pc, bool all)
+{
+	struct mbuf *mbv[PACER_BATCH];
+	struct sa dst;
+	bool more;
+
+	do {
+		uint64_t now = tmr_jiffies_usec();
+		struct pacer_queue *q;
+		size_t n = 0;
+
+		mtx_lock(pc->lock);
+
+		refill(pc, now);
+
+		while (n < PACER_BATCH) {
+
+			q = all ? first_queue(pc) : next_queue(pc, now);
+
+			if (!q)
+				break;
+
+			mbv[n++] = pop(pc, q, now);
+		}
+
+		more = (n == PACER_BATCH);
+		dst  = pc->dst;
+
+		mtx_unlock(pc->lock);
+
+		send_batch(pc, mbv, n, &dst);
+
+	} while (more);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct rtp_pacer *pc = arg;
+
+	tmr_start(&pc->tmr, PACER_INTERVAL, tmr_handler, pc);
+
+	drain(pc, false);
+}
+
+
+int pacer_alloc(struct rtp_pacer **pcp, struct rtp_sock *rs,
+		uint32_t bitrate)
+{
+	struct rtp_pacer *pc;
+	int err = 0;
+
+	if (!pcp || !rs || !bitrate)
+		return EINVAL;
+
+	pc = mem_zalloc(sizeof(*pc), destructor);
+	if (!pc)
+		return ENOMEM;
+
+	pc->rs        = rs;
+	pc->bitrate   = bitrate;
+	pc->budget_ts = tmr_jiffies_usec();
+	sa_init(&pc->dst, AF_UNSPEC);
+	tmr_init(&pc->tmr);
+
+	for (int p = 0; p < RTP_PRIO_MAX; p++) {
+		pc->qv[p].entv = mem_zalloc(PACER_QSIZE *
+					    sizeof(*pc->qv[p].entv), NULL);
+		if (!pc->qv[p].entv) {
+			err = ENOMEM;
+			goto out;
+		}
+	}
+
+	err = mutex_alloc(&pc->lock);
+	if (err)
+		goto out;
+
+	tmr_start(&pc->tmr, PACER_INTERVAL, tmr_handler, pc);
+
+ out:
+	if (err)
+		mem_deref(pc);
+	else
+		*pcp = pc;
+
+	return err;
+}
+
+
+void pacer_set_bitrate(struct rtp_pacer *pc, uint32_t bitrate)
+{
+	if (!pc || !bitrate)
+		return;
+
+	mtx_lock(pc->lock);
+	refill(pc, tmr_jiffies_usec());
+	pc->bitrate = bitrate;
+	mtx_unlock(pc->lock);
+}
+
+
+void pacer_set_prio(struct rtp_pacer *pc, uint8_t pt, bool prio)
+{
+	if (!pc || pt & ~0x7f)
+		return;
+
+	mtx_lock(pc->lock);
+
+	if (prio)
+		pc->prio_pt[pt / 32] |=  (1u << (pt % 32));
+	else
+		pc->prio_pt[pt / 32] &= ~(1u << (pt % 32));
+
+	mtx_unlock(pc->lock);
+}
+
+
+/**
+ * Get the priority of an RTP packet
+ *
+ * @param pc  Pacer
+ * @param mb  RTP packet, positioned at the start of the RTP header
+ *
+ * @return Packet priority
+ */
+enum rtp_prio pacer_prio(const struct rtp_pacer *pc, const struct mbuf *mb)
+{
+	uint8_t pt;
+
+	if (!pc || mbuf_get_left(mb) < 2)
+		return RTP_PRIO_NORMAL;
+
+	pt = mbuf_buf(mb)[1] & 0x7f;
+
+	return (pc->prio_pt[pt / 32] & (1u << (pt % 32))) ? RTP_PRIO_HIGH
+							  : RTP_PRIO_NORMAL;
+}
+
+
+/**
+ * Queue an RTP packet for paced sending, or send it immediately if there
+ * is enough budget and nothing else is queued
+ *
+ * @param pc   Pacer
+ * @param prio Packet priority
+ * @param dst  Destination address
+ * @param mb   RTP packet
+ * @param copy True to queue a copy, false to queue a reference
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int pacer_send(struct rtp_pacer *pc, enum rtp_prio prio,
+	       const struct sa *dst, struct mbuf *mb, bool copy)
+{
+	struct pacer_queue *q;
+	bool direct = true;
+	bool flush;
+	uint64_t now;
+
+	if (!pc || !dst || !mb || prio >= RTP_PRIO_MAX)
+		return EINVAL;
+
+	q = &pc->qv[prio];
+
+	mtx_lock(pc->lock);
+	flush = pc->bytes > 0 && !sa_cmp(&pc->dst, dst, SA_ALL);
+	mtx_unlock(pc->lock);
+
+	/* destination changed, send the old packets to the old one first */
+	if (flush)
+		drain(pc, true);
+
+	now = tmr_jiffies_usec();
+
+	mtx_lock(pc->lock);
+
+	refill(pc, now);
+	sa_cpy(&pc->dst, dst);
+
+	/* keep the order within a priority */
+	for (int p = 0; p <= (int)prio; p++) {
+		if (pc->qv[p].count)
+			direct = false;
+	}
+
+	if (direct && pc->budget > 0) {
+		pc->budget -= (int64_t)mbuf_get_left(mb);
+		++pc->stats.sent;
+		mtx_unlock(pc->lock);
+
+		return rtp_sock_send(pc->rs, dst, mb);
+	}
+
+	if (q->count >= PACER_QSIZE) {
+		/* queue full, send the oldest packet right away */
+		struct mbuf *old = pop(pc, q, now);
+
+		++pc->stats.overflow;
+		mtx_unlock(pc->lock);
+
+		(void)rtp_sock_send(pc->rs, dst, old);
+		mem_deref(old);
+
+		mtx_lock(pc->lock);
+	}
+
+	if (copy) {
+		struct mbuf *cp = mbuf_alloc(PACER_PRESZ + mbuf_get_left(mb));
+		if (!cp) {
+			mtx_unlock(pc->lock);
+			return ENOMEM;
+		}
+
+		cp->pos = cp->end = PACER_PRESZ;
+		(void)mbuf_write_mem(cp, mbuf_buf(mb), mbuf_get_left(mb));
+		cp->pos = PACER_PRESZ;
+		mb = cp;
+	}
+	else {
+		mem_ref(mb);
+	}
+
+	push(q, mb, now);
+	pc->bytes += mbuf_get_left(mb);
+
+	mtx_unlock(pc->lock);
+
+	return 0;
+}
+
+
+void pacer_get_stats(struct rtp_pacer *pc, struct rtp_pacer_stats *stats)
+{
+	uint64_t now = tmr_jiffies_usec();
+
+	mtx_lock(pc->lock);
+
+	*stats = pc->stats;
+	stats->queued = 0;
+	stats->bytes  = pc->bytes;
+	stats->delay  = 0;
+
+	for (int p = 0; p < RTP_PRIO_MAX; p++) {
+
+		const struct pacer_queue *q = &pc->qv[p];
+
+		if (!q->count)
+			continue;
+
+		stats->queued += q->count;
+		stats->delay = MAX(stats->delay, now - q->entv[q->head].ts);
+	}
+
+	mtx_unlock(pc->lock);
+}
+
+
+int pacer_debug(struct re_printf *pf, struct rtp_pacer *pc)
+{
+	struct rtp_pacer_stats stats;
+
+	if (!pc)
+		return 0;
+
+	pacer_get_stats(pc, &stats);
+
+	return re_hprintf(pf, " Pacer: bitrate=%u queued=%u bytes=%zu"
+			  " sent=%u overflow=%u delay=%llu/%llu/%lluus"
+			  " (cur/avg/max)\n",
+			  pc->bitrate, stats.queued, stats.bytes, stats.sent,
+			  stats.overflow, stats.delay, stats.delay_avg,
+			  stats.delay_max);
+}
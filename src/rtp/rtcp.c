@@ -89,6 +89,35 @@ int rtcp_send_nack(struct rtp_sock *rs, uint16_t fsn, uint16_t blp)
 }
 
 
+static int encode_gnack_fci(struct mbuf *mb, void *arg)
+{
+	const struct gnack *fci = arg;
+
+	return rtcp_rtpfb_gnack_encode(mb, fci->pid, fci->blp);
+}
+
+
+/**
+ * Send an RTCP Generic NACK (RFC 4585) packet
+ *
+ * @param rs   RTP Socket
+ * @param ssrc SSRC of the media source
+ * @param pid  Packet ID of the first lost packet
+ * @param blp  Bitmask of following lost packets
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtcp_send_gnack(struct rtp_sock *rs, uint32_t ssrc, uint16_t pid,
+		    uint16_t blp)
+{
+	struct gnack fci = { pid, blp };
+
+	return rtcp_quick_send(rs, RTCP_RTPFB, RTCP_RTPFB_GNACK,
+			       rtp_sess_ssrc(rs), ssrc,
+			       &encode_gnack_fci, &fci);
+}
+
+
 /**
  * Send an RTCP Picture Loss Indication (PLI) packet
  *
@@ -97,6 +97,56 @@ uint64_t ntp_compact2us(uint32_t ntpc);
 
 /* RTP Socket */
 struct rtcp_sess *rtp_rtcp_sess(const struct rtp_sock *rs);
+struct rtp_twcc *rtp_sock_twcc(const struct rtp_sock *rs);
+int rtp_sock_send(struct rtp_sock *rs, const struct sa *dst, struct mbuf *mb);
+
+/** Packet priorities for the pacer, in decreasing order */
+enum rtp_prio {
+	RTP_PRIO_HIGH = 0,  /**< Prioritized payload types, e.g. audio */
+	RTP_PRIO_RTX,       /**< Retransmissions                       */
+	RTP_PRIO_NORMAL,    /**< Everything else                       */
+	RTP_PRIO_MAX
+};
+
+int rtp_sock_queue(struct rtp_sock *rs, enum rtp_prio prio,
+		   const struct sa *dst, struct mbuf *mb);
+
+/* Transport-wide Congestion Control */
+struct rtp_twcc;
+
+int  twcc_alloc(struct rtp_twcc **twp, struct rtp_sock *rs, uint8_t extid,
+		uint32_t interval);
+void twcc_rx_record(struct rtp_twcc *tw, uint16_t seq, uint32_t ssrc,
+		    uint64_t now);
+void twcc_rx_rtp(struct rtp_twcc *tw, const struct rtp_header *hdr,
+		 const struct mbuf *mb);
+void twcc_tx_rtp(struct rtp_twcc *tw, const struct mbuf *mb);
+int  twcc_debug(struct re_printf *pf, const struct rtp_twcc *tw);
+
+/* Retransmission history */
+struct rtp_hist;
+
+int  hist_alloc(struct rtp_hist **histp, struct rtp_sock *rs,
+		const struct rtp_hist_conf *conf);
+void hist_store(struct rtp_hist *hist, const struct sa *dst,
+		const struct mbuf *mb);
+int  hist_resend(struct rtp_hist *hist, uint16_t seq);
+void hist_handle_rtcp(struct rtp_hist *hist, const struct rtcp_msg *msg);
+void hist_get_stats(struct rtp_hist *hist, struct rtp_hist_stats *stats);
+int  hist_debug(struct re_printf *pf, struct rtp_hist *hist);
+
+/* Pacer */
+struct rtp_pacer;
+
+int  pacer_alloc(struct rtp_pacer **pcp, struct rtp_sock *rs,
+		 uint32_t bitrate);
+void pacer_set_bitrate(struct rtp_pacer *pc, uint32_t bitrate);
+void pacer_set_prio(struct rtp_pacer *pc, uint8_t pt, bool prio);
+enum rtp_prio pacer_prio(const struct rtp_pacer *pc, const struct mbuf *mb);
+int  pacer_send(struct rtp_pacer *pc, enum rtp_prio prio,
+		const struct sa *dst, struct mbuf *mb, bool copy);
+void pacer_get_stats(struct rtp_pacer *pc, struct rtp_pacer_stats *stats);
+int  pacer_debug(struct re_printf *pf, struct rtp_pacer *pc);
 
 /* RTCP message */
 typedef int (rtcp_encode_h)(struct mbuf *mb, void *arg);
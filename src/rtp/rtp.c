@@ -38,6 +38,9 @@ struct rtp_sock {
 	rtcp_recv_h *rtcph;     /**< RTCP Receive handler  */
 	void *arg;              /**< Handler argument      */
 	struct rtcp_sess *rtcp; /**< RTCP Session          */
+	struct rtp_twcc *twcc;  /**< Transport-wide CC     */
+	struct rtp_hist *hist;  /**< Retransmission history*/
+	struct rtp_pacer *pacer;/**< Send-side pacer       */
 	bool rtcp_mux;          /**< RTP/RTCP multiplexing */
 };
 
@@ -155,6 +158,9 @@ static void destructor(void *data)
 
 	/* Destroy RTCP Session now */
 	mem_deref(rs->rtcp);
+	mem_deref(rs->twcc);
+	mem_deref(rs->hist);
+	mem_deref(rs->pacer);
 
 	mem_deref(rs->sock_rtp);
 	mem_deref(rs->sock_rtcp);
@@ -171,6 +177,9 @@ static void rtcp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 		/* handle internally first */
 		rtcp_handler(rs->rtcp, msg);
 
+		if (rs->hist)
+			hist_handle_rtcp(rs->hist, msg);
+
 		/* then relay to application */
 		if (rs->rtcph)
 			rs->rtcph(src, msg, rs->arg);
@@ -210,6 +219,9 @@ static void udp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 				 hdr.ssrc, mbuf_get_left(mb), src);
 	}
 
+	if (rs->twcc)
+		twcc_rx_rtp(rs->twcc, &hdr, mb);
+
 	if (rs->recvh)
 		rs->recvh(src, &hdr, mb, rs->arg);
 }
@@ -526,7 +538,16 @@ int rtp_send(struct rtp_sock *rs, const struct sa *dst, bool ext,
 
 	mb->pos = pos;
 
-	return udp_send(rs->sock_rtp, dst, mb);
+	if (rs->hist)
+		hist_store(rs->hist, dst, mb);
+
+	if (rs->pacer) {
+		enum rtp_prio prio = pacer_prio(rs->pacer, mb);
+
+		return pacer_send(rs->pacer, prio, dst, mb, true);
+	}
+
+	return rtp_sock_send(rs, dst, mb);
 }
 
 
@@ -652,6 +673,224 @@ struct rtcp_sess *rtp_rtcp_sess(const struct rtp_sock *rs)
 }
 
 
+/**
+ * Get the Transport-wide Congestion Control state for an RTP/RTCP Socket
+ *
+ * @param rs RTP Socket
+ *
+ * @return TWCC state, NULL if not enabled
+ */
+struct rtp_twcc *rtp_sock_twcc(const struct rtp_sock *rs)
+{
+	return rs ? rs->twcc : NULL;
+}
+
+
+/**
+ * Enable Transport-wide Congestion Control (transport-cc-01)
+ *
+ * Incoming RTP packets carrying the transport-wide sequence number header
+ * extension are recorded, and outgoing packets are kept in a send history
+ * that is used to resolve incoming feedback.
+ *
+ * @param rs       RTP Socket
+ * @param extid    Negotiated header extension ID
+ * @param interval Feedback interval in [ms], 0 to send manually
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtp_twcc_enable(struct rtp_sock *rs, uint8_t extid, uint32_t interval)
+{
+	if (!rs || !extid)
+		return EINVAL;
+
+	rs->twcc = mem_deref(rs->twcc);
+
+	return twcc_alloc(&rs->twcc, rs, extid, interval);
+}
+
+
+/**
+ * Send a complete RTP packet on the RTP transport socket
+ *
+ * @param rs  RTP Socket
+ * @param dst Destination address
+ * @param mb  RTP packet
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtp_sock_send(struct rtp_sock *rs, const struct sa *dst, struct mbuf *mb)
+{
+	if (!rs)
+		return EINVAL;
+
+	if (rs->twcc)
+		twcc_tx_rtp(rs->twcc, mb);
+
+	return udp_send(rs->sock_rtp, dst, mb);
+}
+
+
+/**
+ * Send a complete RTP packet through the pacer, if enabled
+ *
+ * @param rs   RTP Socket
+ * @param prio Packet priority
+ * @param dst  Destination address
+ * @param mb   RTP packet, must not be modified by the caller afterwards
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtp_sock_queue(struct rtp_sock *rs, enum rtp_prio prio,
+		   const struct sa *dst, struct mbuf *mb)
+{
+	if (!rs)
+		return EINVAL;
+
+	if (rs->pacer)
+		return pacer_send(rs->pacer, prio, dst, mb, false);
+
+	return rtp_sock_send(rs, dst, mb);
+}
+
+
+/**
+ * Enable the send-side pacer
+ *
+ * Packets sent with rtp_send() are released at the target bitrate on a
+ * timer instead of being sent in bursts. Retransmissions and payload types
+ * set with rtp_pacer_set_prio() are sent before other packets.
+ *
+ * @param rs      RTP Socket
+ * @param bitrate Target bitrate in [bit/s], 0 to disable
+ *
+ * @return 0 for success, otherwise errorcode
+ *
+ * @note The pacer timer runs on the calling thread
+ */
+int rtp_pacer_enable(struct rtp_sock *rs, uint32_t bitrate)
+{
+	if (!rs)
+		return EINVAL;
+
+	rs->pacer = mem_deref(rs->pacer);
+
+	if (!bitrate)
+		return 0;
+
+	return pacer_alloc(&rs->pacer, rs, bitrate);
+}
+
+
+/**
+ * Set the target bitrate of the send-side pacer
+ *
+ * @param rs      RTP Socket
+ * @param bitrate Target bitrate in [bit/s]
+ */
+void rtp_pacer_set_bitrate(struct rtp_sock *rs, uint32_t bitrate)
+{
+	if (!rs)
+		return;
+
+	pacer_set_bitrate(rs->pacer, bitrate);
+}
+
+
+/**
+ * Set the pacer priority of a payload type
+ *
+ * @param rs   RTP Socket
+ * @param pt   Payload type
+ * @param prio True to send packets of this payload type first
+ */
+void rtp_pacer_set_prio(struct rtp_sock *rs, uint8_t pt, bool prio)
+{
+	if (!rs)
+		return;
+
+	pacer_set_prio(rs->pacer, pt, prio);
+}
+
+
+/**
+ * Get the statistics of the send-side pacer
+ *
+ * @param rs    RTP Socket
+ * @param stats Statistics, set on return
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtp_pacer_stats(const struct rtp_sock *rs, struct rtp_pacer_stats *stats)
+{
+	if (!rs || !rs->pacer || !stats)
+		return EINVAL;
+
+	pacer_get_stats(rs->pacer, stats);
+
+	return 0;
+}
+
+
+/**
+ * Enable the retransmission history
+ *
+ * A copy of every packet sent with rtp_send() is kept for a limited time,
+ * and incoming Generic NACKs for the local SSRC are serviced automatically,
+ * either as plain resend or RTX encapsulated (RFC 4588).
+ *
+ * @param rs   RTP Socket
+ * @param conf History configuration, NULL for defaults
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtp_hist_enable(struct rtp_sock *rs, const struct rtp_hist_conf *conf)
+{
+	if (!rs)
+		return EINVAL;
+
+	rs->hist = mem_deref(rs->hist);
+
+	return hist_alloc(&rs->hist, rs, conf);
+}
+
+
+/**
+ * Retransmit a packet from the retransmission history
+ *
+ * @param rs  RTP Socket
+ * @param seq Sequence number of the original packet
+ *
+ * @return 0 for success, ENOENT if not in history, otherwise errorcode
+ */
+int rtp_hist_resend(struct rtp_sock *rs, uint16_t seq)
+{
+	if (!rs || !rs->hist)
+		return EINVAL;
+
+	return hist_resend(rs->hist, seq);
+}
+
+
+/**
+ * Get the statistics of the retransmission history
+ *
+ * @param rs    RTP Socket
+ * @param stats Statistics, set on return
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtp_hist_stats(const struct rtp_sock *rs, struct rtp_hist_stats *stats)
+{
+	if (!rs || !rs->hist || !stats)
+		return EINVAL;
+
+	hist_get_stats(rs->hist, stats);
+
+	return 0;
+}
+
+
 /**
  * Start the RTCP Session
  *
@@ -746,6 +985,15 @@ int rtp_debug(struct re_printf *pf, const struct rtp_sock *rs)
 	err |= re_hprintf(pf, " Encode: seq=%u ssrc=0x%lx\n",
 			  rs->enc.seq, rs->enc.ssrc);
 
+	if (rs->twcc)
+		err |= twcc_debug(pf, rs->twcc);
+
+	if (rs->hist)
+		err |= hist_debug(pf, rs->hist);
+
+	if (rs->pacer)
+		err |= pacer_debug(pf, rs->pacer);
+
 	if (rs->rtcp)
 		err |= rtcp_debug(pf, rs);
 
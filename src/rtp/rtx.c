@@ -0,0 +1,422 @@
+/**
+ * @file rtx.c  RTP Retransmission history and RTX (RFC 4588)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_sys.h>
+#include <re_sa.h>
+#include <re_tmr.h>
+#include <re_thread.h>
+#include <re_udp.h>
+#include <re_rtp.h>
+#include "rtcp.h"
+
+
+#define DEBUG_MODULE "rtx"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	HIST_SIZE      = 1024,  /**< History ring size (power of two) */
+	HIST_PRESZ     =   64,  /**< Headroom for resent packets      */
+	HIST_MAX_AGE   = 1000,  /**< Default max. packet age [ms]     */
+	HIST_MAX_BYTES = 1024 * 1024,  /**< Default max. stored bytes */
+	HIST_INTERVAL  =   10,  /**< Default min. resend interval [ms]*/
+	RTX_OSN_SIZE   =    2,  /**< Original sequence number         */
+};
+
+
+/** One stored RTP packet */
+struct hist_ent {
+	struct mbuf *mb;       /**< Plain RTP packet, NULL if empty  */
+	uint64_t sent;         /**< Send time in [ms]                */
+	uint64_t resent;       /**< Last resend time in [ms]         */
+	uint16_t seq;          /**< RTP sequence number              */
+};
+
+/** RTP retransmission history */
+struct rtp_hist {
+	struct rtp_sock *rs;           /**< Parent RTP Socket           */
+	struct rtp_hist_conf conf;     /**< Configuration               */
+	struct hist_ent *entv;         /**< Packet ring indexed by seq  */
+	struct sa dst;                 /**< Destination of last packet  */
+	mtx_t *lock;                   /**< Protects the history        */
+	uint16_t first;                /**< Oldest stored seq.          */
+	uint16_t count;                /**< Number of stored packets    */
+	size_t bytes;                  /**< Number of stored bytes      */
+	uint16_t rtx_seq;              /**< RTX sequence number         */
+	uint64_t budget_ts;            /**< Last budget refill [ms]     */
+	uint64_t budget;               /**< Available budget [bytes]    */
+	struct rtp_hist_stats stats;   /**< Statistics                  */
+};
+
+
+static void ent_clear(struct rtp_hist *hist, struct hist_ent *ent)
+{
+	if (!ent->mb)
+		return;
+
+	hist->bytes -= ent->mb->end;
+	ent->mb = mem_deref(ent->mb);
+}
+
+
+static void hist_flush(struct rtp_hist *hist)
+{
+	while (hist->count) {
+		ent_clear(hist, &hist->entv[hist->first & (HIST_SIZE - 1)]);
+		++hist->first;
+		--hist->count;
+	}
+}
+
+
+static void destructor(void *data)
+{
+	struct rtp_hist *hist = data;
+
+	if (hist->entv) {
+		for (size_t i = 0; i < HIST_SIZE; i++)
+			ent_clear(hist, &hist->entv[i]);
+	}
+
+	mem_deref(hist->entv);
+	mem_deref(hist->lock);
+}
+
+
+int hist_alloc(struct rtp_hist **histp, struct rtp_sock *rs,
+	       const struct rtp_hist_conf *conf)
+{
+	struct rtp_hist *hist;
+	int err;
+
+	if (!histp || !rs)
+		return EINVAL;
+
+	hist = mem_zalloc(sizeof(*hist), destructor);
+	if (!hist)
+		return ENOMEM;
+
+	hist->rs = rs;
+
+	if (conf)
+		hist->conf = *conf;
+
+	if (!hist->conf.max_age)
+		hist->conf.max_age = HIST_MAX_AGE;
+	if (!hist->conf.max_bytes)
+		hist->conf.max_bytes = HIST_MAX_BYTES;
+	if (!hist->conf.min_interval)
+		hist->conf.min_interval = HIST_INTERVAL;
+
+	hist->rtx_seq = rand_u16() & 0x7fff;
+	sa_init(&hist->dst, AF_UNSPEC);
+
+	hist->entv = mem_zalloc(HIST_SIZE * sizeof(*hist->entv), NULL);
+	if (!hist->entv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mutex_alloc(&hist->lock);
+
+ out:
+	if (err)
+		mem_deref(hist);
+	else
+		*histp = hist;
+
+	return err;
+}
+
+
+static void expire(struct rtp_hist *hist, uint64_t now)
+{
+	while (hist->count) {
+
+		struct hist_ent *ent = &hist->entv[hist->first &
+						    (HIST_SIZE - 1)];
+
+		if (ent->mb && hist->bytes <= hist->conf.max_bytes &&
+		    now - ent->sent <= hist->conf.max_age)
+			break;
+
+		ent_clear(hist, ent);
+		++hist->first;
+		--hist->count;
+	}
+}
+
+
+/**
+ * Store a copy of an outgoing RTP packet
+ *
+ * @param hist Retransmission history
+ * @param dst  Destination address
+ * @param mb   RTP packet, positioned at the start of the RTP header
+ */
+void hist_store(struct rtp_hist *hist, const struct sa *dst,
+		const struct mbuf *mb)
+{
+	struct hist_ent *ent;
+	struct mbuf *cp;
+	size_t len = mbuf_get_left(mb);
+	uint64_t now = tmr_jiffies();
+	uint16_t seq;
+
+	if (!hist || len < RTP_HEADER_SIZE)
+		return;
+
+	seq = (uint16_t)(mbuf_buf(mb)[2] << 8 | mbuf_buf(mb)[3]);
+
+	cp = mbuf_alloc(len);
+	if (!cp)
+		return;
+
+	(void)mbuf_write_mem(cp, mbuf_buf(mb), len);
+
+	mtx_lock(hist->lock);
+
+	if (dst)
+		sa_cpy(&hist->dst, dst);
+
+	if (hist->count) {
+
+		/* history is contiguous, restart on a sequence jump */
+		if (seq != (uint16_t)(hist->first + hist->count)) {
+			hist_flush(hist);
+		}
+		else if (hist->count >= HIST_SIZE) {
+			ent_clear(hist, &hist->entv[hist->first &
+						    (HIST_SIZE - 1)]);
+			++hist->first;
+			--hist->count;
+		}
+	}
+
+	if (!hist->count)
+		hist->first = seq;
+
+	ent = &hist->entv[seq & (HIST_SIZE - 1)];
+	ent_clear(hist, ent);
+
+	ent->mb     = cp;
+	ent->seq    = seq;
+	ent->sent   = now;
+	ent->resent = 0;
+
+	hist->bytes += len;
+	++hist->count;
+	++hist->stats.stored;
+
+	expire(hist, now);
+
+	mtx_unlock(hist->lock);
+}
+
+
+static bool budget_take(struct rtp_hist *hist, uint64_t now, size_t len)
+{
+	const uint64_t rate = hist->conf.rtx_bitrate / 8;  /* bytes/s */
+	const uint64_t cap  = rate / 4 + 1500;            /* 250ms burst */
+
+	if (!rate)
+		return true;
+
+	if (!hist->budget_ts) {
+		hist->budget = cap;
+	}
+	else {
+		hist->budget += rate * (now - hist->budget_ts) / 1000;
+		if (hist->budget > cap)
+			hist->budget = cap;
+	}
+
+	hist->budget_ts = now;
+
+	if (hist->budget < len)
+		return false;
+
+	hist->budget -= len;
+
+	return true;
+}
+
+
+/*
+ * Build an RTX packet (RFC 4588): the original RTP header with RTX
+ * payload type, sequence number and SSRC, followed by the original
+ * sequence number and the original payload.
+ */
+static int rtx_encode(struct mbuf *mb, struct rtp_hist *hist,
+		      const struct mbuf *orig)
+{
+	const uint8_t *p = orig->buf;
+	size_t hlen = RTP_HEADER_SIZE + (p[0] & 0x0f) * sizeof(uint32_t);
+	int err;
+
+	if (p[0] & 0x10) {
+		if (orig->end < hlen + 4)
+			return EBADMSG;
+
+		hlen += 4 + (p[hlen+2] << 8 | p[hlen+3]) * sizeof(uint32_t);
+	}
+
+	if (orig->end < hlen)
+		return EBADMSG;
+
+	err  = mbuf_write_u8(mb, p[0]);
+	err |= mbuf_write_u8(mb, (p[1] & 0x80) | hist->conf.rtx_pt);
+	err |= mbuf_write_u16(mb, htons(hist->rtx_seq++));
+	err |= mbuf_write_mem(mb, p + 4, 4);
+	err |= mbuf_write_u32(mb, htonl(hist->conf.rtx_ssrc));
+	err |= mbuf_write_mem(mb, p + RTP_HEADER_SIZE, hlen - RTP_HEADER_SIZE);
+	err |= mbuf_write_mem(mb, p + 2, RTX_OSN_SIZE);
+	err |= mbuf_write_mem(mb, p + hlen, orig->end - hlen);
+
+	return err;
+}
+
+
+/**
+ * Retransmit one packet from the history
+ *
+ * @param hist Retransmission history
+ * @param seq  RTP sequence number of the original packet
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int hist_resend(struct rtp_hist *hist, uint16_t seq)
+{
+	struct hist_ent *ent;
+	struct mbuf *mb = NULL;
+	struct sa dst;
+	uint64_t now = tmr_jiffies();
+	int err;
+
+	if (!hist)
+		return EINVAL;
+
+	mtx_lock(hist->lock);
+
+	expire(hist, now);
+
+	ent = &hist->entv[seq & (HIST_SIZE - 1)];
+	if (!ent->mb || ent->seq != seq) {
+		++hist->stats.missing;
+		err = ENOENT;
+		goto out;
+	}
+
+	if (ent->resent && now - ent->resent < hist->conf.min_interval) {
+		++hist->stats.throttled;
+		err = EALREADY;
+		goto out;
+	}
+
+	if (!budget_take(hist, now, ent->mb->end)) {
+		++hist->stats.throttled;
+		err = EAGAIN;
+		goto out;
+	}
+
+	mb = mbuf_alloc(HIST_PRESZ + ent->mb->end + RTX_OSN_SIZE);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	mb->pos = mb->end = HIST_PRESZ;
+
+	if (hist->conf.rtx_pt)
+		err = rtx_encode(mb, hist, ent->mb);
+	else
+		err = mbuf_write_mem(mb, ent->mb->buf, ent->mb->end);
+	if (err)
+		goto out;
+
+	mb->pos = HIST_PRESZ;
+
+	ent->resent = now;
+	++hist->stats.resent;
+	dst = hist->dst;
+
+ out:
+	mtx_unlock(hist->lock);
+
+	if (!err)
+		err = rtp_sock_queue(hist->rs, RTP_PRIO_RTX, &dst, mb);
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/**
+ * Service an incoming RTCP Generic NACK from the history
+ *
+ * @param hist Retransmission history
+ * @param msg  RTCP Message
+ */
+void hist_handle_rtcp(struct rtp_hist *hist, const struct rtcp_msg *msg)
+{
+	if (!hist || !msg)
+		return;
+
+	if (msg->hdr.pt != RTCP_RTPFB || msg->hdr.count != RTCP_RTPFB_GNACK)
+		return;
+
+	if (msg->r.fb.ssrc_media != rtp_sess_ssrc(hist->rs))
+		return;
+
+	for (uint32_t i = 0; i < msg->r.fb.n; i++) {
+
+		const struct gnack *gn = &msg->r.fb.fci.gnackv[i];
+
+		(void)hist_resend(hist, gn->pid);
+
+		for (uint16_t j = 0; j < 16; j++) {
+			if (gn->blp & (1 << j))
+				(void)hist_resend(hist, gn->pid + j + 1);
+		}
+	}
+}
+
+
+void hist_get_stats(struct rtp_hist *hist, struct rtp_hist_stats *stats)
+{
+	mtx_lock(hist->lock);
+	*stats = hist->stats;
+	mtx_unlock(hist->lock);
+}
+
+
+int hist_debug(struct re_printf *pf, struct rtp_hist *hist)
+{
+	struct rtp_hist_stats stats;
+	uint16_t count;
+	size_t bytes;
+
+	if (!hist)
+		return 0;
+
+	mtx_lock(hist->lock);
+	stats = hist->stats;
+	count = hist->count;
+	bytes = hist->bytes;
+	mtx_unlock(hist->lock);
+
+	return re_hprintf(pf, " History: packets=%u bytes=%zu stored=%u"
+			  " resent=%u missing=%u throttled=%u\n",
+			  count, bytes, stats.stored, stats.resent,
+			  stats.missing, stats.throttled);
+}
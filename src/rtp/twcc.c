@@ -0,0 +1,772 @@
+/**
+ * @file twcc.c  Transport-wide Congestion Control (transport-cc-01)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_sys.h>
+#include <re_sa.h>
+#include <re_tmr.h>
+#include <re_thread.h>
+#include <re_rtp.h>
+#include <re_rtpext.h>
+#include "rtcp.h"
+
+
+#define DEBUG_MODULE "twcc"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	TWCC_RX_SIZE   = 4096,  /**< Receive ring size (power of two)      */
+	TWCC_TX_SIZE   = 4096,  /**< Send history size (power of two)      */
+	TWCC_MAX_COUNT =  512,  /**< Max. packet statuses per feedback     */
+	TWCC_MAX_FCI   = 1100,  /**< Max. size of chunks and deltas [bytes]*/
+	TWCC_TICK      =  250,  /**< Receive delta resolution [us]         */
+	TWCC_REF_SHIFT =    8,  /**< Reference time is 64ms = 256 ticks    */
+	TWCC_RUN_MAX   = 0x1fff,
+};
+
+enum twcc_sym {
+	SYM_NOT_RECV = 0,
+	SYM_SMALL    = 1,
+	SYM_LARGE    = 2,
+};
+
+
+/** Send history entry */
+struct twcc_sent {
+	uint64_t tx;    /**< Send time in [us]   */
+	uint32_t size;  /**< Packet size [bytes] */
+	uint16_t seq;   /**< Transport seq. no.  */
+	bool valid;     /**< Entry is in use     */
+};
+
+/** Transport-wide congestion control state for one RTP Socket */
+struct rtp_twcc {
+	struct rtp_sock *rs;     /**< Parent RTP Socket                   */
+	struct tmr tmr;          /**< Feedback timer                      */
+	uint32_t interval;       /**< Feedback interval in [ms]           */
+	uint8_t extid;           /**< Header extension ID                 */
+
+	/* Receive side */
+	uint32_t *arrv;          /**< Arrival ticks indexed by seq, 0=lost*/
+	uint64_t epoch;          /**< Arrival time epoch in [us]          */
+	uint32_t ssrc_media;     /**< Last received media source          */
+	uint16_t rx_base;        /**< First seq. not yet reported         */
+	uint16_t rx_end;         /**< Highest received seq. + 1           */
+	bool rx_started;         /**< First packet received               */
+	uint8_t fbcount;         /**< Feedback packet count               */
+
+	/* Send side */
+	mtx_t *lock;             /**< Protects the send side              */
+	struct twcc_sent *txv;   /**< Send history ring                   */
+	uint16_t tx_seq;         /**< Next transport seq. number          */
+};
+
+/** Feedback encoder state */
+struct twcc_enc {
+	uint8_t symv[TWCC_MAX_COUNT];
+	int16_t deltav[TWCC_MAX_COUNT];
+	uint16_t base;
+	uint16_t count;
+	uint32_t reftime;
+	uint8_t fbcount;
+};
+
+
+static void destructor(void *data)
+{
+	struct rtp_twcc *tw = data;
+
+	tmr_cancel(&tw->tmr);
+	mem_deref(tw->arrv);
+	mem_deref(tw->txv);
+	mem_deref(tw->lock);
+}
+
+
+/*
+ * Find the transport-wide sequence number in an RTP header extension
+ * block, supporting both One-Byte and Two-Byte headers.
+ */
+static bool ext_seq(uint16_t type, const uint8_t *p, size_t len,
+		    uint8_t extid, uint16_t *seqp)
+{
+	const uint8_t *end = p + len;
+	const bool one = (type == RTPEXT_TYPE_MAGIC);
+
+	if (!one && (type & 0xfff0) != RTPEXT_TYPE_MAGIC_LONG)
+		return false;
+
+	while (p < end) {
+		uint8_t id, l;
+
+		if (*p == 0x00) {
+			++p;
+			continue;
+		}
+
+		if (one) {
+			id = *p >> 4;
+			l  = (*p & 0x0f) + 1;
+			if (id == 15)
+				return false;
+			p += 1;
+		}
+		else {
+			if (end - p < 2)
+				return false;
+			id = p[0];
+			l  = p[1];
+			p += 2;
+		}
+
+		if (l > end - p)
+			return false;
+
+		if (id == extid) {
+			if (l < 2)
+				return false;
+			*seqp = (uint16_t)(p[0] << 8 | p[1]);
+			return true;
+		}
+
+		p += l;
+	}
+
+	return false;
+}
+
+
+static int fb_send(struct rtp_twcc *tw);
+
+
+static void tmr_handler(void *arg)
+{
+	struct rtp_twcc *tw = arg;
+
+	tmr_start(&tw->tmr, tw->interval, tmr_handler, tw);
+
+	(void)fb_send(tw);
+}
+
+
+int twcc_alloc(struct rtp_twcc **twp, struct rtp_sock *rs, uint8_t extid,
+	       uint32_t interval)
+{
+	struct rtp_twcc *tw;
+	int err;
+
+	if (!twp || !rs)
+		return EINVAL;
+
+	tw = mem_zalloc(sizeof(*tw), destructor);
+	if (!tw)
+		return ENOMEM;
+
+	tw->rs       = rs;
+	tw->extid    = extid;
+	tw->interval = interval;
+	tw->epoch    = tmr_jiffies_usec();
+	tmr_init(&tw->tmr);
+
+	tw->arrv = mem_zalloc(TWCC_RX_SIZE * sizeof(*tw->arrv), NULL);
+	tw->txv  = mem_zalloc(TWCC_TX_SIZE * sizeof(*tw->txv), NULL);
+	if (!tw->arrv || !tw->txv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mutex_alloc(&tw->lock);
+	if (err)
+		goto out;
+
+	if (interval)
+		tmr_start(&tw->tmr, interval, tmr_handler, tw);
+
+ out:
+	if (err)
+		mem_deref(tw);
+	else
+		*twp = tw;
+
+	return err;
+}
+
+
+/**
+ * Record the arrival of a packet on the receive side
+ *
+ * @param tw   TWCC state
+ * @param seq  Transport-wide sequence number
+ * @param ssrc Media source of the packet
+ * @param now  Arrival time in [us]
+ */
+void twcc_rx_record(struct rtp_twcc *tw, uint16_t seq, uint32_t ssrc,
+		    uint64_t now)
+{
+	uint32_t ticks;
+
+	if (!tw)
+		return;
+
+	ticks = (uint32_t)((now - tw->epoch) / TWCC_TICK);
+	if (!ticks)
+		ticks = 1;  /* zero marks a lost packet */
+
+	tw->ssrc_media = ssrc;
+
+	if (!tw->rx_started) {
+		tw->rx_base = seq;
+		tw->rx_end  = seq + 1;
+		tw->rx_started = true;
+	}
+	else if (rtp_seq_diff(tw->rx_base, seq) < 0) {
+		/* already reported or too old */
+		return;
+	}
+	else if (rtp_seq_diff(tw->rx_end, seq) >= 0) {
+
+		uint16_t gap = seq - tw->rx_end;
+
+		if (gap >= TWCC_RX_SIZE) {
+			memset(tw->arrv, 0, TWCC_RX_SIZE * sizeof(*tw->arrv));
+			tw->rx_base = seq;
+		}
+		else {
+			for (uint16_t s = tw->rx_end; s != seq; s++)
+				tw->arrv[s & (TWCC_RX_SIZE - 1)] = 0;
+		}
+
+		tw->rx_end = seq + 1;
+
+		/* ring full, drop the oldest unreported packets */
+		if ((uint16_t)(tw->rx_end - tw->rx_base) > TWCC_RX_SIZE)
+			tw->rx_base = tw->rx_end - TWCC_RX_SIZE;
+	}
+
+	tw->arrv[seq & (TWCC_RX_SIZE - 1)] = ticks;
+}
+
+
+/**
+ * Handle an incoming RTP packet on the receive side
+ *
+ * @param tw  TWCC state
+ * @param hdr Decoded RTP header
+ * @param mb  RTP payload, positioned after the header extension
+ */
+void twcc_rx_rtp(struct rtp_twcc *tw, const struct rtp_header *hdr,
+		 const struct mbuf *mb)
+{
+	size_t len;
+	uint16_t seq;
+
+	if (!tw || !tw->extid || !hdr->ext)
+		return;
+
+	len = hdr->x.len * sizeof(uint32_t);
+	if (mb->pos < len)
+		return;
+
+	if (!ext_seq(hdr->x.type, mb->buf + mb->pos - len, len, tw->extid,
+		     &seq))
+		return;
+
+	twcc_rx_record(tw, seq, hdr->ssrc, tmr_jiffies_usec());
+}
+
+
+/**
+ * Record an outgoing RTP packet in the send history
+ *
+ * @param tw  TWCC state
+ * @param mb  RTP packet, positioned at the start of the RTP header
+ */
+void twcc_tx_rtp(struct rtp_twcc *tw, const struct mbuf *mb)
+{
+	const uint8_t *p;
+	size_t len, hlen;
+	uint16_t seq;
+	struct twcc_sent *ts;
+
+	if (!tw || !tw->extid || mbuf_get_left(mb) < RTP_HEADER_SIZE + 4)
+		return;
+
+	p = mbuf_buf(mb);
+	if (!(p[0] & 0x10))
+		return;
+
+	hlen = RTP_HEADER_SIZE + (p[0] & 0x0f) * sizeof(uint32_t);
+	if (mbuf_get_left(mb) < hlen + 4)
+		return;
+
+	len = (p[hlen + 2] << 8 | p[hlen + 3]) * sizeof(uint32_t);
+	if (mbuf_get_left(mb) < hlen + 4 + len)
+		return;
+
+	if (!ext_seq((uint16_t)(p[hlen] << 8 | p[hlen + 1]), p + hlen + 4,
+		     len, tw->extid, &seq))
+		return;
+
+	mtx_lock(tw->lock);
+
+	ts = &tw->txv[seq & (TWCC_TX_SIZE - 1)];
+	ts->tx    = tmr_jiffies_usec();
+	ts->size  = (uint32_t)mbuf_get_left(mb);
+	ts->seq   = seq;
+	ts->valid = true;
+
+	mtx_unlock(tw->lock);
+}
+
+
+static bool enc_prepare(struct twcc_enc *enc, struct rtp_twcc *tw)
+{
+	uint16_t n = tw->rx_end - tw->rx_base;
+	uint32_t prev = 0;
+	size_t sz = 0;
+	bool ref = false;
+	uint16_t i;
+
+	if (!tw->rx_started || !n)
+		return false;
+
+	/* a feedback must contain at least one received packet */
+	for (i = 0; i < n; i++) {
+		if (tw->arrv[(uint16_t)(tw->rx_base + i) & (TWCC_RX_SIZE - 1)])
+			break;
+	}
+
+	if (i >= TWCC_MAX_COUNT) {
+		tw->rx_base += i;
+		n -= i;
+	}
+
+	enc->base    = tw->rx_base;
+	enc->fbcount = tw->fbcount;
+
+	for (i = 0; i < n && i < TWCC_MAX_COUNT; i++) {
+
+		uint32_t ticks = tw->arrv[(uint16_t)(enc->base + i)
+					  & (TWCC_RX_SIZE - 1)];
+		int32_t delta;
+
+		if (!ticks) {
+			enc->symv[i] = SYM_NOT_RECV;
+			continue;
+		}
+
+		if (!ref) {
+			enc->reftime = ticks >> TWCC_REF_SHIFT;
+			prev = enc->reftime << TWCC_REF_SHIFT;
+			ref = true;
+		}
+
+		delta = (int32_t)(ticks - prev);
+
+		if (delta >= 0 && delta <= 0xff) {
+			enc->symv[i] = SYM_SMALL;
+			sz += 1;
+		}
+		else if (delta >= INT16_MIN && delta <= INT16_MAX) {
+			enc->symv[i] = SYM_LARGE;
+			sz += 2;
+		}
+		else {
+			/* does not fit, report in the next feedback */
+			break;
+		}
+
+		/* worst case chunk overhead is 2 bytes per 7 statuses */
+		if (sz + (i / 7 + 1) * 2 > TWCC_MAX_FCI)
+			break;
+
+		enc->deltav[i] = (int16_t)delta;
+		prev = ticks;
+	}
+
+	/* trailing lost packets are reported once a later one arrives */
+	while (i && enc->symv[i - 1] == SYM_NOT_RECV)
+		--i;
+
+	enc->count = i;
+
+	return ref && i > 0;
+}
+
+
+static int enc_chunks(struct mbuf *mb, const uint8_t *symv, size_t n)
+{
+	size_t i = 0;
+	int err = 0;
+
+	while (i < n && !err) {
+		size_t run = 1, k;
+		bool large = false;
+		uint16_t chunk;
+
+		while (i + run < n && symv[i + run] == symv[i] &&
+		       run < TWCC_RUN_MAX)
+			++run;
+
+		for (k = 0; k < 14 && i + k < n; k++) {
+			if (symv[i + k] == SYM_LARGE)
+				large = true;
+		}
+
+		if (run >= 14 || (large && run >= 7)) {
+			/* Run Length Chunk */
+			chunk = (uint16_t)(symv[i] << 13 | run);
+			i += run;
+		}
+		else if (!large) {
+			/* Status Vector Chunk, 1-bit symbols */
+			chunk = 0x8000;
+			for (k = 0; k < 14 && i < n; k++, i++)
+				chunk |= symv[i] << (13 - k);
+		}
+		else {
+			/* Status Vector Chunk, 2-bit symbols */
+			chunk = 0xc000;
+			for (k = 0; k < 7 && i < n; k++, i++)
+				chunk |= symv[i] << (2 * (6 - k));
+		}
+
+		err = mbuf_write_u16(mb, htons(chunk));
+	}
+
+	return err;
+}
+
+
+static int fci_encode_handler(struct mbuf *mb, void *arg)
+{
+	const struct twcc_enc *enc = arg;
+	int err;
+
+	err  = mbuf_write_u16(mb, htons(enc->base));
+	err |= mbuf_write_u16(mb, htons(enc->count));
+	err |= mbuf_write_u32(mb, htonl((enc->reftime & 0xffffff) << 8 |
+					enc->fbcount));
+	err |= enc_chunks(mb, enc->symv, enc->count);
+
+	for (uint16_t i = 0; i < enc->count && !err; i++) {
+
+		switch (enc->symv[i]) {
+
+		case SYM_SMALL:
+			err = mbuf_write_u8(mb, (uint8_t)enc->deltav[i]);
+			break;
+
+		case SYM_LARGE:
+			err = mbuf_write_u16(mb,
+					     htons((uint16_t)enc->deltav[i]));
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return err;
+}
+
+
+static int fb_send(struct rtp_twcc *tw)
+{
+	struct twcc_enc enc;
+	struct mbuf *mb;
+	int err = 0;
+
+	if (!enc_prepare(&enc, tw))
+		return 0;
+
+	mb = mbuf_alloc(RTCP_HEADROOM + 64 + TWCC_MAX_FCI);
+	if (!mb)
+		return ENOMEM;
+
+	do {
+		mb->pos = mb->end = RTCP_HEADROOM;
+
+		err = rtcp_encode(mb, RTCP_RTPFB, RTCP_RTPFB_TWCC,
+				  rtp_sess_ssrc(tw->rs), tw->ssrc_media,
+				  fci_encode_handler, &enc);
+		if (err)
+			break;
+
+		mb->pos = RTCP_HEADROOM;
+
+		err = rtcp_send(tw->rs, mb);
+		if (err)
+			break;
+
+		tw->rx_base += enc.count;
+		++tw->fbcount;
+
+	} while (enc_prepare(&enc, tw));
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/**
+ * Encode all pending packet statuses as one or more RTCP Transport-wide
+ * Congestion Control feedback messages
+ *
+ * @param mb  Buffer to encode into
+ * @param rs  RTP Socket
+ *
+ * @return 0 for success, ENODATA if there is nothing to report, otherwise
+ *         errorcode
+ */
+int rtcp_twcc_encode(struct mbuf *mb, struct rtp_sock *rs)
+{
+	struct rtp_twcc *tw = rtp_sock_twcc(rs);
+	struct twcc_enc enc;
+	int err;
+
+	if (!mb || !tw)
+		return EINVAL;
+
+	if (!enc_prepare(&enc, tw))
+		return ENODATA;
+
+	do {
+		err = rtcp_encode(mb, RTCP_RTPFB, RTCP_RTPFB_TWCC,
+				  rtp_sess_ssrc(rs), tw->ssrc_media,
+				  fci_encode_handler, &enc);
+		if (err)
+			break;
+
+		tw->rx_base += enc.count;
+		++tw->fbcount;
+
+	} while (enc_prepare(&enc, tw));
+
+	return err;
+}
+
+
+/**
+ * Send all pending RTCP Transport-wide Congestion Control feedback
+ *
+ * @param rs RTP Socket
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtcp_send_twcc(struct rtp_sock *rs)
+{
+	struct rtp_twcc *tw = rtp_sock_twcc(rs);
+
+	if (!tw)
+		return EINVAL;
+
+	return fb_send(tw);
+}
+
+
+/**
+ * Record the arrival of a packet with a transport-wide sequence number,
+ * for applications that parse the header extension themselves
+ *
+ * @param rs   RTP Socket
+ * @param seq  Transport-wide sequence number
+ * @param ssrc Media source of the packet
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtp_twcc_recv(struct rtp_sock *rs, uint16_t seq, uint32_t ssrc)
+{
+	struct rtp_twcc *tw = rtp_sock_twcc(rs);
+
+	if (!tw)
+		return EINVAL;
+
+	twcc_rx_record(tw, seq, ssrc, tmr_jiffies_usec());
+
+	return 0;
+}
+
+
+/**
+ * Get the next transport-wide sequence number for an outgoing packet
+ *
+ * @param rs RTP Socket
+ *
+ * @return Transport-wide sequence number
+ */
+uint16_t rtp_twcc_next_seq(struct rtp_sock *rs)
+{
+	struct rtp_twcc *tw = rtp_sock_twcc(rs);
+	uint16_t seq;
+
+	if (!tw)
+		return 0;
+
+	mtx_lock(tw->lock);
+	seq = tw->tx_seq++;
+	mtx_unlock(tw->lock);
+
+	return seq;
+}
+
+
+static int status_apply(const struct twcc *twcc, struct rtp_twcc *tw,
+			twcc_status_h *sh, void *arg)
+{
+	const uint8_t *cp, *cend, *dp, *dend;
+	struct twcc_status st;
+	int64_t rx;
+	uint16_t i = 0;
+
+	if (!twcc || !twcc->chunks || !twcc->deltas || !sh)
+		return EINVAL;
+
+	cp   = mbuf_buf(twcc->chunks);
+	cend = cp + mbuf_get_left(twcc->chunks);
+	dp   = mbuf_buf(twcc->deltas);
+	dend = dp + mbuf_get_left(twcc->deltas);
+
+	rx = (int64_t)twcc->reftime * 64000;
+
+	while (i < twcc->count) {
+		uint16_t chunk;
+		unsigned n, k;
+
+		if (cend - cp < 2)
+			return EBADMSG;
+
+		chunk = (uint16_t)(cp[0] << 8 | cp[1]);
+		cp += 2;
+
+		if (!(chunk & 0x8000))
+			n = chunk & TWCC_RUN_MAX;
+		else if (chunk & 0x4000)
+			n = 7;
+		else
+			n = 14;
+
+		for (k = 0; k < n && i < twcc->count; k++, i++) {
+			unsigned sym;
+
+			if (!(chunk & 0x8000))
+				sym = (chunk >> 13) & 0x03;
+			else if (chunk & 0x4000)
+				sym = (chunk >> (2 * (6 - k))) & 0x03;
+			else
+				sym = (chunk >> (13 - k)) & 0x01;
+
+			memset(&st, 0, sizeof(st));
+			st.seq = twcc->seq + i;
+
+			switch (sym) {
+
+			case SYM_NOT_RECV:
+				break;
+
+			case SYM_SMALL:
+				if (dend - dp < 1)
+					return EBADMSG;
+				rx += dp[0] * TWCC_TICK;
+				dp += 1;
+				st.recv = true;
+				break;
+
+			case SYM_LARGE:
+				if (dend - dp < 2)
+					return EBADMSG;
+				rx += (int16_t)(dp[0] << 8 | dp[1]) *
+					TWCC_TICK;
+				dp += 2;
+				st.recv = true;
+				break;
+
+			default:
+				return EBADMSG;
+			}
+
+			if (st.recv)
+				st.rx = rx;
+
+			if (tw) {
+				const struct twcc_sent *ts;
+
+				ts = &tw->txv[st.seq & (TWCC_TX_SIZE - 1)];
+
+				mtx_lock(tw->lock);
+				if (ts->valid && ts->seq == st.seq) {
+					st.tx   = ts->tx;
+					st.size = ts->size;
+				}
+				mtx_unlock(tw->lock);
+			}
+
+			if (sh(&st, arg))
+				return 0;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Apply a handler to all packet statuses of a decoded TWCC message
+ *
+ * @param twcc Decoded TWCC feedback (FCI)
+ * @param sh   Packet status handler
+ * @param arg  Handler argument
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtcp_twcc_apply(const struct twcc *twcc, twcc_status_h *sh, void *arg)
+{
+	return status_apply(twcc, NULL, sh, arg);
+}
+
+
+/**
+ * Apply a handler to all packet statuses of a decoded TWCC message,
+ * filling in send time and size from the send history of the RTP Socket
+ *
+ * @param rs   RTP Socket
+ * @param twcc Decoded TWCC feedback (FCI)
+ * @param sh   Packet status handler
+ * @param arg  Handler argument
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtp_twcc_apply(struct rtp_sock *rs, const struct twcc *twcc,
+		   twcc_status_h *sh, void *arg)
+{
+	struct rtp_twcc *tw = rtp_sock_twcc(rs);
+
+	if (!tw)
+		return EINVAL;
+
+	return status_apply(twcc, tw, sh, arg);
+}
+
+
+int twcc_debug(struct re_printf *pf, const struct rtp_twcc *tw)
+{
+	if (!tw)
+		return 0;
+
+	return re_hprintf(pf, " TWCC: extid=%u rx_base=%u pending=%u"
+			  " fbcount=%u tx_seq=%u\n",
+			  tw->extid, tw->rx_base,
+			  tw->rx_started ? (uint16_t)(tw->rx_end - tw->rx_base)
+					 : 0,
+			  tw->fbcount, tw->tx_seq);
+}
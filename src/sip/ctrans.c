@@ -37,7 +37,7 @@ struct sip_ctrans {
 	struct le he;
 	struct sa dst;
 	struct tmr tmr;
-	struct tmr tmre;
+	struct sip_rtx rtx;
 	struct sip *sip;
 	struct mbuf *mb;
 	struct mbuf *mb_ack;
@@ -111,7 +111,7 @@ static void destructor(void *arg)
 
 	hash_unlink(&ct->he);
 	tmr_cancel(&ct->tmr);
-	tmr_cancel(&ct->tmre);
+	sip_rtx_cancel(&ct->rtx);
 	mem_deref(ct->met);
 	mem_deref(ct->branch);
 	mem_deref(ct->host);
@@ -217,7 +217,7 @@ static void retransmit_handler(void *arg)
 		return;
 	}
 
-	tmr_start(&ct->tmre, timeout, retransmit_handler, ct);
+	sip_rtx_start(ct->sip, &ct->rtx, timeout, retransmit_handler, ct);
 
 	err = sip_transp_send(&ct->qent, ct->sip, NULL, ct->tp, &ct->dst,
 			      ct->host, ct->mb, connect_handler,
@@ -235,7 +235,7 @@ static void invite_response(struct sip_ctrans *ct, const struct sip_msg *msg)
 
 	case CALLING:
 		tmr_cancel(&ct->tmr);
-		tmr_cancel(&ct->tmre);
+		sip_rtx_cancel(&ct->rtx);
 		/*@fallthrough@*/
 	case PROCEEDING:
 		if (msg->scode < 200) {
@@ -311,7 +311,7 @@ static bool response_handler(const struct sip_msg *msg, void *arg)
 			}
 
 			tmr_start(&ct->tmr, SIP_T4, tmr_handler, ct);
-			tmr_cancel(&ct->tmre);
+			sip_rtx_cancel(&ct->rtx);
 		}
 		break;
 
@@ -339,8 +339,6 @@ int sip_ctrans_request(struct sip_ctrans **ctp, struct sip *sip,
 	if (!ct)
 		return ENOMEM;
 
-	hash_append(sip->ht_ctrans, hash_joaat_str(branch), &ct->he, ct);
-
 	ct->invite = !strcmp(met, "INVITE");
 	ct->branch = mem_ref(branch);
 	ct->host   = mem_ref(host);
@@ -354,6 +352,8 @@ int sip_ctrans_request(struct sip_ctrans **ctp, struct sip *sip,
 	ct->resph  = resph ? resph : dummy_handler;
 	ct->arg    = arg;
 
+	hash_append(sip->ht_ctrans, hash_joaat_str(branch), &ct->he, ct);
+
 	err = sip_transp_send(&ct->qent, sip, NULL, tp, dst, host, mb,
 			      connect_handler, transport_handler, ct);
 	if (err)
@@ -362,7 +362,7 @@ int sip_ctrans_request(struct sip_ctrans **ctp, struct sip *sip,
 	tmr_start(&ct->tmr, 64 * SIP_T1, tmr_handler, ct);
 
 	if (!sip_transp_reliable(ct->tp))
-		tmr_start(&ct->tmre, SIP_T1, retransmit_handler, ct);
+		sip_rtx_start(sip, &ct->rtx, SIP_T1, retransmit_handler, ct);
 
  out:
 	if (err)
@@ -417,6 +417,14 @@ int sip_ctrans_cancel(struct sip_ctrans *ct)
 }
 
 
+static uint32_t ctrans_key(const struct le *le)
+{
+	const struct sip_ctrans *ct = le->data;
+
+	return hash_joaat_str(ct->branch);
+}
+
+
 int sip_ctrans_init(struct sip *sip, uint32_t sz)
 {
 	int err;
@@ -425,7 +433,7 @@ int sip_ctrans_init(struct sip *sip, uint32_t sz)
 	if (err)
 		return err;
 
-	return hash_alloc(&sip->ht_ctrans, sz);
+	return hash_alloc_auto(&sip->ht_ctrans, sz, ctrans_key);
 }
 
 
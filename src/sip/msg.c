@@ -4,6 +4,9 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <ctype.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_sys.h>
@@ -20,8 +23,22 @@
 
 
 enum {
-	HDR_HASH_SIZE = 32,
 	STARTLINE_MAX = 8192,
+	HDR_BUCKETS   = 32,
+};
+
+
+/* SIP message with its header index, allocated in one block */
+struct sip_msg_idx {
+	struct sip_msg msg;
+	struct list hdrv[HDR_BUCKETS];  /* SIP headers by SIP Header ID */
+};
+
+
+/* Bytes that can change the state of the header scanner */
+static const bool scan_special[256] = {
+	['\t'] = true, ['\n'] = true, ['\r'] = true, [' '] = true,
+	['"']  = true, [',']  = true, [':']  = true,
 };
 
 
@@ -30,17 +47,20 @@ static void hdr_destructor(void *arg)
 	struct sip_hdr *hdr = arg;
 
 	list_unlink(&hdr->le);
-	hash_unlink(&hdr->he);
+	list_unlink(&hdr->he);
 }
 
 
 static void destructor(void *arg)
 {
-	struct sip_msg *msg = arg;
+	struct sip_msg_idx *mi = arg;
+	struct sip_msg *msg = &mi->msg;
 
 	list_flush(&msg->hdrl);
-	hash_flush(msg->hdrht);
-	mem_deref(msg->hdrht);
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(mi->hdrv); i++)
+		list_flush(&mi->hdrv[i]);
+
 	mem_deref(msg->sock);
 	mem_deref(msg->mb);
 }
@@ -149,46 +169,41 @@ static inline bool hdr_comma_separated(enum sip_hdrid id)
 }
 
 
-static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
-			  enum sip_hdrid id, const char *p, ssize_t l,
-			  bool atomic, bool line)
+static inline struct list *hdr_list(const struct sip_msg *msg,
+				    enum sip_hdrid id)
 {
-	struct sip_hdr *hdr;
-	int err = 0;
+	const struct sip_msg_idx *mi = (const struct sip_msg_idx *)msg;
 
-	hdr = mem_zalloc(sizeof(*hdr), hdr_destructor);
-	if (!hdr)
-		return ENOMEM;
+	return (struct list *)&mi->hdrv[id & (HDR_BUCKETS - 1)];
+}
 
-	hdr->name  = *name;
-	hdr->val.p = p;
-	hdr->val.l = MAX(l, 0);
-	hdr->id    = id;
 
+/* Headers that are only decoded eagerly, or by sip_msg_parse() */
+static inline bool hdr_deferred(enum sip_hdrid id)
+{
 	switch (id) {
 
-	case SIP_HDR_VIA:
-	case SIP_HDR_ROUTE:
-		if (!atomic)
-			break;
-
-		hash_append(msg->hdrht, id, &hdr->he, mem_ref(hdr));
-		list_append(&msg->hdrl, &hdr->le, mem_ref(hdr));
-		break;
+	case SIP_HDR_TO:
+	case SIP_HDR_FROM:
+	case SIP_HDR_RSEQ:
+	case SIP_HDR_RACK:
+	case SIP_HDR_CONTENT_TYPE:
+		return true;
 
 	default:
-		if (atomic)
-			hash_append(msg->hdrht, id, &hdr->he, mem_ref(hdr));
-		if (line)
-			list_append(&msg->hdrl, &hdr->le, mem_ref(hdr));
-		break;
+		return false;
 	}
+}
 
-	/* parse common headers */
-	switch (id) {
+
+static int hdr_decode(struct sip_msg *msg, const struct sip_hdr *hdr)
+{
+	int err = 0;
+
+	switch (hdr->id) {
 
 	case SIP_HDR_VIA:
-		if (!atomic || pl_isset(&msg->via.sentby))
+		if (pl_isset(&msg->via.sentby))
 			break;
 
 		err = sip_via_decode(&msg->via, &hdr->val);
@@ -251,24 +266,169 @@ static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
 		break;
 	}
 
+	return err;
+}
+
+
+static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
+			  enum sip_hdrid id, const char *p, ssize_t l,
+			  bool atomic, bool line)
+{
+	struct sip_hdr *hdr;
+	int err = 0;
+
+	hdr = mem_zalloc(sizeof(*hdr), hdr_destructor);
+	if (!hdr)
+		return ENOMEM;
+
+	hdr->name  = *name;
+	hdr->val.p = p;
+	hdr->val.l = MAX(l, 0);
+	hdr->id    = id;
+
+	switch (id) {
+
+	case SIP_HDR_VIA:
+	case SIP_HDR_ROUTE:
+		if (!atomic)
+			break;
+
+		list_append(hdr_list(msg, id), &hdr->he, mem_ref(hdr));
+		list_append(&msg->hdrl, &hdr->le, mem_ref(hdr));
+		break;
+
+	default:
+		if (atomic)
+			list_append(hdr_list(msg, id), &hdr->he,
+				    mem_ref(hdr));
+		if (line)
+			list_append(&msg->hdrl, &hdr->le, mem_ref(hdr));
+		break;
+	}
+
+	/* parse common headers */
+	if (atomic && !(msg->lazy && hdr_deferred(id)))
+		err = hdr_decode(msg, hdr);
+
 	mem_deref(hdr);
 
 	return err;
 }
 
 
-/**
- * Decode a SIP message
- *
- * @param msgp Pointer to allocated SIP Message
- * @param mb   Buffer containing SIP Message
- *
- * @return 0 if success, otherwise errorcode
+/* Find the first special byte, 16 bytes at a time where available */
+static inline const char *scan_hdr(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+	const __m128i ht = _mm_set1_epi8('\t');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i qt = _mm_set1_epi8('"');
+	const __m128i cm = _mm_set1_epi8(',');
+	const __m128i cl = _mm_set1_epi8(':');
+
+	for (; end - p >= 16; p += 16) {
+
+		const __m128i v = _mm_loadu_si128((const void *)p);
+		__m128i m;
+		int mask;
+
+		m = _mm_or_si128(_mm_cmpeq_epi8(v, ht), _mm_cmpeq_epi8(v, lf));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, cr));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, sp));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, qt));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, cm));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, cl));
+
+		mask = _mm_movemask_epi8(m);
+		if (mask)
+			return p + __builtin_ctz((unsigned)mask);
+	}
+#endif
+
+	while (p < end && !scan_special[(uint8_t)*p])
+		++p;
+
+	return p;
+}
+
+
+/* Find the first CR or LF */
+static inline const char *scan_eol(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+
+	for (; end - p >= 16; p += 16) {
+
+		const __m128i v = _mm_loadu_si128((const void *)p);
+		int mask;
+
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lf),
+						      _mm_cmpeq_epi8(v, cr)));
+		if (mask)
+			return p + __builtin_ctz((unsigned)mask);
+	}
+#endif
+
+	while (p < end && *p != '\r' && *p != '\n')
+		++p;
+
+	return p;
+}
+
+
+static inline bool is_lws(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+
+/*
+ * Decode the start line, equivalent to the anchored expression
+ * "[^ \t\r\n]+ [^ \t\r\n]+ [^\r\n]*[\r]*[\n]1"
  */
-int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
+static bool startline_decode(struct pl *x, struct pl *y, struct pl *z,
+			     const char **eolp, const char *p, size_t l)
+{
+	const char *end = p + l;
+	struct pl *tokv[2] = {x, y};
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(tokv); i++) {
+
+		tokv[i]->p = p;
+
+		while (p < end && !is_lws(*p))
+			++p;
+
+		if (p == tokv[i]->p || p >= end || *p != ' ')
+			return false;
+
+		tokv[i]->l = p++ - tokv[i]->p;
+	}
+
+	z->p = p;
+	p = scan_eol(p, end);
+	z->l = p - z->p;
+
+	while (p < end && *p == '\r')
+		++p;
+
+	if (p >= end || *p != '\n')
+		return false;
+
+	*eolp = p + 1;
+
+	return true;
+}
+
+
+static int msg_decode(struct sip_msg **msgp, struct mbuf *mb, bool lazy)
 {
-	struct pl x, y, z, e, name;
-	const char *p, *v, *cv;
+	struct pl x, y, z, name;
+	const char *p, *v, *cv, *eol;
 	struct sip_msg *msg;
 	bool comsep, quote;
 	enum sip_hdrid id = SIP_HDR_NONE;
@@ -282,21 +442,17 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 	p = (const char *)mbuf_buf(mb);
 	l = mbuf_get_left(mb);
 
-	if (re_regex(p, l, "[^ \t\r\n]+ [^ \t\r\n]+ [^\r\n]*[\r]*[\n]1",
-		     &x, &y, &z, NULL, &e) || x.p != (char *)mbuf_buf(mb))
+	if (!startline_decode(&x, &y, &z, &eol, p, l))
 		return (l > STARTLINE_MAX) ? EBADMSG : ENODATA;
 
-	msg = mem_zalloc(sizeof(*msg), destructor);
+	msg = mem_zalloc(sizeof(struct sip_msg_idx), destructor);
 	if (!msg)
 		return ENOMEM;
 
-	err = hash_alloc(&msg->hdrht, HDR_HASH_SIZE);
-	if (err)
-		goto out;
-
-	msg->tag = rand_u64();
-	msg->mb  = mem_ref(mb);
-	msg->req = (0 == pl_strcmp(&z, "SIP/2.0"));
+	msg->tag  = rand_u64();
+	msg->mb   = mem_ref(mb);
+	msg->req  = (0 == pl_strcmp(&z, "SIP/2.0"));
+	msg->lazy = lazy;
 
 	if (msg->req) {
 
@@ -304,7 +460,7 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 		msg->ruri = y;
 		msg->ver = z;
 
-		if (uri_decode(&msg->uri, &y)) {
+		if (!lazy && uri_decode(&msg->uri, &y)) {
 			err = EBADMSG;
 			goto out;
 		}
@@ -320,8 +476,8 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 		}
 	}
 
-	l -= e.p + e.l - p;
-	p = e.p + e.l;
+	l -= eol - p;
+	p = eol;
 
 	name.p = v = cv = NULL;
 	name.l = ws = lf = 0;
@@ -330,6 +486,21 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 
 	for (; l > 0; p++, l--) {
 
+		/* skip bytes inside a name or value that only reset ws */
+		if (!lf && name.p && (!name.l || (cv && v))) {
+
+			const char *q = scan_hdr(p, p + l);
+
+			if (q != p) {
+				ws = 0;
+				l -= q - p;
+				p = q;
+
+				if (!l)
+					break;
+			}
+		}
+
 		switch (*p) {
 
 		case ' ':
@@ -445,6 +616,81 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 }
 
 
+/**
+ * Decode a SIP message
+ *
+ * @param msgp Pointer to allocated SIP Message
+ * @param mb   Buffer containing SIP Message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
+{
+	return msg_decode(msgp, mb, false);
+}
+
+
+/**
+ * Decode a SIP message lazily. Only the header index, the top Via,
+ * Call-ID, CSeq, Max-Forwards, Expires and Content-Length are decoded;
+ * the Request-URI, To, From, RSeq, RAck and Content-Type fields are
+ * left empty until sip_msg_parse() is called.
+ *
+ * @param msgp Pointer to allocated SIP Message
+ * @param mb   Buffer containing SIP Message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_msg_decode_lazy(struct sip_msg **msgp, struct mbuf *mb)
+{
+	return msg_decode(msgp, mb, true);
+}
+
+
+/**
+ * Decode the structured fields of a lazily decoded SIP message
+ *
+ * @param msg SIP Message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_msg_parse(struct sip_msg *msg)
+{
+	static const enum sip_hdrid idv[] = {
+		SIP_HDR_TO, SIP_HDR_FROM, SIP_HDR_RSEQ, SIP_HDR_RACK,
+		SIP_HDR_CONTENT_TYPE,
+	};
+	int err;
+
+	if (!msg)
+		return EINVAL;
+
+	if (!msg->lazy)
+		return 0;
+
+	if (msg->req && uri_decode(&msg->uri, &msg->ruri))
+		return EBADMSG;
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(idv); i++) {
+
+		/* the last header wins, as with eager decoding */
+		const struct sip_hdr *hdr;
+
+		hdr = sip_msg_hdr_apply(msg, false, idv[i], NULL, NULL);
+		if (!hdr)
+			continue;
+
+		err = hdr_decode(msg, hdr);
+		if (err)
+			return err;
+	}
+
+	msg->lazy = false;
+
+	return 0;
+}
+
+
 /**
  * Get a SIP Header from a SIP Message
  *
@@ -480,7 +726,7 @@ const struct sip_hdr *sip_msg_hdr_apply(const struct sip_msg *msg,
 	if (!msg)
 		return NULL;
 
-	lst = hash_list(msg->hdrht, id);
+	lst = hdr_list(msg, id);
 
 	le = fwd ? list_head(lst) : list_tail(lst);
 
@@ -538,7 +784,7 @@ const struct sip_hdr *sip_msg_xhdr_apply(const struct sip_msg *msg,
 
 	pl_set_str(&pl, name);
 
-	lst = hash_list(msg->hdrht, hdr_hash(&pl));
+	lst = hdr_list(msg, hdr_hash(&pl));
 
 	le = fwd ? list_head(lst) : list_tail(lst);
 
@@ -663,9 +909,9 @@ void sip_msg_dump(const struct sip_msg *msg)
 	if (!msg)
 		return;
 
-	for (i=0; i<HDR_HASH_SIZE; i++) {
+	for (i=0; i<HDR_BUCKETS; i++) {
 
-		le = list_head(hash_list(msg->hdrht, i));
+		le = list_head(hdr_list(msg, i));
 
 		while (le) {
 			const struct sip_hdr *hdr = le->data;
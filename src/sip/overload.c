@@ -0,0 +1,242 @@
+/**
+ * @file sip/overload.c  SIP Overload Control (RFC 7339)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_fmt.h>
+#include <re_uri.h>
+#include <re_sys.h>
+#include <re_tmr.h>
+#include <re_udp.h>
+#include <re_msg.h>
+#include <re_sip.h>
+#include "sip.h"
+
+
+enum {
+	PROBE_INTERVAL = 20,    /* [ms] */
+	OC_VALIDITY    = 1000,  /* [ms] */
+};
+
+
+/*
+ * Loss based overload control. A probe timer measures how late the
+ * main loop runs timers, and the reduction level is derived from the
+ * smoothed lag and from the server transaction occupancy.
+ */
+struct sip_overload {
+	struct sip_overload_conf conf;
+	struct tmr tmr;
+	uint64_t expires;     /* Expected probe time [us]          */
+	uint64_t seq;         /* oc-seq, time of last level change */
+	uint32_t lag;         /* Smoothed loop lag [us]            */
+	uint32_t level;       /* Reduction level from lag [%]      */
+	uint32_t rejected;
+};
+
+
+static void destructor(void *arg)
+{
+	struct sip_overload *oc = arg;
+
+	tmr_cancel(&oc->tmr);
+}
+
+
+static uint32_t scale(uint32_t v, uint32_t lo, uint32_t hi)
+{
+	if (v <= lo)
+		return 0;
+
+	if (v >= hi)
+		return 100;
+
+	return (v - lo) * 100 / (hi - lo);
+}
+
+
+static void probe_handler(void *arg)
+{
+	struct sip_overload *oc = arg;
+	uint64_t now = tmr_jiffies_usec();
+	uint32_t lag, level;
+
+	lag = (uint32_t)MIN(now > oc->expires ? now - oc->expires : 0,
+			    UINT32_MAX);
+
+	/* EWMA with gain 1/8 */
+	oc->lag = oc->lag - oc->lag / 8 + lag / 8;
+
+	level = scale(oc->lag / 1000, oc->conf.lag_min, oc->conf.lag_max);
+	if (level != oc->level) {
+		oc->level = level;
+		oc->seq   = tmr_jiffies();
+	}
+
+	oc->expires = now + PROBE_INTERVAL * 1000;
+	tmr_start(&oc->tmr, PROBE_INTERVAL, probe_handler, oc);
+}
+
+
+static bool has_to_tag(const struct sip_msg *msg)
+{
+	const struct sip_hdr *hdr;
+	struct pl tag;
+
+	if (pl_isset(&msg->to.tag))
+		return true;
+
+	/* the To header is not decoded yet for lazily decoded messages */
+	hdr = sip_msg_hdr(msg, SIP_HDR_TO);
+
+	return hdr && !msg_param_exists(&hdr->val, "tag", &tag);
+}
+
+
+/**
+ * Enable or disable SIP overload control
+ *
+ * New out-of-dialog requests are rejected with 503 and Retry-After with a
+ * probability equal to the reduction level, and the level is advertised
+ * to upstream servers which signal support with a Via "oc" parameter.
+ *
+ * @param sip  SIP stack instance
+ * @param conf Overload control configuration, NULL to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_overload_set(struct sip *sip, const struct sip_overload_conf *conf)
+{
+	struct sip_overload *oc;
+
+	if (!sip)
+		return EINVAL;
+
+	if (!conf) {
+		sip->oc = mem_deref(sip->oc);
+		return 0;
+	}
+
+	if (conf->lag_min >= conf->lag_max)
+		return EINVAL;
+
+	oc = sip->oc;
+	if (!oc) {
+		oc = mem_zalloc(sizeof(*oc), destructor);
+		if (!oc)
+			return ENOMEM;
+
+		oc->expires = tmr_jiffies_usec() + PROBE_INTERVAL * 1000;
+		oc->seq     = tmr_jiffies();
+		tmr_start(&oc->tmr, PROBE_INTERVAL, probe_handler, oc);
+
+		sip->oc = oc;
+	}
+
+	oc->conf = *conf;
+
+	return 0;
+}
+
+
+/**
+ * Get the current overload reduction level
+ *
+ * @param sip SIP stack instance
+ *
+ * @return Percentage of new requests to reject (0-100)
+ */
+uint32_t sip_overload_level(const struct sip *sip)
+{
+	const struct sip_overload *oc;
+	uint32_t max, level;
+
+	if (!sip || !sip->oc)
+		return 0;
+
+	oc  = sip->oc;
+	max = oc->conf.strans_max;
+
+	level = oc->level;
+
+	/* ramp up over the last quarter of the transaction limit */
+	if (max)
+		level = MAX(level, scale(sip->strans_n, max - max / 4, max));
+
+	return level;
+}
+
+
+/**
+ * Get the number of requests rejected by overload control
+ *
+ * @param sip SIP stack instance
+ *
+ * @return Number of rejected requests
+ */
+uint32_t sip_overload_rejected(const struct sip *sip)
+{
+	return sip && sip->oc ? sip->oc->rejected : 0;
+}
+
+
+/**
+ * Reject a new request if overloaded. Only fields available after a lazy
+ * decode are used, so this can run before the message is fully parsed.
+ *
+ * @param sip SIP stack instance
+ * @param msg Received SIP message
+ *
+ * @return True if the request was rejected
+ */
+bool sip_overload_reject(struct sip *sip, const struct sip_msg *msg)
+{
+	uint32_t level;
+
+	if (!sip->oc || !msg->req)
+		return false;
+
+	if (!pl_strcmp(&msg->met, "ACK") || !pl_strcmp(&msg->met, "CANCEL"))
+		return false;
+
+	level = sip_overload_level(sip);
+	if (!level || (level < 100 && rand_u16() % 100 >= level))
+		return false;
+
+	/* in-dialog requests and retransmissions are always let through */
+	if (has_to_tag(msg) || sip_strans_exists(sip, msg))
+		return false;
+
+	++sip->oc->rejected;
+
+	(void)sip_replyf(sip, msg, 503, "Service Unavailable",
+			 "Retry-After: %u\r\n"
+			 "Content-Length: 0\r\n"
+			 "\r\n",
+			 sip->oc->conf.retry_after);
+
+	return true;
+}
+
+
+/**
+ * Encode the RFC 7339 overload control Via parameters
+ *
+ * @param mb  Buffer to encode into
+ * @param sip SIP stack instance
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_overload_encode(struct mbuf *mb, const struct sip *sip)
+{
+	return mbuf_printf(mb, ";oc=%u;oc-algo=\"loss\";oc-validity=%u"
+			   ";oc-seq=%llu",
+			   sip_overload_level(sip), OC_VALIDITY,
+			   sip->oc->seq);
+}
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
@@ -16,6 +17,128 @@
 #include "sip.h"
 
 
+enum {
+	REPLY_OVERHEAD = 128,  /* status line, Server and Content-Length */
+	VIA_EXTRA      = 64,   /* ;rport=65535;received=<IPv6 address>   */
+	OC_EXTRA       = 80,   /* ;oc=..;oc-algo=..;oc-validity=;oc-seq= */
+	TAG_EXTRA      = 24,   /* ;tag=%016llx                           */
+};
+
+
+static const char hexv[] = "0123456789abcdef";
+
+
+static inline int write_hdr(struct mbuf *mb, const struct sip_hdr *hdr)
+{
+	int err;
+
+	err  = mbuf_write_pl(mb, &hdr->name);
+	err |= mbuf_write_mem(mb, (const uint8_t *)": ", 2);
+	err |= mbuf_write_pl(mb, &hdr->val);
+
+	return err;
+}
+
+
+static inline int write_crlf(struct mbuf *mb)
+{
+	return mbuf_write_mem(mb, (const uint8_t *)"\r\n", 2);
+}
+
+
+static int write_u32(struct mbuf *mb, uint32_t v)
+{
+	char buf[10];
+	size_t i = sizeof(buf);
+
+	do {
+		buf[--i] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	return mbuf_write_mem(mb, (uint8_t *)&buf[i], sizeof(buf) - i);
+}
+
+
+static int write_tag(struct mbuf *mb, uint64_t tag)
+{
+	char buf[21] = ";tag=";
+
+	for (int i=15; i>=0; i--) {
+		buf[5 + i] = hexv[tag & 0xf];
+		tag >>= 4;
+	}
+
+	return mbuf_write_mem(mb, (uint8_t *)buf, sizeof(buf));
+}
+
+
+/* Write a value without the given parameters, sorted by position */
+static int write_skip(struct mbuf *mb, const struct pl *val,
+		      const struct pl *skipv, size_t skipc)
+{
+	const char *p = val->p;
+	int err = 0;
+
+	for (size_t i=0; i<skipc; i++) {
+
+		if (!skipv[i].p)
+			continue;
+
+		err |= mbuf_write_mem(mb, (const uint8_t *)p,
+				      skipv[i].p - p);
+		p = skipv[i].p + skipv[i].l;
+	}
+
+	err |= mbuf_write_mem(mb, (const uint8_t *)p, val->p + val->l - p);
+
+	return err;
+}
+
+
+/* Locate the Via "oc" parameter including any value (RFC 7339) */
+static bool via_oc(struct pl *oc, const struct sip_msg *msg)
+{
+	struct pl val;
+
+	if (msg_param_exists(&msg->via.params, "oc", oc))
+		return false;
+
+	if (!msg_param_decode(&msg->via.params, "oc", &val) && val.l)
+		oc->l = val.p + val.l - oc->p;
+
+	return true;
+}
+
+
+/* Upper bound of the reply size, excluding formatted headers and body */
+static size_t reply_size(const struct sip *sip, const struct sip_msg *msg,
+			 const char *reason)
+{
+	size_t sz = REPLY_OVERHEAD + VIA_EXTRA + OC_EXTRA + TAG_EXTRA +
+		strlen(reason);
+	struct le *le;
+
+	if (sip->software)
+		sz += strlen(sip->software);
+
+	for (le = msg->hdrl.head; le; le = le->next) {
+
+		const struct sip_hdr *hdr = le->data;
+
+		sz += hdr->name.l + hdr->val.l + 4;
+	}
+
+	return sz;
+}
+
+
+/*
+ * The reply is built from the byte ranges of the request headers, with
+ * only the Via rport/received and To tag parameters spliced in. Avoid
+ * the format interpreter here, stateless replies such as 100 Trying and
+ * rejects are sent at very high rates.
+ */
 static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 		   struct sip *sip, const struct sip_msg *msg, bool rec_route,
 		   uint16_t scode, const char *reason,
@@ -34,52 +157,80 @@ static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 	if (!pl_strcmp(&msg->met, "ACK"))
 		return 0;
 
-	mb = mbuf_alloc(1024);
+	mb = mbuf_alloc(reply_size(sip, msg, reason));
 	if (!mb) {
 		err = ENOMEM;
 		goto out;
 	}
 
-	err = mbuf_printf(mb, "SIP/2.0 %u %s\r\n", scode, reason);
+	err  = mbuf_write_str(mb, "SIP/2.0 ");
+	err |= write_u32(mb, scode);
+	err |= mbuf_write_u8(mb, ' ');
+	err |= mbuf_write_str(mb, reason);
+	err |= write_crlf(mb);
 
 	for (le = msg->hdrl.head; le; le = le->next) {
 
 		struct sip_hdr *hdr = le->data;
-		struct pl rp;
+		struct pl skipv[2];
+		char addr[64];
+		bool oc;
 
 		switch (hdr->id) {
 
 		case SIP_HDR_VIA:
-			err |= mbuf_printf(mb, "%r: ", &hdr->name);
 			if (viac++) {
-				err |= mbuf_printf(mb, "%r\r\n", &hdr->val);
+				err |= write_hdr(mb, hdr);
+				err |= write_crlf(mb);
 				break;
 			}
 
-			if (!msg_param_exists(&msg->via.params, "rport", &rp)){
-				err |= mbuf_write_pl_skip(mb, &hdr->val, &rp);
-				err |= mbuf_printf(mb, ";rport=%u",
-						   sa_port(&msg->src));
+			err |= mbuf_write_pl(mb, &hdr->name);
+			err |= mbuf_write_mem(mb, (const uint8_t *)": ", 2);
+
+			memset(skipv, 0, sizeof(skipv));
+
+			if (!msg_param_exists(&msg->via.params, "rport",
+					      &skipv[0]))
 				rport = true;
+
+			oc = sip->oc && via_oc(&skipv[1], msg);
+
+			if (skipv[0].p && skipv[1].p &&
+			    skipv[1].p < skipv[0].p) {
+				struct pl t = skipv[0];
+
+				skipv[0] = skipv[1];
+				skipv[1] = t;
+			}
+
+			err |= write_skip(mb, &hdr->val, skipv, 2);
+
+			if (rport) {
+				err |= mbuf_write_str(mb, ";rport=");
+				err |= write_u32(mb, sa_port(&msg->src));
 			}
-			else
-				err |= mbuf_write_pl(mb, &hdr->val);
 
 			if (rport || !sa_cmp(&msg->src, &msg->via.addr,
-					     SA_ADDR))
-				err |= mbuf_printf(mb, ";received=%j",
-						   &msg->src);
+					     SA_ADDR)) {
+				err |= mbuf_write_str(mb, ";received=");
+				if (sa_ntop(&msg->src, addr, sizeof(addr)))
+					err |= mbuf_write_u8(mb, '?');
+				else
+					err |= mbuf_write_str(mb, addr);
+			}
+
+			if (oc)
+				err |= sip_overload_encode(mb, sip);
 
-			err |= mbuf_write_str(mb, "\r\n");
+			err |= write_crlf(mb);
 			break;
 
 		case SIP_HDR_TO:
-			err |= mbuf_printf(mb, "%r: %r", &hdr->name,
-					   &hdr->val);
+			err |= write_hdr(mb, hdr);
 			if (!pl_isset(&msg->to.tag) && scode > 100)
-				err |= mbuf_printf(mb, ";tag=%016llx",
-						   msg->tag);
-			err |= mbuf_write_str(mb, "\r\n");
+				err |= write_tag(mb, msg->tag);
+			err |= write_crlf(mb);
 			break;
 
 		case SIP_HDR_RECORD_ROUTE:
@@ -91,8 +242,8 @@ static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 		case SIP_HDR_FROM:
 		case SIP_HDR_CALL_ID:
 		case SIP_HDR_CSEQ:
-			err |= mbuf_printf(mb, "%r: %r\r\n",
-					   &hdr->name, &hdr->val);
+			err |= write_hdr(mb, hdr);
+			err |= write_crlf(mb);
 			break;
 
 		default:
@@ -100,13 +251,16 @@ static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 		}
 	}
 
-	if (sip->software)
-		err |= mbuf_printf(mb, "Server: %s\r\n", sip->software);
+	if (sip->software) {
+		err |= mbuf_write_str(mb, "Server: ");
+		err |= mbuf_write_str(mb, sip->software);
+		err |= write_crlf(mb);
+	}
 
 	if (fmt)
 		err |= mbuf_vprintf(mb, fmt, ap);
 	else
-		err |= mbuf_printf(mb, "Content-Length: 0\r\n\r\n");
+		err |= mbuf_write_str(mb, "Content-Length: 0\r\n\r\n");
 
 	if (err)
 		goto out;
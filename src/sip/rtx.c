@@ -0,0 +1,211 @@
+/**
+ * @file sip/rtx.c  SIP Retransmission Scheduler
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_fmt.h>
+#include <re_uri.h>
+#include <re_sys.h>
+#include <re_tmr.h>
+#include <re_udp.h>
+#include <re_msg.h>
+#include <re_sip.h>
+#include "sip.h"
+
+
+enum {
+	RTX_RES   = SIP_T1 / 4,  /* Slot width [ms]           */
+	RTX_SLOTS = 64,          /* Number of slots, power of 2 */
+};
+
+
+/*
+ * Timer wheel for transaction retransmissions. All retransmission
+ * intervals are multiples of the slot width, so transactions started
+ * in the same slot stay together and are handled by a single timer
+ * callback. Entries further away than one revolution stay in their
+ * slot until their tick is reached.
+ */
+struct sip_rtxw {
+	struct list slotv[RTX_SLOTS];
+	struct tmr tmr;
+	uint64_t tick;        /* Next tick to run      */
+	uint32_t n;           /* Number of entries     */
+	uint32_t fired;       /* Entries fired in total */
+	uint32_t batch_max;   /* Largest single batch  */
+};
+
+
+static void destructor(void *arg)
+{
+	struct sip_rtxw *w = arg;
+
+	tmr_cancel(&w->tmr);
+
+	for (size_t i=0; i<RTX_SLOTS; i++)
+		list_clear(&w->slotv[i]);
+}
+
+
+static void tmr_handler(void *arg);
+
+
+static void tmr_schedule(struct sip_rtxw *w)
+{
+	uint64_t now = tmr_jiffies();
+	uint64_t next = w->tick * RTX_RES;
+
+	tmr_start(&w->tmr, next > now ? next - now : 0, tmr_handler, w);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct sip_rtxw *w = arg;
+	uint64_t last = tmr_jiffies() / RTX_RES;
+	struct list due = LIST_INIT;
+	uint32_t batch = 0;
+	struct le *le;
+
+	for (uint64_t t = w->tick; t <= last && t < w->tick + RTX_SLOTS; t++) {
+
+		le = list_head(&w->slotv[t & (RTX_SLOTS-1)]);
+
+		while (le) {
+
+			struct sip_rtx *rtx = le->data;
+			le = le->next;
+
+			if (rtx->tick > last)
+				continue;
+
+			list_unlink(&rtx->le);
+			list_append(&due, &rtx->le, rtx);
+		}
+	}
+
+	w->tick = last + 1;
+
+	/* handlers may cancel or restart any entry, including those due */
+	mem_ref(w);
+
+	while ((le = list_head(&due))) {
+
+		struct sip_rtx *rtx = le->data;
+
+		list_unlink(le);
+		--w->n;
+		++batch;
+
+		rtx->h(rtx->arg);
+	}
+
+	w->fired += batch;
+	w->batch_max = MAX(w->batch_max, batch);
+
+	if (w->n)
+		tmr_schedule(w);
+
+	mem_deref(w);
+}
+
+
+int sip_rtx_init(struct sip *sip)
+{
+	struct sip_rtxw *w;
+
+	w = mem_zalloc(sizeof(*w), destructor);
+	if (!w)
+		return ENOMEM;
+
+	tmr_init(&w->tmr);
+
+	sip->rtxw = w;
+
+	return 0;
+}
+
+
+/**
+ * Schedule a retransmission. The handler is called in the first slot
+ * at or after the delay, i.e. at most one slot width late.
+ *
+ * @param sip   SIP stack instance
+ * @param rtx   Retransmission entry, owned by the caller
+ * @param delay Delay in [ms]
+ * @param h     Retransmission handler
+ * @param arg   Handler argument
+ */
+void sip_rtx_start(struct sip *sip, struct sip_rtx *rtx, uint64_t delay,
+		   sip_rtx_h *h, void *arg)
+{
+	struct sip_rtxw *w = sip->rtxw;
+	uint64_t now = tmr_jiffies();
+
+	sip_rtx_cancel(rtx);
+
+	if (!w->n)
+		w->tick = now / RTX_RES + 1;
+
+	rtx->w    = w;
+	rtx->tick = MAX((now + delay + RTX_RES - 1) / RTX_RES, w->tick);
+	rtx->h    = h;
+	rtx->arg  = arg;
+
+	list_append(&w->slotv[rtx->tick & (RTX_SLOTS-1)], &rtx->le, rtx);
+
+	if (!w->n++)
+		tmr_schedule(w);
+}
+
+
+void sip_rtx_cancel(struct sip_rtx *rtx)
+{
+	if (!rtx || !rtx->le.list)
+		return;
+
+	list_unlink(&rtx->le);
+	--rtx->w->n;
+}
+
+
+int sip_rtx_debug(struct re_printf *pf, const struct sip *sip)
+{
+	const struct sip_rtxw *w = sip->rtxw;
+	int err;
+
+	err = re_hprintf(pf, "retransmissions: %u pending, %u fired,"
+			 " largest batch %u\n", w->n, w->fired, w->batch_max);
+
+	for (size_t i=0; i<RTX_SLOTS && w->n; i++) {
+
+		uint64_t t = w->tick + i;
+		uint32_t n = 0, later = 0;
+		struct le *le;
+
+		le = list_head(&w->slotv[t & (RTX_SLOTS-1)]);
+		for (; le; le = le->next) {
+
+			const struct sip_rtx *rtx = le->data;
+
+			if (rtx->tick == t)
+				++n;
+			else
+				++later;
+		}
+
+		if (!n && !later)
+			continue;
+
+		err |= re_hprintf(pf, "  +%5zums: %u (%u later)\n",
+				  i * RTX_RES, n, later);
+	}
+
+	return err;
+}
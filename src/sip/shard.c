@@ -0,0 +1,349 @@
+/**
+ * @file shard.c  SIP Call-ID sharding across threads
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_fmt.h>
+#include <re_uri.h>
+#include <re_udp.h>
+#include <re_msg.h>
+#include <re_mqueue.h>
+#include <re_thread.h>
+#include <re_sip.h>
+#include "sip.h"
+
+
+#define DEBUG_MODULE "sipshard"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	SHARD_MSG    = 1,
+	SHARD_EXEC   = 2,
+	SHARD_RETURN = 3,
+};
+
+
+struct shard_ent {
+	struct sip *sip;
+	struct mqueue *mq;
+};
+
+/*
+ * A group of SIP stacks, each running in its own re thread. Every
+ * Call-ID is owned by exactly one shard, which holds all transactions
+ * and dialogs for it.
+ */
+struct sip_shard {
+	mtx_t *mtx;
+	struct shard_ent *entv;
+	uint32_t n;
+};
+
+struct shard_job {
+	struct mbuf *mb;
+	struct sa src;
+	struct sa dst;
+	sip_shard_h *h;
+	void *arg;
+	uint32_t from;     /* Index of the shard which received it */
+};
+
+
+static void destructor(void *arg)
+{
+	struct sip_shard *sh = arg;
+
+	mem_deref(sh->entv);
+	mem_deref(sh->mtx);
+}
+
+
+static void job_destructor(void *arg)
+{
+	struct shard_job *job = arg;
+
+	mem_deref(job->mb);
+}
+
+
+/* Push a job to the owner of idx, the job is consumed on success */
+static int shard_push(struct sip_shard *sh, uint32_t idx, int id,
+		      struct shard_job *job)
+{
+	int err;
+
+	mtx_lock(sh->mtx);
+
+	if (sh->entv[idx].mq)
+		err = mqueue_push(sh->entv[idx].mq, id, job);
+	else
+		err = ENOENT;
+
+	mtx_unlock(sh->mtx);
+
+	return err;
+}
+
+
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	struct shard_job *job = data;
+	struct sip *sip = arg;
+	int err;
+
+	switch (id) {
+
+	case SHARD_MSG:
+		err = sip_transp_udp_recv(sip, &job->dst, &job->src, job->mb);
+		if (err != ENOENT)
+			break;
+
+		/* no transport on that address here, hand it back */
+		if (!shard_push(sip->shard, job->from, SHARD_RETURN, job))
+			return;
+
+		DEBUG_WARNING("shard %u: no transport on %J, dropped\n",
+			      sip->shard_idx, &job->dst);
+		break;
+
+	case SHARD_RETURN:
+		err = sip_transp_udp_recv(sip, &job->dst, &job->src, job->mb);
+		if (err) {
+			DEBUG_WARNING("shard %u: no transport on %J,"
+				      " dropped (%m)\n",
+				      sip->shard_idx, &job->dst, err);
+		}
+		break;
+
+	case SHARD_EXEC:
+		job->h(sip, job->arg);
+		break;
+
+	default:
+		break;
+	}
+
+	mem_deref(job);
+}
+
+
+/**
+ * Allocate a SIP shard group
+ *
+ * @param shp Pointer to allocated shard group
+ * @param n   Number of shards
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_shard_alloc(struct sip_shard **shp, uint32_t n)
+{
+	struct sip_shard *sh;
+	int err;
+
+	if (!shp || !n)
+		return EINVAL;
+
+	sh = mem_zalloc(sizeof(*sh), destructor);
+	if (!sh)
+		return ENOMEM;
+
+	sh->entv = mem_zalloc(n * sizeof(*sh->entv), NULL);
+	if (!sh->entv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	sh->n = n;
+
+	err = mutex_alloc(&sh->mtx);
+
+ out:
+	if (err)
+		mem_deref(sh);
+	else
+		*shp = sh;
+
+	return err;
+}
+
+
+/**
+ * Attach a SIP stack to a shard group. Must be called from the thread
+ * which runs the SIP stack, before any transports are added. UDP
+ * transports added afterwards share their local port with the other
+ * shards, and incoming requests and responses are handed over to the
+ * shard owning their Call-ID.
+ *
+ * @param sh  SIP shard group
+ * @param idx Shard index
+ * @param sip SIP stack instance
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_shard_attach(struct sip_shard *sh, uint32_t idx, struct sip *sip)
+{
+	struct mqueue *mq;
+	int err;
+
+	if (!sh || idx >= sh->n || !sip || sip->shard)
+		return EINVAL;
+
+	err = mqueue_alloc(&mq, mqueue_handler, sip);
+	if (err)
+		return err;
+
+	mtx_lock(sh->mtx);
+
+	if (sh->entv[idx].sip) {
+		err = EALREADY;
+	}
+	else {
+		sh->entv[idx].sip = sip;
+		sh->entv[idx].mq  = mq;
+	}
+
+	mtx_unlock(sh->mtx);
+
+	if (err) {
+		mem_deref(mq);
+		return err;
+	}
+
+	sip->shard     = mem_ref(sh);
+	sip->shard_idx = idx;
+
+	return 0;
+}
+
+
+void sip_shard_detach(struct sip *sip)
+{
+	struct sip_shard *sh = sip->shard;
+	struct mqueue *mq;
+
+	if (!sh)
+		return;
+
+	mtx_lock(sh->mtx);
+	mq = sh->entv[sip->shard_idx].mq;
+	sh->entv[sip->shard_idx].sip = NULL;
+	sh->entv[sip->shard_idx].mq  = NULL;
+	mtx_unlock(sh->mtx);
+
+	mem_deref(mq);
+
+	sip->shard = mem_deref(sip->shard);
+}
+
+
+/**
+ * Get the index of the shard owning a Call-ID
+ *
+ * @param sh     SIP shard group
+ * @param callid Call-ID
+ *
+ * @return Shard index
+ */
+uint32_t sip_shard_index(const struct sip_shard *sh, const struct pl *callid)
+{
+	if (!sh || !pl_isset(callid))
+		return 0;
+
+	return hash_joaat((const uint8_t *)callid->p, callid->l) % sh->n;
+}
+
+
+/**
+ * Run a handler in the thread of the shard owning a Call-ID. Use this to
+ * send requests and replies for a call from any thread, so that its
+ * transactions live in the same shard as its incoming messages.
+ *
+ * @param sh     SIP shard group
+ * @param callid Call-ID
+ * @param h      Handler, called with the owning SIP stack
+ * @param arg    Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_shard_exec(struct sip_shard *sh, const struct pl *callid,
+		   sip_shard_h *h, void *arg)
+{
+	struct shard_job *job;
+	int err;
+
+	if (!sh || !h)
+		return EINVAL;
+
+	job = mem_zalloc(sizeof(*job), job_destructor);
+	if (!job)
+		return ENOMEM;
+
+	job->h   = h;
+	job->arg = arg;
+
+	err = shard_push(sh, sip_shard_index(sh, callid), SHARD_EXEC, job);
+	if (err)
+		mem_deref(job);
+
+	return err;
+}
+
+
+/**
+ * Hand a received message over to the shard owning its Call-ID. If the
+ * owner has no UDP transport on the local address of the message, it is
+ * handed back and handled by the receiving shard.
+ *
+ * @param sip   SIP stack which received the message
+ * @param msg   Received SIP message
+ * @param start Start of the message in msg->mb
+ *
+ * @return True if the message was handed over, false to handle it here
+ */
+bool sip_shard_steer(struct sip *sip, const struct sip_msg *msg,
+		     size_t start)
+{
+	struct sip_shard *sh = sip->shard;
+	struct shard_job *job;
+	uint32_t idx;
+	int err;
+
+	idx = sip_shard_index(sh, &msg->callid);
+	if (idx == sip->shard_idx)
+		return false;
+
+	job = mem_zalloc(sizeof(*job), job_destructor);
+	if (!job)
+		return false;
+
+	job->mb = mbuf_alloc(msg->mb->end - start);
+	if (!job->mb)
+		goto out;
+
+	err = mbuf_write_mem(job->mb, msg->mb->buf + start,
+			     msg->mb->end - start);
+	if (err)
+		goto out;
+
+	job->mb->pos = 0;
+	job->src = msg->src;
+	job->dst = msg->dst;
+	job->from = sip->shard_idx;
+
+	err = shard_push(sh, idx, SHARD_MSG, job);
+	if (!err)
+		return true;
+
+ out:
+	mem_deref(job);
+
+	return false;
+}
@@ -59,6 +59,9 @@ static void destructor(void *arg)
 		return;
 	}
 
+	sip_shard_detach(sip);
+	sip->oc = mem_deref(sip->oc);
+
 	sip_request_close(sip);
 	sip_request_close(sip);
 
@@ -70,6 +73,8 @@ static void destructor(void *arg)
 	mem_deref(sip->ht_strans);
 	mem_deref(sip->ht_strans_mrg);
 
+	mem_deref(sip->rtxw);
+
 	hash_flush(sip->ht_conn);
 	mem_deref(sip->ht_conn);
 	hash_flush(sip->ht_conncfg);
@@ -105,8 +110,8 @@ static void lsnr_destructor(void *arg)
  *
  * @param sipp     Pointer to allocated SIP stack
  * @param dnsc     DNS Client (optional)
- * @param ctsz     Size of client transactions hashtable (power of 2)
- * @param stsz     Size of server transactions hashtable (power of 2)
+ * @param ctsz     Initial size of client transactions hashtable (power of 2)
+ * @param stsz     Initial size of server transactions hashtable (power of 2)
  * @param tcsz     Size of SIP transport hashtable (power of 2)
  * @param software Software identifier
  * @param exith    SIP-stack exit handler
@@ -133,6 +138,10 @@ int sip_alloc(struct sip **sipp, struct dnsc *dnsc, uint32_t ctsz,
 	if (err)
 		goto out;
 
+	err = sip_rtx_init(sip);
+	if (err)
+		goto out;
+
 	err = sip_ctrans_init(sip, ctsz);
 	if (err)
 		goto out;
@@ -293,6 +302,7 @@ int sip_debug(struct re_printf *pf, const struct sip *sip)
 	err  = sip_transp_debug(pf, sip);
 	err |= sip_ctrans_debug(pf, sip);
 	err |= sip_strans_debug(pf, sip);
+	err |= sip_rtx_debug(pf, sip);
 
 	return err;
 }
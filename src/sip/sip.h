@@ -18,6 +18,11 @@ struct sip {
 	struct dnsc *dnsc;
 	struct stun *stun;
 	struct websock *websock;
+	struct sip_shard *shard;
+	uint32_t shard_idx;
+	struct sip_overload *oc;
+	struct sip_rtxw *rtxw;
+	uint32_t strans_n;
 	char *software;
 	sip_exit_h *exith;
 	sip_trace_h *traceh;
@@ -49,6 +54,35 @@ struct sip_keepalive {
 void sip_request_close(struct sip *sip);
 
 
+/* overload */
+bool sip_overload_reject(struct sip *sip, const struct sip_msg *msg);
+int  sip_overload_encode(struct mbuf *mb, const struct sip *sip);
+
+
+/* rtx */
+typedef void (sip_rtx_h)(void *arg);
+
+struct sip_rtx {
+	struct le le;
+	struct sip_rtxw *w;
+	uint64_t tick;
+	sip_rtx_h *h;
+	void *arg;
+};
+
+int  sip_rtx_init(struct sip *sip);
+void sip_rtx_start(struct sip *sip, struct sip_rtx *rtx, uint64_t delay,
+		   sip_rtx_h *h, void *arg);
+void sip_rtx_cancel(struct sip_rtx *rtx);
+int  sip_rtx_debug(struct re_printf *pf, const struct sip *sip);
+
+
+/* shard */
+bool sip_shard_steer(struct sip *sip, const struct sip_msg *msg,
+		     size_t start);
+void sip_shard_detach(struct sip *sip);
+
+
 /* ctrans */
 struct sip_ctrans;
 
@@ -64,6 +98,7 @@ int  sip_ctrans_debug(struct re_printf *pf, const struct sip *sip);
 
 /* strans */
 int  sip_strans_init(struct sip *sip, uint32_t sz);
+bool sip_strans_exists(struct sip *sip, const struct sip_msg *msg);
 int  sip_strans_debug(struct re_printf *pf, const struct sip *sip);
 
 
@@ -80,6 +115,8 @@ int  sip_transp_send(struct sip_connqent **qentp, struct sip *sip, void *sock,
 bool sip_transp_supported(struct sip *sip, enum sip_transp tp, int af);
 const char *sip_transp_srvid(enum sip_transp tp);
 bool sip_transp_reliable(enum sip_transp tp);
+int  sip_transp_udp_recv(struct sip *sip, const struct sa *laddr,
+			 const struct sa *src, struct mbuf *mb);
 int  sip_transp_debug(struct re_printf *pf, const struct sip *sip);
 
 
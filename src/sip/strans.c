@@ -32,7 +32,7 @@ struct sip_strans {
 	struct le he;
 	struct le he_mrg;
 	struct tmr tmr;
-	struct tmr tmrg;
+	struct sip_rtx rtx;
 	struct sa dst;
 	struct sip *sip;
 	struct sip_msg *msg;
@@ -49,10 +49,13 @@ static void destructor(void *arg)
 {
 	struct sip_strans *st = arg;
 
+	if (st->sip)
+		--st->sip->strans_n;
+
 	hash_unlink(&st->he);
 	hash_unlink(&st->he_mrg);
 	tmr_cancel(&st->tmr);
-	tmr_cancel(&st->tmrg);
+	sip_rtx_cancel(&st->rtx);
 	mem_deref(st->msg);
 	mem_deref(st->mb);
 }
@@ -161,8 +164,8 @@ static void retransmit_handler(void *arg)
 		       st->mb);
 
 	st->txc++;
-	tmr_start(&st->tmrg, MIN(SIP_T1<<st->txc, SIP_T2), retransmit_handler,
-		  st);
+	sip_rtx_start(st->sip, &st->rtx, MIN(SIP_T1<<st->txc, SIP_T2),
+		      retransmit_handler, st);
 }
 
 
@@ -189,7 +192,7 @@ static bool ack_handler(struct sip *sip, const struct sip_msg *msg)
 		}
 
 		tmr_start(&st->tmr, SIP_T4, tmr_handler, st);
-		tmr_cancel(&st->tmrg);
+		sip_rtx_cancel(&st->rtx);
 		st->state = CONFIRMED;
 		break;
 
@@ -298,12 +301,6 @@ int sip_strans_alloc(struct sip_strans **stp, struct sip *sip,
 	if (!st)
 		return ENOMEM;
 
-	hash_append(sip->ht_strans, hash_joaat_pl(&msg->via.branch),
-		    &st->he, st);
-
-	hash_append(sip->ht_strans_mrg, hash_joaat_pl(&msg->callid),
-		    &st->he_mrg, st);
-
 	st->invite  = !pl_strcmp(&msg->met, "INVITE");
 	st->msg     = mem_ref((void *)msg);
 	st->state   = TRYING;
@@ -311,6 +308,14 @@ int sip_strans_alloc(struct sip_strans **stp, struct sip *sip,
 	st->arg     = arg;
 	st->sip     = sip;
 
+	hash_append(sip->ht_strans, hash_joaat_pl(&msg->via.branch),
+		    &st->he, st);
+
+	hash_append(sip->ht_strans_mrg, hash_joaat_pl(&msg->callid),
+		    &st->he_mrg, st);
+
+	++sip->strans_n;
+
 	*stp = st;
 
 	return 0;
@@ -375,8 +380,8 @@ int sip_strans_reply(struct sip_strans **stp, struct sip *sip,
 			st->state = COMPLETED;
 
 			if (!sip_transp_reliable(st->msg->tp))
-				tmr_start(&st->tmrg, SIP_T1,
-					  retransmit_handler, st);
+				sip_rtx_start(sip, &st->rtx, SIP_T1,
+					      retransmit_handler, st);
 		}
 	}
 	else {
@@ -399,6 +404,30 @@ int sip_strans_reply(struct sip_strans **stp, struct sip *sip,
 }
 
 
+bool sip_strans_exists(struct sip *sip, const struct sip_msg *msg)
+{
+	return NULL != hash_lookup(sip->ht_strans,
+				   hash_joaat_pl(&msg->via.branch),
+				   cmp_handler, (void *)msg);
+}
+
+
+static uint32_t strans_key(const struct le *le)
+{
+	const struct sip_strans *st = le->data;
+
+	return hash_joaat_pl(&st->msg->via.branch);
+}
+
+
+static uint32_t strans_mrg_key(const struct le *le)
+{
+	const struct sip_strans *st = le->data;
+
+	return hash_joaat_pl(&st->msg->callid);
+}
+
+
 int sip_strans_init(struct sip *sip, uint32_t sz)
 {
 	int err;
@@ -407,11 +436,11 @@ int sip_strans_init(struct sip *sip, uint32_t sz)
 	if (err)
 		return err;
 
-	err = hash_alloc(&sip->ht_strans_mrg, sz);
+	err = hash_alloc_auto(&sip->ht_strans_mrg, sz, strans_mrg_key);
 	if (err)
 		return err;
 
-	return hash_alloc(&sip->ht_strans, sz);
+	return hash_alloc_auto(&sip->ht_strans, sz, strans_key);
 }
 
 
@@ -74,6 +74,9 @@ struct sip_conn {
 	struct tcp_conn *tc;
 	struct mbuf *mb;
 	struct sip *sip;
+	size_t scan;          /* Header scan offset in current message  */
+	size_t hlen;          /* Header length, 0 until headers complete */
+	uint32_t clen;
 	uint32_t ka_interval;
 	bool established;
 
@@ -377,13 +380,54 @@ static void sip_recv(struct sip *sip, const struct sip_msg *msg,
 }
 
 
+static void udp_recv(struct sip_transport *transp, const struct sa *src,
+		     struct mbuf *mb, bool steer)
+{
+	struct sip *sip = transp->sip;
+	size_t start = mb->pos;
+	struct sip_msg *msg;
+	int err;
+
+	/* only a few fields are needed for steering and overload control */
+	if (sip->shard || sip->oc)
+		err = sip_msg_decode_lazy(&msg, mb);
+	else
+		err = sip_msg_decode(&msg, mb);
+	if (err) {
+		(void)re_fprintf(stderr, "sip: msg decode err: %m\n", err);
+		return;
+	}
+
+	msg->sock = mem_ref(transp->sock);
+	msg->src = *src;
+	msg->dst = transp->laddr;
+	msg->tp = SIP_TRANSP_UDP;
+	sa_set_scopeid(&msg->src, sa_scopeid(&transp->laddr));
+
+	if (steer && sip->shard && sip_shard_steer(sip, msg, start))
+		goto out;
+
+	if (sip_overload_reject(sip, msg))
+		goto out;
+
+	err = sip_msg_parse(msg);
+	if (err) {
+		(void)re_fprintf(stderr, "sip: msg decode err: %m\n", err);
+		goto out;
+	}
+
+	sip_recv(sip, msg, start);
+
+ out:
+	mem_deref(msg);
+}
+
+
 static void udp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 {
 	struct sip_transport *transp = arg;
 	struct stun_unknown_attr ua;
 	struct stun_msg *stun_msg;
-	struct sip_msg *msg;
-	int err;
 
 	if (mb->end <= 4)
 		return;
@@ -416,144 +460,298 @@ static void udp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 		return;
 	}
 
-	err = sip_msg_decode(&msg, mb);
-	if (err) {
-		(void)re_fprintf(stderr, "sip: msg decode err: %m\n", err);
-		return;
+	udp_recv(transp, src, mb, true);
+}
+
+
+/**
+ * Receive a SIP message on a UDP transport with the given local address,
+ * used for messages handed over from another SIP shard
+ *
+ * @param sip   SIP stack instance
+ * @param laddr Local address the message was received on
+ * @param src   Source address
+ * @param mb    Buffer containing the SIP message
+ *
+ * @return 0 if success, ENOENT if there is no such transport
+ */
+int sip_transp_udp_recv(struct sip *sip, const struct sa *laddr,
+			const struct sa *src, struct mbuf *mb)
+{
+	struct le *le;
+
+	if (!sip || !laddr || !src || !mb)
+		return EINVAL;
+
+	for (le = sip->transpl.head; le; le = le->next) {
+
+		struct sip_transport *transp = le->data;
+
+		if (transp->tp != SIP_TRANSP_UDP)
+			continue;
+
+		if (!sa_cmp(&transp->laddr, laddr, SA_ALL))
+			continue;
+
+		udp_recv(transp, src, mb, false);
+		return 0;
 	}
 
-	msg->sock = mem_ref(transp->sock);
-	msg->src = *src;
-	msg->dst = transp->laddr;
-	msg->tp = SIP_TRANSP_UDP;
-	sa_set_scopeid(&msg->src, sa_scopeid(&transp->laddr));
+	return ENOENT;
+}
 
-	sip_recv(transp->sip, msg, 0);
 
-	mem_deref(msg);
+/*
+ * Find the empty line ending the headers, resuming at *scan. Returns the
+ * header length, or 0 with *scan updated if the headers are incomplete.
+ */
+static size_t hdr_end(const uint8_t *p, size_t l, size_t *scan)
+{
+	size_t i = *scan;
+
+	while (i < l) {
+
+		const uint8_t *lf = memchr(p + i, '\n', l - i);
+		size_t j;
+
+		if (!lf)
+			break;
+
+		j = lf - p + 1;
+		while (j < l && p[j] == '\r')
+			++j;
+
+		if (j == l) {
+			*scan = lf - p;
+			return 0;
+		}
+
+		if (p[j] == '\n')
+			return j + 1;
+
+		i = j;
+	}
+
+	*scan = l;
+
+	return 0;
 }
 
 
-static void tcp_recv_handler(struct mbuf *mb, void *arg)
+/* Get the Content-Length from a complete header block */
+static int clen_decode(uint32_t *clenp, const uint8_t *p, size_t l)
 {
-	struct sip_conn *conn = arg;
-	size_t pos;
-	int err = 0;
+	const char *s = (const char *)p, *e = s + l;
+	int err = EBADMSG;
 
-	if (conn->mb) {
-		pos = conn->mb->pos;
+	while (s < e) {
 
-		conn->mb->pos = conn->mb->end;
+		const char *eol = memchr(s, '\n', e - s);
+		const char *c;
+		struct pl name, val;
 
-		err = mbuf_write_mem(conn->mb, mbuf_buf(mb),mbuf_get_left(mb));
-		if (err)
-			goto out;
+		if (!eol)
+			break;
 
-		conn->mb->pos = pos;
+		c = memchr(s, ':', eol - s);
+		if (!c || *s == ' ' || *s == '\t')
+			goto next;
 
-		if (mbuf_get_left(conn->mb) > TCP_BUFSIZE_MAX) {
-			err = EOVERFLOW;
-			goto out;
+		name.p = s;
+		name.l = c - s;
+		while (name.l && (s[name.l-1] == ' ' || s[name.l-1] == '\t'))
+			--name.l;
+
+		if (pl_strcasecmp(&name, "Content-Length") &&
+		    pl_strcasecmp(&name, "l"))
+			goto next;
+
+		val.p = c + 1;
+		val.l = eol - val.p;
+
+		while (val.l && (*val.p == ' ' || *val.p == '\t')) {
+			++val.p;
+			--val.l;
 		}
+
+		while (val.l && (val.p[val.l-1] == ' ' ||
+				 val.p[val.l-1] == '\t' ||
+				 val.p[val.l-1] == '\r'))
+			--val.l;
+
+		if (!val.l)
+			return EBADMSG;
+
+		*clenp = pl_u32(&val);
+		err = 0;
+
+	next:
+		s = eol + 1;
 	}
-	else {
+
+	return err;
+}
+
+
+/*
+ * Append received data to the connection buffer. Complete messages are
+ * handed out as slices sharing the buffer memory, so a buffer which is
+ * still referenced is never written to or reallocated.
+ */
+static int conn_buf_append(struct sip_conn *conn, struct mbuf *mb)
+{
+	struct mbuf *cmb = conn->mb;
+	int err;
+
+	if (!cmb) {
 		conn->mb = mem_ref(mb);
+		return 0;
 	}
 
+	if (mem_nrefs(cmb->buf) > 1) {
+
+		cmb = mbuf_alloc(mbuf_get_left(conn->mb) + mbuf_get_left(mb));
+		if (!cmb)
+			return ENOMEM;
+
+		(void)mbuf_write_mem(cmb, mbuf_buf(conn->mb),
+				     mbuf_get_left(conn->mb));
+
+		mem_deref(conn->mb);
+		conn->mb = cmb;
+	}
+	else if (cmb->pos) {
+
+		err = mbuf_shift(cmb, -(ssize_t)cmb->pos);
+		if (err)
+			return err;
+	}
+
+	cmb->pos = cmb->end;
+
+	err = mbuf_write_mem(cmb, mbuf_buf(mb), mbuf_get_left(mb));
+
+	cmb->pos = 0;
+
+	if (err)
+		return err;
+
+	if (mbuf_get_left(cmb) > TCP_BUFSIZE_MAX)
+		return EOVERFLOW;
+
+	return 0;
+}
+
+
+static void tcp_recv_handler(struct mbuf *mb, void *arg)
+{
+	struct sip_conn *conn = arg;
+	int err;
+
+	err = conn_buf_append(conn, mb);
+	if (err)
+		goto out;
+
 	for (;;) {
 		struct sip_msg *msg;
-		uint32_t clen;
-		size_t end;
+		const uint8_t *p;
+		size_t left;
 
-		if (mbuf_get_left(conn->mb) < 2)
-			break;
-
-		if (!memcmp(mbuf_buf(conn->mb), "\r\n", 2)) {
+		p    = mbuf_buf(conn->mb);
+		left = mbuf_get_left(conn->mb);
 
-			tmr_start(&conn->tmr, TCP_IDLE_TIMEOUT * 1000,
-				  conn_tmr_handler, conn);
+		if (!conn->hlen) {
 
-			conn->mb->pos += 2;
+			if (left < 2)
+				break;
 
-			if (mbuf_get_left(conn->mb) >= 2 &&
-			    !memcmp(mbuf_buf(conn->mb), "\r\n", 2)) {
+			if (!conn->scan && !memcmp(p, "\r\n", 2)) {
 
-				struct mbuf mbr;
+				tmr_start(&conn->tmr, TCP_IDLE_TIMEOUT * 1000,
+					  conn_tmr_handler, conn);
 
 				conn->mb->pos += 2;
 
-				mbr.buf  = crlfcrlf;
-				mbr.size = sizeof(crlfcrlf);
-				mbr.pos  = 0;
-				mbr.end  = 2;
+				if (mbuf_get_left(conn->mb) >= 2 &&
+				    !memcmp(mbuf_buf(conn->mb), "\r\n", 2)) {
 
-				err = tcp_send(conn->tc, &mbr);
-				if (err)
-					break;
+					struct mbuf mbr;
+
+					conn->mb->pos += 2;
+
+					mbr.buf  = crlfcrlf;
+					mbr.size = sizeof(crlfcrlf);
+					mbr.pos  = 0;
+					mbr.end  = 2;
+
+					err = tcp_send(conn->tc, &mbr);
+					if (err)
+						break;
+				}
+
+				if (mbuf_get_left(conn->mb))
+					continue;
+
+				conn->mb = mem_deref(conn->mb);
+				break;
 			}
 
-			if (mbuf_get_left(conn->mb))
-				continue;
+			conn->hlen = hdr_end(p, left, &conn->scan);
+			if (!conn->hlen)
+				break;
 
-			conn->mb = mem_deref(conn->mb);
+			err = clen_decode(&conn->clen, p, conn->hlen);
+			if (err)
+				break;
+		}
+
+		if (left < conn->hlen + conn->clen)
+			break;
+
+		mb = mbuf_alloc_ref(conn->mb);
+		if (!mb) {
+			err = ENOMEM;
 			break;
 		}
 
-		pos = conn->mb->pos;
+		mb->end = mb->pos + conn->hlen + conn->clen;
+
+		conn->mb->pos = mb->end;
+		conn->scan = 0;
+		conn->hlen = 0;
+		conn->clen = 0;
 
-		err = sip_msg_decode(&msg, conn->mb);
+		err = sip_msg_decode(&msg, mb);
+		mem_deref(mb);
 		if (err) {
 			if (err == ENODATA)
-				err = 0;
+				err = EBADMSG;
 			break;
 		}
 
-		if (!msg->clen.p) {
+		if (!msg->clen.p ||
+		    pl_u32(&msg->clen) != mbuf_get_left(msg->mb)) {
 			mem_deref(msg);
 			err = EBADMSG;
 			break;
 		}
 
-		clen = pl_u32(&msg->clen);
-
-		if (mbuf_get_left(conn->mb) < clen) {
-			conn->mb->pos = pos;
-			mem_deref(msg);
-			break;
-		}
-
 		tmr_start(&conn->tmr, TCP_IDLE_TIMEOUT * 1000,
 			  conn_tmr_handler, conn);
 
-		end = conn->mb->end;
-
-		msg->mb->end = msg->mb->pos + clen;
 		msg->sock = mem_ref(conn);
 		msg->src = conn->paddr;
 		msg->dst = conn->laddr;
 		msg->tp = conn->sc ? SIP_TRANSP_TLS : SIP_TRANSP_TCP;
 
-		sip_recv(conn->sip, msg, 0);
+		if (!sip_overload_reject(conn->sip, msg))
+			sip_recv(conn->sip, msg, 0);
 		mem_deref(msg);
 
-		if (end <= conn->mb->end) {
+		if (!mbuf_get_left(conn->mb)) {
 			conn->mb = mem_deref(conn->mb);
 			break;
 		}
-
-		mb = mbuf_alloc(end - conn->mb->end);
-		if (!mb) {
-			err = ENOMEM;
-			goto out;
-		}
-
-		(void)mbuf_write_mem(mb, &conn->mb->buf[conn->mb->end],
-				     end - conn->mb->end);
-
-		mb->pos = 0;
-
-		mem_deref(conn->mb);
-		conn->mb = mb;
 	}
 
  out:
@@ -945,7 +1143,8 @@ static void websock_recv_handler(const struct websock_hdr *hdr,
 	msg->dst = conn->laddr;
 	msg->tp = conn->tp;
 
-	sip_recv(conn->sip, msg, start);
+	if (!sip_overload_reject(conn->sip, msg))
+		sip_recv(conn->sip, msg, start);
 
 	mem_deref(msg);
 }
@@ -1216,8 +1415,13 @@ int sip_transp_add(struct sip *sip, enum sip_transp tp,
 	switch (tp) {
 
 	case SIP_TRANSP_UDP:
-		err = udp_listen((struct udp_sock **)&transp->sock, laddr,
-				 udp_recv_handler, transp);
+		if (sip->shard)
+			err = udp_listen_shared((struct udp_sock **)
+						&transp->sock, laddr,
+						udp_recv_handler, transp);
+		else
+			err = udp_listen((struct udp_sock **)&transp->sock,
+					 laddr, udp_recv_handler, transp);
 		if (err)
 			break;
 
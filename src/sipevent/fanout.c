@@ -0,0 +1,229 @@
+/**
+ * @file sipevent/fanout.c  SIP Event Notify fan-out
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_fmt.h>
+#include <re_uri.h>
+#include <re_tmr.h>
+#include <re_msg.h>
+#include <re_sip.h>
+#include <re_sipevent.h>
+#include "sipevent.h"
+
+
+enum {
+	FANOUT_TICK  = 10,   /* Send interval when rate limited [ms] */
+	FANOUT_BURST = 256,  /* NOTIFYs per loop iteration otherwise */
+};
+
+
+/*
+ * Send queue shared by many notifiers. A state update only replaces
+ * the body of each notifier and queues it once, so watchers which are
+ * still waiting for their turn get the latest state.
+ */
+struct sipevent_fanout {
+	struct list sendq;
+	struct tmr tmr;
+	uint64_t ts;          /* Time of last credit update [ms]  */
+	uint64_t credit;      /* Send credit [1/1000 NOTIFY]       */
+	uint32_t rate;        /* Max. NOTIFYs per second, 0 is any */
+};
+
+
+static void destructor(void *arg)
+{
+	struct sipevent_fanout *fo = arg;
+
+	tmr_cancel(&fo->tmr);
+	list_clear(&fo->sendq);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct sipevent_fanout *fo = arg;
+	uint64_t now = tmr_jiffies();
+	uint32_t budget;
+	struct le *le;
+
+	if (fo->rate) {
+		fo->credit += (now - fo->ts) * fo->rate;
+		fo->credit  = MIN(fo->credit,
+				  MAX(fo->rate * FANOUT_TICK, 1000));
+		budget = (uint32_t)(fo->credit / 1000);
+	}
+	else {
+		budget = FANOUT_BURST;
+	}
+
+	fo->ts = now;
+
+	while (budget-- && (le = list_head(&fo->sendq))) {
+
+		struct sipnot *not = le->data;
+
+		list_unlink(le);
+
+		if (fo->rate)
+			fo->credit -= 1000;
+
+		if (not->terminated)
+			continue;
+
+		(void)sipnot_notify(not);
+	}
+
+	if (!list_isempty(&fo->sendq))
+		tmr_start(&fo->tmr, fo->rate ? FANOUT_TICK : 0,
+			  tmr_handler, fo);
+}
+
+
+static int content_encode(struct mbuf **mbp, const char *ctype,
+			  const struct mbuf *body)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(64 + str_len(ctype) + mbuf_get_left(body));
+	if (!mb)
+		return ENOMEM;
+
+	err = mbuf_printf(mb,
+			  "Content-Type: %s\r\n"
+			  "Content-Length: %zu\r\n"
+			  "\r\n"
+			  "%b",
+			  ctype,
+			  mbuf_get_left(body),
+			  mbuf_buf(body), mbuf_get_left(body));
+	if (err) {
+		mem_deref(mb);
+		return err;
+	}
+
+	mb->pos = 0;
+	*mbp = mb;
+
+	return 0;
+}
+
+
+/**
+ * Allocate a NOTIFY fan-out queue
+ *
+ * @param fop  Pointer to allocated fan-out queue
+ * @param rate Max. number of NOTIFY requests per second, 0 for no limit
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sipevent_fanout_alloc(struct sipevent_fanout **fop, uint32_t rate)
+{
+	struct sipevent_fanout *fo;
+
+	if (!fop)
+		return EINVAL;
+
+	fo = mem_zalloc(sizeof(*fo), destructor);
+	if (!fo)
+		return ENOMEM;
+
+	tmr_init(&fo->tmr);
+	fo->rate = rate;
+
+	*fop = fo;
+
+	return 0;
+}
+
+
+/**
+ * Notify a set of subscriptions of the same state change. The content
+ * headers and body are encoded once per content type and shared by all
+ * requests, which are sent from the fan-out queue without blocking the
+ * main loop. Each subscription is queued at most once, and the RFC 6446
+ * rate limit of every subscription still applies.
+ *
+ * @param fo    NOTIFY fan-out queue
+ * @param notv  Array of SIP Event notifiers
+ * @param notc  Number of notifiers
+ * @param mb    Message body (optional)
+ * @param state Subscription state, active or pending
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sipevent_fanout(struct sipevent_fanout *fo, struct sipnot * const *notv,
+		    size_t notc, struct mbuf *mb, enum sipevent_subst state)
+{
+	struct mbuf *content = NULL;
+	const char *ctype = NULL;
+	int err = 0;
+
+	if (!fo || (!notv && notc))
+		return EINVAL;
+
+	if (state != SIPEVENT_ACTIVE && state != SIPEVENT_PENDING)
+		return EINVAL;
+
+	for (size_t i=0; i<notc; i++) {
+
+		struct sipnot *not = notv[i];
+
+		if (!not || not->terminated)
+			continue;
+
+		if (mb && (!ctype || strcmp(ctype, not->ctype))) {
+
+			content = mem_deref(content);
+			ctype   = not->ctype;
+
+			err = content_encode(&content, ctype, mb);
+			if (err)
+				break;
+		}
+
+		mem_deref(not->mb);
+		mem_deref(not->content);
+		not->mb       = mem_ref(mb);
+		not->content  = mem_ref(content);
+		not->substate = state;
+
+		if (!not->fle.list)
+			list_append(&fo->sendq, &not->fle, not);
+	}
+
+	mem_deref(content);
+
+	if (!list_isempty(&fo->sendq) && !tmr_isrunning(&fo->tmr)) {
+
+		/* an idle queue may send one tick worth at once */
+		fo->ts     = tmr_jiffies();
+		fo->credit = MAX(fo->rate * FANOUT_TICK, 1000);
+
+		tmr_start(&fo->tmr, 0, tmr_handler, fo);
+	}
+
+	return err;
+}
+
+
+/**
+ * Get the number of subscriptions waiting in the fan-out queue
+ *
+ * @param fo NOTIFY fan-out queue
+ *
+ * @return Number of queued subscriptions
+ */
+uint32_t sipevent_fanout_pending(const struct sipevent_fanout *fo)
+{
+	return fo ? list_count(&fo->sendq) : 0;
+}
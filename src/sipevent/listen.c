@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
@@ -40,7 +41,13 @@ static bool event_cmp(const struct sipevent_event *evt,
 		      const char *event, const char *id,
 		      int32_t refer_cseq)
 {
-	if (pl_strcmp(&evt->event, event))
+	struct pl name;
+
+	/* a subscribed event may carry parameters, e.g. max-rate */
+	pl_set_str(&name, event);
+	name.l = strcspn(event, ";");
+
+	if (pl_cmp(&evt->event, &name))
 		return false;
 
 	if (!pl_isset(&evt->id) && !id)
@@ -285,6 +292,7 @@ static void subscribe_handler(struct sipevent_sock *sock,
 
 	(void)sip_dialog_update(not->dlg, msg);
 
+	sipnot_rate_set(not, &event.params);
 	sipnot_refresh(not, expires);
 
 	(void)sipnot_reply(not, msg, 200, "OK");
@@ -20,6 +20,7 @@
 
 
 static int notify_request(struct sipnot *not, bool reset_ls);
+static int notify_send(struct sipnot *not);
 
 
 static void internal_close_handler(int err, const struct sip_msg *msg,
@@ -56,6 +57,8 @@ static void destructor(void *arg)
 	struct sipnot *not = arg;
 
 	tmr_cancel(&not->tmr);
+	tmr_cancel(&not->tmr_rate);
+	list_unlink(&not->fle);
 
 	if (!not->terminated) {
 
@@ -68,6 +71,7 @@ static void destructor(void *arg)
 	mem_deref(not->dlg);
 	mem_deref(not->auth);
 	mem_deref(not->mb);
+	mem_deref(not->content);
 	mem_deref(not->event);
 	mem_deref(not->id);
 	mem_deref(not->cuser);
@@ -114,6 +118,28 @@ void sipnot_refresh(struct sipnot *not, uint32_t expires)
 }
 
 
+/*
+ * Apply the RFC 6446 "max-rate" Event header parameter, which limits
+ * how often NOTIFY requests are sent for the subscription.
+ */
+void sipnot_rate_set(struct sipnot *not, const struct pl *params)
+{
+	struct pl val;
+	double rate;
+
+	not->interval = 0;
+
+	if (!params || msg_param_decode(params, "max-rate", &val))
+		return;
+
+	rate = pl_float(&val);
+	if (rate <= 0)
+		return;
+
+	not->interval = (uint32_t)MIN(1000 / rate, UINT32_MAX);
+}
+
+
 static void response_handler(int err, const struct sip_msg *msg, void *arg)
 {
 	struct sipnot *not = arg;
@@ -169,7 +195,7 @@ static void response_handler(int err, const struct sip_msg *msg, void *arg)
 		sipnot_terminate(not, err, msg, -1);
 	}
 	else if (not->notify_pending) {
-		(void)notify_request(not, true);
+		(void)notify_send(not);
 	}
 }
 
@@ -227,7 +253,10 @@ static int print_substate(struct re_printf *pf, const struct sipnot *not)
 
 static int print_content(struct re_printf *pf, const struct sipnot *not)
 {
-	if (!not->mb)
+	if (not->content)
+		return re_hprintf(pf, "%b", mbuf_buf(not->content),
+				  mbuf_get_left(not->content));
+	else if (!not->mb)
 		return re_hprintf(pf,
 				  "Content-Length: 0\r\n"
 				  "\r\n");
@@ -253,6 +282,7 @@ static int notify_request(struct sipnot *not, bool reset_ls)
 		not->termsent = true;
 
 	not->notify_pending = false;
+	not->last = tmr_jiffies();
 
 	return sip_drequestf(&not->req, not->sip, true, "NOTIFY",
 			     not->dlg, 0, not->auth,
@@ -268,6 +298,43 @@ static int notify_request(struct sipnot *not, bool reset_ls)
 }
 
 
+static void rate_handler(void *arg)
+{
+	struct sipnot *not = arg;
+
+	if (not->terminated)
+		return;
+
+	if (not->req)
+		not->notify_pending = true;
+	else
+		(void)notify_request(not, true);
+}
+
+
+/* Send a NOTIFY now, or when the rate limit allows it */
+static int notify_send(struct sipnot *not)
+{
+	uint64_t now, next;
+
+	if (!not->interval || !not->last)
+		return notify_request(not, true);
+
+	if (tmr_isrunning(&not->tmr_rate))
+		return 0;
+
+	now  = tmr_jiffies();
+	next = not->last + not->interval;
+
+	if (now >= next)
+		return notify_request(not, true);
+
+	tmr_start(&not->tmr_rate, next - now, rate_handler, not);
+
+	return 0;
+}
+
+
 int sipnot_notify(struct sipnot *not)
 {
 	if (not->expires == 0) {
@@ -279,7 +346,7 @@ int sipnot_notify(struct sipnot *not)
 		return 0;
 	}
 
-	return notify_request(not, true);
+	return notify_send(not);
 }
 
 
@@ -350,6 +417,8 @@ int sipevent_accept(struct sipnot **notp, struct sipevent_sock *sock,
 			if (err)
 				goto out;
 		}
+
+		sipnot_rate_set(not, &event->params);
 	}
 
 	if (dlg) {
@@ -429,6 +498,7 @@ int sipevent_notify(struct sipnot *not, struct mbuf *mb,
 	if (mb || state != SIPEVENT_TERMINATED) {
 		mem_deref(not->mb);
 		not->mb = mem_ref(mb);
+		not->content = mem_deref(not->content);
 	}
 
 	switch (state) {
@@ -20,14 +20,17 @@ struct sipevent_sock {
 
 struct sipnot {
 	struct le he;
+	struct le fle;
 	struct sip_loopstate ls;
 	struct tmr tmr;
+	struct tmr tmr_rate;
 	struct sipevent_sock *sock;
 	struct sip_request *req;
 	struct sip_dialog *dlg;
 	struct sip_auth *auth;
 	struct sip *sip;
 	struct mbuf *mb;
+	struct mbuf *content;
 	char *event;
 	char *id;
 	char *cuser;
@@ -35,6 +38,8 @@ struct sipnot {
 	char *ctype;
 	sipnot_close_h *closeh;
 	void *arg;
+	uint64_t last;
+	uint32_t interval;
 	uint32_t expires;
 	uint32_t expires_min;
 	uint32_t expires_dfl;
@@ -49,6 +54,7 @@ struct sipnot {
 };
 
 void sipnot_refresh(struct sipnot *not, uint32_t expires);
+void sipnot_rate_set(struct sipnot *not, const struct pl *params);
 int  sipnot_notify(struct sipnot *not);
 int  sipnot_reply(struct sipnot *not, const struct sip_msg *msg,
 		  uint16_t scode, const char *reason);
@@ -450,7 +450,7 @@ static int sipsub_alloc(struct sipsub **subp, struct sipevent_sock *sock,
  * @param uri       SIP Request URI
  * @param from_name SIP From-header Name (optional)
  * @param from_uri  SIP From-header URI
- * @param event     SIP Event to subscribe to
+ * @param event     SIP Event to subscribe to, with optional parameters
  * @param id        SIP Event ID (optional)
  * @param expires   Subscription expires value
  * @param cuser     Contact username or URI
@@ -497,7 +497,7 @@ int sipevent_subscribe(struct sipsub **subp, struct sipevent_sock *sock,
  * @param subp      Pointer to allocated SIP subscriber client
  * @param sock      SIP Event socket
  * @param dlg       Established SIP Dialog
- * @param event     SIP Event to subscribe to
+ * @param event     SIP Event to subscribe to, with optional parameters
  * @param id        SIP Event ID (optional)
  * @param expires   Subscription expires value
  * @param cuser     Contact username or URI
@@ -208,6 +208,7 @@ int stun_keepalive_alloc(struct stun_keepalive **skap,
 	case IPPROTO_UDP:
 		err = udp_register_helper(&ska->uh, sock, layer,
 					  NULL, udp_recv_handler, ska);
+		udp_helper_set_classes(ska->uh, UDP_PKT_STUN);
 		break;
 
 	default:
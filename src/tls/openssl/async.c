@@ -0,0 +1,582 @@
+/**
+ * @file openssl/async.c  Offload of private-key operations to worker threads
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+/* the legacy key methods are the only hook for a non-blocking signer */
+#define OPENSSL_SUPPRESS_DEPRECATED 1
+
+#include <string.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/async.h>
+#include <openssl/rsa.h>
+#include <openssl/ec.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_async.h>
+#include "tls.h"
+
+
+#define DEBUG_MODULE "tls"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+#ifdef TLS_ASYNC
+
+/*
+ * Handshakes of accepting connections run as OpenSSL async jobs
+ * (SSL_MODE_ASYNC). The private key of the context is wrapped in a key
+ * method that hands the signature to a re_async worker thread and
+ * pauses the job. When the worker is done, the SSL async callback of
+ * the connection resumes the handshake on the re thread.
+ *
+ * The wrapped key only points to the offload state, it does not hold a
+ * reference. Closing the state restores the original key of the
+ * context, SSL objects that still use the wrapped key sign inline.
+ */
+struct tls_async {
+	struct re_async *async;
+	SSL_CTX *ctx;
+	EVP_PKEY *pkey;          /* Original key, NULL if none    */
+	EVP_PKEY *wrapped;       /* Key that points to this state */
+	uint64_t ops;            /* Operations done by a worker   */
+};
+
+struct async_op {
+	struct tls_async *ta;
+	EC_KEY *ec;
+	RSA *rsa;
+	uint8_t *in;
+	uint8_t *out;
+	size_t inlen;
+	size_t outlen;
+	int type;                /* ECDSA digest type or RSA padding */
+	int (*resumeh)(void *);  /* Async wait context callback      */
+	void *resume_arg;
+	bool done;
+	bool abort;
+};
+
+
+static EC_KEY_METHOD *ec_meth;
+static RSA_METHOD *rsa_meth;
+static int ec_idx = -1;
+static int rsa_idx = -1;
+static int ssl_idx = -1;
+
+
+static void op_destructor(void *arg)
+{
+	struct async_op *op = arg;
+
+	EC_KEY_free(op->ec);
+	RSA_free(op->rsa);
+	mem_deref(op->in);
+	mem_deref(op->out);
+	mem_deref(op->ta);
+}
+
+
+static void ta_destructor(void *arg)
+{
+	struct tls_async *ta = arg;
+
+	tls_async_close(ta);
+	mem_deref(ta->async);
+}
+
+
+/* called by a worker thread */
+static int op_work(void *arg)
+{
+	struct async_op *op = arg;
+	int r;
+
+	if (op->ec) {
+		int (*sign)(int, const unsigned char *, int, unsigned char *,
+			    unsigned int *, const BIGNUM *, const BIGNUM *,
+			    EC_KEY *);
+		unsigned int len = 0;
+
+		EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), &sign, NULL, NULL);
+
+		r = sign(op->type, op->in, (int)op->inlen, op->out, &len,
+			 NULL, NULL, op->ec);
+		op->outlen = len;
+	}
+	else {
+		r = RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL())(
+			(int)op->inlen, op->in, op->out, op->rsa, op->type);
+		op->outlen = r > 0 ? (size_t)r : 0;
+	}
+
+	if (r <= 0) {
+		ERR_clear_error();
+		return EPROTO;
+	}
+
+	return 0;
+}
+
+
+static void op_handler(int err, void *arg)
+{
+	struct async_op *op = arg;
+
+	op->done = true;
+
+	if (err)
+		op->outlen = 0;
+	else
+		++op->ta->ops;
+
+	if (!op->abort)
+		(void)op->resumeh(op->resume_arg);
+
+	mem_deref(op);
+}
+
+
+/*
+ * Start the operation on a worker thread and pause the job until it is
+ * done. Returns the result length, or -1 if the operation could not be
+ * offloaded and has to be done inline.
+ */
+static int op_run(struct async_op *op)
+{
+	ASYNC_JOB *job = ASYNC_get_current_job();
+	ASYNC_WAIT_CTX *wctx;
+	SSL *ssl;
+	int err;
+
+	if (!job)
+		return -1;
+
+	wctx = ASYNC_get_wait_ctx(job);
+	if (!ASYNC_WAIT_CTX_get_callback(wctx, &op->resumeh, (void **)&ssl) ||
+	    !op->resumeh)
+		return -1;
+
+	err = re_async(op->ta->async, 0, op_work, op_handler, mem_ref(op));
+	if (err) {
+		mem_deref(op);
+		return -1;
+	}
+
+	/* the SSL object is the argument of its wait context callback */
+	op->resume_arg = ssl;
+	SSL_set_ex_data(ssl, ssl_idx, op);
+
+	while (!op->done && !op->abort) {
+		if (!ASYNC_pause_job()) {
+			op->abort = true;
+			break;
+		}
+	}
+
+	SSL_set_ex_data(ssl, ssl_idx, NULL);
+
+	return op->done ? (int)op->outlen : 0;
+}
+
+
+static struct async_op *op_alloc(struct tls_async *ta, const uint8_t *in,
+				 size_t inlen, size_t outsize)
+{
+	struct async_op *op;
+
+	op = mem_zalloc(sizeof(*op), op_destructor);
+	if (!op)
+		return NULL;
+
+	op->in  = mem_alloc(inlen, NULL);
+	op->out = mem_alloc(outsize, NULL);
+	if (!op->in || !op->out)
+		return mem_deref(op);
+
+	memcpy(op->in, in, inlen);
+	op->inlen = inlen;
+	op->ta    = mem_ref(ta);
+
+	return op;
+}
+
+
+static int ec_sign(int type, const unsigned char *dgst, int dlen,
+		   unsigned char *sig, unsigned int *siglen,
+		   const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey)
+{
+	int (*sign)(int, const unsigned char *, int, unsigned char *,
+		    unsigned int *, const BIGNUM *, const BIGNUM *, EC_KEY *);
+	struct tls_async *ta = EC_KEY_get_ex_data(eckey, ec_idx);
+	struct async_op *op = NULL;
+	int n = -1;
+
+	if (ta && !kinv && !r && ASYNC_get_current_job())
+		op = op_alloc(ta, dgst, dlen, ECDSA_size(eckey));
+
+	if (op) {
+		EC_KEY_up_ref(eckey);
+		op->ec   = eckey;
+		op->type = type;
+
+		n = op_run(op);
+		if (n > 0) {
+			memcpy(sig, op->out, n);
+			*siglen = n;
+		}
+	}
+
+	mem_deref(op);
+
+	if (n >= 0)
+		return n > 0;
+
+	EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), &sign, NULL, NULL);
+
+	return sign(type, dgst, dlen, sig, siglen, kinv, r, eckey);
+}
+
+
+static int rsa_priv_enc(int flen, const unsigned char *from,
+			unsigned char *to, RSA *rsa, int padding)
+{
+	struct tls_async *ta = RSA_get_ex_data(rsa, rsa_idx);
+	struct async_op *op = NULL;
+	int n = -1;
+
+	if (ta && ASYNC_get_current_job())
+		op = op_alloc(ta, from, flen, RSA_size(rsa));
+
+	if (op) {
+		RSA_up_ref(rsa);
+		op->rsa  = rsa;
+		op->type = padding;
+
+		n = op_run(op);
+		if (n > 0)
+			memcpy(to, op->out, n);
+	}
+
+	mem_deref(op);
+
+	if (n > 0)
+		return n;
+	else if (n == 0)
+		return -1;
+
+	return RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL())(flen, from, to,
+							  rsa, padding);
+}
+
+
+static int methods_init(void)
+{
+	if (ssl_idx < 0) {
+		ec_idx  = EC_KEY_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+		rsa_idx = RSA_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+		ssl_idx = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+	}
+
+	if (ec_idx < 0 || rsa_idx < 0 || ssl_idx < 0)
+		return ENOMEM;
+
+	if (!ec_meth) {
+		int (*setup)(EC_KEY *, BN_CTX *, BIGNUM **, BIGNUM **);
+		ECDSA_SIG *(*sign_sig)(const unsigned char *, int,
+				       const BIGNUM *, const BIGNUM *,
+				       EC_KEY *);
+
+		ec_meth = EC_KEY_METHOD_new(EC_KEY_OpenSSL());
+		if (!ec_meth)
+			return ENOMEM;
+
+		EC_KEY_METHOD_get_sign(ec_meth, NULL, &setup, &sign_sig);
+		EC_KEY_METHOD_set_sign(ec_meth, ec_sign, setup, sign_sig);
+	}
+
+	if (!rsa_meth) {
+		rsa_meth = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+		if (!rsa_meth)
+			return ENOMEM;
+
+		RSA_meth_set_priv_enc(rsa_meth, rsa_priv_enc);
+	}
+
+	return 0;
+}
+
+
+static int wrap_ec(EVP_PKEY **pkeyp, EVP_PKEY *pkey, struct tls_async *ta)
+{
+	EC_KEY *ec, *dup = NULL;
+	int err = 0;
+
+	ec = EVP_PKEY_get1_EC_KEY(pkey);
+	if (!ec)
+		return EINVAL;
+
+	/* the key is wrapped already, switch to the new pool */
+	if (EC_KEY_get_method(ec) == ec_meth) {
+		EC_KEY_set_ex_data(ec, ec_idx, ta);
+		goto out;
+	}
+
+	dup = EC_KEY_dup(ec);
+	if (!dup || !EC_KEY_set_method(dup, ec_meth)) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	if (!EC_KEY_set_ex_data(dup, ec_idx, ta)) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	*pkeyp = EVP_PKEY_new();
+	if (!*pkeyp || !EVP_PKEY_assign_EC_KEY(*pkeyp, dup)) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	dup = NULL;
+
+ out:
+	EC_KEY_free(dup);
+	EC_KEY_free(ec);
+
+	return err;
+}
+
+
+static int wrap_rsa(EVP_PKEY **pkeyp, EVP_PKEY *pkey, struct tls_async *ta)
+{
+	RSA *rsa, *dup = NULL;
+	int err = 0;
+
+	rsa = EVP_PKEY_get1_RSA(pkey);
+	if (!rsa)
+		return EINVAL;
+
+	if (RSA_get_method(rsa) == rsa_meth) {
+		RSA_set_ex_data(rsa, rsa_idx, ta);
+		goto out;
+	}
+
+	dup = RSAPrivateKey_dup(rsa);
+	if (!dup || !RSA_set_method(dup, rsa_meth)) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	if (!RSA_set_ex_data(dup, rsa_idx, ta)) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	*pkeyp = EVP_PKEY_new();
+	if (!*pkeyp || !EVP_PKEY_assign_RSA(*pkeyp, dup)) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	dup = NULL;
+
+ out:
+	RSA_free(dup);
+	RSA_free(rsa);
+
+	return err;
+}
+
+
+/**
+ * Wrap the private key of an SSL context, so that its signatures can be
+ * computed by a pool of worker threads
+ *
+ * @param tap   Pointer to allocated offload state
+ * @param ctx   SSL context with certificate and private key
+ * @param async Worker thread pool
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tls_async_alloc(struct tls_async **tap, SSL_CTX *ctx,
+		    struct re_async *async)
+{
+	struct tls_async *ta;
+	EVP_PKEY *pkey, *wrapped = NULL;
+	int err;
+
+	if (!tap || !ctx || !async)
+		return EINVAL;
+
+	pkey = SSL_CTX_get0_privatekey(ctx);
+	if (!pkey)
+		return ENOENT;
+
+	err = methods_init();
+	if (err)
+		return err;
+
+	ta = mem_zalloc(sizeof(*ta), ta_destructor);
+	if (!ta)
+		return ENOMEM;
+
+	ta->async = mem_ref(async);
+
+	switch (EVP_PKEY_get_base_id(pkey)) {
+
+	case EVP_PKEY_EC:
+		err = wrap_ec(&wrapped, pkey, ta);
+		break;
+
+	case EVP_PKEY_RSA:
+		err = wrap_rsa(&wrapped, pkey, ta);
+		break;
+
+	default:
+		err = ENOTSUP;
+		break;
+	}
+
+	if (err) {
+		EVP_PKEY_free(wrapped);
+		goto out;
+	}
+
+	SSL_CTX_up_ref(ctx);
+	ta->ctx = ctx;
+
+	/* the key of the context was wrapped already if not replaced */
+	if (!wrapped) {
+		EVP_PKEY_up_ref(pkey);
+		ta->wrapped = pkey;
+		goto out;
+	}
+
+	ta->wrapped = wrapped;
+
+	/* keep the original key, the context drops its reference */
+	EVP_PKEY_up_ref(pkey);
+	ta->pkey = pkey;
+
+	if (SSL_CTX_use_PrivateKey(ctx, wrapped) != 1) {
+		DEBUG_WARNING("async: wrapped private key rejected\n");
+		ERR_clear_error();
+		err = EINVAL;
+		goto out;
+	}
+
+ out:
+	if (err)
+		mem_deref(ta);
+	else
+		*tap = ta;
+
+	return err;
+}
+
+
+/**
+ * Stop offloading: restore the original private key of the SSL context
+ * and detach the wrapped key, so it no longer uses the worker pool.
+ * Operations in progress still finish on their worker thread.
+ *
+ * @param ta Offload state
+ */
+void tls_async_close(struct tls_async *ta)
+{
+	EC_KEY *ec;
+	RSA *rsa;
+
+	if (!ta || !ta->wrapped)
+		return;
+
+	if (ta->pkey && SSL_CTX_get0_privatekey(ta->ctx) == ta->wrapped &&
+	    SSL_CTX_use_PrivateKey(ta->ctx, ta->pkey) != 1) {
+		DEBUG_WARNING("async: original private key rejected\n");
+		ERR_clear_error();
+	}
+
+	ec  = EVP_PKEY_get1_EC_KEY(ta->wrapped);
+	rsa = EVP_PKEY_get1_RSA(ta->wrapped);
+	ERR_clear_error();
+
+	if (ec && EC_KEY_get_ex_data(ec, ec_idx) == ta)
+		EC_KEY_set_ex_data(ec, ec_idx, NULL);
+
+	if (rsa && RSA_get_ex_data(rsa, rsa_idx) == ta)
+		RSA_set_ex_data(rsa, rsa_idx, NULL);
+
+	EC_KEY_free(ec);
+	RSA_free(rsa);
+
+	EVP_PKEY_free(ta->wrapped);
+	EVP_PKEY_free(ta->pkey);
+	SSL_CTX_free(ta->ctx);
+
+	ta->wrapped = NULL;
+	ta->pkey    = NULL;
+	ta->ctx     = NULL;
+}
+
+
+/**
+ * Run the handshake of an accepting SSL object as an async job
+ *
+ * @param ta      Offload state, NULL to run it inline
+ * @param ssl     SSL object
+ * @param resumeh Called on the re thread when the handshake can go on
+ * @param arg     Handler argument
+ */
+void tls_async_ssl(struct tls_async *ta, SSL *ssl,
+		   SSL_async_callback_fn resumeh, void *arg)
+{
+	if (!ta || !ssl)
+		return;
+
+	SSL_set_mode(ssl, SSL_MODE_ASYNC);
+	SSL_set_async_callback(ssl, resumeh);
+	SSL_set_async_callback_arg(ssl, arg);
+}
+
+
+/**
+ * Let a paused handshake job finish, so the SSL object can be freed.
+ * The operation still running on the worker thread is discarded.
+ *
+ * @param ssl SSL object
+ */
+void tls_async_abort(SSL *ssl)
+{
+	struct async_op *op;
+
+	if (!ssl || ssl_idx < 0 || !SSL_waiting_for_async(ssl))
+		return;
+
+	op = SSL_get_ex_data(ssl, ssl_idx);
+	if (op)
+		op->abort = true;
+
+	ERR_clear_error();
+	(void)SSL_do_handshake(ssl);
+	ERR_clear_error();
+}
+
+
+/**
+ * Get the number of private-key operations done by worker threads
+ *
+ * @param ta Offload state
+ *
+ * @return Number of operations
+ */
+uint64_t tls_async_count(const struct tls_async *ta)
+{
+	return ta ? ta->ops : 0;
+}
+
+#endif
@@ -47,6 +47,9 @@ struct tls {
 	bool verify_server;  /**< Enable SIP TLS server verification   */
 	struct session_reuse reuse;
 	struct list certs;   /**< Certificates for SNI selection       */
+#ifdef TLS_ASYNC
+	struct tls_async *async; /**< Private-key offload, optional    */
+#endif
 };
 
 /**
@@ -128,6 +131,9 @@ static void destructor(void *data)
 	mem_deref(tls->reuse.ht_sessions);
 	mem_deref(tls->pass);
 	list_flush(&tls->certs);
+#ifdef TLS_ASYNC
+	mem_deref(tls->async);
+#endif
 }
 
 
@@ -209,6 +215,7 @@ int tls_verify_handler(int ok, X509_STORE_CTX *ctx)
 
 
 static int tls_verify_idx = -1;
+static int tls_cookie_idx = -1;
 static once_flag oflag = ONCE_FLAG_INIT;
 
 static void tls_init_verify_idx(void)
@@ -218,9 +225,41 @@ static void tls_init_verify_idx(void)
 
 	tls_verify_idx = SSL_get_ex_new_index(0, "tls verify ud",
 		NULL, NULL, NULL);
+	tls_cookie_idx = SSL_get_ex_new_index(0, "dtls cookie verified",
+		NULL, NULL, NULL);
+}
+
+
+#if !defined(LIBRESSL_VERSION_NUMBER)
+static int dtls_cookie_verify_handler(SSL *ssl, const unsigned char *cookie,
+				      unsigned int cookie_len)
+{
+	(void)cookie;
+	(void)cookie_len;
+
+	/* only cookies checked by tls_udp.c against the socket key */
+	return tls_cookie_idx > -1 &&
+		SSL_get_ex_data(ssl, tls_cookie_idx) != NULL;
 }
 
 
+/**
+ * Mark the cookies of the ClientHellos of an SSL object as verified, or
+ * clear the mark. The cookies of unmarked SSL objects are rejected.
+ *
+ * @param ssl      SSL object
+ * @param verified True if the cookie was verified
+ */
+void tls_set_cookie_verified(SSL *ssl, bool verified)
+{
+	if (!ssl || tls_cookie_idx < 0)
+		return;
+
+	SSL_set_ex_data(ssl, tls_cookie_idx, verified ? ssl : NULL);
+}
+#endif
+
+
 /**
  * Allocate a new TLS context
  *
@@ -256,6 +295,12 @@ int tls_alloc(struct tls **tlsp, enum tls_method method, const char *keyfile,
 	case TLS_METHOD_DTLSV1:
 	case TLS_METHOD_DTLSV1_2:
 		tls->ctx = SSL_CTX_new(DTLS_method());
+#if !defined(LIBRESSL_VERSION_NUMBER)
+		/* accepts only cookies verified by a protected dtls_sock */
+		if (tls->ctx)
+			SSL_CTX_set_cookie_verify_cb(tls->ctx,
+						dtls_cookie_verify_handler);
+#endif
 		break;
 
 	default:
@@ -2139,3 +2184,58 @@ int tls_verify_client_post_handshake(struct tls_conn *tc)
 
 	return err;
 }
+
+
+/**
+ * Offload the private-key operations of accepted handshakes to a pool
+ * of worker threads. Must be called after the certificate is set.
+ *
+ * @param tls   TLS Context
+ * @param async Worker thread pool, NULL to sign on the re thread again
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tls_set_async(struct tls *tls, struct re_async *async)
+{
+	if (!tls)
+		return EINVAL;
+
+#ifdef TLS_ASYNC
+	tls_async_close(tls->async);
+	tls->async = mem_deref(tls->async);
+
+	if (!async)
+		return 0;
+
+	return tls_async_alloc(&tls->async, tls->ctx, async);
+#else
+	(void)async;
+	return ENOSYS;
+#endif
+}
+
+
+/**
+ * Get the number of private-key operations done by worker threads
+ *
+ * @param tls TLS Context
+ *
+ * @return Number of operations
+ */
+uint64_t tls_async_ops(const struct tls *tls)
+{
+#ifdef TLS_ASYNC
+	return tls ? tls_async_count(tls->async) : 0;
+#else
+	(void)tls;
+	return 0;
+#endif
+}
+
+
+#ifdef TLS_ASYNC
+struct tls_async *tls_get_async(const struct tls *tls)
+{
+	return tls ? tls->async : NULL;
+}
+#endif
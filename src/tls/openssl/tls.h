@@ -18,6 +18,12 @@
 #define SSL_ST_OK TLS_ST_OK
 #endif
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && \
+	!defined(LIBRESSL_VERSION_NUMBER) && \
+	!defined(OPENSSL_NO_ASYNC) && !defined(OPENSSL_NO_DEPRECATED_3_0)
+#define TLS_ASYNC 1
+#endif
+
 
 typedef X509_NAME*(tls_get_certfield_h)(const X509 *);
 
@@ -37,4 +43,19 @@ struct tls_cert *tls_cert_for_sni(const struct tls *tls, const char *sni);
 #if !defined(LIBRESSL_VERSION_NUMBER)
 int tls_verify_handler(int ok, X509_STORE_CTX *ctx);
 void tls_enable_sni(struct tls *tls);
+void tls_set_cookie_verified(SSL *ssl, bool verified);
+#endif
+
+#ifdef TLS_ASYNC
+struct re_async;
+struct tls_async;
+
+int  tls_async_alloc(struct tls_async **tap, SSL_CTX *ctx,
+		     struct re_async *async);
+void tls_async_close(struct tls_async *ta);
+void tls_async_ssl(struct tls_async *ta, SSL *ssl,
+		   SSL_async_callback_fn resumeh, void *arg);
+void tls_async_abort(SSL *ssl);
+uint64_t tls_async_count(const struct tls_async *ta);
+struct tls_async *tls_get_async(const struct tls *tls);
 #endif
@@ -44,7 +44,12 @@ static void destructor(void *arg)
 	struct tls_conn *tc = arg;
 
 	if (tc->ssl) {
-		int r = SSL_shutdown(tc->ssl);
+		int r;
+
+#ifdef TLS_ASYNC
+		tls_async_abort(tc->ssl);
+#endif
+		r = SSL_shutdown(tc->ssl);
 		if (r <= 0)
 			ERR_clear_error();
 
@@ -178,6 +183,9 @@ static int tls_accept(struct tls_conn *tc)
 		switch (ssl_err) {
 
 		case SSL_ERROR_WANT_READ:
+#ifdef TLS_ASYNC
+		case SSL_ERROR_WANT_ASYNC:
+#endif
 			break;
 
 		default:
@@ -195,6 +203,23 @@ static int tls_accept(struct tls_conn *tc)
 }
 
 
+#ifdef TLS_ASYNC
+/*
+ * A private-key operation of the handshake is done. A failure sends an
+ * alert, the connection is closed on the next receive.
+ */
+static int async_handler(SSL *ssl, void *arg)
+{
+	struct tls_conn *tc = arg;
+	(void)ssl;
+
+	(void)tls_accept(tc);
+
+	return 1;
+}
+#endif
+
+
 static bool estab_handler(int *err, bool active, void *arg)
 {
 	struct tls_conn *tc = arg;
@@ -205,6 +230,9 @@ static bool estab_handler(int *err, bool active, void *arg)
 		return true;
 
 	tc->active = true;
+#ifdef TLS_ASYNC
+	SSL_clear_mode(tc->ssl, SSL_MODE_ASYNC);
+#endif
 	if (tls_get_session_reuse(tc))
 		(void) tls_reuse_session(tc);
 
@@ -420,6 +448,10 @@ int tls_start_tcp(struct tls_conn **ptc, struct tls *tls, struct tcp_conn *tcp,
 
 	SSL_set_bio(tc->ssl, tc->sbio_in, tc->sbio_out);
 
+#ifdef TLS_ASYNC
+	tls_async_ssl(tls_get_async(tls), tc->ssl, async_handler, tc);
+#endif
+
 	err = 0;
 
  out:
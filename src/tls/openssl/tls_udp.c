@@ -4,6 +4,7 @@
  * Copyright (C) 2010 Creytiv.com
  */
 
+#include <string.h>
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
@@ -19,6 +20,8 @@
 #include <re_srtp.h>
 #include <re_udp.h>
 #include <re_tmr.h>
+#include <re_sys.h>
+#include <re_hmac.h>
 #include <re_tls.h>
 #include "tls.h"
 
@@ -33,6 +36,22 @@ enum {
 	MTU_FALLBACK = 548,
 };
 
+enum {
+	RECORD_HDR    = 13,
+	HANDSHAKE_HDR = 12,
+	RANDOM_SIZE   = 32,
+	COOKIE_SIZE   = 16,
+	KEY_SIZE      = 32,
+	KEY_LIFETIME  = 60000,
+};
+
+
+/* HandshakeType defined in RFC 6347 */
+enum handshake_type {
+	HS_CLIENT_HELLO         = 1,
+	HS_HELLO_VERIFY_REQUEST = 3,
+};
+
 
 /* TLS ContentType defined in RFC 5246 */
 enum content_type {
@@ -48,11 +67,32 @@ struct dtls_sock {
 	struct udp_helper *uh;
 	struct udp_sock *us;
 	struct hash *ht;
+	struct tls_conn *single;  /* The connection in single mode */
 	struct mbuf *mb;
 	dtls_conn_h *connh;
 	void *arg;
 	size_t mtu;
 	bool single_conn;  /* If enabled, only one DTLS connection */
+
+	/* protection of dtls_accept() */
+	struct dtls_listen_conf conf;
+	struct dtls_listen_stats stats;
+	struct tmr tmr_key;
+	uint8_t key[KEY_SIZE];      /* Cookie key                     */
+	uint8_t key_prev[KEY_SIZE]; /* Previous key, cookies in flight */
+	uint64_t refill;            /* Last token bucket refill [ms]  */
+	uint32_t tokens;
+	uint32_t pending;           /* Accepted, not yet established  */
+	bool protect;
+	bool verified;              /* Current ClientHello has cookie */
+};
+
+
+struct client_hello {
+	const uint8_t *rseq;      /* Record sequence number */
+	const uint8_t *random;
+	const uint8_t *cookie;
+	size_t cookie_len;
 };
 
 
@@ -74,6 +114,7 @@ struct tls_conn {
 	void *arg;
 	bool active;
 	bool up;
+	bool pending;         /* Counted in sock->pending */
 };
 
 
@@ -207,6 +248,9 @@ static void tls_close(struct tls_conn *tc)
 	if (!tc->ssl)
 		return;
 
+#ifdef TLS_ASYNC
+	tls_async_abort(tc->ssl);
+#endif
 	r = SSL_shutdown(tc->ssl);
 	if (r <= 0)
 		ERR_clear_error();
@@ -216,6 +260,16 @@ static void tls_close(struct tls_conn *tc)
 }
 
 
+static void pending_done(struct tls_conn *tc)
+{
+	if (!tc->pending)
+		return;
+
+	tc->pending = false;
+	--tc->sock->pending;
+}
+
+
 static void conn_destructor(void *arg)
 {
 	struct tls_conn *tc = arg;
@@ -223,6 +277,10 @@ static void conn_destructor(void *arg)
 	hash_unlink(&tc->he);
 	tmr_cancel(&tc->tmr);
 	tls_close(tc);
+	pending_done(tc);
+
+	if (tc->sock && tc->sock->single == tc)
+		tc->sock->single = NULL;
 
 	if (tc->biomet)
 		BIO_meth_free(tc->biomet);
@@ -235,6 +293,7 @@ static void conn_close(struct tls_conn *tc, int err)
 {
 	tmr_cancel(&tc->tmr);
 	tls_close(tc);
+	pending_done(tc);
 	tc->up = false;
 
 	if (tc->closeh)
@@ -251,6 +310,12 @@ static void timeout(void *arg)
 
 	DEBUG_INFO("timeout\n");
 
+#ifdef TLS_ASYNC
+	/* the handshake goes on, and restarts the timer, when resumed */
+	if (SSL_waiting_for_async(tc->ssl))
+		return;
+#endif
+
 	if (0 <= DTLSv1_handle_timeout(tc->ssl)) {
 
 		check_timer(tc);
@@ -321,6 +386,9 @@ static int tls_accept(struct tls_conn *tc)
 		switch (ssl_err) {
 
 		case SSL_ERROR_WANT_READ:
+#ifdef TLS_ASYNC
+		case SSL_ERROR_WANT_ASYNC:
+#endif
 			break;
 
 		default:
@@ -335,6 +403,23 @@ static int tls_accept(struct tls_conn *tc)
 }
 
 
+#ifdef TLS_ASYNC
+/* a private-key operation of the handshake is done */
+static int async_handler(SSL *ssl, void *arg)
+{
+	struct tls_conn *tc = arg;
+	int err;
+	(void)ssl;
+
+	err = tls_accept(tc);
+	if (err)
+		conn_close(tc, err);
+
+	return 1;
+}
+#endif
+
+
 static void conn_recv(struct tls_conn *tc, struct mbuf *mb)
 {
 	int err, r;
@@ -380,6 +465,11 @@ static void conn_recv(struct tls_conn *tc, struct mbuf *mb)
 
 		tc->up = true;
 
+		if (tc->pending) {
+			pending_done(tc);
+			++tc->sock->stats.completed;
+		}
+
 		if (tc->estabh) {
 			uint32_t nrefs;
 
@@ -453,11 +543,9 @@ static int conn_alloc(struct tls_conn **ptc, struct tls *tls,
 	struct tls_conn *tc;
 	int err = 0;
 
-	if (sock->single_conn) {
-		if (hash_get_first(sock->ht)) {
-			DEBUG_WARNING("single: only one connection allowed\n");
-			return EMFILE;
-		}
+	if (sock->single_conn && sock->single) {
+		DEBUG_WARNING("single: only one connection allowed\n");
+		return EMFILE;
 	}
 
 	tc = mem_zalloc(sizeof(*tc), conn_destructor);
@@ -474,6 +562,9 @@ static int conn_alloc(struct tls_conn **ptc, struct tls *tls,
 	tc->arg    = arg;
 	tc->tls    = tls;
 
+	if (sock->single_conn)
+		sock->single = tc;
+
 	tc->biomet = bio_method_udp();
 	if (!tc->biomet) {
 		err = ENOMEM;
@@ -566,6 +657,44 @@ int dtls_connect(struct tls_conn **ptc, struct tls *tls,
 }
 
 
+#if !defined(LIBRESSL_VERSION_NUMBER)
+/*
+ * Hand a ClientHello with a valid cookie to OpenSSL. DTLSv1_listen()
+ * sets up the sequence numbers that follow the HelloVerifyRequest,
+ * which was sent statelessly by recv_handler(). The cookie verify
+ * callback of DTLS contexts, set by tls_alloc(), accepts the cookie
+ * only for SSL objects marked here.
+ */
+static int listen_verified(struct tls_conn *tc)
+{
+	BIO_ADDR *addr;
+	int r;
+
+	addr = BIO_ADDR_new();
+	if (!addr)
+		return ENOMEM;
+
+	SSL_set_accept_state(tc->ssl);
+
+	ERR_clear_error();
+
+	/* also checked again when the handshake goes on */
+	tls_set_cookie_verified(tc->ssl, true);
+
+	r = DTLSv1_listen(tc->ssl, addr);
+	BIO_ADDR_free(addr);
+
+	if (r != 1) {
+		DEBUG_WARNING("listen error: %i\n", r);
+		ERR_clear_error();
+		return EPROTO;
+	}
+
+	return 0;
+}
+#endif
+
+
 /**
  * DTLS Accept
  *
@@ -597,6 +726,10 @@ int dtls_accept(struct tls_conn **ptc, struct tls *tls,
 
 	tc->active = false;
 
+#ifdef TLS_ASYNC
+	tls_async_ssl(tls_get_async(tls), tc->ssl, async_handler, tc);
+#endif
+
 	r = BIO_write(tc->sbio_in, mbuf_buf(sock->mb),
 		      (int)mbuf_get_left(sock->mb));
 	if (r <= 0) {
@@ -606,12 +739,23 @@ int dtls_accept(struct tls_conn **ptc, struct tls *tls,
 		goto out;
 	}
 
+#if !defined(LIBRESSL_VERSION_NUMBER)
+	if (sock->verified) {
+		err = listen_verified(tc);
+		if (err)
+			goto out;
+	}
+#endif
+
 	err = tls_accept(tc);
 	if (err)
 		goto out;
 
 	sock->mb = mem_deref(sock->mb);
 
+	tc->pending = true;
+	++sock->pending;
+
  out:
 	if (err)
 		mem_deref(tc);
@@ -710,6 +854,7 @@ static void sock_destructor(void *arg)
 {
 	struct dtls_sock *sock = arg;
 
+	tmr_cancel(&sock->tmr_key);
 	hash_clear(sock->ht);
 	mem_deref(sock->uh);
 	mem_deref(sock->us);
@@ -729,30 +874,252 @@ static bool cmp_handler(struct le *le, void *arg)
 static struct tls_conn *conn_lookup(struct dtls_sock *sock,
 				    const struct sa *peer)
 {
-	if (sock->single_conn) {
-		struct le *le = hash_get_first(sock->ht);
-		return list_ledata(le);
-	}
+	if (sock->single_conn)
+		return sock->single;
 
 	return list_ledata(hash_lookup(sock->ht, sa_hash(peer, SA_ALL),
                                        cmp_handler, (void *)peer));
 }
 
 
+static int hello_decode(struct client_hello *ch, const struct mbuf *mb)
+{
+	const uint8_t *p = mbuf_buf(mb);
+	size_t n = mbuf_get_left(mb);
+	size_t len, sid_len;
+
+	if (n < RECORD_HDR + HANDSHAKE_HDR)
+		return EBADMSG;
+
+	/* record header, epoch 0 */
+	if (p[0] != TYPE_HANDSHAKE || p[3] || p[4])
+		return EBADMSG;
+
+	len = p[11] << 8 | p[12];
+	if (len > n - RECORD_HDR)
+		return EBADMSG;
+
+	ch->rseq = p + 5;
+	p += RECORD_HDR;
+
+	/* handshake header, an unfragmented ClientHello */
+	if (p[0] != HS_CLIENT_HELLO || len < HANDSHAKE_HDR)
+		return EBADMSG;
+
+	n = (size_t)p[1] << 16 | p[2] << 8 | p[3];
+	if (p[6] || p[7] || p[8] || memcmp(p + 1, p + 9, 3))
+		return EBADMSG;
+
+	if (n > len - HANDSHAKE_HDR)
+		return EBADMSG;
+
+	p += HANDSHAKE_HDR;
+
+	/* client_version, random, session_id, cookie */
+	if (n < 2 + RANDOM_SIZE + 1)
+		return EBADMSG;
+
+	ch->random = p + 2;
+	sid_len = p[2 + RANDOM_SIZE];
+	p += 2 + RANDOM_SIZE + 1;
+	n -= 2 + RANDOM_SIZE + 1;
+
+	if (n < sid_len + 1)
+		return EBADMSG;
+
+	ch->cookie_len = p[sid_len];
+	ch->cookie = p + sid_len + 1;
+
+	if (n - sid_len - 1 < ch->cookie_len)
+		return EBADMSG;
+
+	return 0;
+}
+
+
+/*
+ * Cookie = HMAC(Secret, Client-IP, Client-Parameters), as suggested in
+ * RFC 6347 4.2.1. The client random is the same in both ClientHellos.
+ */
+static void cookie_calc(uint8_t *cookie, const uint8_t *key,
+			const struct sa *peer, const uint8_t *random)
+{
+	uint8_t d[16 + 2 + RANDOM_SIZE];
+	uint8_t md[32];
+	uint16_t port = sa_port(peer);
+	size_t n = 0;
+
+	if (sa_af(peer) == AF_INET) {
+		uint32_t addr = sa_in(peer);
+
+		d[n++] = addr >> 24;
+		d[n++] = addr >> 16;
+		d[n++] = addr >> 8;
+		d[n++] = addr;
+	}
+#ifdef HAVE_INET6
+	else if (sa_af(peer) == AF_INET6) {
+		sa_in6(peer, d);
+		n = 16;
+	}
+#endif
+
+	d[n++] = port >> 8;
+	d[n++] = port;
+
+	memcpy(d + n, random, RANDOM_SIZE);
+	n += RANDOM_SIZE;
+
+	hmac_sha256(key, KEY_SIZE, d, n, md, sizeof(md));
+
+	memcpy(cookie, md, COOKIE_SIZE);
+}
+
+
+static bool cookie_valid(const struct dtls_sock *sock, const struct sa *peer,
+			 const struct client_hello *ch)
+{
+	uint8_t cookie[COOKIE_SIZE];
+
+	if (ch->cookie_len != COOKIE_SIZE)
+		return false;
+
+	cookie_calc(cookie, sock->key, peer, ch->random);
+	if (!mem_seccmp(cookie, ch->cookie, COOKIE_SIZE))
+		return true;
+
+	cookie_calc(cookie, sock->key_prev, peer, ch->random);
+
+	return !mem_seccmp(cookie, ch->cookie, COOKIE_SIZE);
+}
+
+
+/* HelloVerifyRequest as in RFC 6347 4.2.1, no state is kept */
+static int hello_verify_send(struct dtls_sock *sock, const struct sa *peer,
+			     const struct client_hello *ch)
+{
+	enum {SPACE = 4, BODY = 2 + 1 + COOKIE_SIZE};
+	uint8_t cookie[COOKIE_SIZE];
+	struct mbuf *mb;
+	int err = 0;
+
+	mb = mbuf_alloc(SPACE + RECORD_HDR + HANDSHAKE_HDR + BODY);
+	if (!mb)
+		return ENOMEM;
+
+	cookie_calc(cookie, sock->key, peer, ch->random);
+
+	mb->pos = SPACE;
+
+	/* the record sequence number of the ClientHello is reused */
+	err |= mbuf_write_u8(mb, TYPE_HANDSHAKE);
+	err |= mbuf_write_u16(mb, htons(DTLS1_VERSION));
+	err |= mbuf_write_u16(mb, 0);
+	err |= mbuf_write_mem(mb, ch->rseq, 6);
+	err |= mbuf_write_u16(mb, htons(HANDSHAKE_HDR + BODY));
+
+	err |= mbuf_write_u8(mb, HS_HELLO_VERIFY_REQUEST);
+	err |= mbuf_write_u8(mb, 0);
+	err |= mbuf_write_u16(mb, htons(BODY));
+	err |= mbuf_write_u16(mb, 0);
+	err |= mbuf_write_u8(mb, 0);
+	err |= mbuf_write_u16(mb, 0);
+	err |= mbuf_write_u8(mb, 0);
+	err |= mbuf_write_u16(mb, htons(BODY));
+
+	err |= mbuf_write_u16(mb, htons(DTLS1_VERSION));
+	err |= mbuf_write_u8(mb, COOKIE_SIZE);
+	err |= mbuf_write_mem(mb, cookie, COOKIE_SIZE);
+	if (err)
+		goto out;
+
+	mb->pos = SPACE;
+
+	err = udp_send_helper(sock->us, peer, mb, sock->uh);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/* token bucket for new handshakes, and the limit of pending ones */
+static bool handshake_admit(struct dtls_sock *sock)
+{
+	const struct dtls_listen_conf *conf = &sock->conf;
+	uint64_t now, add;
+
+	if (conf->hs_pending && sock->pending >= conf->hs_pending)
+		return false;
+
+	if (!conf->hs_rate)
+		return true;
+
+	now = tmr_jiffies();
+	add = (now - sock->refill) * conf->hs_rate / 1000;
+	if (add) {
+		sock->tokens = (uint32_t)min(sock->tokens + add,
+					     (uint64_t)conf->hs_burst);
+
+		/* keep the time not yet worth a whole token */
+		if (sock->tokens < conf->hs_burst)
+			sock->refill += add * 1000 / conf->hs_rate;
+		else
+			sock->refill = now;
+	}
+
+	if (!sock->tokens)
+		return false;
+
+	--sock->tokens;
+
+	return true;
+}
+
+
+static bool hello_admit(struct dtls_sock *sock, const struct sa *peer,
+			const struct mbuf *mb)
+{
+	struct client_hello ch;
+
+	if (hello_decode(&ch, mb)) {
+		++sock->stats.rejected;
+		return false;
+	}
+
+	if (sock->conf.cookie) {
+
+		if (!cookie_valid(sock, peer, &ch)) {
+			++sock->stats.hello_verify;
+			(void)hello_verify_send(sock, peer, &ch);
+			return false;
+		}
+
+		++sock->stats.verified;
+	}
+
+	if (!handshake_admit(sock)) {
+		++sock->stats.rejected;
+		return false;
+	}
+
+	sock->verified = sock->conf.cookie;
+
+	return true;
+}
+
+
 static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 {
 	struct dtls_sock *sock = arg;
 	struct tls_conn *tc;
-	uint8_t b;
 
-	if (mbuf_get_left(mb) < 1)
+	if (udp_pkt_classify(mb) != UDP_PKT_DTLS)
 		return false;
 
-	b = mb->buf[mb->pos];
-	if (b < 20 || b > 63)
-		return false;
-
-	DEBUG_INFO("receive '%s' from %J\n", content_type_str(b), src);
+	DEBUG_INFO("receive '%s' from %J\n",
+		   content_type_str(mb->buf[mb->pos]), src);
 
 	tc = conn_lookup(sock, src);
 	if (tc) {
@@ -760,14 +1127,18 @@ static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 		return true;
 	}
 
-	if (sock->connh) {
+	if (!sock->connh)
+		return true;
 
-		mem_deref(sock->mb);
-		sock->mb   = mem_ref(mb);
-		sock->peer = *src;
+	if (sock->protect && !hello_admit(sock, src, mb))
+		return true;
 
-		sock->connh(src, sock->arg);
-	}
+	mem_deref(sock->mb);
+	sock->mb   = mem_ref(mb);
+	sock->peer = *src;
+
+	sock->connh(src, sock->arg);
+	sock->verified = false;
 
 	return true;
 }
@@ -814,6 +1185,8 @@ int dtls_listen(struct dtls_sock **sockp, const struct sa *laddr,
 	if (err)
 		goto out;
 
+	udp_helper_set_classes(sock->uh, UDP_PKT_DTLS);
+
 	err = hash_alloc(&sock->ht, hash_valid_size(htsize));
 	if (err)
 		goto out;
@@ -893,4 +1266,90 @@ void dtls_set_single(struct dtls_sock *sock, bool single)
 		return;
 
 	sock->single_conn = single;
+	sock->single = single ? list_ledata(hash_get_first(sock->ht)) : NULL;
+}
+
+
+static void key_handler(void *arg)
+{
+	struct dtls_sock *sock = arg;
+
+	memcpy(sock->key_prev, sock->key, KEY_SIZE);
+	rand_bytes(sock->key, KEY_SIZE);
+
+	tmr_start(&sock->tmr_key, sock->conf.key_lifetime, key_handler, sock);
+}
+
+
+/**
+ * Protect a DTLS Socket against floods of ClientHellos. New peers get a
+ * stateless HelloVerifyRequest and are only passed to the connect
+ * handler once they return a valid cookie. The number of new and of
+ * pending handshakes can be limited.
+ *
+ * @param sock DTLS Socket
+ * @param conf Protection settings, NULL to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtls_set_listen_conf(struct dtls_sock *sock,
+			 const struct dtls_listen_conf *conf)
+{
+	if (!sock)
+		return EINVAL;
+
+	tmr_cancel(&sock->tmr_key);
+
+	if (!conf) {
+		sock->protect = false;
+		return 0;
+	}
+
+#if defined(LIBRESSL_VERSION_NUMBER)
+	if (conf->cookie)
+		return ENOSYS;
+#endif
+
+	sock->conf = *conf;
+
+	if (!sock->conf.key_lifetime)
+		sock->conf.key_lifetime = KEY_LIFETIME;
+
+	if (!sock->conf.hs_burst)
+		sock->conf.hs_burst = sock->conf.hs_rate;
+
+	sock->tokens  = sock->conf.hs_burst;
+	sock->refill  = tmr_jiffies();
+	sock->protect = true;
+
+	if (sock->conf.cookie) {
+		rand_bytes(sock->key, KEY_SIZE);
+		memcpy(sock->key_prev, sock->key, KEY_SIZE);
+
+		tmr_start(&sock->tmr_key, sock->conf.key_lifetime,
+			  key_handler, sock);
+	}
+
+	return 0;
+}
+
+
+/**
+ * Get the handshake counters of a DTLS Socket
+ *
+ * @param sock  DTLS Socket
+ * @param stats Returned counters
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtls_listen_stats(const struct dtls_sock *sock,
+		      struct dtls_listen_stats *stats)
+{
+	if (!sock || !stats)
+		return EINVAL;
+
+	*stats = sock->stats;
+	stats->pending = sock->pending;
+
+	return 0;
 }
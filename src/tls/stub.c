@@ -449,6 +449,24 @@ void dtls_set_single(struct dtls_sock *sock, bool single)
 }
 
 
+int dtls_set_listen_conf(struct dtls_sock *sock,
+			 const struct dtls_listen_conf *conf)
+{
+	(void)sock;
+	(void)conf;
+	return ENOSYS;
+}
+
+
+int dtls_listen_stats(const struct dtls_sock *sock,
+		      struct dtls_listen_stats *stats)
+{
+	(void)sock;
+	(void)stats;
+	return ENOSYS;
+}
+
+
 int tls_set_certificate_openssl(struct tls *tls, struct x509_st *cert,
 				struct evp_pkey_st *pkey, bool up_ref)
 {
@@ -467,3 +485,18 @@ int tls_add_certf(struct tls *tls, const char *certf, const char *host)
 	(void)host;
 	return ENOSYS;
 }
+
+
+int tls_set_async(struct tls *tls, struct re_async *async)
+{
+	(void)tls;
+	(void)async;
+	return ENOSYS;
+}
+
+
+uint64_t tls_async_ops(const struct tls *tls)
+{
+	(void)tls;
+	return 0;
+}
@@ -84,6 +84,7 @@ struct udp_helper {
 	udp_helper_recv_h *recvh;
 	mtx_t *lock;         /**< A lock for the helpers list */
 	void *arg;
+	unsigned classes;    /**< Packet classes to receive, 0 for all */
 };
 
 
@@ -192,6 +193,10 @@ static void udp_read(struct udp_sock *us, re_sock_t fd)
 		le = le->next;
 		mtx_unlock(us->lock);
 
+		/* a lower helper may have stripped its header */
+		if (uh->classes && !(uh->classes & udp_pkt_classify(mb)))
+			continue;
+
 		hdld = uh->recvh(&src, mb, uh->arg);
 		if (hdld)
 			goto out;
@@ -242,18 +247,8 @@ static int udp_alloc(struct udp_sock **usp)
 }
 
 
-/**
- * Create and listen on a UDP Socket
- *
- * @param usp   Pointer to returned UDP Socket
- * @param local Local network address
- * @param rh    Receive handler
- * @param arg   Handler argument
- *
- * @return 0 if success, otherwise errorcode
- */
-int udp_listen(struct udp_sock **usp, const struct sa *local,
-	       udp_recv_h *rh, void *arg)
+static int udp_listen_sock(struct udp_sock **usp, const struct sa *local,
+			   bool reuse, udp_recv_h *rh, void *arg)
 {
 	struct addrinfo hints, *res = NULL, *r;
 	struct udp_sock *us;
@@ -326,6 +321,9 @@ int udp_listen(struct udp_sock **usp, const struct sa *local,
 		if (r->ai_family == AF_INET6)
 			(void)net_sockopt_v6only(fd, false);
 
+		if (reuse)
+			(void)net_sockopt_reuse_set(fd, true);
+
 		if (bind(fd, r->ai_addr, SIZ_CAST r->ai_addrlen) < 0) {
 			err = RE_ERRNO_SOCK;
 			DEBUG_INFO("listen: bind(): %m (%J)\n", err, local);
@@ -365,6 +363,42 @@ int udp_listen(struct udp_sock **usp, const struct sa *local,
 }
 
 
+/**
+ * Create and listen on a UDP Socket
+ *
+ * @param usp   Pointer to returned UDP Socket
+ * @param local Local network address
+ * @param rh    Receive handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_listen(struct udp_sock **usp, const struct sa *local,
+	       udp_recv_h *rh, void *arg)
+{
+	return udp_listen_sock(usp, local, false, rh, arg);
+}
+
+
+/**
+ * Create and listen on a UDP Socket which shares its local port with
+ * other sockets (SO_REUSEPORT). The kernel distributes incoming
+ * datagrams between the sockets by flow.
+ *
+ * @param usp   Pointer to returned UDP Socket
+ * @param local Local network address
+ * @param rh    Receive handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_listen_shared(struct udp_sock **usp, const struct sa *local,
+		      udp_recv_h *rh, void *arg)
+{
+	return udp_listen_sock(usp, local, true, rh, arg);
+}
+
+
 int udp_alloc_sockless(struct udp_sock **usp,
 		       udp_send_h *sendh, udp_recv_h *recvh, void *arg)
 {
@@ -902,6 +936,10 @@ void udp_recv_helper(struct udp_sock *us, const struct sa *src,
 		le = le->next;
 		mtx_unlock(us->lock);
 
+		/* a lower helper may have stripped its header */
+		if (uh->classes && !(uh->classes & udp_pkt_classify(mb)))
+			continue;
+
 		if (src != &hsrc) {
 			sa_cpy(&hsrc, src);
 			src = &hsrc;
@@ -950,6 +988,53 @@ struct udp_helper *udp_helper_find(const struct udp_sock *us, int layer)
 }
 
 
+/**
+ * Set the packet classes a UDP helper receives. Datagrams of other
+ * classes are passed on to the next helper without calling it.
+ *
+ * @param uh      UDP helper
+ * @param classes Bitmask of enum udp_pkt_class, 0 for all packets
+ */
+void udp_helper_set_classes(struct udp_helper *uh, unsigned classes)
+{
+	if (!uh)
+		return;
+
+	uh->classes = classes;
+}
+
+
+/**
+ * Classify a datagram by its first byte, as described in RFC 7983
+ *
+ * @param mb Buffer with the datagram at the current position
+ *
+ * @return Packet class
+ */
+enum udp_pkt_class udp_pkt_classify(const struct mbuf *mb)
+{
+	uint8_t b;
+
+	if (!mbuf_get_left(mb))
+		return UDP_PKT_OTHER;
+
+	b = mb->buf[mb->pos];
+
+	if (b <= 3)
+		return UDP_PKT_STUN;
+	else if (b >= 16 && b <= 19)
+		return UDP_PKT_ZRTP;
+	else if (b >= 20 && b <= 63)
+		return UDP_PKT_DTLS;
+	else if (b >= 64 && b <= 79)
+		return UDP_PKT_TURN;
+	else if (b >= 128 && b <= 191)
+		return UDP_PKT_RTP;
+
+	return UDP_PKT_OTHER;
+}
+
+
 /**
  * Flush a given UDP socket
  *
@@ -997,6 +1082,10 @@ void udp_recv_packet(struct udp_sock *us, const struct sa *src,
 		le = le->next;
 		mtx_unlock(us->lock);
 
+		/* a lower helper may have stripped its header */
+		if (uh->classes && !(uh->classes & udp_pkt_classify(mb)))
+			continue;
+
 		if (src != &hsrc) {
 			sa_cpy(&hsrc, src);
 			src = &hsrc;
@@ -0,0 +1,864 @@
+/**
+ * @file websock/deflate.c  WebSocket permessage-deflate (RFC 7692)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_sa.h>
+#include <re_msg.h>
+#include <re_http.h>
+#include <re_websock.h>
+#include "websock.h"
+
+
+#ifdef USE_ZLIB
+
+
+enum {
+	WBITS_MIN = 9,     /* zlib cannot deflate with a 256 byte window */
+	WBITS_MAX = 15,
+	CHUNK     = 4096,
+};
+
+
+/*
+ * A side which does not take over its context starts every message
+ * with an empty window, so it needs no state between messages. Those
+ * streams are shared by all connections of a WebSocket instance, one
+ * per window size, and only connections with context takeover keep
+ * streams of their own.
+ */
+struct websock_dfl_pool {
+	struct websock_deflate conf;
+	struct zs *txv[WBITS_MAX + 1];
+	struct zs *rxv[WBITS_MAX + 1];
+};
+
+struct websock_dfl {
+	struct websock_deflate_stats stats;
+	struct websock_dfl_pool *pool;
+	struct zs *tx;        /* Deflater with context takeover      */
+	struct zs *rx;        /* Inflater with context takeover, or
+				 for a fragmented message            */
+	struct zs *rx_cur;    /* Inflater of the current message     */
+	uint8_t tx_bits;
+	uint8_t rx_bits;
+	bool tx_nctx;
+	bool rx_nctx;
+};
+
+struct zs {
+	z_stream z;
+	bool inflate;
+};
+
+/* Negotiated parameters, from the server point of view */
+struct params {
+	uint8_t srv_bits;
+	uint8_t cli_bits;
+	bool srv_nctx;
+	bool cli_nctx;
+};
+
+/* Extension parameters of an offer or a response */
+struct offer {
+	uint8_t srv_bits;     /* server_max_window_bits, 0 if absent    */
+	uint8_t cli_bits;     /* client_max_window_bits value, if any   */
+	bool cli_bits_param;  /* client_max_window_bits present         */
+	bool srv_nctx;
+	bool cli_nctx;
+};
+
+
+static void zs_destructor(void *arg)
+{
+	struct zs *zs = arg;
+
+	if (zs->inflate)
+		(void)inflateEnd(&zs->z);
+	else
+		(void)deflateEnd(&zs->z);
+}
+
+
+static int zs_alloc(struct zs **zsp, bool inflate, int level, uint8_t bits)
+{
+	struct zs *zs;
+	int ret;
+
+	zs = mem_zalloc(sizeof(*zs), NULL);
+	if (!zs)
+		return ENOMEM;
+
+	/* raw deflate, the memory level follows the window size */
+	if (inflate)
+		ret = inflateInit2(&zs->z, -MAX(bits, WBITS_MIN));
+	else
+		ret = deflateInit2(&zs->z, level, Z_DEFLATED, -bits,
+				   bits - 7, Z_DEFAULT_STRATEGY);
+	if (ret != Z_OK) {
+		mem_deref(zs);
+		return ret == Z_MEM_ERROR ? ENOMEM : EINVAL;
+	}
+
+	zs->inflate = inflate;
+	mem_destructor(zs, zs_destructor);
+
+	*zsp = zs;
+
+	return 0;
+}
+
+
+static void pool_destructor(void *arg)
+{
+	struct websock_dfl_pool *pool = arg;
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(pool->txv); i++) {
+		mem_deref(pool->txv[i]);
+		mem_deref(pool->rxv[i]);
+	}
+}
+
+
+static void dfl_destructor(void *arg)
+{
+	struct websock_dfl *dfl = arg;
+
+	mem_deref(dfl->tx);
+	mem_deref(dfl->rx);
+	mem_deref(dfl->pool);
+}
+
+
+static void trim(struct pl *pl)
+{
+	while (pl->l && (pl->p[0] == ' ' || pl->p[0] == '\t'))
+		pl_advance(pl, 1);
+
+	while (pl->l && (pl->p[pl->l-1] == ' ' || pl->p[pl->l-1] == '\t'))
+		--pl->l;
+}
+
+
+/* Split off the next element of a list */
+static bool list_next(struct pl *elem, struct pl *list, char sep)
+{
+	const char *p;
+
+	if (!list->p || !list->l)
+		return false;
+
+	p = pl_strchr(list, sep);
+
+	elem->p = list->p;
+	elem->l = p ? (size_t)(p - list->p) : list->l;
+
+	pl_advance(list, p ? elem->l + 1 : elem->l);
+	trim(elem);
+
+	return true;
+}
+
+
+static int bits_decode(uint8_t *bits, const struct pl *pl)
+{
+	uint32_t v;
+
+	if (pl->l < 1 || pl->l > 2)
+		return EBADMSG;
+
+	for (size_t i=0; i<pl->l; i++) {
+		if (pl->p[i] < '0' || pl->p[i] > '9')
+			return EBADMSG;
+	}
+
+	v = pl_u32(pl);
+	if (v < 8 || v > WBITS_MAX)
+		return EBADMSG;
+
+	*bits = (uint8_t)v;
+
+	return 0;
+}
+
+
+static int param_decode(struct offer *o, struct pl *param)
+{
+	struct pl name, val = PL_INIT;
+	const char *p;
+
+	p = pl_strchr(param, '=');
+	if (p) {
+		name.p = param->p;
+		name.l = p - param->p;
+		val.p  = p + 1;
+		val.l  = param->l - name.l - 1;
+
+		trim(&name);
+		trim(&val);
+
+		if (val.l >= 2 && val.p[0] == '"' && val.p[val.l-1] == '"') {
+			pl_advance(&val, 1);
+			val.l -= 1;
+		}
+
+		if (!val.l)
+			return EBADMSG;
+	}
+	else {
+		name = *param;
+	}
+
+	if (!pl_strcasecmp(&name, "server_no_context_takeover")) {
+
+		if (val.p || o->srv_nctx)
+			return EBADMSG;
+
+		o->srv_nctx = true;
+	}
+	else if (!pl_strcasecmp(&name, "client_no_context_takeover")) {
+
+		if (val.p || o->cli_nctx)
+			return EBADMSG;
+
+		o->cli_nctx = true;
+	}
+	else if (!pl_strcasecmp(&name, "server_max_window_bits")) {
+
+		if (!val.p || o->srv_bits)
+			return EBADMSG;
+
+		return bits_decode(&o->srv_bits, &val);
+	}
+	else if (!pl_strcasecmp(&name, "client_max_window_bits")) {
+
+		if (o->cli_bits_param)
+			return EBADMSG;
+
+		o->cli_bits_param = true;
+
+		if (val.p)
+			return bits_decode(&o->cli_bits, &val);
+	}
+	else {
+		return EBADMSG;
+	}
+
+	return 0;
+}
+
+
+static int offer_decode(struct offer *o, struct pl *ext)
+{
+	struct pl param;
+	int err;
+
+	memset(o, 0, sizeof(*o));
+
+	if (!list_next(&param, ext, ';') ||
+	    pl_strcasecmp(&param, "permessage-deflate"))
+		return ENOENT;
+
+	while (list_next(&param, ext, ';')) {
+
+		err = param_decode(o, &param);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
+static int dfl_alloc(struct websock_dfl **dflp, struct websock_dfl_pool *pool,
+		     const struct params *prm, bool server)
+{
+	struct websock_dfl *dfl;
+
+	dfl = mem_zalloc(sizeof(*dfl), dfl_destructor);
+	if (!dfl)
+		return ENOMEM;
+
+	dfl->pool    = mem_ref(pool);
+	dfl->tx_bits = server ? prm->srv_bits : prm->cli_bits;
+	dfl->rx_bits = server ? prm->cli_bits : prm->srv_bits;
+	dfl->tx_nctx = server ? prm->srv_nctx : prm->cli_nctx;
+	dfl->rx_nctx = server ? prm->cli_nctx : prm->srv_nctx;
+
+	*dflp = dfl;
+
+	return 0;
+}
+
+
+int websock_dfl_pool_alloc(struct websock_dfl_pool **poolp,
+			   const struct websock_deflate *conf)
+{
+	struct websock_dfl_pool *pool;
+	struct websock_deflate c;
+
+	if (!poolp || !conf)
+		return EINVAL;
+
+	c = *conf;
+
+	if (!c.level)
+		c.level = Z_DEFAULT_COMPRESSION;
+	if (!c.server_max_window_bits)
+		c.server_max_window_bits = WBITS_MAX;
+	if (!c.client_max_window_bits)
+		c.client_max_window_bits = WBITS_MAX;
+
+	if (c.level > 9 ||
+	    c.server_max_window_bits < WBITS_MIN ||
+	    c.server_max_window_bits > WBITS_MAX ||
+	    c.client_max_window_bits < WBITS_MIN ||
+	    c.client_max_window_bits > WBITS_MAX)
+		return EINVAL;
+
+	pool = mem_zalloc(sizeof(*pool), pool_destructor);
+	if (!pool)
+		return ENOMEM;
+
+	pool->conf = c;
+
+	*poolp = pool;
+
+	return 0;
+}
+
+
+/* Extension offer of a client */
+int websock_dfl_offer(char *buf, size_t sz,
+		      const struct websock_dfl_pool *pool)
+{
+	const struct websock_deflate *c;
+	char cbits[8] = "", sbits[32] = "";
+
+	if (!buf || !pool)
+		return EINVAL;
+
+	c = &pool->conf;
+
+	if (c->client_max_window_bits < WBITS_MAX)
+		re_snprintf(cbits, sizeof(cbits), "=%u",
+			    c->client_max_window_bits);
+
+	if (c->server_max_window_bits < WBITS_MAX)
+		re_snprintf(sbits, sizeof(sbits),
+			    "; server_max_window_bits=%u",
+			    c->server_max_window_bits);
+
+	if (re_snprintf(buf, sz, "permessage-deflate"
+			"; client_max_window_bits%s%s%s%s",
+			cbits, sbits,
+			c->server_no_context_takeover ?
+			"; server_no_context_takeover" : "",
+			c->client_no_context_takeover ?
+			"; client_no_context_takeover" : "") < 0)
+		return ENOMEM;
+
+	return 0;
+}
+
+
+/* Server: choose parameters for an offer, if it can be accepted */
+static int offer_accept(struct params *prm, const struct websock_deflate *c,
+			const struct offer *o)
+{
+	prm->srv_bits = c->server_max_window_bits;
+	if (o->srv_bits)
+		prm->srv_bits = MIN(prm->srv_bits, o->srv_bits);
+
+	if (prm->srv_bits < WBITS_MIN)
+		return ENOTSUP;
+
+	/* the client window can only be limited if the client allows it */
+	if (o->cli_bits_param) {
+		prm->cli_bits = c->client_max_window_bits;
+		if (o->cli_bits)
+			prm->cli_bits = MIN(prm->cli_bits, o->cli_bits);
+	}
+	else if (c->client_max_window_bits < WBITS_MAX) {
+		return ENOTSUP;
+	}
+	else {
+		prm->cli_bits = WBITS_MAX;
+	}
+
+	prm->srv_nctx = o->srv_nctx || c->server_no_context_takeover;
+	prm->cli_nctx = o->cli_nctx || c->client_no_context_takeover;
+
+	return 0;
+}
+
+
+/**
+ * Accept the first acceptable permessage-deflate offer of a client
+ *
+ * @param dflp Pointer to allocated extension state
+ * @param pool Shared extension state
+ * @param val  Sec-WebSocket-Extensions header value
+ * @param buf  Buffer for the response header value
+ * @param sz   Size of the buffer
+ *
+ * @return 0 if success, ENOENT if there is no acceptable offer
+ */
+int websock_dfl_accept(struct websock_dfl **dflp,
+		       struct websock_dfl_pool *pool, const struct pl *val,
+		       char *buf, size_t sz)
+{
+	struct pl list, ext;
+	char sbits[32] = "", cbits[32] = "";
+
+	if (!dflp || !pool || !val || !buf)
+		return EINVAL;
+
+	list = *val;
+
+	while (list_next(&ext, &list, ',')) {
+
+		struct params prm;
+		struct offer o;
+
+		if (offer_decode(&o, &ext))
+			continue;
+
+		if (offer_accept(&prm, &pool->conf, &o))
+			continue;
+
+		if (o.srv_bits || prm.srv_bits < WBITS_MAX)
+			re_snprintf(sbits, sizeof(sbits),
+				    "; server_max_window_bits=%u",
+				    prm.srv_bits);
+
+		if (prm.cli_bits < WBITS_MAX)
+			re_snprintf(cbits, sizeof(cbits),
+				    "; client_max_window_bits=%u",
+				    prm.cli_bits);
+
+		if (re_snprintf(buf, sz, "permessage-deflate%s%s%s%s",
+				prm.srv_nctx ?
+				"; server_no_context_takeover" : "",
+				prm.cli_nctx ?
+				"; client_no_context_takeover" : "",
+				sbits, cbits) < 0)
+			return ENOMEM;
+
+		return dfl_alloc(dflp, pool, &prm, true);
+	}
+
+	return ENOENT;
+}
+
+
+/**
+ * Check the permessage-deflate response of a server to our offer
+ *
+ * @param dflp Pointer to allocated extension state
+ * @param pool Shared extension state
+ * @param val  Sec-WebSocket-Extensions header value
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int websock_dfl_confirm(struct websock_dfl **dflp,
+			struct websock_dfl_pool *pool, const struct pl *val)
+{
+	const struct websock_deflate *c;
+	struct pl list, ext;
+	struct params prm;
+	struct offer o;
+
+	if (!dflp || !pool || !val)
+		return EINVAL;
+
+	c    = &pool->conf;
+	list = *val;
+
+	if (!list_next(&ext, &list, ',') || list.l)
+		return EPROTO;
+
+	if (offer_decode(&o, &ext))
+		return EPROTO;
+
+	if (c->server_max_window_bits < WBITS_MAX &&
+	    (!o.srv_bits || o.srv_bits > c->server_max_window_bits))
+		return EPROTO;
+
+	if (c->server_no_context_takeover && !o.srv_nctx)
+		return EPROTO;
+
+	if (o.cli_bits_param && !o.cli_bits)
+		return EPROTO;
+
+	if (o.cli_bits && o.cli_bits < WBITS_MIN)
+		return EPROTO;
+
+	prm.srv_bits = o.srv_bits ? o.srv_bits : WBITS_MAX;
+	prm.cli_bits = c->client_max_window_bits;
+	if (o.cli_bits)
+		prm.cli_bits = MIN(prm.cli_bits, o.cli_bits);
+
+	prm.srv_nctx = o.srv_nctx;
+	prm.cli_nctx = o.cli_nctx || c->client_no_context_takeover;
+
+	return dfl_alloc(dflp, pool, &prm, false);
+}
+
+
+static int tx_stream(z_stream **zp, struct websock_dfl *dfl)
+{
+	struct zs **zsp;
+	int err;
+
+	zsp = dfl->tx_nctx ? &dfl->pool->txv[dfl->tx_bits] : &dfl->tx;
+
+	if (!*zsp) {
+		err = zs_alloc(zsp, false, dfl->pool->conf.level,
+			       dfl->tx_bits);
+		if (err)
+			return err;
+	}
+	else if (dfl->tx_nctx) {
+		(void)deflateReset(&(*zsp)->z);
+	}
+
+	*zp = &(*zsp)->z;
+
+	return 0;
+}
+
+
+/**
+ * Compress a message. The output is passed to the print handler in
+ * chunks, without the trailing 0x00 0x00 0xff 0xff (RFC 7692 7.2.1).
+ *
+ * @param dfl Extension state
+ * @param p   Message payload
+ * @param n   Payload length
+ * @param ph  Print handler for the compressed payload
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int websock_dfl_compress(struct websock_dfl *dfl, const uint8_t *p,
+			 size_t n, re_vprintf_h *ph, void *arg)
+{
+	uint8_t buf[4 + CHUNK];
+	size_t keep = 0;
+	z_stream *z;
+	int err;
+
+	if (!dfl || (!p && n) || !ph)
+		return EINVAL;
+
+	err = tx_stream(&z, dfl);
+	if (err)
+		return err;
+
+	z->next_in  = (Bytef *)p;
+	z->avail_in = (uInt)n;
+
+	do {
+		size_t have;
+		int ret;
+
+		z->next_out  = buf + keep;
+		z->avail_out = CHUNK;
+
+		ret = deflate(z, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+			return EPROTO;
+
+		/* hold back the last 4 bytes, until they are known */
+		have = keep + CHUNK - z->avail_out;
+		if (have <= 4) {
+			keep = have;
+			continue;
+		}
+
+		err = ph((const char *)buf, have - 4, arg);
+		if (err)
+			return err;
+
+		memmove(buf, buf + have - 4, 4);
+		keep = 4;
+
+		dfl->stats.tx_comp += have - 4;
+
+	} while (z->avail_out == 0);
+
+	dfl->stats.tx_raw += n;
+
+	return 0;
+}
+
+
+static int rx_start(struct websock_dfl *dfl, bool fin)
+{
+	struct zs **zsp;
+	int err;
+
+	/* a shared inflater cannot wait for the next fragment */
+	if (dfl->rx_nctx && fin)
+		zsp = &dfl->pool->rxv[dfl->rx_bits];
+	else
+		zsp = &dfl->rx;
+
+	if (!*zsp) {
+		err = zs_alloc(zsp, true, 0, dfl->rx_bits);
+		if (err)
+			return err;
+	}
+	else if (dfl->rx_nctx) {
+		(void)inflateReset(&(*zsp)->z);
+	}
+
+	dfl->rx_cur = *zsp;
+
+	return 0;
+}
+
+
+static void rx_end(struct websock_dfl *dfl)
+{
+	/* keep no inflater between messages without context takeover */
+	if (dfl->rx_nctx)
+		dfl->rx = mem_deref(dfl->rx);
+
+	dfl->rx_cur = NULL;
+}
+
+
+static int inflate_mem(z_stream *z, struct mbuf *mb, const uint8_t *p,
+		       size_t n, size_t max)
+{
+	z->next_in  = (Bytef *)p;
+	z->avail_in = (uInt)n;
+
+	for (;;) {
+		size_t space;
+		int ret, err;
+
+		if (mb->pos == mb->size) {
+
+			if (mb->size >= max)
+				return EOVERFLOW;
+
+			err = mbuf_resize(mb, MIN(max, 2 * mb->size));
+			if (err)
+				return err;
+		}
+
+		space = mb->size - mb->pos;
+
+		z->next_out  = mb->buf + mb->pos;
+		z->avail_out = (uInt)space;
+
+		ret = inflate(z, Z_SYNC_FLUSH);
+
+		mb->pos += space - z->avail_out;
+		mb->end  = mb->pos;
+
+		if (ret == Z_STREAM_END) {
+			(void)inflateReset(z);
+			if (!z->avail_in)
+				break;
+		}
+		else if (ret == Z_BUF_ERROR) {
+			if (z->avail_out)
+				break;
+		}
+		else if (ret != Z_OK) {
+			return EBADMSG;
+		}
+		else if (!z->avail_in && z->avail_out) {
+			break;
+		}
+	}
+
+	return z->avail_in ? EBADMSG : 0;
+}
+
+
+/**
+ * Decompress one frame of a compressed message
+ *
+ * @param dfl Extension state
+ * @param mbp Pointer to allocated buffer with the decompressed payload
+ * @param p   Frame payload
+ * @param n   Payload length
+ * @param fin True for the last frame of the message
+ * @param max Max. decompressed frame size
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int websock_dfl_decompress(struct websock_dfl *dfl, struct mbuf **mbp,
+			   const uint8_t *p, size_t n, bool fin, size_t max)
+{
+	static const uint8_t trailer[4] = {0x00, 0x00, 0xff, 0xff};
+	struct mbuf *mb;
+	int err;
+
+	if (!dfl || !mbp || (!p && n) || !max)
+		return EINVAL;
+
+	if (!dfl->rx_cur) {
+		err = rx_start(dfl, fin);
+		if (err)
+			return err;
+	}
+
+	mb = mbuf_alloc(MIN(max, 4 * n + 256));
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = inflate_mem(&dfl->rx_cur->z, mb, p, n, max);
+	if (err)
+		goto out;
+
+	if (fin) {
+		err = inflate_mem(&dfl->rx_cur->z, mb, trailer,
+				  sizeof(trailer), max);
+		if (err)
+			goto out;
+	}
+
+	dfl->stats.rx_comp += n;
+	dfl->stats.rx_raw  += mb->end;
+
+ out:
+	if (fin || err)
+		rx_end(dfl);
+
+	if (err) {
+		mem_deref(mb);
+	}
+	else {
+		mb->pos = 0;
+		*mbp = mb;
+	}
+
+	return err;
+}
+
+
+/* True while the frames of a compressed message are received */
+bool websock_dfl_rx_active(const struct websock_dfl *dfl)
+{
+	return dfl && dfl->rx_cur;
+}
+
+
+const struct websock_deflate_stats *
+websock_dfl_stats(const struct websock_dfl *dfl)
+{
+	return dfl ? &dfl->stats : NULL;
+}
+
+
+#else
+
+
+int websock_dfl_pool_alloc(struct websock_dfl_pool **poolp,
+			   const struct websock_deflate *conf)
+{
+	(void)poolp;
+	(void)conf;
+
+	return ENOSYS;
+}
+
+
+int websock_dfl_offer(char *buf, size_t sz,
+		      const struct websock_dfl_pool *pool)
+{
+	(void)buf;
+	(void)sz;
+	(void)pool;
+
+	return ENOSYS;
+}
+
+
+int websock_dfl_accept(struct websock_dfl **dflp,
+		       struct websock_dfl_pool *pool, const struct pl *val,
+		       char *buf, size_t sz)
+{
+	(void)dflp;
+	(void)pool;
+	(void)val;
+	(void)buf;
+	(void)sz;
+
+	return ENOENT;
+}
+
+
+int websock_dfl_confirm(struct websock_dfl **dflp,
+			struct websock_dfl_pool *pool, const struct pl *val)
+{
+	(void)dflp;
+	(void)pool;
+	(void)val;
+
+	return EPROTO;
+}
+
+
+int websock_dfl_compress(struct websock_dfl *dfl, const uint8_t *p,
+			 size_t n, re_vprintf_h *ph, void *arg)
+{
+	(void)dfl;
+	(void)p;
+	(void)n;
+	(void)ph;
+	(void)arg;
+
+	return ENOSYS;
+}
+
+
+int websock_dfl_decompress(struct websock_dfl *dfl, struct mbuf **mbp,
+			   const uint8_t *p, size_t n, bool fin, size_t max)
+{
+	(void)dfl;
+	(void)mbp;
+	(void)p;
+	(void)n;
+	(void)fin;
+	(void)max;
+
+	return ENOSYS;
+}
+
+
+bool websock_dfl_rx_active(const struct websock_dfl *dfl)
+{
+	(void)dfl;
+
+	return false;
+}
+
+
+const struct websock_deflate_stats *
+websock_dfl_stats(const struct websock_dfl *dfl)
+{
+	(void)dfl;
+
+	return NULL;
+}
+
+
+#endif
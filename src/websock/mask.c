@@ -0,0 +1,96 @@
+/**
+ * @file websock/mask.c  WebSocket payload masking
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_sa.h>
+#include <re_msg.h>
+#include <re_http.h>
+#include <re_websock.h>
+
+
+/**
+ * Mask or unmask WebSocket payload (RFC 6455 5.3). The key repeats
+ * every 4 bytes, so it is applied a vector or a word at a time once
+ * the destination is aligned.
+ *
+ * @param dst  Destination buffer, may be the same as the source
+ * @param src  Source buffer
+ * @param n    Number of bytes
+ * @param mkey Masking key, 4 bytes
+ * @param pos  Payload offset of the first byte
+ */
+void websock_mask(uint8_t *dst, const uint8_t *src, size_t n,
+		  const uint8_t *mkey, size_t pos)
+{
+	uint8_t k[4];
+	uint32_t k32;
+	uint64_t k64;
+
+	if (!dst || !src || !mkey)
+		return;
+
+	for (; n && ((uintptr_t)dst & 15); n--, pos++)
+		*dst++ = *src++ ^ mkey[pos & 3];
+
+	for (size_t i=0; i<4; i++)
+		k[i] = mkey[(pos + i) & 3];
+
+	memcpy(&k32, k, 4);
+	k64 = (uint64_t)k32 << 32 | k32;
+
+#if defined(__AVX2__)
+	{
+		const __m256i kv = _mm256_set1_epi32((int)k32);
+
+		for (; n >= 32; n -= 32, dst += 32, src += 32) {
+			__m256i v = _mm256_loadu_si256((const void *)src);
+
+			_mm256_storeu_si256((void *)dst,
+					    _mm256_xor_si256(v, kv));
+		}
+	}
+#endif
+
+#if defined(__SSE2__)
+	{
+		const __m128i kv = _mm_set1_epi32((int)k32);
+
+		for (; n >= 16; n -= 16, dst += 16, src += 16) {
+			__m128i v = _mm_loadu_si128((const void *)src);
+
+			_mm_store_si128((void *)dst, _mm_xor_si128(v, kv));
+		}
+	}
+#elif defined(__ARM_NEON)
+	{
+		const uint8x16_t kv = vreinterpretq_u8_u32(vdupq_n_u32(k32));
+
+		for (; n >= 16; n -= 16, dst += 16, src += 16)
+			vst1q_u8(dst, veorq_u8(vld1q_u8(src), kv));
+	}
+#endif
+
+	for (; n >= 8; n -= 8, dst += 8, src += 8) {
+		uint64_t v;
+
+		memcpy(&v, src, 8);
+		v ^= k64;
+		memcpy(dst, &v, 8);
+	}
+
+	for (size_t i=0; i<n; i++)
+		dst[i] = src[i] ^ k[i & 3];
+}
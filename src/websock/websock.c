@@ -21,6 +21,7 @@
 #include <re_sha.h>
 #include <re_sys.h>
 #include <re_websock.h>
+#include "websock.h"
 
 
 enum {
@@ -37,6 +38,7 @@ enum websock_state {
 };
 
 struct websock {
+	struct websock_dfl_pool *dfl;
 	websock_shutdown_h *shuth;
 	void *arg;
 	bool shutdown;
@@ -51,6 +53,7 @@ struct websock_conn {
 	struct tls_conn *sc;
 	struct mbuf *mb;
 	struct http_req *req;
+	struct websock_dfl *dfl;
 	websock_estab_h *estabh;
 	websock_recv_h *recvh;
 	websock_close_h *closeh;
@@ -96,6 +99,8 @@ static void sock_destructor(void *arg)
 			sock->shuth(sock->arg);
 		return;
 	}
+
+	mem_deref(sock->dfl);
 }
 
 
@@ -124,6 +129,7 @@ static void conn_destructor(void *arg)
 	mem_deref(conn->tc);
 	mem_deref(conn->mb);
 	mem_deref(conn->req);
+	mem_deref(conn->dfl);
 	mem_deref(conn->sock);
 }
 
@@ -171,8 +177,7 @@ static enum websock_scode websock_err2scode(int err)
 
 static int websock_decode(struct websock_hdr *hdr, struct mbuf *mb)
 {
-	uint8_t v, *p;
-	size_t i;
+	uint8_t v;
 
 	if (mbuf_get_left(mb) < 2)
 		return ENODATA;
@@ -213,8 +218,8 @@ static int websock_decode(struct websock_hdr *hdr, struct mbuf *mb)
 		hdr->mkey[2] = mbuf_read_u8(mb);
 		hdr->mkey[3] = mbuf_read_u8(mb);
 
-		for (i=0, p=mbuf_buf(mb); i<hdr->len; i++)
-			p[i] = p[i] ^ hdr->mkey[i%4];
+		websock_mask(mbuf_buf(mb), mbuf_buf(mb), hdr->len,
+			     hdr->mkey, 0);
 	}
 	else {
 		if (mbuf_get_left(mb) < hdr->len)
@@ -274,7 +279,14 @@ static void recv_handler(struct mbuf *mb, void *arg)
 			goto out;
 		}
 
-		if (hdr.rsv1 || hdr.rsv2 || hdr.rsv3) {
+		if (hdr.rsv2 || hdr.rsv3) {
+			err = EPROTO;
+			goto out;
+		}
+
+		/* RSV1 marks the first frame of a compressed message */
+		if (hdr.rsv1 && (!conn->dfl || (hdr.opcode != WEBSOCK_TEXT &&
+						hdr.opcode != WEBSOCK_BIN))) {
 			err = EPROTO;
 			goto out;
 		}
@@ -306,6 +318,25 @@ static void recv_handler(struct mbuf *mb, void *arg)
 		case WEBSOCK_CONT:
 		case WEBSOCK_TEXT:
 		case WEBSOCK_BIN:
+			if (hdr.rsv1 || (hdr.opcode == WEBSOCK_CONT &&
+					 websock_dfl_rx_active(conn->dfl))) {
+
+				struct mbuf *mbd = NULL;
+
+				err = websock_dfl_decompress(conn->dfl, &mbd,
+							     mbuf_buf(mb),
+							     mbuf_get_left(mb),
+							     hdr.fin,
+							     BUFSIZE_MAX);
+				mem_deref(mb);
+				if (err)
+					goto out;
+
+				mb = mbd;
+				hdr.rsv1 = 0;
+				hdr.len  = mbuf_get_left(mb);
+			}
+
 			mem_ref(conn);
 			conn->recvh(&hdr, mb, conn->arg);
 
@@ -416,6 +447,18 @@ static void http_resp_handler(int err, const struct http_msg *msg, void *arg)
 	if (pl_strcmp(&hdr->val, buf))
 		goto fail;
 
+	/* only an extension we offered may be used */
+	hdr = http_msg_hdr(msg, HTTP_HDR_SEC_WEBSOCKET_EXTENSIONS);
+	if (hdr) {
+		if (!conn->sock->dfl)
+			goto fail;
+
+		err = websock_dfl_confirm(&conn->dfl, conn->sock->dfl,
+					  &hdr->val);
+		if (err)
+			goto fail;
+	}
+
 	/* here we are ok */
 
 	conn->state = OPEN;
@@ -454,6 +497,7 @@ static int ws_connect(struct websock_conn **connp, const char *proto,
 	struct websock_conn *conn;
 	uint8_t nonce[16];
 	char proto_hdr[64];
+	char ext[160];
 	size_t len;
 	int err, ret;
 
@@ -468,6 +512,12 @@ static int ws_connect(struct websock_conn **connp, const char *proto,
 			return EINVAL;
 	}
 
+	if (sock->dfl) {
+		err = websock_dfl_offer(ext, sizeof(ext), sock->dfl);
+		if (err)
+			return err;
+	}
+
 	conn = mem_zalloc(sizeof(*conn), conn_destructor);
 	if (!conn)
 		return ENOMEM;
@@ -498,10 +548,14 @@ static int ws_connect(struct websock_conn **connp, const char *proto,
 			   "Sec-WebSocket-Key: %b\r\n"
 			   "Sec-WebSocket-Version: 13\r\n"
 			   "%s"
+			   "%s%s%s"
 			   "%v"
 			   "\r\n",
 			   conn->nonce, sizeof(conn->nonce),
 			   proto ? proto_hdr : "",
+			   sock->dfl ? "Sec-WebSocket-Extensions: " : "",
+			   sock->dfl ? ext : "",
+			   sock->dfl ? "\r\n" : "",
 			   fmt, ap);
 	if (err)
 		goto out;
@@ -564,6 +618,25 @@ int websock_accept(struct websock_conn **connp, struct websock *sock,
 }
 
 
+struct ext_accept {
+	struct websock_dfl **dflp;
+	struct websock_dfl_pool *pool;
+	char buf[160];
+	int err;
+};
+
+
+static bool ext_accept_handler(const struct http_hdr *hdr, void *arg)
+{
+	struct ext_accept *ea = arg;
+
+	ea->err = websock_dfl_accept(ea->dflp, ea->pool, &hdr->val,
+				     ea->buf, sizeof(ea->buf));
+
+	return ea->err != ENOENT;
+}
+
+
 int websock_accept_proto(struct websock_conn **connp, const char *proto,
 			 struct websock *sock, struct http_conn *htconn,
 			 const struct http_msg *msg, unsigned kaint,
@@ -572,6 +645,7 @@ int websock_accept_proto(struct websock_conn **connp, const char *proto,
 {
 	const struct http_hdr *key;
 	struct websock_conn *conn;
+	struct ext_accept ea;
 	char proto_hdr[64];
 	int err, ret;
 
@@ -603,14 +677,32 @@ int websock_accept_proto(struct websock_conn **connp, const char *proto,
 	if (!conn)
 		return ENOMEM;
 
+	if (sock->dfl) {
+		ea.dflp = &conn->dfl;
+		ea.pool = sock->dfl;
+		ea.err  = 0;
+
+		(void)http_msg_hdr_apply(msg, true,
+					 HTTP_HDR_SEC_WEBSOCKET_EXTENSIONS,
+					 ext_accept_handler, &ea);
+		if (ea.err && ea.err != ENOENT) {
+			err = ea.err;
+			goto out;
+		}
+	}
+
 	err = http_reply(htconn, 101, "Switching Protocols",
 			 "Upgrade: websocket\r\n"
 			 "Connection: Upgrade\r\n"
 			 "Sec-WebSocket-Accept: %H\r\n"
 			 "%s"
+			 "%s%s%s"
 			 "\r\n",
 			 accept_print, &key->val,
-			 proto ? proto_hdr : "");
+			 proto ? proto_hdr : "",
+			 conn->dfl ? "Sec-WebSocket-Extensions: " : "",
+			 conn->dfl ? ea.buf : "",
+			 conn->dfl ? "\r\n" : "");
 	if (err)
 		goto out;
 
@@ -641,12 +733,48 @@ int websock_accept_proto(struct websock_conn **connp, const char *proto,
 }
 
 
-static int websock_encode(struct mbuf *mb, bool fin,
-			  enum websock_opcode opcode, bool mask, size_t len)
+/* Payload writer, masks while copying into the frame buffer */
+struct payload_print {
+	struct mbuf *mb;
+	const uint8_t *mkey;
+	size_t start;
+};
+
+
+static int payload_print_handler(const char *p, size_t size, void *arg)
+{
+	struct payload_print *pp = arg;
+	struct mbuf *mb = pp->mb;
+	int err;
+
+	if (!pp->mkey)
+		return mbuf_write_mem(mb, (const uint8_t *)p, size);
+
+	if (mbuf_get_space(mb) < size) {
+
+		err = mbuf_resize(mb, 2 * mb->size + size);
+		if (err)
+			return err;
+	}
+
+	websock_mask(mbuf_buf(mb), (const uint8_t *)p, size, pp->mkey,
+		     mb->pos - pp->start);
+
+	mb->pos += size;
+	mb->end  = MAX(mb->end, mb->pos);
+
+	return 0;
+}
+
+
+static int websock_encode(struct mbuf *mb, bool fin, bool rsv1,
+			  enum websock_opcode opcode, const uint8_t *mkey,
+			  size_t len)
 {
+	const bool mask = mkey != NULL;
 	int err;
 
-	err = mbuf_write_u8(mb, (fin<<7) | (opcode & 0x0f));
+	err = mbuf_write_u8(mb, (fin<<7) | (rsv1<<6) | (opcode & 0x0f));
 
 	if (len > 0xffff) {
 		err |= mbuf_write_u8(mb, (mask<<7) | 127);
@@ -660,18 +788,8 @@ static int websock_encode(struct mbuf *mb, bool fin,
 		err |= mbuf_write_u8(mb, (mask<<7) | (uint8_t)len);
 	}
 
-	if (mask) {
-		uint8_t mkey[4];
-		uint8_t *p;
-		size_t i;
-
-		rand_bytes(mkey, sizeof(mkey));
-
-		err |= mbuf_write_mem(mb, mkey, sizeof(mkey));
-
-		for (i=0, p=mbuf_buf(mb); i<len; i++)
-			p[i] = p[i] ^ mkey[i%4];
-	}
+	if (mask)
+		err |= mbuf_write_mem(mb, mkey, 4);
 
 	return err;
 }
@@ -681,6 +799,10 @@ static int websock_vsend(struct websock_conn *conn, enum websock_opcode opcode,
 			 enum websock_scode scode, const char *fmt, va_list ap)
 {
 	const size_t hsz = conn->active ? 14 : 10;
+	const bool compress = conn->dfl && (opcode == WEBSOCK_TEXT ||
+					    opcode == WEBSOCK_BIN);
+	struct payload_print pp;
+	uint8_t mkey[4];
 	size_t len, start;
 	struct mbuf *mb;
 	int err = 0;
@@ -694,10 +816,44 @@ static int websock_vsend(struct websock_conn *conn, enum websock_opcode opcode,
 
 	mb->pos = hsz;
 
-	if (scode)
-		err |= mbuf_write_u16(mb, htons(scode));
-	if (fmt)
-		err |= mbuf_vprintf(mb, fmt, ap);
+	if (conn->active)
+		rand_bytes(mkey, sizeof(mkey));
+
+	pp.mb    = mb;
+	pp.mkey  = conn->active ? mkey : NULL;
+	pp.start = hsz;
+
+	if (compress) {
+		struct mbuf *raw = NULL;
+
+		if (fmt) {
+			raw = mbuf_alloc(1024);
+			if (!raw) {
+				err = ENOMEM;
+				goto out;
+			}
+
+			err = mbuf_vprintf(raw, fmt, ap);
+		}
+
+		if (!err)
+			err = websock_dfl_compress(conn->dfl,
+						   raw ? raw->buf : NULL,
+						   raw ? raw->end : 0,
+						   payload_print_handler, &pp);
+		mem_deref(raw);
+	}
+	else {
+		if (scode) {
+			const uint16_t v = htons(scode);
+
+			err |= payload_print_handler((const char *)&v,
+						     sizeof(v), &pp);
+		}
+		if (fmt)
+			err |= re_vhprintf(fmt, ap, payload_print_handler,
+					   &pp);
+	}
 	if (err)
 		goto out;
 
@@ -710,7 +866,7 @@ static int websock_vsend(struct websock_conn *conn, enum websock_opcode opcode,
 	else
 		start = mb->pos = 8;
 
-	err = websock_encode(mb, true, opcode, conn->active, len);
+	err = websock_encode(mb, true, compress, opcode, pp.mkey, len);
 	if (err)
 		goto out;
 
@@ -807,3 +963,56 @@ void websock_shutdown(struct websock *sock)
 	sock->shutdown = true;
 	mem_deref(sock);
 }
+
+
+/**
+ * Enable the permessage-deflate extension (RFC 7692) for new client
+ * and server connections
+ *
+ * @param sock WebSocket instance
+ * @param conf Extension settings, NULL to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int websock_deflate(struct websock *sock, const struct websock_deflate *conf)
+{
+	struct websock_dfl_pool *pool = NULL;
+	int err;
+
+	if (!sock)
+		return EINVAL;
+
+	if (conf) {
+		err = websock_dfl_pool_alloc(&pool, conf);
+		if (err)
+			return err;
+	}
+
+	mem_deref(sock->dfl);
+	sock->dfl = pool;
+
+	return 0;
+}
+
+
+/**
+ * Get the permessage-deflate statistics of a connection
+ *
+ * @param conn  WebSocket connection
+ * @param stats Returned statistics
+ *
+ * @return 0 if success, ENOENT if the extension is not in use
+ */
+int websock_deflate_stats(const struct websock_conn *conn,
+			  struct websock_deflate_stats *stats)
+{
+	if (!conn || !stats)
+		return EINVAL;
+
+	if (!conn->dfl)
+		return ENOENT;
+
+	*stats = *websock_dfl_stats(conn->dfl);
+
+	return 0;
+}
@@ -0,0 +1,29 @@
+/**
+ * @file websock.h  WebSocket internal interface
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/* permessage-deflate (RFC 7692) */
+
+struct websock_dfl_pool;
+struct websock_dfl;
+
+int  websock_dfl_pool_alloc(struct websock_dfl_pool **poolp,
+			    const struct websock_deflate *conf);
+int  websock_dfl_offer(char *buf, size_t sz,
+		       const struct websock_dfl_pool *pool);
+int  websock_dfl_accept(struct websock_dfl **dflp,
+			struct websock_dfl_pool *pool, const struct pl *val,
+			char *buf, size_t sz);
+int  websock_dfl_confirm(struct websock_dfl **dflp,
+			 struct websock_dfl_pool *pool, const struct pl *val);
+int  websock_dfl_compress(struct websock_dfl *dfl, const uint8_t *p,
+			  size_t n, re_vprintf_h *ph, void *arg);
+int  websock_dfl_decompress(struct websock_dfl *dfl, struct mbuf **mbp,
+			    const uint8_t *p, size_t n, bool fin,
+			    size_t max);
+bool websock_dfl_rx_active(const struct websock_dfl *dfl);
+const struct websock_deflate_stats *
+     websock_dfl_stats(const struct websock_dfl *dfl);
@@ -96,6 +96,96 @@ static int test_aes_ctr_loop(void)
 }
 
 
+/*
+ * NIST SP 800-38A F.5 CTR vectors for all key sizes, encrypted and
+ * decrypted in chunks that do not align with the block size
+ */
+static int test_aes_ctr_stream(void)
+{
+	static const size_t chunkv[] = {5, 27, 1, 31};
+	static const struct {
+		size_t key_bits;
+		const char *key_str;
+		const char *ciph_str;
+	} testv[] = {
+		{128,
+		 "2b7e151628aed2a6abf7158809cf4f3c",
+		 "874d6191b620e3261bef6864990db6ce"
+		 "9806f66b7970fdff8617187bb9fffdff"
+		 "5ae4df3edbd5d35e5b4f09020db03eab"
+		 "1e031dda2fbe03d1792170a0f3009cee"},
+
+		{192,
+		 "8e73b0f7da0e6452c810f32b809079e5"
+		 "62f8ead2522c6b7b",
+		 "1abc932417521ca24f2b0459fe7e6e0b"
+		 "090339ec0aa6faefd5ccc2c6f4ce8e94"
+		 "1e36b26bd1ebc670d1bd1d665620abf7"
+		 "4f78a7f6d29809585a97daec58c6b050"},
+
+		{256,
+		 "603deb1015ca71be2b73aef0857d7781"
+		 "1f352c073b6108d72d9810a30914dff4",
+		 "601ec313775789a5b7a7f504bbf3d228"
+		 "f443e3ca4d62b59aca84e990cacaf5c5"
+		 "2b0930daa23de94ce87017ba2d84988d"
+		 "dfc9c58db67aada613c2dd08457941a6"},
+	};
+	uint8_t iv[AES_BLOCK_SIZE];
+	uint8_t plain[64], ciph[64], out[64];
+	struct aes *aes = NULL;
+	int err;
+
+	err  = str_hex(iv, sizeof(iv), "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff");
+	err |= str_hex(plain, sizeof(plain),
+		       "6bc1bee22e409f96e93d7e117393172a"
+		       "ae2d8a571e03ac9c9eb76fac45af8e51"
+		       "30c81c46a35ce411e5fbc1191a0a52ef"
+		       "f69f2445df4f9b17ad2b417be66c3710");
+	if (err)
+		return err;
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(testv); i++) {
+
+		uint8_t key[32];
+		size_t pos = 0;
+
+		err  = str_hex(key, testv[i].key_bits / 8, testv[i].key_str);
+		err |= str_hex(ciph, sizeof(ciph), testv[i].ciph_str);
+		TEST_ERR(err);
+
+		err = aes_alloc(&aes, AES_MODE_CTR, key, testv[i].key_bits,
+				iv);
+		TEST_ERR(err);
+
+		for (size_t j=0; j<RE_ARRAY_SIZE(chunkv); j++) {
+			err = aes_encr(aes, out + pos, plain + pos,
+				       chunkv[j]);
+			TEST_ERR(err);
+			pos += chunkv[j];
+		}
+
+		TEST_MEMCMP(ciph, sizeof(ciph), out, sizeof(out));
+
+		/* in-place, after a new IV */
+		aes_set_iv(aes, iv);
+
+		err  = aes_decr(aes, out, out, 17);
+		err |= aes_decr(aes, out + 17, out + 17, sizeof(out) - 17);
+		TEST_ERR(err);
+
+		TEST_MEMCMP(plain, sizeof(plain), out, sizeof(out));
+
+		aes = mem_deref(aes);
+	}
+
+ out:
+	mem_deref(aes);
+
+	return err;
+}
+
+
 static bool have_aes(enum aes_mode mode)
 {
 	static const uint8_t nullkey[AES_BLOCK_SIZE];
@@ -122,6 +212,9 @@ int test_aes(void)
 	err = test_aes_ctr_loop();
 	TEST_ERR(err);
 
+	err = test_aes_ctr_stream();
+	TEST_ERR(err);
+
 out:
 	return err;
 }
@@ -134,6 +227,73 @@ out:
 #define TAG_LEN 16    /* 128 bits */
 
 
+/*
+ * GCM spec test case 4 (AES-128, 60 bytes text, 20 bytes AAD), with
+ * AAD and text passed in chunks that do not align with the block size
+ */
+static int test_aes_gcm_stream(void)
+{
+	uint8_t key[16], iv[IV_LEN], aad[20], tag_ref[TAG_LEN];
+	uint8_t plain[60], ciph[60], buf[60], tag[TAG_LEN];
+	struct aes *aes = NULL;
+	int err;
+
+	err  = str_hex(key, sizeof(key), "feffe9928665731c6d6a8f9467308308");
+	err |= str_hex(iv, sizeof(iv), "cafebabefacedbaddecaf888");
+	err |= str_hex(aad, sizeof(aad),
+		       "feedfacedeadbeeffeedfacedeadbeefabaddad2");
+	err |= str_hex(plain, sizeof(plain),
+		       "d9313225f88406e5a55909c5aff5269a"
+		       "86a7a9531534f7da2e4c303d8a318a72"
+		       "1c3c0c95956809532fcf0e2449a6b525"
+		       "b16aedf5aa0de657ba637b39");
+	err |= str_hex(ciph, sizeof(ciph),
+		       "42831ec2217774244b7221b784d0d49c"
+		       "e3aa212f2c02a4e035c17e2329aca12e"
+		       "21d514b25466931c7d8f6a5aac84aa05"
+		       "1ba30b396a0aac973d58e091");
+	err |= str_hex(tag_ref, sizeof(tag_ref),
+		       "5bc94fbc3221a5db94fae95ae7121a47");
+	if (err)
+		return err;
+
+	err = aes_alloc(&aes, AES_MODE_GCM, key, 128, iv);
+	TEST_ERR(err);
+
+	err  = aes_encr(aes, NULL, aad, 7);
+	err |= aes_encr(aes, NULL, aad + 7, sizeof(aad) - 7);
+	err |= aes_encr(aes, buf, plain, 1);
+	err |= aes_encr(aes, buf + 1, plain + 1, 17);
+	err |= aes_encr(aes, buf + 18, plain + 18, sizeof(plain) - 18);
+	TEST_ERR(err);
+
+	TEST_MEMCMP(ciph, sizeof(ciph), buf, sizeof(buf));
+
+	err = aes_get_authtag(aes, tag, sizeof(tag));
+	TEST_ERR(err);
+
+	TEST_MEMCMP(tag_ref, sizeof(tag_ref), tag, sizeof(tag));
+
+	/* decrypt in-place on the same context, after a new IV */
+	aes_set_iv(aes, iv);
+
+	err  = aes_decr(aes, NULL, aad, sizeof(aad));
+	err |= aes_decr(aes, buf, buf, 33);
+	err |= aes_decr(aes, buf + 33, buf + 33, sizeof(buf) - 33);
+	TEST_ERR(err);
+
+	err = aes_authenticate(aes, tag_ref, sizeof(tag_ref));
+	TEST_ERR(err);
+
+	TEST_MEMCMP(plain, sizeof(plain), buf, sizeof(buf));
+
+ out:
+	mem_deref(aes);
+
+	return err;
+}
+
+
 /**
  * Testcases for AES GCM (Galois Counter Mode)
  *
@@ -357,6 +517,10 @@ int test_aes_gcm(void)
 
 		dec = mem_deref(dec);
 	}
+	TEST_ERR(err);
+
+	err = test_aes_gcm_stream();
+	TEST_ERR(err);
 
  out:
 	mem_deref(enc);
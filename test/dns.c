@@ -459,3 +459,456 @@ out:
 
 	return err;
 }
+
+
+struct test_dnsc {
+	struct dns_query *qv[8];
+	uint32_t addr;
+	uint8_t rcode;
+	unsigned n;
+	unsigned nexp;
+	int err;
+};
+
+
+static void cache_query_handler(int err, const struct dnshdr *hdr,
+				struct list *ansl, struct list *authl,
+				struct list *addl, void *arg)
+{
+	struct dnsrr *rr = list_ledata(list_head(ansl));
+	struct test_dnsc *t = arg;
+	(void)authl;
+	(void)addl;
+
+	TEST_ERR(err);
+	TEST_EQUALS(t->rcode, hdr->rcode);
+
+	if (t->addr) {
+		TEST_ASSERT(rr != NULL);
+		TEST_EQUALS(t->addr, rr->rdata.a.addr);
+	}
+	else {
+		TEST_ASSERT(rr == NULL);
+	}
+
+ out:
+	if (err)
+		t->err = err;
+
+	if (err || ++t->n == t->nexp)
+		re_cancel();
+}
+
+
+static int cache_query(struct test_dnsc *t, struct dnsc *dnsc,
+		       const char *name, unsigned n)
+{
+	int err = 0;
+
+	t->n    = 0;
+	t->nexp = n;
+
+	for (unsigned i=0; i<n; i++) {
+
+		err = dnsc_query(&t->qv[i], dnsc, name, DNS_TYPE_A,
+				 DNS_CLASS_IN, true, cache_query_handler, t);
+		if (err)
+			break;
+	}
+
+	return err;
+}
+
+
+static void wait_handler(void *arg)
+{
+	(void)arg;
+	re_cancel();
+}
+
+
+/* Run the main loop for a while, the test timeout may be overridden */
+static void main_wait(uint32_t ms)
+{
+	struct tmr tmr;
+
+	tmr_init(&tmr);
+	tmr_start(&tmr, ms, wait_handler, NULL);
+
+	(void)re_main_timeout(ms + 1000);
+
+	tmr_cancel(&tmr);
+}
+
+
+int test_dns_cache(void)
+{
+	struct dns_server *srv = NULL;
+	struct dnsc *dnsc = NULL;
+	struct dnsc_stats stats;
+	struct test_dnsc t;
+	int err;
+
+	memset(&t, 0, sizeof(t));
+
+	err = dns_server_alloc(&srv, false);
+	TEST_ERR(err);
+
+	err  = dns_server_add_a(srv, "test1.example.net", IP_127_0_0_1, 1);
+	err |= dns_server_add_a(srv, "test2.example.net", IP_127_0_0_2, 600);
+	err |= dns_server_add_soa(srv, "example.net", 600);
+	TEST_ERR(err);
+
+	err = dnsc_alloc(&dnsc, NULL, &srv->addr, 1);
+	TEST_ERR(err);
+
+	dnsc_cache_stale(dnsc, 60);
+
+	/* --- Identical queries share one request --- */
+	t.addr = IP_127_0_0_2;
+	err = cache_query(&t, dnsc, "test2.example.net", 8);
+	TEST_ERR(err);
+
+	err = re_main_timeout(200);
+	TEST_ERR(err);
+	err = t.err;
+	TEST_ERR(err);
+
+	TEST_EQUALS(8, t.n);
+	TEST_EQUALS(1, srv->nq);
+
+	/* --- The remaining queries survive a cancelled one --- */
+	dnsc_cache_flush(dnsc);
+
+	err = cache_query(&t, dnsc, "test2.example.net", 3);
+	TEST_ERR(err);
+
+	t.qv[0] = mem_deref(t.qv[0]);
+	t.nexp  = 2;
+
+	err = re_main_timeout(200);
+	TEST_ERR(err);
+	err = t.err;
+	TEST_ERR(err);
+
+	TEST_EQUALS(2, t.n);
+	TEST_EQUALS(3, srv->nq);
+
+	/* --- NXDOMAIN is cached with the SOA minimum (RFC 2308) --- */
+	t.addr  = 0;
+	t.rcode = DNS_RCODE_NAME_ERR;
+
+	for (int i=0; i<2; i++) {
+
+		err = cache_query(&t, dnsc, "nx.example.net", 1);
+		TEST_ERR(err);
+
+		err = re_main_timeout(200);
+		TEST_ERR(err);
+		err = t.err;
+		TEST_ERR(err);
+	}
+
+	TEST_EQUALS(1, t.n);
+	TEST_EQUALS(4, srv->nq);
+
+	/* --- Expired answers are used when the server is gone --- */
+	t.addr  = IP_127_0_0_1;
+	t.rcode = DNS_RCODE_OK;
+
+	err = cache_query(&t, dnsc, "test1.example.net", 1);
+	TEST_ERR(err);
+
+	err = re_main_timeout(200);
+	TEST_ERR(err);
+
+	sys_msleep(150);    /* wait until TTL timer expires */
+	main_wait(1); /* execute tmr callbacks */
+
+	srv->silent = true;
+
+	err = cache_query(&t, dnsc, "test1.example.net", 2);
+	TEST_ERR(err);
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+	err = t.err;
+	TEST_ERR(err);
+
+	TEST_EQUALS(2, t.n);
+
+	err = dnsc_stats(dnsc, &stats);
+	TEST_ERR(err);
+
+	TEST_EQUALS(1, stats.hits);
+	TEST_EQUALS(5, stats.misses);
+	TEST_EQUALS(10, stats.coalesced);
+	TEST_EQUALS(2, stats.stale);
+
+	/* --- Answers over the memory limit are not kept --- */
+	srv->silent = false;
+
+	main_wait(600); /* complete the refresh of the stale answer */
+
+	srv->nq = 0;
+
+	dnsc_cache_limit(dnsc, 1);
+
+	t.addr = IP_127_0_0_2;
+
+	for (int i=0; i<2; i++) {
+
+		err = cache_query(&t, dnsc, "test2.example.net", 1);
+		TEST_ERR(err);
+
+		err = re_main_timeout(200);
+		TEST_ERR(err);
+		err = t.err;
+		TEST_ERR(err);
+	}
+
+	TEST_EQUALS(2, srv->nq);
+
+ out:
+	mem_deref(dnsc);
+	mem_deref(srv);
+
+	return err;
+}
+
+
+static struct {
+	mtx_t *mtx;
+	uint32_t calls;
+	uint32_t running;
+	uint32_t running_max;
+} stub;
+
+
+/* called from the resolver threads */
+static int stub_resolv(struct list *rrl, const char *name, uint16_t type)
+{
+	struct dnsrr *rr;
+	int err = 0;
+	(void)type;
+
+	mtx_lock(stub.mtx);
+	++stub.calls;
+	++stub.running;
+	stub.running_max = MAX(stub.running_max, stub.running);
+	mtx_unlock(stub.mtx);
+
+	if (!strncmp(name, "slow", 4))
+		sys_msleep(200);
+
+	rr = dns_rr_alloc();
+	if (!rr) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = str_dup(&rr->name, name);
+	if (err) {
+		mem_deref(rr);
+		goto out;
+	}
+
+	rr->type	 = DNS_TYPE_A;
+	rr->dnsclass	 = DNS_CLASS_IN;
+	rr->rdlen	 = 4;
+	rr->rdata.a.addr = IP_127_0_0_1;
+
+	list_append(rrl, &rr->le_priv, rr);
+
+ out:
+	mtx_lock(stub.mtx);
+	--stub.running;
+	mtx_unlock(stub.mtx);
+
+	return err;
+}
+
+
+struct test_gai {
+	uint32_t n;
+	uint32_t nexp;
+	int experr;
+	int err;
+};
+
+
+static void gai_query_handler(int err, const struct dnshdr *hdr,
+			      struct list *ansl, struct list *authl,
+			      struct list *addl, void *arg)
+{
+	struct dnsrr *rr = list_ledata(list_head(ansl));
+	struct test_gai *t = arg;
+	(void)hdr;
+	(void)authl;
+	(void)addl;
+
+	TEST_EQUALS(t->experr, err);
+
+	if (!t->experr) {
+		TEST_ASSERT(rr != NULL);
+		TEST_EQUALS(IP_127_0_0_1, rr->rdata.a.addr);
+	}
+
+	err = 0;
+
+ out:
+	if (err)
+		t->err = err;
+
+	if (err || ++t->n == t->nexp)
+		re_cancel();
+}
+
+
+int test_dns_getaddrinfo(void)
+{
+	enum { NAMES = 10000, WORKERS = 4 };
+	struct dnsc *dnsc = NULL;
+	struct dnsc_stats stats;
+	struct test_gai t;
+	struct sa srv;
+	uint64_t start;
+	char name[64];
+	int err;
+
+	/* the resolver has no argument, so its counters are shared */
+	if (test_mode == TEST_THREAD)
+		return ESKIPPED;
+
+	memset(&stub, 0, sizeof(stub));
+	memset(&t, 0, sizeof(t));
+
+	err = mutex_alloc(&stub.mtx);
+	TEST_ERR(err);
+
+	err = sa_set_str(&srv, "127.0.0.1", 53);
+	TEST_ERR(err);
+
+	err = dnsc_alloc(&dnsc, NULL, &srv, 1);
+	TEST_ERR(err);
+
+	dnsc_getaddrinfo(dnsc, true);
+	dnsc_getaddrinfo_pool(dnsc, WORKERS, 0);
+	dnsc_getaddrinfo_resolver(dnsc, stub_resolv);
+
+	/* --- Many names, each queried twice, use a bounded pool --- */
+	t.nexp = 2 * NAMES;
+
+	for (unsigned i=0; i<2*NAMES; i++) {
+
+		re_snprintf(name, sizeof(name), "host%u.example.net",
+			    i % NAMES);
+
+		err = dnsc_query(NULL, dnsc, name, DNS_TYPE_A, DNS_CLASS_IN,
+				 true, gai_query_handler, &t);
+		TEST_ERR(err);
+	}
+
+	err = re_main_timeout(10000);
+	TEST_ERR(err);
+	err = t.err;
+	TEST_ERR(err);
+
+	TEST_EQUALS(2 * NAMES, t.n);
+	TEST_EQUALS(NAMES, stub.calls);
+	TEST_ASSERT(stub.running_max <= WORKERS);
+
+	err = dnsc_stats(dnsc, &stats);
+	TEST_ERR(err);
+
+	TEST_EQUALS(NAMES, stats.misses);
+	TEST_EQUALS(NAMES, stats.coalesced);
+
+	/* --- Queries time out, queued lookups never start --- */
+	dnsc = mem_deref(dnsc);
+
+	err = dnsc_alloc(&dnsc, NULL, &srv, 1);
+	TEST_ERR(err);
+
+	dnsc_getaddrinfo(dnsc, true);
+	dnsc_getaddrinfo_pool(dnsc, 1, 50);
+	dnsc_getaddrinfo_resolver(dnsc, stub_resolv);
+
+	stub.calls = 0;
+	t.n        = 0;
+	t.nexp     = 2;
+	t.experr   = ETIMEDOUT;
+
+	err  = dnsc_query(NULL, dnsc, "slow.example.net", DNS_TYPE_A,
+			  DNS_CLASS_IN, true, gai_query_handler, &t);
+	err |= dnsc_query(NULL, dnsc, "fast.example.net", DNS_TYPE_A,
+			  DNS_CLASS_IN, true, gai_query_handler, &t);
+	TEST_ERR(err);
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+	err = t.err;
+	TEST_ERR(err);
+
+	TEST_EQUALS(2, t.n);
+
+	main_wait(300); /* the slow lookup completes */
+
+	TEST_EQUALS(1, stub.calls);
+
+	/* --- The late answer was cached --- */
+	t.n      = 0;
+	t.nexp   = 1;
+	t.experr = 0;
+
+	err = dnsc_query(NULL, dnsc, "slow.example.net", DNS_TYPE_A,
+			 DNS_CLASS_IN, true, gai_query_handler, &t);
+	TEST_ERR(err);
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+	err = t.err;
+	TEST_ERR(err);
+
+	err = dnsc_stats(dnsc, &stats);
+	TEST_ERR(err);
+
+	TEST_EQUALS(1, stats.hits);
+	TEST_EQUALS(1, stub.calls);
+
+	/* --- Freeing the client does not wait for a running lookup --- */
+	t.n      = 0;
+	t.nexp   = 1;
+	t.experr = ECONNABORTED;
+	t.err    = 0;
+
+	err = dnsc_query(NULL, dnsc, "slow2.example.net", DNS_TYPE_A,
+			 DNS_CLASS_IN, true, gai_query_handler, &t);
+	TEST_ERR(err);
+
+	start = tmr_jiffies();
+	dnsc = mem_deref(dnsc);
+	TEST_ASSERT(tmr_jiffies() - start < 100);
+
+	/* the pending query was aborted */
+	err = t.err;
+	TEST_ERR(err);
+	TEST_EQUALS(1, t.n);
+
+	main_wait(300); /* the detached lookup completes */
+
+	TEST_EQUALS(2, stub.calls);
+	TEST_EQUALS(0, stub.running);
+
+ out:
+	mem_deref(dnsc);
+
+	/* let detached lookups finish and release their workers */
+	while (stub.running)
+		main_wait(10);
+	main_wait(10);
+
+	mem_deref(stub.mtx);
+
+	return err;
+}
@@ -193,7 +193,8 @@ static void conn_handler(const struct sa *src, void *arg)
 }
 
 
-static int test_dtls_srtp_base(enum tls_method method, bool dtls_srtp)
+static int test_dtls_srtp_base(enum tls_method method, bool dtls_srtp,
+			       const struct dtls_listen_conf *conf)
 {
 	static const char *srtp_suites =
 		"SRTP_AES128_CM_SHA1_80:"
@@ -243,6 +244,11 @@ static int test_dtls_srtp_base(enum tls_method method, bool dtls_srtp)
 	err = dtls_listen(&test.sock_srv, NULL, us, 4, 0, conn_handler, &test);
 	TEST_ERR(err);
 
+	if (conf) {
+		err = dtls_set_listen_conf(test.sock_srv, conf);
+		TEST_ERR(err);
+	}
+
 	err = dtls_listen(&test.sock_cli, &cli, NULL, 4, 0, NULL, NULL);
 	TEST_ERR(err);
 
@@ -283,6 +289,19 @@ static int test_dtls_srtp_base(enum tls_method method, bool dtls_srtp)
 			    test.srv.srv_key, sizeof(test.srv.srv_key));
 	}
 
+	if (conf) {
+		struct dtls_listen_stats stats;
+
+		err = dtls_listen_stats(test.sock_srv, &stats);
+		TEST_ERR(err);
+
+		TEST_EQUALS(conf->cookie ? 1 : 0, stats.hello_verify);
+		TEST_EQUALS(conf->cookie ? 1 : 0, stats.verified);
+		TEST_EQUALS(0, stats.rejected);
+		TEST_EQUALS(1, stats.completed);
+		TEST_EQUALS(0, stats.pending);
+	}
+
  out:
 	test.conn_cli = mem_deref(test.conn_cli);
 	test.conn_srv = mem_deref(test.conn_srv);
@@ -320,7 +339,7 @@ int test_dtls(void)
 		return ESKIPPED;
 	}
 	else {
-		err = test_dtls_srtp_base(TLS_METHOD_DTLSV1, false);
+		err = test_dtls_srtp_base(TLS_METHOD_DTLSV1, false, NULL);
 		if (err)
 			return err;
 	}
@@ -338,9 +357,185 @@ int test_dtls_srtp(void)
 		return ESKIPPED;
 	}
 
-	err = test_dtls_srtp_base(TLS_METHOD_DTLSV1, true);
+	err = test_dtls_srtp_base(TLS_METHOD_DTLSV1, true, NULL);
 	if (err)
 		return err;
 
 	return 0;
 }
+
+
+int test_dtls_cookie(void)
+{
+	struct dtls_listen_conf conf = {
+		.cookie = true,
+	};
+	int err;
+
+	if (!have_dtls_support(TLS_METHOD_DTLS)) {
+		(void)re_printf("skip DTLS tests\n");
+		return ESKIPPED;
+	}
+
+	err = test_dtls_srtp_base(TLS_METHOD_DTLS, false, &conf);
+	if (err == ENOSYS)
+		return ESKIPPED;
+	TEST_ERR(err);
+
+	/* pending handshakes are limited only */
+	memset(&conf, 0, sizeof(conf));
+	conf.hs_pending = 1;
+
+	err = test_dtls_srtp_base(TLS_METHOD_DTLS, false, &conf);
+	TEST_ERR(err);
+
+ out:
+	return err;
+}
+
+
+static void limit_conn_handler(const struct sa *src, void *arg)
+{
+	unsigned *n_conn = arg;
+	(void)src;
+
+	++*n_conn;
+}
+
+
+static int hello_packet(struct dtls_sock *sock, const struct sa *src,
+			uint8_t type)
+{
+	struct mbuf *mb = mbuf_alloc(128);
+	int err = 0;
+
+	if (!mb)
+		return ENOMEM;
+
+	/* record and handshake header of a ClientHello, 42 bytes body */
+	err |= mbuf_write_u8(mb, 22);
+	err |= mbuf_write_u16(mb, htons(0xfefd));
+	err |= mbuf_fill(mb, 0, 8);
+	err |= mbuf_write_u16(mb, htons(12 + 42));
+
+	err |= mbuf_write_u8(mb, type);
+	err |= mbuf_write_u8(mb, 0);
+	err |= mbuf_write_u16(mb, htons(42));
+	err |= mbuf_fill(mb, 0, 6);
+	err |= mbuf_write_u16(mb, htons(42));
+
+	err |= mbuf_write_u16(mb, htons(0xfefd));
+	err |= mbuf_fill(mb, 0x2a, 32);
+	err |= mbuf_write_u8(mb, 0);   /* session_id */
+	err |= mbuf_write_u8(mb, 0);   /* cookie     */
+	err |= mbuf_write_u16(mb, htons(2));
+	err |= mbuf_write_u16(mb, htons(0xc02b));
+	err |= mbuf_write_u8(mb, 1);
+	err |= mbuf_write_u8(mb, 0);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+	dtls_recv_packet(sock, src, mb);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+int test_dtls_limit(void)
+{
+	struct dtls_listen_conf conf = {
+		.hs_rate  = 1,
+		.hs_burst = 2,
+	};
+	struct dtls_listen_stats stats;
+	struct dtls_sock *sock = NULL;
+	unsigned n_conn = 0;
+	struct sa laddr, peer;
+	int err;
+
+	err  = sa_set_str(&laddr, "127.0.0.1", 0);
+	err |= sa_set_str(&peer, "127.0.0.1", 5004);
+	TEST_ERR(err);
+
+	err = dtls_listen(&sock, &laddr, NULL, 4, 0, limit_conn_handler,
+			  &n_conn);
+	if (err == ENOSYS)
+		return ESKIPPED;
+	TEST_ERR(err);
+
+	TEST_EINVAL(dtls_set_listen_conf, NULL, &conf);
+	TEST_EINVAL(dtls_listen_stats, sock, NULL);
+
+	/* without protection every packet reaches the connect handler */
+	err = hello_packet(sock, &peer, 2);
+	TEST_ERR(err);
+	TEST_EQUALS(1, n_conn);
+
+	err = dtls_set_listen_conf(sock, &conf);
+	TEST_ERR(err);
+
+	/* not a ClientHello */
+	err = hello_packet(sock, &peer, 2);
+	TEST_ERR(err);
+	TEST_EQUALS(1, n_conn);
+
+	/* the token bucket admits a burst of two */
+	for (int i=0; i<4; i++) {
+		sa_set_port(&peer, 5006 + 2*i);
+		err = hello_packet(sock, &peer, 1);
+		TEST_ERR(err);
+	}
+	TEST_EQUALS(3, n_conn);
+
+	err = dtls_listen_stats(sock, &stats);
+	TEST_ERR(err);
+
+	TEST_EQUALS(0, stats.hello_verify);
+	TEST_EQUALS(0, stats.verified);
+	TEST_EQUALS(3, stats.rejected);
+	TEST_EQUALS(0, stats.completed);
+	TEST_EQUALS(0, stats.pending);
+
+	err = dtls_set_listen_conf(sock, NULL);
+	TEST_ERR(err);
+
+	err = hello_packet(sock, &peer, 1);
+	TEST_ERR(err);
+	TEST_EQUALS(4, n_conn);
+
+	/* a refill keeps the time not yet worth a token, 100 ms each */
+	if (test_mode != TEST_MEMORY) {
+
+		conf.hs_rate = 10;
+
+		err = dtls_set_listen_conf(sock, &conf);
+		TEST_ERR(err);
+
+		for (int i=0; i<2; i++) {
+			err = hello_packet(sock, &peer, 1);
+			TEST_ERR(err);
+		}
+		TEST_EQUALS(6, n_conn);
+
+		sys_msleep(150);
+
+		err = hello_packet(sock, &peer, 1);
+		TEST_ERR(err);
+		TEST_EQUALS(7, n_conn);
+
+		sys_msleep(60);
+
+		err = hello_packet(sock, &peer, 1);
+		TEST_ERR(err);
+		TEST_EQUALS(8, n_conn);
+	}
+
+ out:
+	mem_deref(sock);
+
+	return err;
+}
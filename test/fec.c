@@ -0,0 +1,447 @@
+/**
+ * @file fec.c Forward Error Correction Testcode
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "fectest"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	FEC_SSRC = 0x01020304,
+	FEC_NPKT = 16,
+};
+
+
+struct fec_test {
+	struct mbuf *pktv[FEC_NPKT];
+	struct jbuf *jb;
+	unsigned n_recovered;
+	int err;
+};
+
+
+static int pkt_make(struct mbuf **mbp, uint16_t seq, bool marker,
+		    size_t plen)
+{
+	struct rtp_header hdr;
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(RTP_HEADER_SIZE + 8 + plen);
+	if (!mb)
+		return ENOMEM;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ver  = RTP_VERSION;
+	hdr.m    = marker;
+	hdr.pt   = 96;
+	hdr.seq  = seq;
+	hdr.ts   = 3000 * (seq / 4);
+	hdr.ssrc = FEC_SSRC;
+	hdr.cc   = seq % 3 == 1;
+	hdr.ext  = seq % 4 == 2;
+	hdr.csrc[0] = 0xc0ffee;
+
+	err = rtp_hdr_encode(mb, &hdr);
+	if (hdr.ext) {
+		err |= rtpext_hdr_encode(mb, 4);
+		err |= mbuf_write_u32(mb, htonl(0x10aabbcc));
+	}
+
+	for (size_t i=0; i<plen; i++)
+		err |= mbuf_write_u8(mb, (uint8_t)(seq * 7 + i));
+
+	if (err) {
+		mem_deref(mb);
+		return err;
+	}
+
+	mb->pos = 0;
+	*mbp = mb;
+
+	return 0;
+}
+
+
+static int pkt_recv(struct fec_dec *dec, struct jbuf *jb,
+		    const struct mbuf *pkt)
+{
+	struct rtp_header hdr;
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(pkt->end);
+	if (!mb)
+		return ENOMEM;
+
+	err = mbuf_write_mem(mb, pkt->buf, pkt->end);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+
+	err = rtp_hdr_decode(&hdr, mb);
+	if (err)
+		goto out;
+
+	err = fec_dec_media(dec, &hdr, mb);
+	if (err)
+		goto out;
+
+	if (jb)
+		err = jbuf_put(jb, &hdr, mb);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+static int fec_recv(struct fec_dec *dec, struct mbuf *fec)
+{
+	struct rtp_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ssrc = FEC_SSRC;
+
+	return fec_dec_fec(dec, &hdr, fec);
+}
+
+
+static void recover_handler(const struct rtp_header *hdr, struct mbuf *mb,
+			    void *arg)
+{
+	struct fec_test *t = arg;
+	const struct mbuf *orig = t->pktv[(hdr->seq - 100) % FEC_NPKT];
+	int err = 0;
+
+	++t->n_recovered;
+
+	TEST_EQUALS(FEC_SSRC, hdr->ssrc);
+	TEST_MEMCMP(orig->buf, orig->end, mb->buf, mb->end);
+
+	err = jbuf_put(t->jb, hdr, mb);
+	TEST_ERR(err);
+
+ out:
+	if (err)
+		t->err = err;
+}
+
+
+static int test_fec_hdr(void)
+{
+	struct mbuf *pktv[2] = {NULL, NULL};
+	struct mbuf *mb;
+	struct fec_hdr hdr;
+	int err;
+
+	mb = mbuf_alloc(256);
+	if (!mb)
+		return ENOMEM;
+
+	err  = pkt_make(&pktv[0], 65535, false, 10);
+	err |= pkt_make(&pktv[1], 1, true, 20);
+	TEST_ERR(err);
+
+	/* SN base wraps, offsets 0 and 2 fit in a short mask */
+	err = fec_encode(mb, pktv, 2);
+	TEST_ERR(err);
+
+	mb->pos = 0;
+	err = fec_hdr_decode(&hdr, mb);
+	TEST_ERR(err);
+
+	TEST_EQUALS(false, hdr.l);
+	TEST_EQUALS(65535, hdr.sn_base);
+	TEST_EQUALS(24, hdr.prot_len);
+	TEST_EQUALS(10 ^ 24, hdr.len_rec);
+	TEST_EQUALS(0x80, hdr.b1);
+	TEST_EQUALS(0xa00000000000ULL, hdr.mask);
+	TEST_EQUALS(hdr.prot_len, mbuf_get_left(mb));
+
+	/* offset 20 needs the long mask */
+	mem_deref(pktv[1]);
+	pktv[1] = NULL;
+	err = pkt_make(&pktv[1], 19, false, 20);
+	TEST_ERR(err);
+
+	mbuf_rewind(mb);
+	err = fec_encode(mb, pktv, 2);
+	TEST_ERR(err);
+
+	mb->pos = 0;
+	err = fec_hdr_decode(&hdr, mb);
+	TEST_ERR(err);
+
+	TEST_EQUALS(true, hdr.l);
+	TEST_EQUALS(0x800008000000ULL, hdr.mask);
+
+	/* out of mask range */
+	mem_deref(pktv[1]);
+	pktv[1] = NULL;
+	err = pkt_make(&pktv[1], 47, false, 20);
+	TEST_ERR(err);
+
+	mbuf_rewind(mb);
+	err = fec_encode(mb, pktv, 2);
+	TEST_EQUALS(ERANGE, err);
+	err = 0;
+
+ out:
+	mem_deref(pktv[0]);
+	mem_deref(pktv[1]);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+int test_fec(void)
+{
+	struct fec_test t;
+	struct fec_enc *enc = NULL;
+	struct fec_dec *dec = NULL;
+	struct fec_stats stats;
+	struct mbuf *fec;
+	uint16_t seq = 0;
+	int err;
+
+	memset(&t, 0, sizeof(t));
+
+	err = test_fec_hdr();
+	TEST_ERR(err);
+
+	err = fec_enc_alloc(&enc, 8, 2, FEC_MASK_INTERLEAVED);
+	TEST_ERR(err);
+
+	err = fec_dec_alloc(&dec, recover_handler, &t);
+	TEST_ERR(err);
+
+	err = jbuf_alloc(&t.jb, 0, 100);
+	TEST_ERR(err);
+
+	for (uint16_t i=0; i<FEC_NPKT; i++) {
+
+		err = pkt_make(&t.pktv[i], 100 + i, (i % 8) == 7,
+			       17 * i + 3);
+		TEST_ERR(err);
+
+		err = fec_enc_put(enc, t.pktv[i]);
+		TEST_ERR(err);
+
+		/* lose one packet in the first group, two in the second */
+		if (i != 3 && i != 9 && i != 10) {
+			err = pkt_recv(dec, t.jb, t.pktv[i]);
+			TEST_ERR(err);
+		}
+
+		while (0 == fec_enc_get(enc, &fec)) {
+			err = fec_recv(dec, fec);
+			mem_deref(fec);
+			TEST_ERR(err);
+		}
+	}
+
+	err = t.err;
+	TEST_ERR(err);
+	TEST_EQUALS(3, t.n_recovered);
+
+	fec_dec_stats(dec, &stats);
+	TEST_EQUALS(13, stats.media);
+	TEST_EQUALS(4, stats.fec);
+	TEST_EQUALS(3, stats.recovered);
+
+	/* all packets are in the jitter buffer, in order */
+	for (uint16_t i=0; i<FEC_NPKT; i++) {
+		struct rtp_header hdr;
+		void *mem;
+
+		err = jbuf_drain(t.jb, &hdr, &mem);
+		TEST_ERR(err);
+		mem_deref(mem);
+
+		TEST_EQUALS(100 + i, hdr.seq);
+		seq = hdr.seq;
+	}
+
+	TEST_EQUALS(100 + FEC_NPKT - 1, seq);
+
+ out:
+	for (size_t i=0; i<FEC_NPKT; i++)
+		mem_deref(t.pktv[i]);
+
+	mem_deref(t.jb);
+	mem_deref(dec);
+	mem_deref(enc);
+
+	return err;
+}
+
+
+static void loss_handler(const struct rtp_header *hdr, struct mbuf *mb,
+			 void *arg)
+{
+	unsigned *n_recovered = arg;
+	(void)hdr;
+	(void)mb;
+
+	++*n_recovered;
+}
+
+
+static bool loss_sim(uint32_t *state)
+{
+	*state = *state * 1103515245 + 12345;
+
+	return ((*state >> 16) % 100) < 5;
+}
+
+
+static const struct loss_conf {
+	uint8_t k, m;
+	enum fec_mask type;
+} loss_confv[] = {
+	{10, 1, FEC_MASK_BLOCK},
+	{10, 2, FEC_MASK_BLOCK},
+	{10, 2, FEC_MASK_INTERLEAVED},
+	{ 8, 4, FEC_MASK_INTERLEAVED},
+};
+
+struct loss_result {
+	unsigned n_lost;
+	unsigned n_fec;
+	unsigned n_recovered;
+	uint64_t usec;
+};
+
+enum { LOSS_N = 480, LOSS_PLEN = 300 };
+
+
+/* Send LOSS_N packets with FEC over a channel with 5% random loss */
+static int loss_run(const struct loss_conf *conf, struct loss_result *res)
+{
+	struct fec_enc *enc = NULL;
+	struct fec_dec *dec = NULL;
+	struct mbuf *pkt = NULL, *fec;
+	uint32_t state = 42;
+	uint64_t usec;
+	int err;
+
+	memset(res, 0, sizeof(*res));
+
+	err  = fec_enc_alloc(&enc, conf->k, conf->m, conf->type);
+	err |= fec_dec_alloc(&dec, loss_handler, &res->n_recovered);
+	if (err)
+		goto out;
+
+	for (uint16_t i=0; i<LOSS_N; i++) {
+
+		err = pkt_make(&pkt, i, false, LOSS_PLEN);
+		if (err)
+			goto out;
+
+		usec = tmr_jiffies_usec();
+		err = fec_enc_put(enc, pkt);
+		res->usec += tmr_jiffies_usec() - usec;
+		if (err)
+			goto out;
+
+		if (loss_sim(&state)) {
+			++res->n_lost;
+		}
+		else {
+			err = pkt_recv(dec, NULL, pkt);
+			if (err)
+				goto out;
+		}
+
+		pkt = mem_deref(pkt);
+
+		while (0 == fec_enc_get(enc, &fec)) {
+
+			++res->n_fec;
+
+			if (!loss_sim(&state))
+				err = fec_recv(dec, fec);
+
+			mem_deref(fec);
+			if (err)
+				goto out;
+		}
+	}
+
+ out:
+	mem_deref(pkt);
+	mem_deref(dec);
+	mem_deref(enc);
+
+	return err;
+}
+
+
+/*
+ * Residual loss with 5% random loss, for different FEC configurations
+ */
+int test_fec_recovery(void)
+{
+	struct loss_result res;
+	int err = 0;
+
+	for (size_t c=0; c<RE_ARRAY_SIZE(loss_confv); c++) {
+
+		err = loss_run(&loss_confv[c], &res);
+		TEST_ERR(err);
+
+		TEST_ASSERT(res.n_lost > 0);
+		TEST_ASSERT(res.n_fec >= LOSS_N / loss_confv[c].k);
+		TEST_ASSERT(res.n_recovered <= res.n_lost);
+		TEST_ASSERT(res.n_recovered > 0);
+	}
+
+ out:
+	return err;
+}
+
+
+/*
+ * FEC overhead, residual loss and encoding time,
+ * run with "retest -p test_fec_recovery_perf"
+ */
+int test_fec_recovery_perf(void)
+{
+	struct loss_result res;
+	int err = 0;
+
+	if (test_mode != TEST_PERF)
+		return ESKIPPED;
+
+	for (size_t c=0; c<RE_ARRAY_SIZE(loss_confv); c++) {
+
+		const struct loss_conf *conf = &loss_confv[c];
+
+		err = loss_run(conf, &res);
+		TEST_ERR(err);
+
+		re_printf("fec: k=%2u m=%u %-11s overhead=%4.1f%%"
+			  " loss=%4.1f%% residual=%4.1f%% encode=%u ns/pkt\n",
+			  conf->k, conf->m,
+			  conf->type == FEC_MASK_BLOCK ? "block"
+			  : "interleaved",
+			  100.0 * res.n_fec / LOSS_N,
+			  100.0 * res.n_lost / LOSS_N,
+			  100.0 * (res.n_lost - res.n_recovered) / LOSS_N,
+			  (unsigned)(res.usec * 1000 / LOSS_N));
+	}
+
+ out:
+	return err;
+}
@@ -215,6 +215,131 @@ static int test_hash_large(void)
 }
 
 
+static uint32_t obj_key(const struct le *le)
+{
+	const struct object *obj = le->data;
+
+	return obj->key;
+}
+
+
+static bool count_apply(struct le *le, void *arg)
+{
+	(void)le;
+
+	++*(uint32_t *)arg;
+
+	return false;
+}
+
+
+static int test_hash_auto(void)
+{
+	enum { N = 5000 };
+	struct hash *ht = NULL;
+	uint32_t i, n = 0, max = 0;
+	int err = 0;
+
+	err = hash_alloc_auto(&ht, 4, obj_key);
+	TEST_ERR(err);
+
+	for (i=0; i<N; i++) {
+
+		struct object *obj;
+
+		obj = mem_zalloc(sizeof(*obj), obj_destructor);
+		if (!obj) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		obj->key = hash_joaat((uint8_t *)&i, sizeof(i));
+
+		hash_append(ht, obj->key, &obj->he, obj);
+	}
+
+	TEST_ASSERT(hash_bsize(ht) > N / 8);
+	TEST_ASSERT(hash_bsize(ht) <= N);
+
+	/* the bucket of each key is found through both lookup paths */
+	for (i=0; i<N; i++) {
+
+		uint32_t key = hash_joaat((uint8_t *)&i, sizeof(i));
+		struct le *le;
+
+		le = hash_lookup(ht, key, cmp_handler, &key);
+		TEST_ASSERT(le != NULL);
+		TEST_ASSERT(le->list == hash_list(ht, key));
+	}
+
+	for (i=0; i<hash_bsize(ht); i++)
+		max = MAX(max, list_count(hash_list_idx(ht, i)));
+
+	TEST_ASSERT(max <= 16);
+
+	hash_apply(ht, count_apply, &n);
+	TEST_EQUALS(N, n);
+
+	hash_flush(ht);
+	ht = mem_deref(ht);
+
+	/* identical keys must not grow the table without bound */
+	err = hash_alloc_auto(&ht, 4, obj_key);
+	TEST_ERR(err);
+
+	for (i=0; i<64; i++) {
+
+		struct object *obj;
+
+		obj = mem_zalloc(sizeof(*obj), obj_destructor);
+		if (!obj) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		obj->key = 42;
+
+		hash_append(ht, obj->key, &obj->he, obj);
+	}
+
+	TEST_ASSERT(hash_bsize(ht) <= 16);
+	TEST_EQUALS(64, list_count(hash_list(ht, 42)));
+
+	hash_flush(ht);
+	ht = mem_deref(ht);
+
+	/* churn of colliding keys grows by the live load only */
+	err = hash_alloc_auto(&ht, 4, obj_key);
+	TEST_ERR(err);
+
+	for (i=0; i<10000; i++) {
+
+		struct object *obj;
+
+		obj = mem_zalloc(sizeof(*obj), obj_destructor);
+		if (!obj) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		obj->key = 42;
+
+		hash_append(ht, obj->key, &obj->he, obj);
+
+		if (list_count(hash_list(ht, 42)) > 8)
+			mem_deref(list_ledata(list_head(hash_list(ht, 42))));
+	}
+
+	TEST_EQUALS(4, hash_bsize(ht));
+
+ out:
+	hash_flush(ht);
+	mem_deref(ht);
+
+	return err;
+}
+
+
 int test_hash(void)
 {
 	int err;
@@ -231,5 +356,9 @@ int test_hash(void)
 	if (err)
 		return err;
 
+	err = test_hash_auto();
+	if (err)
+		return err;
+
 	return 0;
 }
@@ -651,11 +651,10 @@ static int test_http_loop_base(bool secure, const char *met, bool http_conn,
 				put ? 	http_req_long_body_handler :
 					http_req_body_handler,
 				&t,
-				"Content-Length: %zu\r\n%s\r\n%s",
+				"Content-Length: %zu\r\n%s\r\n",
 				t.clen,
 				t.clen > REQ_BODY_CHUNK_SIZE ?
-					"Expect: 100-continue\r\n" : "",
-				"abcdefghijklmnopqrstuvwxyz");
+					"Expect: 100-continue\r\n" : "");
 		}
 
 		if (err)
@@ -820,3 +819,509 @@ int test_https_conn_post_handshake(void)
 }
 
 #endif
+
+
+enum {
+	PIPE_STREAM_SIZE = 300000,
+};
+
+struct pipe_test {
+	struct tcp_conn *tc;
+	struct http_conn *async;
+	struct http_conn *stream;
+	struct tmr tmr;
+	struct mbuf *mb;
+	char file[256];
+	size_t stream_pos;
+	uint32_t n_req;
+	int err;
+};
+
+
+static void pipe_abort(struct pipe_test *t, int err)
+{
+	t->err = err;
+	re_cancel();
+}
+
+
+static void pipe_async_handler(void *arg)
+{
+	struct pipe_test *t = arg;
+	int err;
+
+	err = http_creply(t->async, 200, "OK", "text/plain", "async");
+	t->async = NULL;
+	if (err)
+		pipe_abort(t, err);
+}
+
+
+static size_t pipe_stream_handler(struct mbuf *mb, void *arg)
+{
+	struct pipe_test *t = arg;
+	size_t n = min(mbuf_get_space(mb), PIPE_STREAM_SIZE - t->stream_pos);
+
+	/* only called when the previous data has been sent */
+	if (tcp_conn_txqsz(http_conn_tcp(t->stream)))
+		t->err = EOVERFLOW;
+
+	for (size_t i=0; i<n; i++)
+		(void)mbuf_write_u8(mb, 'a' + (t->stream_pos + i) % 26);
+
+	t->stream_pos += n;
+
+	return n;
+}
+
+
+static void pipe_req_handler(struct http_conn *conn,
+			     const struct http_msg *msg, void *arg)
+{
+	struct pipe_test *t = arg;
+	int err = 0;
+
+	/* the previous response must be complete */
+	TEST_ASSERT(t->async == NULL);
+
+	switch (t->n_req++) {
+
+	case 0:
+		TEST_ERR(pl_strcmp(&msg->path, "/async"));
+		t->async = conn;
+		tmr_start(&t->tmr, 10, pipe_async_handler, t);
+		break;
+
+	case 1:
+		TEST_ERR(pl_strcmp(&msg->path, "/stream"));
+		t->stream = conn;
+		err = http_sreply(conn, 200, "OK", -1, pipe_stream_handler, t,
+				  "Content-Type: text/plain\r\n");
+		break;
+
+	case 2:
+	case 3:
+		TEST_ERR(pl_strcmp(&msg->path, "/file"));
+		err = http_freply(conn, 200, "OK", "application/json",
+				  t->file);
+		break;
+
+	default:
+		err = EPROTO;
+		break;
+	}
+
+ out:
+	if (err)
+		pipe_abort(t, err);
+}
+
+
+static void pipe_estab_handler(void *arg)
+{
+	struct pipe_test *t = arg;
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(512);
+	if (!mb) {
+		pipe_abort(t, ENOMEM);
+		return;
+	}
+
+	err = mbuf_write_str(mb,
+			     "GET /async HTTP/1.1\r\n"
+			     "\r\n"
+			     "GET /stream HTTP/1.1\r\n"
+			     "\r\n"
+			     "HEAD /file HTTP/1.1\r\n"
+			     "\r\n"
+			     "GET /file HTTP/1.1\r\n"
+			     "Connection: close\r\n"
+			     "\r\n");
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+
+	err = tcp_send(t->tc, mb);
+
+ out:
+	mem_deref(mb);
+	if (err)
+		pipe_abort(t, err);
+}
+
+
+static void pipe_recv_handler(struct mbuf *mb, void *arg)
+{
+	struct pipe_test *t = arg;
+	int err;
+
+	err = mbuf_write_mem(t->mb, mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		pipe_abort(t, err);
+}
+
+
+static void pipe_close_handler(int err, void *arg)
+{
+	struct pipe_test *t = arg;
+
+	/* the server gives up early if it runs out of memory */
+	if (!err && t->n_req < 4)
+		err = ENOMEM;
+
+	pipe_abort(t, err);
+}
+
+
+static int chunked_decode(struct mbuf *body, struct mbuf *mb)
+{
+	for (;;) {
+		struct pl pl = {(char *)mbuf_buf(mb), mbuf_get_left(mb)};
+		struct pl size;
+		uint32_t n;
+		int err;
+
+		if (re_regex(pl.p, pl.l, "[0-9a-f]+\r\n", &size))
+			return EBADMSG;
+
+		mbuf_advance(mb, size.p - pl.p + size.l + 2);
+
+		n = pl_x32(&size);
+		if (mbuf_get_left(mb) < n + 2)
+			return EBADMSG;
+
+		err = mbuf_write_mem(body, mbuf_buf(mb), n);
+		if (err)
+			return err;
+
+		mbuf_advance(mb, n + 2);
+
+		if (!n)
+			return 0;
+	}
+}
+
+
+/*
+ * Four pipelined requests: an asynchronous response, a streamed body
+ * of unknown length, HEAD and GET of a file, the last one closing.
+ */
+int test_http_pipeline(void)
+{
+	struct pipe_test t;
+	struct http_sock *sock = NULL;
+	struct http_msg *msg = NULL;
+	struct mbuf *body = NULL, *file = NULL;
+	struct sa srv;
+	int err;
+
+	memset(&t, 0, sizeof(t));
+
+	t.mb = mbuf_alloc(PIPE_STREAM_SIZE);
+	body = mbuf_alloc(PIPE_STREAM_SIZE);
+	if (!t.mb || !body) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	re_snprintf(t.file, sizeof(t.file), "%s/menu.json", test_datapath());
+
+	err = fs_fread(&file, t.file);
+	TEST_ERR(err);
+
+	err = sa_set_str(&srv, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err = http_listen(&sock, &srv, pipe_req_handler, &t);
+	TEST_ERR(err);
+
+	err = tcp_sock_local_get(http_sock_tcp(sock), &srv);
+	TEST_ERR(err);
+
+	err = tcp_connect(&t.tc, &srv, pipe_estab_handler, pipe_recv_handler,
+			  pipe_close_handler, &t);
+	TEST_ERR(err);
+
+	err = re_main_timeout(2000);
+	TEST_ERR(err);
+
+	err = t.err;
+	TEST_ERR(err);
+
+	TEST_EQUALS(4, t.n_req);
+
+	t.mb->pos = 0;
+
+	/* asynchronous response */
+	err = http_msg_decode(&msg, t.mb, false);
+	TEST_ERR(err);
+	TEST_EQUALS(200, msg->scode);
+	TEST_STRCMP("async", 5, mbuf_buf(t.mb), msg->clen);
+	mbuf_advance(t.mb, msg->clen);
+	msg = mem_deref(msg);
+
+	/* streamed */
+	err = http_msg_decode(&msg, t.mb, false);
+	TEST_ERR(err);
+	TEST_ASSERT(http_msg_hdr_has_value(msg, HTTP_HDR_TRANSFER_ENCODING,
+					   "chunked"));
+	msg = mem_deref(msg);
+
+	err = chunked_decode(body, t.mb);
+	TEST_ERR(err);
+	TEST_EQUALS(PIPE_STREAM_SIZE, body->end);
+	for (size_t i=0; i<body->end; i++)
+		TEST_EQUALS('a' + i % 26, body->buf[i]);
+
+	/* HEAD, no body */
+	err = http_msg_decode(&msg, t.mb, false);
+	TEST_ERR(err);
+	TEST_EQUALS(file->end, msg->clen);
+	msg = mem_deref(msg);
+
+	/* GET */
+	err = http_msg_decode(&msg, t.mb, false);
+	TEST_ERR(err);
+	TEST_EQUALS(file->end, msg->clen);
+	TEST_MEMCMP(file->buf, file->end, mbuf_buf(t.mb), msg->clen);
+	mbuf_advance(t.mb, msg->clen);
+
+	TEST_EQUALS(0, mbuf_get_left(t.mb));
+
+ out:
+	tmr_cancel(&t.tmr);
+	mem_deref(msg);
+	mem_deref(t.tc);
+	mem_deref(t.mb);
+	mem_deref(sock);
+	mem_deref(body);
+	mem_deref(file);
+
+	return err;
+}
+
+
+enum {
+	POOL_REQUESTS = 24,
+};
+
+struct pool_test {
+	struct http_conn *connv[POOL_REQUESTS];  /* waiting for a reply */
+	uint32_t pathv[POOL_REQUESTS];
+	struct sa peerv[POOL_REQUESTS];          /* client connections */
+	struct tmr tmr;
+	uint32_t n_wait;
+	uint32_t n_peer;
+	uint32_t n_req;
+	uint32_t n_resp;
+	bool fifo;                               /* single connection */
+	int err;
+};
+
+struct pool_req {
+	struct pool_test *t;
+	uint32_t i;
+};
+
+
+static void pool_abort(struct pool_test *t, int err)
+{
+	t->err = err;
+	re_cancel();
+}
+
+
+static void pool_reply_handler(void *arg)
+{
+	struct pool_test *t = arg;
+	int err = 0;
+
+	for (uint32_t i=0; i<t->n_wait; i++) {
+
+		err = http_creply(t->connv[i], 200, "OK", "text/plain",
+				  "%u", t->pathv[i]);
+		if (err)
+			break;
+	}
+
+	t->n_wait = 0;
+
+	if (err)
+		pool_abort(t, err);
+}
+
+
+static void pool_req_handler(struct http_conn *conn,
+			     const struct http_msg *msg, void *arg)
+{
+	struct pool_test *t = arg;
+	const struct sa *peer = http_conn_peer(conn);
+	uint32_t i;
+
+	for (i=0; i<t->n_peer; i++) {
+		if (sa_cmp(&t->peerv[i], peer, SA_ALL))
+			break;
+	}
+
+	if (i == t->n_peer)
+		t->peerv[t->n_peer++] = *peer;
+
+	if (t->n_wait >= POOL_REQUESTS) {
+		pool_abort(t, EOVERFLOW);
+		return;
+	}
+
+	/* reply later, so requests pile up */
+	t->connv[t->n_wait] = conn;
+	t->pathv[t->n_wait] = pl_u32(&(struct pl){msg->path.p + 1,
+						  msg->path.l - 1});
+
+	if (t->fifo && t->pathv[t->n_wait] != t->n_req) {
+		pool_abort(t, EPROTO);
+		return;
+	}
+
+	++t->n_wait;
+	++t->n_req;
+
+	tmr_start(&t->tmr, 2, pool_reply_handler, t);
+}
+
+
+static void pool_resp_handler(int err, const struct http_msg *msg,
+			      void *arg)
+{
+	struct pool_req *r = arg;
+	struct pool_test *t = r->t;
+
+	if (err)
+		goto out;
+
+	if (t->fifo)
+		TEST_EQUALS(t->n_resp, r->i);
+
+	TEST_EQUALS(200, msg->scode);
+	TEST_EQUALS(r->i, pl_u32(&(struct pl){(char *)mbuf_buf(msg->mb),
+					       mbuf_get_left(msg->mb)}));
+
+	if (++t->n_resp == POOL_REQUESTS)
+		re_cancel();
+
+ out:
+	if (err)
+		pool_abort(t, err);
+}
+
+
+static int pool_run(struct http_pool_stats *stats, uint32_t max_conns,
+		    uint32_t pipeline)
+{
+	struct pool_req rv[POOL_REQUESTS];
+	struct http_sock *sock = NULL;
+	struct http_cli *cli = NULL;
+	struct dnsc *dnsc = NULL;
+	struct pool_test t;
+	struct sa srv, dns;
+	char uri[64];
+	int err;
+
+	memset(&t, 0, sizeof(t));
+	t.fifo = max_conns == 1;
+
+	err  = sa_set_str(&srv, "127.0.0.1", 0);
+	err |= sa_set_str(&dns, "127.0.0.1", 53);    /* note: unused */
+	TEST_ERR(err);
+
+	err = http_listen(&sock, &srv, pool_req_handler, &t);
+	TEST_ERR(err);
+
+	err = tcp_sock_local_get(http_sock_tcp(sock), &srv);
+	TEST_ERR(err);
+
+	err = dnsc_alloc(&dnsc, NULL, &dns, 1);
+	TEST_ERR(err);
+
+	err = http_client_alloc(&cli, dnsc);
+	TEST_ERR(err);
+
+	err = http_client_set_pool(cli, max_conns, pipeline);
+	TEST_ERR(err);
+
+	for (uint32_t i=0; i<POOL_REQUESTS; i++) {
+
+		rv[i].t = &t;
+		rv[i].i = i;
+
+		re_snprintf(uri, sizeof(uri), "http://%J/%u", &srv, i);
+
+		err = http_request(NULL, cli, "GET", uri, pool_resp_handler,
+				   NULL, NULL, &rv[i], NULL);
+		TEST_ERR(err);
+	}
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+
+	err = t.err;
+	TEST_ERR(err);
+
+	TEST_EQUALS(POOL_REQUESTS, t.n_req);
+	TEST_EQUALS(POOL_REQUESTS, t.n_resp);
+
+	err = http_client_pool_stats(cli, stats);
+	TEST_ERR(err);
+
+	TEST_EQUALS(t.n_peer, stats->conn_new);
+
+ out:
+	tmr_cancel(&t.tmr);
+	mem_deref(cli);
+	mem_deref(dnsc);
+	mem_deref(sock);
+
+	return err;
+}
+
+
+int test_http_client_pool(void)
+{
+	struct http_pool_stats stats;
+	int err;
+
+	/* no limit, a connection per request */
+	err = pool_run(&stats, 0, 0);
+	TEST_ERR(err);
+	TEST_EQUALS(POOL_REQUESTS, stats.conn_new);
+	TEST_EQUALS(0, stats.waited);
+
+	/* queued */
+	err = pool_run(&stats, 2, 0);
+	TEST_ERR(err);
+	TEST_EQUALS(2, stats.conn_new);
+	TEST_EQUALS(POOL_REQUESTS - 2, stats.waited);
+	TEST_EQUALS(POOL_REQUESTS - 2, stats.conn_reused);
+	TEST_EQUALS(0, stats.pipelined);
+	TEST_EQUALS(2, stats.conns);
+	TEST_EQUALS(0, stats.queued);
+
+	/* one at a time, in order */
+	err = pool_run(&stats, 1, 0);
+	TEST_ERR(err);
+	TEST_EQUALS(1, stats.conn_new);
+	TEST_EQUALS(POOL_REQUESTS - 1, stats.conn_reused);
+
+	/* pipelined, in order */
+	err = pool_run(&stats, 1, 4);
+	TEST_ERR(err);
+	TEST_EQUALS(1, stats.conn_new);
+	TEST_ASSERT(stats.pipelined > 0);
+	TEST_EQUALS(POOL_REQUESTS - 1,
+		    stats.pipelined + stats.conn_reused);
+	TEST_EQUALS(1, stats.conns);
+
+ out:
+	return err;
+}
@@ -16,8 +16,25 @@
 #define LOCAL_PORT 0
 
 
+static bool name_exists(const struct dns_server *srv, const char *name)
+{
+	struct le *le;
+
+	for (le = srv->rrl.head; le; le = le->next) {
+
+		const struct dnsrr *rr = le->data;
+
+		if (rr->type != DNS_TYPE_SOA && !str_casecmp(name, rr->name))
+			return true;
+	}
+
+	return false;
+}
+
+
 static void dns_server_match(struct dns_server *srv, struct list *rrl,
-			     const char *name, uint16_t type)
+			     struct list *authl, const char *name,
+			     uint16_t type)
 {
 	struct dnsrr *rr0 = NULL;
 	struct le *le;
@@ -36,6 +53,24 @@ static void dns_server_match(struct dns_server *srv, struct list *rrl,
 		}
 	}
 
+	if (rr0)
+		goto rotate;
+
+	/* No answer, add the SOA of the zone as negative answer */
+	for (le = srv->rrl.head; le; le = le->next) {
+
+		struct dnsrr *rr = le->data;
+		size_t nl = str_len(name), zl = str_len(rr->name);
+
+		if (rr->type != DNS_TYPE_SOA || nl < zl ||
+		    str_casecmp(name + nl - zl, rr->name))
+			continue;
+
+		list_append(authl, &rr->le_priv, rr);
+		break;
+	}
+
+ rotate:
 	/* If rotation is enabled, then rotate multiple entries
 	   in a deterministic way (no randomness please) */
 	if (srv->rotate && rr0) {
@@ -49,6 +84,7 @@ static void decode_dns_query(struct dns_server *srv, const struct sa *src,
 			     struct mbuf *mb)
 {
 	struct list rrl = LIST_INIT;
+	struct list authl = LIST_INIT;
 	struct dnshdr hdr;
 	struct le *le;
 	char *qname = NULL;
@@ -64,6 +100,11 @@ static void decode_dns_query(struct dns_server *srv, const struct sa *src,
 		return;
 	}
 
+	++srv->nq;
+
+	if (srv->silent)
+		return;
+
 	err = dns_dname_decode(mb, &qname, start);
 	if (err) {
 		DEBUG_WARNING("unable to decode query name\n");
@@ -82,7 +123,7 @@ static void decode_dns_query(struct dns_server *srv, const struct sa *src,
 		   qname);
 
 	if (dnsclass == DNS_CLASS_IN) {
-		dns_server_match(srv, &rrl, qname, type);
+		dns_server_match(srv, &rrl, &authl, qname, type);
 	}
 
 	hdr.qr	  = true;
@@ -90,6 +131,10 @@ static void decode_dns_query(struct dns_server *srv, const struct sa *src,
 	hdr.rcode = DNS_RCODE_OK;
 	hdr.nq	  = 1;
 	hdr.nans  = list_count(&rrl);
+	hdr.nauth = list_count(&authl);
+
+	if (hdr.nauth && !name_exists(srv, qname))
+		hdr.rcode = DNS_RCODE_NAME_ERR;
 
 	mb->pos = start;
 
@@ -110,12 +155,21 @@ static void decode_dns_query(struct dns_server *srv, const struct sa *src,
 			goto out;
 	}
 
+	for (le = authl.head; le; le = le->next) {
+		struct dnsrr *rr = le->data;
+
+		err = dns_rr_encode(mb, rr, 0, NULL, start);
+		if (err)
+			goto out;
+	}
+
 	mb->pos = start;
 
 	(void)udp_send(srv->us, src, mb);
 
 out:
 	list_clear(&rrl);
+	list_clear(&authl);
 	mem_deref(qname);
 }
 
@@ -282,3 +336,42 @@ out:
 
 	return err;
 }
+
+
+int dns_server_add_soa(struct dns_server *srv, const char *zone,
+		       uint32_t ttlmin)
+{
+	struct dnsrr *rr;
+	int err;
+
+	if (!srv || !zone)
+		return EINVAL;
+
+	rr = dns_rr_alloc();
+	if (!rr)
+		return ENOMEM;
+
+	/* set the type first, the destructor frees the rdata by type */
+	rr->type     = DNS_TYPE_SOA;
+
+	err  = str_dup(&rr->name, zone);
+	err |= str_dup(&rr->rdata.soa.mname, zone);
+	err |= str_dup(&rr->rdata.soa.rname, zone);
+	if (err)
+		goto out;
+
+	rr->dnsclass = DNS_CLASS_IN;
+	rr->ttl	     = 3600;
+	rr->rdlen    = 0;
+
+	rr->rdata.soa.serial = 1;
+	rr->rdata.soa.ttlmin = ttlmin;
+
+	list_append(&srv->rrl, &rr->le, rr);
+
+out:
+	if (err)
+		mem_deref(rr);
+
+	return err;
+}
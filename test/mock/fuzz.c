@@ -56,6 +56,24 @@ static void apply_fuzzing(struct fuzz *fuzz, struct mbuf *mb)
 }
 
 
+/**
+ * Flip random bits in a buffer
+ *
+ * @param mb    Buffer, fuzzed from the current position
+ * @param nbits Number of bits to flip
+ */
+void fuzz_mbuf(struct mbuf *mb, unsigned nbits)
+{
+	const size_t len = mbuf_get_left(mb);
+
+	if (!len)
+		return;
+
+	while (nbits--)
+		mbuf_buf(mb)[rand_u32() % len] ^= 1 << (rand_u16() % 8);
+}
+
+
 static bool helper_send_handler(int *err, struct mbuf *mb, void *arg)
 {
 	struct fuzz *fuzz = arg;
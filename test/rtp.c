@@ -600,6 +600,43 @@ out:
 }
 
 
+struct twcc_cnt {
+	unsigned recv;
+	unsigned lost;
+	uint16_t next;
+	bool bad;
+	int64_t rx;
+	unsigned txc;
+};
+
+
+static bool twcc_status_handler(const struct twcc_status *st, void *arg)
+{
+	struct twcc_cnt *cnt = arg;
+
+	if (st->seq != cnt->next)
+		cnt->bad = true;
+
+	if (st->recv) {
+		if (cnt->recv && st->rx < cnt->rx)
+			cnt->bad = true;
+
+		cnt->rx = st->rx;
+		++cnt->recv;
+	}
+	else {
+		++cnt->lost;
+	}
+
+	if (st->tx && st->size == RTP_HEADER_SIZE + 8 + PAYLOAD_SIZE)
+		++cnt->txc;
+
+	++cnt->next;
+
+	return false;
+}
+
+
 int test_rtcp_twcc(void)
 {
 	/*
@@ -720,6 +757,16 @@ int test_rtcp_twcc(void)
 	ASSERT_EQ(2, twcc->fbcount);
 	ASSERT_EQ(2, mbuf_get_left(twcc->chunks));
 	ASSERT_EQ(14, mbuf_get_left(twcc->deltas));
+
+	struct twcc_cnt cnt;
+	memset(&cnt, 0, sizeof(cnt));
+	cnt.next = 8;
+	err = rtcp_twcc_apply(twcc, twcc_status_handler, &cnt);
+	TEST_ERR(err);
+	ASSERT_EQ(14, cnt.recv);
+	ASSERT_EQ(0, cnt.lost);
+	ASSERT_EQ(22, cnt.next);
+	ASSERT_TRUE(!cnt.bad);
 	msg = mem_deref(msg);
 
 	/* Assert we have processed everything. */
@@ -730,3 +777,520 @@ int test_rtcp_twcc(void)
 	mem_deref(msg);
 	return err;
 }
+
+
+int test_rtcp_twcc_encode(void)
+{
+	struct rtp_sock *rs = NULL;
+	struct mbuf *mb = NULL, *pkt = NULL;
+	struct rtcp_msg *msg = NULL;
+	struct twcc_cnt cnt;
+	struct sa dst;
+	uint8_t ext[2];
+	int err;
+
+	memset(&cnt, 0, sizeof(cnt));
+	cnt.next = 100;
+
+	err = rtp_open(&rs, AF_INET);
+	TEST_ERR(err);
+
+	err = rtp_twcc_enable(rs, 3, 0);
+	TEST_ERR(err);
+
+	/* nothing to report yet */
+	mb = mbuf_alloc(1024);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+	ASSERT_EQ(ENODATA, rtcp_twcc_encode(mb, rs));
+
+	/* receive side: every 7th packet lost, then a gap */
+	for (uint16_t seq = 100; seq < 200; seq++) {
+		if (seq % 7)
+			rtp_twcc_recv(rs, seq, 0x1234);
+	}
+	rtp_twcc_recv(rs, 400, 0x1234);
+
+	err = rtcp_twcc_encode(mb, rs);
+	TEST_ERR(err);
+
+	mb->pos = 0;
+	while (mbuf_get_left(mb)) {
+		err = rtcp_decode(&msg, mb);
+		TEST_ERR(err);
+
+		ASSERT_EQ(RTCP_RTPFB, msg->hdr.pt);
+		ASSERT_EQ(RTCP_RTPFB_TWCC, msg->hdr.count);
+		ASSERT_EQ(0x1234, msg->r.fb.ssrc_media);
+
+		err = rtcp_twcc_apply(msg->r.fb.fci.twccv,
+				      twcc_status_handler, &cnt);
+		TEST_ERR(err);
+
+		msg = mem_deref(msg);
+	}
+
+	ASSERT_TRUE(!cnt.bad);
+	ASSERT_EQ(401, cnt.next);
+	ASSERT_EQ(86 + 1, cnt.recv);
+	ASSERT_EQ(14 + 200, cnt.lost);
+
+	/* everything reported */
+	mbuf_rewind(mb);
+	ASSERT_EQ(ENODATA, rtcp_twcc_encode(mb, rs));
+
+	/* send side: history resolves send time and size */
+	err = rtp_twcc_enable(rs, 3, 0);
+	TEST_ERR(err);
+
+	pkt = mbuf_alloc(RTP_HEADER_SIZE + 8 + PAYLOAD_SIZE);
+	if (!pkt) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	sa_set_str(&dst, "127.0.0.1", 9);
+
+	for (int i = 0; i < 3; i++) {
+		uint16_t seq = rtp_twcc_next_seq(rs);
+
+		ASSERT_EQ(i, seq);
+
+		ext[0] = seq >> 8;
+		ext[1] = seq & 0xff;
+
+		mbuf_rewind(pkt);
+		pkt->pos = pkt->end = RTP_HEADER_SIZE;
+		err  = rtpext_hdr_encode(pkt, 4);
+		err |= rtpext_encode(pkt, 3, sizeof(ext), ext);
+		err |= mbuf_fill(pkt, 0x55, PAYLOAD_SIZE);
+		TEST_ERR(err);
+
+		pkt->pos = RTP_HEADER_SIZE;
+		err = rtp_send(rs, &dst, true, false, 0, 160, 0, pkt);
+		TEST_ERR(err);
+
+		rtp_twcc_recv(rs, seq, 0x1234);
+	}
+
+	mbuf_rewind(mb);
+	err = rtcp_twcc_encode(mb, rs);
+	TEST_ERR(err);
+
+	mb->pos = 0;
+	err = rtcp_decode(&msg, mb);
+	TEST_ERR(err);
+
+	memset(&cnt, 0, sizeof(cnt));
+	err = rtp_twcc_apply(rs, msg->r.fb.fci.twccv, twcc_status_handler,
+			     &cnt);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(!cnt.bad);
+	ASSERT_EQ(3, cnt.recv);
+	ASSERT_EQ(3, cnt.txc);
+
+ out:
+	mem_deref(msg);
+	mem_deref(pkt);
+	mem_deref(mb);
+	mem_deref(rs);
+
+	return err;
+}
+
+
+struct rtx_test {
+	struct rtp_sock *rtp;
+	uint16_t seqv[3];
+	unsigned n;
+	unsigned rtx;
+	bool bad;
+};
+
+
+static void rtx_recv_handler(const struct sa *src,
+			     const struct rtp_header *hdr, struct mbuf *mb,
+			     void *arg)
+{
+	struct rtx_test *test = arg;
+	(void)src;
+
+	if (hdr->pt == 0) {
+		++test->n;
+		return;
+	}
+
+	if (hdr->pt != 97 || hdr->ssrc != 0xabcdef ||
+	    mbuf_get_left(mb) != 2 + PAYLOAD_SIZE) {
+		test->bad = true;
+		re_cancel();
+		return;
+	}
+
+	/* Original sequence number */
+	if (ntohs(mbuf_read_u16(mb)) != test->seqv[test->rtx])
+		test->bad = true;
+
+	if (++test->rtx == 2)
+		re_cancel();
+}
+
+
+int test_rtp_rtx(void)
+{
+	struct rtp_hist_conf conf;
+	struct rtp_hist_stats stats;
+	struct rtx_test test;
+	struct mbuf *mb = NULL;
+	struct sa sa;
+	int err;
+
+	memset(&test, 0, sizeof(test));
+	memset(&conf, 0, sizeof(conf));
+	conf.rtx_pt   = 97;
+	conf.rtx_ssrc = 0xabcdef;
+
+	sa_init(&sa, AF_INET);
+	err = rtp_listen(&test.rtp, IPPROTO_UDP, &sa, 1024, 49152, true,
+			 rtx_recv_handler, NULL, &test);
+	TEST_ERR(err);
+
+	err = rtp_hist_enable(test.rtp, &conf);
+	TEST_ERR(err);
+
+	sa_set_str(&sa, "127.0.0.1", sa_port(rtp_local(test.rtp)));
+	rtcp_enable_mux(test.rtp, true);
+	rtcp_start(test.rtp, "rtx", &sa);
+
+	mb = mbuf_alloc(RTP_HEADER_SIZE + PAYLOAD_SIZE);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (int i = 0; i < 3; i++) {
+
+		mbuf_rewind(mb);
+		mb->pos = mb->end = RTP_HEADER_SIZE;
+		err = mbuf_fill(mb, (uint8_t)i, PAYLOAD_SIZE);
+		TEST_ERR(err);
+		mb->pos = RTP_HEADER_SIZE;
+
+		err = rtp_send(test.rtp, &sa, false, false, 0, 160 * i,
+			       tmr_jiffies_rt_usec(), mb);
+		TEST_ERR(err);
+
+		test.seqv[i] = rtp_sess_seq(test.rtp);
+	}
+
+	/* NACK the first and the third packet */
+	err = rtcp_send_gnack(test.rtp, rtp_sess_ssrc(test.rtp),
+			      test.seqv[0], 0x0002);
+	TEST_ERR(err);
+
+	test.seqv[1] = test.seqv[2];
+
+	err = re_main_timeout(200);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(!test.bad);
+	ASSERT_EQ(3, test.n);
+	ASSERT_EQ(2, test.rtx);
+
+	/* Resent packets are throttled by the min. interval */
+	ASSERT_EQ(EALREADY, rtp_hist_resend(test.rtp, test.seqv[0]));
+	ASSERT_EQ(ENOENT, rtp_hist_resend(test.rtp, test.seqv[0] - 1));
+
+	err = rtp_hist_stats(test.rtp, &stats);
+	TEST_ERR(err);
+
+	ASSERT_EQ(3, stats.stored);
+	ASSERT_EQ(2, stats.resent);
+	ASSERT_EQ(1, stats.missing);
+	ASSERT_EQ(1, stats.throttled);
+
+ out:
+	mem_deref(test.rtp);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+struct pacer_test {
+	unsigned n;
+	unsigned audio_pos;
+	uint16_t seq;
+	bool bad;
+};
+
+
+static void pacer_recv_handler(const struct sa *src,
+			       const struct rtp_header *hdr, struct mbuf *mb,
+			       void *arg)
+{
+	struct pacer_test *test = arg;
+	(void)src;
+	(void)mb;
+
+	if (hdr->pt == 8) {
+		test->audio_pos = test->n;
+	}
+	else {
+		/* video must stay in order */
+		if (test->n && hdr->seq != (uint16_t)(test->seq + 1) &&
+		    hdr->seq != (uint16_t)(test->seq + 2))
+			test->bad = true;
+		test->seq = hdr->seq;
+	}
+
+	if (++test->n == 51)
+		re_cancel();
+}
+
+
+int test_rtp_pacer(void)
+{
+	struct rtp_pacer_stats stats;
+	struct pacer_test test;
+	struct rtp_sock *rtp = NULL;
+	struct mbuf *mb = NULL;
+	struct sa sa;
+	uint64_t start;
+	int err;
+
+	memset(&test, 0, sizeof(test));
+
+	sa_init(&sa, AF_INET);
+	err = rtp_listen(&rtp, IPPROTO_UDP, &sa, 1024, 49152, false,
+			 pacer_recv_handler, NULL, &test);
+	TEST_ERR(err);
+
+	/* 8 Mbit/s: 50 x 1000 bytes take about 50ms */
+	err = rtp_pacer_enable(rtp, 8000000);
+	TEST_ERR(err);
+
+	rtp_pacer_set_prio(rtp, 8, true);
+
+	sa_set_str(&sa, "127.0.0.1", sa_port(rtp_local(rtp)));
+
+	mb = mbuf_alloc(RTP_HEADER_SIZE + 1000);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	start = tmr_jiffies();
+
+	for (int i = 0; i < 51; i++) {
+
+		/* one audio packet in the middle of the keyframe */
+		uint8_t pt = (i == 25) ? 8 : 96;
+
+		mbuf_rewind(mb);
+		mb->pos = mb->end = RTP_HEADER_SIZE;
+		err = mbuf_fill(mb, 0xa5, pt == 8 ? 160 : 1000);
+		TEST_ERR(err);
+		mb->pos = RTP_HEADER_SIZE;
+
+		err = rtp_send(rtp, &sa, false, false, pt, 0,
+			       tmr_jiffies_rt_usec(), mb);
+		TEST_ERR(err);
+	}
+
+	err = rtp_pacer_stats(rtp, &stats);
+	TEST_ERR(err);
+	ASSERT_TRUE(stats.queued >= 40);
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(!test.bad);
+	ASSERT_EQ(51, test.n);
+	ASSERT_TRUE(test.audio_pos < 10);
+	ASSERT_TRUE(tmr_jiffies() - start >= 30);
+
+	err = rtp_pacer_stats(rtp, &stats);
+	TEST_ERR(err);
+	ASSERT_EQ(0, stats.queued);
+	ASSERT_EQ(51, stats.sent);
+	ASSERT_TRUE(stats.delay_max > 0);
+
+ out:
+	mem_deref(rtp);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+struct pacer_dst_test {
+	unsigned n[2];
+	uint16_t seq;      /* First sequence number */
+	bool bad;
+};
+
+
+static void pacer_dst_handler(struct pacer_dst_test *test, unsigned i,
+			      const struct rtp_header *hdr)
+{
+	const uint16_t n = hdr->seq - test->seq;
+
+	/* the first 20 packets belong to the first destination */
+	if ((n < 20) != (i == 0))
+		test->bad = true;
+
+	++test->n[i];
+
+	if (test->n[0] + test->n[1] == 21)
+		re_cancel();
+}
+
+
+static void pacer_dst_handler0(const struct sa *src,
+			       const struct rtp_header *hdr, struct mbuf *mb,
+			       void *arg)
+{
+	(void)src;
+	(void)mb;
+
+	pacer_dst_handler(arg, 0, hdr);
+}
+
+
+static void pacer_dst_handler1(const struct sa *src,
+			       const struct rtp_header *hdr, struct mbuf *mb,
+			       void *arg)
+{
+	(void)src;
+	(void)mb;
+
+	pacer_dst_handler(arg, 1, hdr);
+}
+
+
+int test_rtp_pacer_dst(void)
+{
+	struct pacer_dst_test test;
+	struct rtp_sock *rtp = NULL, *peer = NULL;
+	struct mbuf *mb = NULL;
+	struct sa sa, sa_peer;
+	int err;
+
+	memset(&test, 0, sizeof(test));
+
+	sa_init(&sa, AF_INET);
+	err = rtp_listen(&rtp, IPPROTO_UDP, &sa, 1024, 49152, false,
+			 pacer_dst_handler0, NULL, &test);
+	TEST_ERR(err);
+
+	err = rtp_listen(&peer, IPPROTO_UDP, &sa, 1024, 49152, false,
+			 pacer_dst_handler1, NULL, &test);
+	TEST_ERR(err);
+
+	/* 1 Mbit/s: 20 x 1000 bytes are still queued after the loop */
+	err = rtp_pacer_enable(rtp, 1000000);
+	TEST_ERR(err);
+
+	sa_set_str(&sa, "127.0.0.1", sa_port(rtp_local(rtp)));
+	sa_set_str(&sa_peer, "127.0.0.1", sa_port(rtp_local(peer)));
+
+	mb = mbuf_alloc(RTP_HEADER_SIZE + 1000);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	/* rtp_sess_seq() is the last sequence number sent */
+	test.seq = rtp_sess_seq(rtp) + 1;
+
+	for (int i = 0; i < 21; i++) {
+
+		mbuf_rewind(mb);
+		mb->pos = mb->end = RTP_HEADER_SIZE;
+		err = mbuf_fill(mb, 0xa5, 1000);
+		TEST_ERR(err);
+		mb->pos = RTP_HEADER_SIZE;
+
+		err = rtp_send(rtp, i < 20 ? &sa : &sa_peer, false, false, 96,
+			       0, tmr_jiffies_rt_usec(), mb);
+		TEST_ERR(err);
+	}
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(!test.bad);
+	ASSERT_EQ(20, test.n[0]);
+	ASSERT_EQ(1, test.n[1]);
+
+ out:
+	mem_deref(rtp);
+	mem_deref(peer);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+int test_rtp_pacer_refill(void)
+{
+	struct rtp_pacer_stats stats;
+	struct pacer_test test;
+	struct rtp_sock *rtp = NULL;
+	struct mbuf *mb = NULL;
+	struct sa sa;
+	uint64_t start;
+	int err;
+
+	memset(&test, 0, sizeof(test));
+
+	sa_init(&sa, AF_INET);
+	err = rtp_listen(&rtp, IPPROTO_UDP, &sa, 1024, 49152, false,
+			 pacer_recv_handler, NULL, &test);
+	TEST_ERR(err);
+
+	/* 80 kbit/s: one byte of budget every 100 us */
+	err = rtp_pacer_enable(rtp, 80000);
+	TEST_ERR(err);
+
+	sa_set_str(&sa, "127.0.0.1", sa_port(rtp_local(rtp)));
+
+	/* many refills shorter than a byte still add up */
+	start = tmr_jiffies();
+	while (tmr_jiffies() - start < 50)
+		rtp_pacer_set_bitrate(rtp, 80000);
+
+	mb = mbuf_alloc(RTP_HEADER_SIZE + 100);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	/* about 500 bytes of budget, sent without queueing */
+	for (int i = 0; i < 8; i++) {
+
+		mbuf_rewind(mb);
+		mb->pos = mb->end = RTP_HEADER_SIZE;
+		err = mbuf_fill(mb, 0xa5, 100);
+		TEST_ERR(err);
+		mb->pos = RTP_HEADER_SIZE;
+
+		err = rtp_send(rtp, &sa, false, false, 96, 0,
+			       tmr_jiffies_rt_usec(), mb);
+		TEST_ERR(err);
+	}
+
+	err = rtp_pacer_stats(rtp, &stats);
+	TEST_ERR(err);
+	ASSERT_TRUE(stats.sent >= 4);
+
+ out:
+	mem_deref(rtp);
+	mem_deref(mb);
+
+	return err;
+}
@@ -607,6 +607,335 @@ int test_sip_parse(void)
 }
 
 
+static int sip_msg_decode_str(struct sip_msg **msgp, const char *str,
+			      bool lazy)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(512);
+	if (!mb)
+		return ENOMEM;
+
+	err = mbuf_write_str(mb, str);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+	err = lazy ? sip_msg_decode_lazy(msgp, mb) : sip_msg_decode(msgp, mb);
+
+ out:
+	mem_deref(mb);
+	return err;
+}
+
+
+int test_sip_parse_lazy(void)
+{
+	const char str_raw[] =
+		"INVITE sip:bob@biloxi.com;transport=tcp SIP/2.0\r\n"
+		"Via: SIP/2.0/TCP 10.0.0.1:5060;branch=z9hG4bK.a\r\n"
+		"Via: SIP/2.0/UDP 10.0.0.2:5060;branch=z9hG4bK.b\r\n"
+		"To: Bob <sip:bob@biloxi.com>\r\n"
+		"From: Alice <sip:alice@atlanta.com>;tag=1928301774\r\n"
+		"Call-ID: a84b4c76e66710@pc33.atlanta.com\r\n"
+		"CSeq: 314159 INVITE\r\n"
+		"RAck: 776656 1 INVITE\r\n"
+		"Content-Type: application/sdp\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n";
+	struct sip_msg *eager = NULL, *lazy = NULL;
+	int err;
+
+	err = sip_msg_decode_str(&eager, str_raw, false);
+	TEST_ERR(err);
+
+	err = sip_msg_decode_str(&lazy, str_raw, true);
+	TEST_ERR(err);
+
+	TEST_ASSERT(!eager->lazy);
+	TEST_ASSERT(lazy->lazy);
+
+	/* fields needed for stateless forwarding are always decoded */
+	TEST_ASSERT(0 == pl_cmp(&eager->via.branch, &lazy->via.branch));
+	TEST_ASSERT(0 == pl_cmp(&eager->callid, &lazy->callid));
+	TEST_EQUALS(eager->cseq.num, lazy->cseq.num);
+	TEST_EQUALS(eager->req, lazy->req);
+	TEST_EQUALS(2, sip_msg_hdr_count(lazy, SIP_HDR_VIA));
+
+	/* deferred fields are empty until parsed */
+	TEST_ASSERT(!pl_isset(&lazy->from.tag));
+	TEST_ASSERT(!pl_isset(&lazy->to.auri));
+	TEST_ASSERT(!pl_isset(&lazy->uri.host));
+	TEST_EQUALS(0, lazy->rack.rel_seq);
+
+	err = sip_msg_parse(lazy);
+	TEST_ERR(err);
+	TEST_ASSERT(!lazy->lazy);
+
+	TEST_ASSERT(0 == pl_cmp(&eager->from.tag, &lazy->from.tag));
+	TEST_ASSERT(0 == pl_cmp(&eager->from.auri, &lazy->from.auri));
+	TEST_ASSERT(0 == pl_cmp(&eager->to.auri, &lazy->to.auri));
+	TEST_ASSERT(0 == pl_cmp(&eager->uri.host, &lazy->uri.host));
+	TEST_ASSERT(0 == pl_cmp(&eager->uri.params, &lazy->uri.params));
+	TEST_EQUALS(776656, lazy->rack.rel_seq);
+	TEST_ASSERT(msg_ctype_cmp(&lazy->ctyp, "application", "sdp"));
+
+	/* parsing again is a no-op */
+	err = sip_msg_parse(lazy);
+	TEST_ERR(err);
+
+ out:
+	mem_deref(eager);
+	mem_deref(lazy);
+
+	return err;
+}
+
+
+static const char *sip_samplev[] = {
+	"INVITE sip:bob@biloxi.com SIP/2.0\r\n"
+	"Via : SIP/2.0/UDP 127.0.0.1:1234;branch=z9hG4bK.2ed0447\r\n"
+	"Max-Forwards: 70\r\n"
+	"Record-Route: <sip:p2.domain.com;lr>, <sip:p1.example.com;lr>\r\n"
+	"t: Bob <sip:bob@biloxi.com>\r\n"
+	"f: \"Alice, A.\" <sip:alice@atlanta.com>\r\n"
+	" ;tag=1928301774\r\n"
+	"Call-ID : a84b4c76e66710@pc33.atlanta.com\r\n"
+	"CSeq  : 314159 INVITE\r\n"
+	"Contact:  <sip:alice@pc33.atlanta.com>\r\n"
+	"Allow: INVITE,ACK,CANCEL,BYE,UPDATE,INFO,OPTIONS\r\n"
+	"X-Custom-Header-With-A-Long-Name: some long value for scanning\r\n"
+	"Content-Type: application/sdp\r\n"
+	"Content-Length: 142\r\n"
+	"\r\n",
+
+	"SIP/2.0 180 Ringing\r\n"
+	"Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK776asdhds\r\n"
+	"\t;received=192.0.2.1\r\n"
+	"To: Bob <sip:bob@biloxi.com>;tag=a6c85cf\r\n"
+	"From: Alice <sip:alice@atlanta.com>;tag=1928301774\r\n"
+	"Call-ID: a84b4c76e66710\r\n"
+	"CSeq: 314159 INVITE\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n",
+};
+
+
+static int sip_decode_at(struct sip_msg **msgp, struct mbuf **mbp,
+			 const uint8_t *buf, size_t len, size_t offset)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(offset + len + 1);
+	if (!mb)
+		return ENOMEM;
+
+	mb->pos = mb->end = offset;
+	err = mbuf_write_mem(mb, buf, len);
+	if (err)
+		goto out;
+
+	mb->pos = offset;
+	err = sip_msg_decode(msgp, mb);
+
+ out:
+	if (err)
+		mem_deref(mb);
+	else
+		*mbp = mb;
+
+	return err;
+}
+
+
+static bool pl_equal(const struct pl *a, const char *basea,
+		     const struct pl *b, const char *baseb)
+{
+	if (a->l != b->l || !a->p != !b->p)
+		return false;
+
+	return !a->p || a->p - basea == b->p - baseb;
+}
+
+
+/* Compare decoded messages by their offsets into the original buffer */
+static int sip_msg_cmp(const struct sip_msg *a, const char *basea,
+		       const struct sip_msg *b, const char *baseb)
+{
+	const struct le *la = list_head(&a->hdrl);
+	const struct le *lb = list_head(&b->hdrl);
+	int err = 0;
+
+	TEST_ASSERT(a->req == b->req);
+	TEST_EQUALS(a->scode, b->scode);
+	TEST_ASSERT(pl_equal(&a->met, basea, &b->met, baseb));
+	TEST_ASSERT(pl_equal(&a->ruri, basea, &b->ruri, baseb));
+	TEST_ASSERT(pl_equal(&a->ver, basea, &b->ver, baseb));
+	TEST_ASSERT(pl_equal(&a->reason, basea, &b->reason, baseb));
+	TEST_ASSERT(pl_equal(&a->callid, basea, &b->callid, baseb));
+	TEST_ASSERT(pl_equal(&a->via.branch, basea, &b->via.branch, baseb));
+	TEST_EQUALS(a->cseq.num, b->cseq.num);
+	TEST_EQUALS(list_count(&a->hdrl), list_count(&b->hdrl));
+
+	for (; la && lb; la = la->next, lb = lb->next) {
+
+		const struct sip_hdr *ha = la->data, *hb = lb->data;
+
+		TEST_EQUALS(ha->id, hb->id);
+		TEST_ASSERT(pl_equal(&ha->name, basea, &hb->name, baseb));
+		TEST_ASSERT(pl_equal(&ha->val, basea, &hb->val, baseb));
+	}
+
+ out:
+	return err;
+}
+
+
+/*
+ * Differential test of the SIP scanner: the start line is checked against
+ * the generic regex, and the headers against a decode of the same bytes
+ * at a different alignment, so that the vector and scalar scanning paths
+ * see different chunk boundaries.
+ */
+int test_sip_parse_fuzz(void)
+{
+	struct mbuf *mb = NULL, *mba = NULL, *mbb = NULL;
+	struct sip_msg *a = NULL, *b = NULL;
+	int err = 0;
+
+	mb = mbuf_alloc(1024);
+	if (!mb)
+		return ENOMEM;
+
+	for (unsigned i=0; i<2000; i++) {
+
+		const char *sample;
+		struct pl x, y, z, e;
+		size_t len;
+		int ea, eb, eref;
+
+		sample = sip_samplev[i % RE_ARRAY_SIZE(sip_samplev)];
+
+		mbuf_rewind(mb);
+		err = mbuf_write_str(mb, sample);
+		TEST_ERR(err);
+
+		mb->pos = 0;
+		fuzz_mbuf(mb, 1 + i % 4);
+
+		/* sometimes insert a scanner special character */
+		if (i % 3 == 0) {
+			static const char specv[] = " \t\r\n,\":";
+
+			mb->buf[rand_u32() % mb->end] =
+				specv[rand_u16() % (sizeof(specv) - 1)];
+		}
+
+		/* sometimes truncate the message */
+		len = (i % 5 == 0) ? rand_u32() % mb->end : mb->end;
+
+		eref = re_regex((char *)mb->buf, len,
+				"[^ \t\r\n]+ [^ \t\r\n]+ [^\r\n]*[\r]*[\n]1",
+				&x, &y, &z, NULL, &e);
+		if (!eref && x.p != (char *)mb->buf)
+			eref = ENOENT;
+
+		ea = sip_decode_at(&a, &mba, mb->buf, len, 0);
+		eb = sip_decode_at(&b, &mbb, mb->buf, len, 7);
+
+		if (ea == ENOMEM || eb == ENOMEM) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		TEST_EQUALS(ea, eb);
+
+		if (eref) {
+			TEST_EQUALS(ENODATA, ea);
+		}
+		else if (!ea) {
+			const struct pl *xp = a->req ? &a->met : &a->ver;
+			const struct pl *zp = a->req ? &a->ver : &a->reason;
+
+			TEST_EQUALS((size_t)(x.p - (char *)mb->buf),
+				    (size_t)(xp->p - (char *)mba->buf));
+			TEST_EQUALS(x.l, xp->l);
+			TEST_EQUALS(z.l, zp->l);
+
+			TEST_EQUALS(mba->pos, mbb->pos - 7);
+
+			err = sip_msg_cmp(a, (char *)mba->buf,
+					  b, (char *)mbb->buf + 7);
+			TEST_ERR(err);
+		}
+
+		a = mem_deref(a);
+		b = mem_deref(b);
+		mba = mem_deref(mba);
+		mbb = mem_deref(mbb);
+	}
+
+ out:
+	mem_deref(a);
+	mem_deref(b);
+	mem_deref(mba);
+	mem_deref(mbb);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/*
+ * SIP message decode rate, run with "retest -p test_sip_parse_perf"
+ */
+int test_sip_parse_perf(void)
+{
+	enum { N = 1000 };
+	struct sip_msg *msg = NULL;
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(1024);
+	if (!mb)
+		return ENOMEM;
+
+	err = mbuf_write_str(mb, sip_samplev[0]);
+	TEST_ERR(err);
+
+	for (int lazy=0; lazy<2; lazy++) {
+
+		uint64_t usec = tmr_jiffies_usec();
+
+		for (unsigned i=0; i<N; i++) {
+
+			mb->pos = 0;
+
+			if (lazy)
+				err = sip_msg_decode_lazy(&msg, mb);
+			else
+				err = sip_msg_decode(&msg, mb);
+			TEST_ERR(err);
+
+			msg = mem_deref(msg);
+		}
+
+		usec = tmr_jiffies_usec() - usec;
+
+		re_printf("sip decode%s: %u msgs/s\n", lazy ? " (lazy)" : "",
+			  (unsigned)(N * 1000000ULL / (usec ? usec : 1)));
+	}
+
+ out:
+	mem_deref(msg);
+	mem_deref(mb);
+
+	return err;
+}
+
+
 static bool count_handler(const struct sip_hdr *hdr, const struct sip_msg *msg,
 			  void *arg)
 {
@@ -863,3 +1192,1086 @@ int test_sip_transp_add_client_cert(void)
 	return err;
 }
 #endif
+
+
+struct shard_node {
+	struct sip *sip;
+	struct sip_lsnr *lsnr;
+	struct shard_test *test;
+	thrd_t thr;
+	thrd_t self;          /* as seen from the shard thread */
+	struct tmr tmr;
+	uint32_t idx;
+	unsigned n_req;
+	unsigned n_exec;
+	bool started;
+	bool ready;
+	bool stop;
+	bool bad;
+	int err;
+};
+
+struct shard_test {
+	struct shard_node nodev[2];
+	struct sip_shard *sh;
+	struct udp_sock *us;
+	struct sa laddr;
+	mtx_t *mtx;
+	cnd_t cnd;
+	unsigned n_resp;
+	int err;
+	bool fallback;        /* shard 1 listens on another port */
+};
+
+
+/* called in the shard thread */
+static bool shard_req_handler(const struct sip_msg *msg, void *arg)
+{
+	struct shard_node *node = arg;
+
+	if ((!node->test->fallback &&
+	     node->idx != sip_shard_index(node->test->sh, &msg->callid)) ||
+	    !thrd_equal(thrd_current(), node->self))
+		node->bad = true;
+
+	++node->n_req;
+
+	(void)sip_reply(node->sip, msg, 200, "OK");
+
+	return true;
+}
+
+
+/* called in the shard thread, stops it */
+static void shard_exec_handler(struct sip *sip, void *arg)
+{
+	struct shard_node *node = arg;
+
+	if (sip != node->sip || !thrd_equal(thrd_current(), node->self))
+		node->bad = true;
+
+	++node->n_exec;
+
+	re_cancel();
+}
+
+
+/* fallback, if the shard cannot be stopped with sip_shard_exec() */
+static void shard_tmr_handler(void *arg)
+{
+	struct shard_node *node = arg;
+	bool stop;
+
+	mtx_lock(node->test->mtx);
+	stop = node->stop;
+	mtx_unlock(node->test->mtx);
+
+	if (stop)
+		re_cancel();
+	else
+		tmr_start(&node->tmr, 10, shard_tmr_handler, node);
+}
+
+
+static int shard_setup(struct shard_node *node)
+{
+	struct shard_test *test = node->test;
+	struct sa laddr = test->laddr;
+	int err;
+
+	err = sip_alloc(&node->sip, NULL, 32, 32, 32, "retest", NULL, NULL);
+	if (err)
+		return err;
+
+	err = sip_shard_attach(test->sh, node->idx, node->sip);
+	if (err)
+		return err;
+
+	if (test->fallback && node->idx > 0)
+		sa_set_port(&laddr, 0);
+
+	/* all shards share one local port, unless testing the fallback */
+	err = sip_transp_add(node->sip, SIP_TRANSP_UDP, &laddr);
+	if (err)
+		return err;
+
+	if (node->idx == 0) {
+		err = sip_transp_laddr(node->sip, &test->laddr,
+				       SIP_TRANSP_UDP, NULL);
+		if (err)
+			return err;
+	}
+
+	return sip_listen(&node->lsnr, node->sip, true, shard_req_handler,
+			  node);
+}
+
+
+static int shard_thread(void *arg)
+{
+	struct shard_node *node = arg;
+	struct shard_test *test = node->test;
+	int err;
+
+	err = re_thread_init();
+	if (!err) {
+		node->self = thrd_current();
+		err = shard_setup(node);
+	}
+
+	mtx_lock(test->mtx);
+	node->ready = true;
+	node->err   = err;
+	cnd_signal(&test->cnd);
+	mtx_unlock(test->mtx);
+
+	if (!err) {
+		tmr_start(&node->tmr, 10, shard_tmr_handler, node);
+		node->err = re_main(NULL);
+	}
+
+	tmr_cancel(&node->tmr);
+	mem_deref(node->lsnr);
+	sip_close(node->sip, true);
+	node->sip = mem_deref(node->sip);
+
+	re_thread_close();
+
+	return 0;
+}
+
+
+static int shard_start(struct shard_node *node)
+{
+	struct shard_test *test = node->test;
+	int err;
+
+	err = thread_create_name(&node->thr, "sip shard", shard_thread,
+				 node);
+	if (err)
+		return err;
+
+	node->started = true;
+
+	mtx_lock(test->mtx);
+	while (!node->ready)
+		cnd_wait(&test->cnd, test->mtx);
+	err = node->err;
+	mtx_unlock(test->mtx);
+
+	return err;
+}
+
+
+/* stop the shard threads from their own loops */
+static void shard_stop(struct shard_test *test)
+{
+	for (uint32_t i=0; i<RE_ARRAY_SIZE(test->nodev); i++) {
+
+		struct shard_node *node = &test->nodev[i];
+		char buf[16];
+		struct pl callid;
+
+		if (!node->started)
+			continue;
+
+		if (node->ready && !node->err) {
+
+			/* a Call-ID owned by this shard */
+			for (unsigned n=0; ; n++) {
+				re_snprintf(buf, sizeof(buf), "stop-%u", n);
+				pl_set_str(&callid, buf);
+
+				if (sip_shard_index(test->sh, &callid) == i)
+					break;
+			}
+
+			if (sip_shard_exec(test->sh, &callid,
+					   shard_exec_handler, node)) {
+				mtx_lock(test->mtx);
+				node->stop = true;
+				mtx_unlock(test->mtx);
+			}
+		}
+
+		thrd_join(node->thr, NULL);
+		node->started = false;
+	}
+}
+
+
+static void shard_client_recv(const struct sa *src, struct mbuf *mb,
+			      void *arg)
+{
+	struct shard_test *test = arg;
+	struct sip_msg *msg;
+	int err;
+	(void)src;
+
+	err = sip_msg_decode(&msg, mb);
+	if (err) {
+		test->err = err;
+		re_cancel();
+		return;
+	}
+
+	if (msg->scode == 200)
+		++test->n_resp;
+
+	mem_deref(msg);
+
+	if (test->n_resp == 16)
+		re_cancel();
+}
+
+
+static int test_sip_shard_base(bool fallback)
+{
+	struct shard_test test;
+	struct sa caddr;
+	struct mbuf *mb = NULL;
+	int err;
+
+	memset(&test, 0, sizeof(test));
+	test.fallback = fallback;
+
+	err = mutex_alloc(&test.mtx);
+	TEST_ERR(err);
+
+	err = cnd_init(&test.cnd);
+	TEST_EQUALS(thrd_success, err);
+
+	err = sip_shard_alloc(&test.sh, RE_ARRAY_SIZE(test.nodev));
+	TEST_ERR(err);
+
+	err = sa_set_str(&test.laddr, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	/* each shard runs in its own thread */
+	for (uint32_t i=0; i<RE_ARRAY_SIZE(test.nodev); i++) {
+
+		test.nodev[i].test = &test;
+		test.nodev[i].idx  = i;
+
+		err = shard_start(&test.nodev[i]);
+		TEST_ERR(err);
+	}
+
+	err = sa_set_str(&caddr, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err = udp_listen(&test.us, &caddr, shard_client_recv, &test);
+	TEST_ERR(err);
+
+	err = udp_local_get(test.us, &caddr);
+	TEST_ERR(err);
+
+	mb = mbuf_alloc(512);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	/* one flow, so the kernel delivers everything to one shard */
+	for (unsigned i=0; i<16; i++) {
+
+		mbuf_rewind(mb);
+		err = mbuf_printf(mb,
+				  "OPTIONS sip:%J SIP/2.0\r\n"
+				  "Via: SIP/2.0/UDP %J"
+				  ";branch=z9hG4bK%u;rport\r\n"
+				  "Max-Forwards: 70\r\n"
+				  "To: <sip:%J>\r\n"
+				  "From: <sip:%J>;tag=%u\r\n"
+				  "Call-ID: shard-%u\r\n"
+				  "CSeq: 1 OPTIONS\r\n"
+				  "Content-Length: 0\r\n"
+				  "\r\n",
+				  &test.laddr, &caddr, i, &test.laddr, &caddr,
+				  i, i);
+		TEST_ERR(err);
+
+		mb->pos = 0;
+		err = udp_send(test.us, &test.laddr, mb);
+		TEST_ERR(err);
+	}
+
+	err = re_main_timeout(2000);
+	TEST_ERR(err);
+	err = test.err;
+	TEST_ERR(err);
+
+	shard_stop(&test);
+
+	TEST_EQUALS(16, test.n_resp);
+	TEST_EQUALS(16, test.nodev[0].n_req + test.nodev[1].n_req);
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(test.nodev); i++) {
+
+		const struct shard_node *node = &test.nodev[i];
+
+		err = node->err;
+		TEST_ERR(err);
+
+		TEST_ASSERT(!node->bad);
+		TEST_EQUALS(1, node->n_exec);
+	}
+
+	/* messages for shard 1 are handed back to the receiving shard */
+	if (fallback) {
+		TEST_EQUALS(16, test.nodev[0].n_req);
+	}
+	else {
+		TEST_ASSERT(test.nodev[0].n_req > 0);
+		TEST_ASSERT(test.nodev[1].n_req > 0);
+	}
+
+ out:
+	shard_stop(&test);
+
+	if (test.mtx)
+		cnd_destroy(&test.cnd);
+
+	mem_deref(test.us);
+	mem_deref(test.sh);
+	mem_deref(test.mtx);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+int test_sip_shard(void)
+{
+	int err;
+
+	err = test_sip_shard_base(false);
+	TEST_ERR(err);
+
+	err = test_sip_shard_base(true);
+	TEST_ERR(err);
+
+ out:
+	return err;
+}
+
+
+static int sip_reply_check(struct sip *sip, struct sip_msg *msg,
+			   bool rec_route, uint16_t scode, const char *reason,
+			   const char *fmt, const char *ref)
+{
+	struct sip_strans *st = NULL;
+	struct mbuf *mb = NULL;
+	int err;
+
+	if (fmt)
+		err = sip_treplyf(&st, &mb, sip, msg, rec_route, scode, reason,
+				  "%s", fmt);
+	else
+		err = sip_treplyf(&st, &mb, sip, msg, rec_route, scode, reason,
+				  NULL);
+	TEST_ERR(err);
+
+	TEST_MEMCMP(ref, strlen(ref), mb->buf, mb->end);
+
+ out:
+	mem_deref(st);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+int test_sip_reply(void)
+{
+	const char req[] =
+		"INVITE sip:bob@10.0.0.9 SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK.a;rport\r\n"
+		"v: SIP/2.0/UDP 10.0.0.2:5060;branch=z9hG4bK.b\r\n"
+		"Record-Route: <sip:p1.example.com;lr>\r\n"
+		"To: Bob <sip:bob@biloxi.com>\r\n"
+		"From: Alice <sip:alice@atlanta.com>;tag=1928301774\r\n"
+		"Call-ID: a84b4c76e66710\r\n"
+		"Contact: <sip:alice@10.0.0.1>\r\n"
+		"CSeq: 314159 INVITE\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n";
+	const char ref_100[] =
+		"SIP/2.0 100 Trying\r\n"
+		"Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK.a"
+		";rport=9;received=127.0.0.1\r\n"
+		"v: SIP/2.0/UDP 10.0.0.2:5060;branch=z9hG4bK.b\r\n"
+		"To: Bob <sip:bob@biloxi.com>\r\n"
+		"From: Alice <sip:alice@atlanta.com>;tag=1928301774\r\n"
+		"Call-ID: a84b4c76e66710\r\n"
+		"CSeq: 314159 INVITE\r\n"
+		"Server: retest\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n";
+	const char ref_180[] =
+		"SIP/2.0 180 Ringing\r\n"
+		"Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK.a"
+		";rport=9;received=127.0.0.1\r\n"
+		"v: SIP/2.0/UDP 10.0.0.2:5060;branch=z9hG4bK.b\r\n"
+		"Record-Route: <sip:p1.example.com;lr>\r\n"
+		"To: Bob <sip:bob@biloxi.com>;tag=0123456789abcdef\r\n"
+		"From: Alice <sip:alice@atlanta.com>;tag=1928301774\r\n"
+		"Call-ID: a84b4c76e66710\r\n"
+		"CSeq: 314159 INVITE\r\n"
+		"Server: retest\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n";
+	const char ref_486[] =
+		"SIP/2.0 486 Busy Here\r\n"
+		"Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK.a"
+		";rport=9;received=127.0.0.1\r\n"
+		"v: SIP/2.0/UDP 10.0.0.2:5060;branch=z9hG4bK.b\r\n"
+		"To: Bob <sip:bob@biloxi.com>;tag=0123456789abcdef\r\n"
+		"From: Alice <sip:alice@atlanta.com>;tag=1928301774\r\n"
+		"Call-ID: a84b4c76e66710\r\n"
+		"CSeq: 314159 INVITE\r\n"
+		"Server: retest\r\n"
+		"Retry-After: 60\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n";
+	const char req_local[] =
+		"OPTIONS sip:bob@10.0.0.9 SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP 127.0.0.1:9;branch=z9hG4bK.c\r\n"
+		"To: <sip:bob@biloxi.com>;tag=abc\r\n"
+		"From: <sip:alice@atlanta.com>;tag=def\r\n"
+		"Call-ID: 1234\r\n"
+		"CSeq: 2 OPTIONS\r\n"
+		"\r\n";
+	const char ref_local[] =
+		"SIP/2.0 200 OK\r\n"
+		"Via: SIP/2.0/UDP 127.0.0.1:9;branch=z9hG4bK.c\r\n"
+		"To: <sip:bob@biloxi.com>;tag=abc\r\n"
+		"From: <sip:alice@atlanta.com>;tag=def\r\n"
+		"Call-ID: 1234\r\n"
+		"CSeq: 2 OPTIONS\r\n"
+		"Server: retest\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n";
+	struct sip_msg *msg = NULL;
+	struct sip *sip = NULL;
+	struct sa laddr;
+	int err;
+
+	err = sip_alloc(&sip, NULL, 32, 32, 32, "retest", NULL, NULL);
+	TEST_ERR(err);
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err = sip_transp_add(sip, SIP_TRANSP_UDP, &laddr);
+	TEST_ERR(err);
+
+	err = sip_msg_decode_str(&msg, req, false);
+	TEST_ERR(err);
+
+	err = sa_set_str(&msg->src, "127.0.0.1", 9);
+	TEST_ERR(err);
+
+	msg->tp  = SIP_TRANSP_UDP;
+	msg->tag = 0x0123456789abcdefULL;
+
+	err = sip_reply_check(sip, msg, false, 100, "Trying", NULL, ref_100);
+	TEST_ERR(err);
+
+	err = sip_reply_check(sip, msg, true, 180, "Ringing", NULL, ref_180);
+	TEST_ERR(err);
+
+	err = sip_reply_check(sip, msg, false, 486, "Busy Here",
+			      "Retry-After: 60\r\nContent-Length: 0\r\n\r\n",
+			      ref_486);
+	TEST_ERR(err);
+
+	/* no rport and matching source address */
+	msg = mem_deref(msg);
+
+	err = sip_msg_decode_str(&msg, req_local, false);
+	TEST_ERR(err);
+
+	err = sa_set_str(&msg->src, "127.0.0.1", 9);
+	TEST_ERR(err);
+
+	msg->tp = SIP_TRANSP_UDP;
+
+	err = sip_reply_check(sip, msg, false, 200, "OK", NULL, ref_local);
+	TEST_ERR(err);
+
+ out:
+	mem_deref(msg);
+	mem_deref(sip);
+
+	return err;
+}
+
+
+struct oc_test {
+	struct sip *sip;
+	struct sip_msg *resp;
+	unsigned n_req;
+};
+
+
+static bool oc_req_handler(const struct sip_msg *msg, void *arg)
+{
+	struct oc_test *test = arg;
+
+	++test->n_req;
+
+	(void)sip_reply(test->sip, msg, 200, "OK");
+
+	return true;
+}
+
+
+static void oc_cancel_handler(void *arg)
+{
+	(void)arg;
+
+	re_cancel();
+}
+
+
+static void oc_client_recv(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct oc_test *test = arg;
+	(void)src;
+
+	test->resp = mem_deref(test->resp);
+
+	(void)sip_msg_decode(&test->resp, mb);
+
+	re_cancel();
+}
+
+
+static void oc_block_handler(void *arg)
+{
+	struct tmr *tmr = arg;
+
+	/* stall the main loop, so that timers run late */
+	sys_msleep(80);
+
+	tmr_start(tmr, 40, oc_cancel_handler, NULL);
+}
+
+
+static int oc_send(struct udp_sock *us, const struct sa *laddr,
+		   const struct sa *caddr, const char *branch)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(512);
+	if (!mb)
+		return ENOMEM;
+
+	err = mbuf_printf(mb,
+			  "INVITE sip:%J SIP/2.0\r\n"
+			  "Via: SIP/2.0/UDP %J;branch=%s;rport;oc\r\n"
+			  "Max-Forwards: 70\r\n"
+			  "To: <sip:%J>\r\n"
+			  "From: <sip:%J>;tag=1\r\n"
+			  "Call-ID: %s\r\n"
+			  "CSeq: 1 INVITE\r\n"
+			  "Content-Length: 0\r\n"
+			  "\r\n",
+			  laddr, caddr, branch, laddr, caddr, branch);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+	err = udp_send(us, laddr, mb);
+
+ out:
+	mem_deref(mb);
+	return err;
+}
+
+
+int test_sip_overload(void)
+{
+	struct sip_overload_conf conf;
+	struct sip_strans *stv[4] = {NULL};
+	struct sip_lsnr *lsnr = NULL;
+	struct udp_sock *us = NULL;
+	struct oc_test test;
+	struct sa laddr, caddr;
+	struct tmr tmr;
+	struct pl oc;
+	int err;
+
+	tmr_init(&tmr);
+	memset(&test, 0, sizeof(test));
+	memset(&conf, 0, sizeof(conf));
+
+	conf.lag_min     = 1000;
+	conf.lag_max     = 2000;
+	conf.strans_max  = RE_ARRAY_SIZE(stv);
+	conf.retry_after = 7;
+
+	err = sip_alloc(&test.sip, NULL, 32, 32, 32, "retest", NULL, NULL);
+	TEST_ERR(err);
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err = sip_transp_add(test.sip, SIP_TRANSP_UDP, &laddr);
+	TEST_ERR(err);
+
+	err = sip_transp_laddr(test.sip, &laddr, SIP_TRANSP_UDP, NULL);
+	TEST_ERR(err);
+
+	err = sip_listen(&lsnr, test.sip, true, oc_req_handler, &test);
+	TEST_ERR(err);
+
+	err = sip_overload_set(test.sip, &conf);
+	TEST_ERR(err);
+
+	TEST_EQUALS(0, sip_overload_level(test.sip));
+
+	/* fill the server transaction table */
+	for (size_t i=0; i<RE_ARRAY_SIZE(stv); i++) {
+
+		struct sip_msg *msg;
+		char str[256];
+
+		re_snprintf(str, sizeof(str),
+			    "INVITE sip:a@b SIP/2.0\r\n"
+			    "Via: SIP/2.0/UDP 10.0.0.1;branch=z9hG4bK%zu\r\n"
+			    "To: <sip:a@b>\r\n"
+			    "From: <sip:c@d>;tag=1\r\n"
+			    "Call-ID: %zu\r\n"
+			    "CSeq: 1 INVITE\r\n"
+			    "\r\n", i, i);
+
+		err = sip_msg_decode_str(&msg, str, false);
+		TEST_ERR(err);
+
+		err = sip_strans_alloc(&stv[i], test.sip, msg, NULL, NULL);
+		mem_deref(msg);
+		TEST_ERR(err);
+	}
+
+	TEST_EQUALS(100, sip_overload_level(test.sip));
+
+	err = sa_set_str(&caddr, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err = udp_listen(&us, &caddr, oc_client_recv, &test);
+	TEST_ERR(err);
+
+	err = udp_local_get(us, &caddr);
+	TEST_ERR(err);
+
+	/* new INVITEs are rejected */
+	err = oc_send(us, &laddr, &caddr, "z9hG4bKa");
+	TEST_ERR(err);
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+
+	TEST_ASSERT(test.resp != NULL);
+	TEST_EQUALS(503, test.resp->scode);
+	TEST_EQUALS(0, test.n_req);
+	TEST_EQUALS(1, sip_overload_rejected(test.sip));
+	TEST_ASSERT(sip_msg_hdr_has_value(test.resp, SIP_HDR_RETRY_AFTER,
+					  "7"));
+	err = msg_param_decode(&test.resp->via.params, "oc", &oc);
+	TEST_ERR(err);
+	TEST_ASSERT(0 == pl_strcmp(&oc, "100"));
+	err = msg_param_decode(&test.resp->via.params, "rport", &oc);
+	TEST_ERR(err);
+	TEST_EQUALS(sa_port(&caddr), pl_u32(&oc));
+
+	/* and accepted again once the load is gone */
+	for (size_t i=0; i<RE_ARRAY_SIZE(stv); i++)
+		stv[i] = mem_deref(stv[i]);
+
+	TEST_EQUALS(0, sip_overload_level(test.sip));
+
+	err = oc_send(us, &laddr, &caddr, "z9hG4bKb");
+	TEST_ERR(err);
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+
+	TEST_EQUALS(200, test.resp->scode);
+	TEST_EQUALS(1, test.n_req);
+	err = msg_param_decode(&test.resp->via.params, "oc", &oc);
+	TEST_ERR(err);
+	TEST_ASSERT(0 == pl_strcmp(&oc, "0"));
+
+	/* loop lag raises the level */
+	conf.lag_min = 1;
+	conf.lag_max = 5;
+
+	err = sip_overload_set(test.sip, &conf);
+	TEST_ERR(err);
+
+	tmr_start(&tmr, 1, oc_block_handler, &tmr);
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+
+	TEST_ASSERT(sip_overload_level(test.sip) > 0);
+
+	err = sip_overload_set(test.sip, NULL);
+	TEST_ERR(err);
+
+	TEST_EQUALS(0, sip_overload_level(test.sip));
+
+ out:
+	tmr_cancel(&tmr);
+	for (size_t i=0; i<RE_ARRAY_SIZE(stv); i++)
+		mem_deref(stv[i]);
+
+	mem_deref(test.resp);
+	mem_deref(us);
+	mem_deref(lsnr);
+	mem_deref(test.sip);
+
+	return err;
+}
+
+
+struct framing_test {
+	struct sip *sip;
+	struct tcp_conn *tc;
+	struct mbuf *mb;
+	struct tmr tmr;
+	size_t chunk;
+	unsigned n_req;
+	int err;
+};
+
+
+static const char *framing_bodyv[] = {
+	"",
+	"hello\r\n\r\nworld",
+	"x",
+};
+
+
+/* the server closes the connection when it runs out of memory */
+static void framing_abort(struct framing_test *test, int err)
+{
+	test->err = test_mode == TEST_MEMORY ? ENOMEM : err;
+	re_cancel();
+}
+
+
+static bool framing_req_handler(const struct sip_msg *msg, void *arg)
+{
+	struct framing_test *test = arg;
+	const char *body;
+	int err = 0;
+
+	TEST_ASSERT(test->n_req < RE_ARRAY_SIZE(framing_bodyv));
+
+	body = framing_bodyv[test->n_req];
+
+	TEST_EQUALS(SIP_TRANSP_TCP, msg->tp);
+	TEST_EQUALS(str_len(body), mbuf_get_left(msg->mb));
+	TEST_MEMCMP(body, str_len(body),
+		    mbuf_buf(msg->mb), mbuf_get_left(msg->mb));
+
+	(void)sip_reply(test->sip, msg, 200, "OK");
+
+	if (++test->n_req == RE_ARRAY_SIZE(framing_bodyv))
+		re_cancel();
+
+ out:
+	if (err) {
+		test->err = err;
+		re_cancel();
+	}
+
+	return true;
+}
+
+
+/* Send the stream in small chunks, to split it at every position */
+static void framing_send_handler(void *arg)
+{
+	struct framing_test *test = arg;
+	struct mbuf mb;
+	int err;
+
+	mb.buf  = test->mb->buf;
+	mb.size = test->mb->size;
+	mb.pos  = test->mb->pos;
+	mb.end  = test->mb->pos + min(test->chunk, mbuf_get_left(test->mb));
+
+	err = tcp_send(test->tc, &mb);
+	if (err) {
+		framing_abort(test, err);
+		return;
+	}
+
+	test->mb->pos = mb.end;
+	test->chunk = test->chunk % 13 + 1;
+
+	if (mbuf_get_left(test->mb))
+		tmr_start(&test->tmr, 0, framing_send_handler, test);
+}
+
+
+static void framing_estab_handler(void *arg)
+{
+	struct framing_test *test = arg;
+
+	framing_send_handler(test);
+}
+
+
+static void framing_recv_handler(struct mbuf *mb, void *arg)
+{
+	(void)mb;
+	(void)arg;
+}
+
+
+static void framing_close_handler(int err, void *arg)
+{
+	struct framing_test *test = arg;
+
+	framing_abort(test, err ? err : ECONNRESET);
+}
+
+
+int test_sip_tcp_framing(void)
+{
+	struct sip_lsnr *lsnr = NULL;
+	struct framing_test test;
+	struct sa laddr;
+	int err;
+
+	memset(&test, 0, sizeof(test));
+	tmr_init(&test.tmr);
+	test.chunk = 1;
+
+	err = sip_alloc(&test.sip, NULL, 32, 32, 32, "retest", NULL, NULL);
+	TEST_ERR(err);
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err = sip_transp_add(test.sip, SIP_TRANSP_TCP, &laddr);
+	TEST_ERR(err);
+
+	err = sip_transp_laddr(test.sip, &laddr, SIP_TRANSP_TCP, NULL);
+	TEST_ERR(err);
+
+	err = sip_listen(&lsnr, test.sip, true, framing_req_handler, &test);
+	TEST_ERR(err);
+
+	test.mb = mbuf_alloc(1024);
+	if (!test.mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	/* keepalive ping, then pipelined requests with bodies */
+	err = mbuf_write_str(test.mb, "\r\n\r\n");
+	TEST_ERR(err);
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(framing_bodyv); i++) {
+
+		err = mbuf_printf(test.mb,
+				  "MESSAGE sip:%J;transport=tcp SIP/2.0\r\n"
+				  "Via: SIP/2.0/TCP 127.0.0.1"
+				  ";branch=z9hG4bK%zu\r\n"
+				  "To: <sip:a@b>\r\n"
+				  "From: <sip:c@d>;tag=1\r\n"
+				  "Call-ID: framing%zu\r\n"
+				  "CSeq: 1 MESSAGE\r\n"
+				  "Max-Forwards: 70\r\n"
+				  "%s: %zu\r\n"
+				  "\r\n"
+				  "%s",
+				  &laddr, i, i, i % 2 ? "l" : "Content-Length",
+				  str_len(framing_bodyv[i]), framing_bodyv[i]);
+		TEST_ERR(err);
+	}
+
+	test.mb->pos = 0;
+
+	err = tcp_connect(&test.tc, &laddr, framing_estab_handler,
+			  framing_recv_handler, framing_close_handler, &test);
+	TEST_ERR(err);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	err = test.err;
+	TEST_ERR(err);
+
+	TEST_EQUALS(RE_ARRAY_SIZE(framing_bodyv), test.n_req);
+	TEST_EQUALS(0, mbuf_get_left(test.mb));
+
+ out:
+	tmr_cancel(&test.tmr);
+	mem_deref(test.tc);
+	mem_deref(test.mb);
+	mem_deref(lsnr);
+	mem_deref(test.sip);
+
+	return err;
+}
+
+
+enum { RTX_N = 16 };
+
+struct rtx_test {
+	struct sip *sip;
+	struct sip_request *reqv[RTX_N];
+	uint64_t start;
+	uint64_t elapsed;
+	unsigned n;
+	unsigned n_exp;
+};
+
+
+static void rtx_recv_handler(const struct sa *src, struct mbuf *mb,
+			     void *arg)
+{
+	struct rtx_test *test = arg;
+	(void)src;
+	(void)mb;
+
+	if (!test->n++)
+		test->start = tmr_jiffies();
+
+	if (test->n == test->n_exp) {
+		test->elapsed = tmr_jiffies() - test->start;
+		re_cancel();
+	}
+}
+
+
+static void rtx_resp_handler(int err, const struct sip_msg *msg, void *arg)
+{
+	(void)err;
+	(void)msg;
+	(void)arg;
+}
+
+
+/* Send n requests to a peer which never answers */
+static int rtx_send(struct rtx_test *test, unsigned n, unsigned n_exp)
+{
+	struct udp_sock *us = NULL;
+	struct sa laddr, paddr;
+	char uri[64];
+	int err;
+
+	test->n_exp = n_exp;
+
+	err = sip_alloc(&test->sip, NULL, 32, 32, 32, "retest", NULL, NULL);
+	TEST_ERR(err);
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err = sip_transp_add(test->sip, SIP_TRANSP_UDP, &laddr);
+	TEST_ERR(err);
+
+	err = udp_listen(&us, &laddr, rtx_recv_handler, test);
+	TEST_ERR(err);
+
+	err = udp_local_get(us, &paddr);
+	TEST_ERR(err);
+
+	re_snprintf(uri, sizeof(uri), "sip:rtx@%J", &paddr);
+
+	for (unsigned i=0; i<n; i++) {
+
+		err = sip_requestf(&test->reqv[i], test->sip, true, "OPTIONS",
+				   uri, NULL, NULL, NULL, rtx_resp_handler,
+				   test,
+				   "To: <%s>\r\n"
+				   "From: <%s>;tag=1\r\n"
+				   "Call-ID: rtx-%u\r\n"
+				   "CSeq: 1 OPTIONS\r\n"
+				   "Content-Length: 0\r\n"
+				   "\r\n", uri, uri, i);
+		TEST_ERR(err);
+	}
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+
+	TEST_EQUALS(n_exp, test->n);
+
+ out:
+	for (unsigned i=0; i<n; i++)
+		test->reqv[i] = mem_deref(test->reqv[i]);
+
+	mem_deref(us);
+
+	return err;
+}
+
+
+/*
+ * Transactions started together are retransmitted together, from one
+ * callback of the retransmission timer wheel
+ */
+int test_sip_retransmit(void)
+{
+	struct rtx_test test;
+	char *dbg = NULL;
+	struct pl batch;
+	int err;
+
+	memset(&test, 0, sizeof(test));
+
+	/* the requests and their first retransmissions */
+	err = rtx_send(&test, RTX_N, 2 * RTX_N);
+	TEST_ERR(err);
+
+	/* never early */
+	TEST_ASSERT(test.elapsed >= SIP_T1);
+
+	err = re_sdprintf(&dbg, "%H", sip_debug, test.sip);
+	TEST_ERR(err);
+
+	err = re_regex(dbg, str_len(dbg), "largest batch [0-9]+", &batch);
+	TEST_ERR(err);
+
+	/* one batch, or two if the start straddled a slot boundary */
+	TEST_ASSERT(pl_u32(&batch) >= RTX_N / 2);
+
+ out:
+	mem_deref(dbg);
+	mem_deref(test.sip);
+
+	return err;
+}
+
+
+/*
+ * Retransmission times with real timers, sent at 0, T1 and 3*T1
+ */
+int test_sip_retransmit_timing(void)
+{
+	struct rtx_test test;
+	int err;
+
+	memset(&test, 0, sizeof(test));
+
+	err = rtx_send(&test, 1, 3);
+	TEST_ERR(err);
+
+	/* never early, and at most one slot late per retransmission */
+	TEST_ASSERT(test.elapsed >= 3 * SIP_T1);
+	TEST_ASSERT(test.elapsed <= 3 * SIP_T1 + SIP_T1);
+
+ out:
+	mem_deref(test.sip);
+
+	return err;
+}
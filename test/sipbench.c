@@ -0,0 +1,746 @@
+/**
+ * @file sipbench.c  SIP load generator and benchmark
+ *
+ * Runs a registrar/UAS and a UAC SIP stack over loopback in the same
+ * process, and measures REGISTER, SUBSCRIBE and INVITE throughput,
+ * transaction latency, memory per dialog and CPU time per SIP message.
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_GETOPT
+#include <getopt.h>
+#endif
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+#include <re.h>
+
+
+#define DEBUG_MODULE "sipbench"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	DEFAULT_COUNT  = 10000,
+	DEFAULT_WINDOW = 100,
+	SETTLE_TIME    = 1000,   /* [ms] */
+	PHASE_TIMEOUT  = 120,    /* [s]  */
+};
+
+
+static const char sdp[] =
+	"v=0\r\n"
+	"o=- 1 1 IN IP4 127.0.0.1\r\n"
+	"s=-\r\n"
+	"c=IN IP4 127.0.0.1\r\n"
+	"t=0 0\r\n"
+	"m=audio 9 RTP/AVP 0\r\n";
+
+static const char event[] = "sipbench";
+
+
+struct bench;
+
+struct bench_op {
+	struct bench *b;
+	void *obj;          /* sipreg, sipsub or sipsess of the UAC */
+	uint64_t ts;        /* Start time [us] */
+	uint64_t lat;       /* Latency [us]    */
+	int err;
+	bool done;
+};
+
+typedef int (bench_start_h)(struct bench_op *op);
+
+struct bench {
+	struct sip *uas;
+	struct sip *uac;
+	struct sipsess_sock *sock_uas;
+	struct sipsess_sock *sock_uac;
+	struct sipevent_sock *evsock_uas;
+	struct sipevent_sock *evsock_uac;
+	struct sip_lsnr *lsnr;
+	struct sip_lsnr *lsnr_uac;
+	void **uasv;        /* sipsess or sipnot of the UAS */
+	struct bench_op *opv;
+	struct tmr tmr;
+	bench_start_h *starth;
+	enum sip_transp tp;
+	char uri[64];
+	uint32_t n;
+	uint32_t window;
+	uint32_t started;
+	uint32_t done;
+	uint32_t failed;
+	uint32_t uasc;
+	uint64_t msgs;
+	uint32_t late;
+	bool timeout;
+};
+
+
+static void op_start(struct bench *b);
+
+
+static void op_done(struct bench_op *op, int err)
+{
+	struct bench *b = op->b;
+
+	if (op->done)
+		return;
+
+	op->done = true;
+	op->err  = err;
+	op->lat  = tmr_jiffies_usec() - op->ts;
+
+	if (err)
+		++b->failed;
+
+	if (++b->done == b->n)
+		re_cancel();
+	else if (b->started < b->n)
+		op_start(b);
+}
+
+
+static void op_start(struct bench *b)
+{
+	struct bench_op *op = &b->opv[b->started++];
+	int err;
+
+	op->b  = b;
+	op->ts = tmr_jiffies_usec();
+
+	err = b->starth(op);
+	if (err)
+		op_done(op, err);
+}
+
+
+static void trace_handler(bool tx, enum sip_transp tp,
+			  const struct sa *src, const struct sa *dst,
+			  const uint8_t *pkt, size_t len, void *arg)
+{
+	struct bench *b = arg;
+	(void)tp;
+	(void)src;
+	(void)dst;
+	(void)pkt;
+	(void)len;
+
+	/* both ends are in this process, count every message once */
+	if (tx)
+		++b->msgs;
+}
+
+
+/* retransmitted responses, for transactions which are done already */
+static bool late_handler(const struct sip_msg *msg, void *arg)
+{
+	struct bench *b = arg;
+	(void)msg;
+
+	++b->late;
+
+	return true;
+}
+
+
+static bool registrar_handler(const struct sip_msg *msg, void *arg)
+{
+	struct bench *b = arg;
+
+	if (pl_strcmp(&msg->met, "REGISTER"))
+		return false;
+
+	(void)sip_reply(b->uas, msg, 200, "OK");
+
+	return true;
+}
+
+
+static int desc_handler(struct mbuf **descp, const struct sa *src,
+			const struct sa *dst, void *arg)
+{
+	struct mbuf *desc;
+	(void)src;
+	(void)dst;
+	(void)arg;
+
+	desc = mbuf_alloc(sizeof(sdp));
+	if (!desc)
+		return ENOMEM;
+
+	(void)mbuf_write_str(desc, sdp);
+	desc->pos = 0;
+
+	*descp = desc;
+
+	return 0;
+}
+
+
+static int offer_handler(struct mbuf **descp, const struct sip_msg *msg,
+			 void *arg)
+{
+	(void)descp;
+	(void)msg;
+	(void)arg;
+
+	return 0;
+}
+
+
+static int answer_handler(const struct sip_msg *msg, void *arg)
+{
+	(void)msg;
+	(void)arg;
+
+	return 0;
+}
+
+
+static void uas_close_handler(int err, const struct sip_msg *msg, void *arg)
+{
+	(void)err;
+	(void)msg;
+	(void)arg;
+}
+
+
+static void uas_conn_handler(const struct sip_msg *msg, void *arg)
+{
+	struct bench *b = arg;
+	struct sipsess *sess = NULL;
+	struct mbuf *desc = NULL;
+	int err;
+
+	if (b->uasc >= b->n) {
+		(void)sip_treply(NULL, b->uas, msg, 486, "Busy Here");
+		return;
+	}
+
+	err = desc_handler(&desc, NULL, NULL, NULL);
+	if (err)
+		goto out;
+
+	err = sipsess_accept(&sess, b->sock_uas, msg, 200, "OK",
+			     REL100_DISABLED, "uas", "application/sdp", desc,
+			     NULL, NULL, false, offer_handler, answer_handler,
+			     NULL, NULL, NULL, uas_close_handler, b, NULL);
+	if (err)
+		goto out;
+
+	b->uasv[b->uasc++] = sess;
+
+ out:
+	if (err)
+		(void)sip_treply(NULL, b->uas, msg, 500, "Server Error");
+
+	mem_deref(desc);
+}
+
+
+static void reg_resp_handler(int err, const struct sip_msg *msg, void *arg)
+{
+	struct bench_op *op = arg;
+
+	if (!err && msg->scode < 200)
+		return;
+
+	op_done(op, err ? err : (msg->scode < 300 ? 0 : EPROTO));
+}
+
+
+static int reg_start(struct bench_op *op)
+{
+	struct bench *b = op->b;
+	char aor[64], cuser[32];
+	uint32_t idx = (uint32_t)(op - b->opv);
+
+	re_snprintf(aor, sizeof(aor), "sip:user%u@127.0.0.1", idx);
+	re_snprintf(cuser, sizeof(cuser), "user%u", idx);
+
+	return sipreg_register((struct sipreg **)&op->obj, b->uac, b->uri,
+			       aor, NULL, aor, 3600, cuser, NULL, 0, 0,
+			       NULL, NULL, false, reg_resp_handler, op,
+			       NULL, NULL);
+}
+
+
+static void uac_estab_handler(const struct sip_msg *msg, void *arg)
+{
+	(void)msg;
+
+	op_done(arg, 0);
+}
+
+
+static void uac_close_handler(int err, const struct sip_msg *msg, void *arg)
+{
+	op_done(arg, err ? err : (msg ? (int)msg->scode : EPROTO));
+}
+
+
+static int call_start(struct bench_op *op)
+{
+	struct bench *b = op->b;
+
+	return sipsess_connect((struct sipsess **)&op->obj, b->sock_uac,
+			       b->uri, NULL, "sip:uac@127.0.0.1", "uac",
+			       NULL, 0, "application/sdp", NULL, NULL, false,
+			       NULL, desc_handler, offer_handler,
+			       answer_handler, NULL, uac_estab_handler, NULL,
+			       NULL, uac_close_handler, op, NULL);
+}
+
+
+static void not_close_handler(int err, const struct sip_msg *msg, void *arg)
+{
+	(void)err;
+	(void)msg;
+	(void)arg;
+}
+
+
+static bool notifier_handler(const struct sip_msg *msg, void *arg)
+{
+	struct bench *b = arg;
+	const struct sip_hdr *hdr;
+	struct sipevent_event se;
+	struct sipnot *not = NULL;
+	int err;
+
+	if (b->uasc >= b->n) {
+		(void)sip_treply(NULL, b->uas, msg, 503,
+				 "Service Unavailable");
+		return true;
+	}
+
+	hdr = sip_msg_hdr(msg, SIP_HDR_EVENT);
+	if (!hdr) {
+		err = EPROTO;
+		goto out;
+	}
+
+	err = sipevent_event_decode(&se, &hdr->val);
+	if (err)
+		goto out;
+
+	err = sipevent_accept(&not, b->evsock_uas, msg, NULL, &se, 200, "OK",
+			      600, 600, 600, "uas", "text/plain", NULL, NULL,
+			      false, not_close_handler, b, NULL);
+	if (err)
+		goto out;
+
+	b->uasv[b->uasc++] = not;
+
+	err = sipevent_notify(not, NULL, SIPEVENT_ACTIVE, 0, 0);
+
+ out:
+	if (err && !not)
+		(void)sip_treply(NULL, b->uas, msg, 500, "Server Error");
+
+	return true;
+}
+
+
+static void sub_notify_handler(struct sip *sip, const struct sip_msg *msg,
+			       void *arg)
+{
+	(void)sip_treply(NULL, sip, msg, 200, "OK");
+
+	/* the subscription is up once the first NOTIFY arrives */
+	op_done(arg, 0);
+}
+
+
+static void sub_close_handler(int err, const struct sip_msg *msg,
+			      const struct sipevent_substate *substate,
+			      void *arg)
+{
+	(void)substate;
+
+	op_done(arg, err ? err : (msg ? (int)msg->scode : EPROTO));
+}
+
+
+static int sub_start(struct bench_op *op)
+{
+	struct bench *b = op->b;
+	char from[64], cuser[32];
+	uint32_t idx = (uint32_t)(op - b->opv);
+
+	re_snprintf(from, sizeof(from), "sip:user%u@127.0.0.1", idx);
+	re_snprintf(cuser, sizeof(cuser), "user%u", idx);
+
+	return sipevent_subscribe((struct sipsub **)&op->obj, b->evsock_uac,
+				  b->uri, NULL, from, event, NULL, 600, cuser,
+				  NULL, 0, NULL, NULL, false, NULL,
+				  sub_notify_handler, sub_close_handler, op,
+				  NULL);
+}
+
+
+static void timeout_handler(void *arg)
+{
+	struct bench *b = arg;
+
+	b->timeout = true;
+	re_cancel();
+}
+
+
+static void settle(struct bench *b)
+{
+	tmr_start(&b->tmr, SETTLE_TIME, timeout_handler, b);
+	(void)re_main(NULL);
+	b->timeout = false;
+}
+
+
+static uint64_t cpu_usec(void)
+{
+#ifndef WIN32
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+		+ ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#else
+	return 0;
+#endif
+}
+
+
+static int lat_cmp(const void *p1, const void *p2)
+{
+	const uint64_t *a = p1, *b = p2;
+
+	return (*a > *b) - (*a < *b);
+}
+
+
+static uint64_t memstat_bytes(void)
+{
+	struct memstat mstat;
+
+	if (mem_get_stat(&mstat))
+		return 0;
+
+	return mstat.bytes_cur;
+}
+
+
+/* Run one phase, with at most b->window operations outstanding */
+static int run(struct bench *b, const char *name, bench_start_h *starth,
+	       bool dialogs)
+{
+	uint64_t t0, t1, cpu0, cpu1, mem0, mem1 = 0;
+	uint64_t *latv;
+	uint32_t okc = 0;
+
+	b->opv = mem_zalloc(b->n * sizeof(*b->opv), NULL);
+	latv   = mem_zalloc(b->n * sizeof(*latv), NULL);
+	if (!b->opv || !latv) {
+		b->opv = mem_deref(b->opv);
+		mem_deref(latv);
+		return ENOMEM;
+	}
+
+	b->starth  = starth;
+	b->started = 0;
+	b->done    = 0;
+	b->failed  = 0;
+	b->msgs    = 0;
+	b->late    = 0;
+
+	mem0 = memstat_bytes();
+	cpu0 = cpu_usec();
+	t0   = tmr_jiffies_usec();
+
+	tmr_start(&b->tmr, PHASE_TIMEOUT * 1000, timeout_handler, b);
+
+	while (b->started < MIN(b->window, b->n))
+		op_start(b);
+
+	if (b->done < b->n)
+		(void)re_main(NULL);
+
+	t1   = tmr_jiffies_usec();
+	cpu1 = cpu_usec();
+
+	if (dialogs)
+		mem1 = memstat_bytes();
+
+	for (uint32_t i=0; i<b->started; i++) {
+
+		if (!b->opv[i].done || b->opv[i].err)
+			continue;
+
+		latv[okc++] = b->opv[i].lat;
+	}
+
+	qsort(latv, okc, sizeof(*latv), lat_cmp);
+
+	re_printf("%-10s %6u done, %u failed%s in %llu ms: %llu/s\n",
+		  name, b->done - b->failed, b->failed,
+		  b->timeout ? " (timeout)" : "",
+		  (t1 - t0) / 1000,
+		  (uint64_t)b->done * 1000000 / MAX(t1 - t0, 1));
+
+	if (okc) {
+		re_printf("%-10s latency p50 %llu.%03llu ms,"
+			  " p99 %llu.%03llu ms\n", "",
+			  latv[okc/2] / 1000, latv[okc/2] % 1000,
+			  latv[okc*99/100] / 1000, latv[okc*99/100] % 1000);
+	}
+
+	re_printf("%-10s %llu messages, cpu %llu ns/message,"
+		  " %u late responses\n", "",
+		  b->msgs, (cpu1 - cpu0) * 1000 / MAX(b->msgs, 1), b->late);
+
+	if (dialogs && mem0 && b->done > b->failed) {
+		int64_t diff = (int64_t)(mem1 - mem0);
+
+		re_printf("%-10s memory %lld bytes/dialog (both ends)\n", "",
+			  diff / (int64_t)(b->done - b->failed));
+	}
+	else if (dialogs) {
+		re_printf("%-10s memory n/a (needs MEM_DEBUG)\n", "");
+	}
+
+	/* tear down, and let unregistrations and BYEs finish */
+	for (uint32_t i=0; i<b->started; i++)
+		mem_deref(b->opv[i].obj);
+
+	for (uint32_t i=0; i<b->uasc; i++)
+		mem_deref(b->uasv[i]);
+
+	b->uasc = 0;
+	b->timeout = false;
+
+	settle(b);
+
+	b->opv = mem_deref(b->opv);
+	mem_deref(latv);
+
+	return 0;
+}
+
+
+static int bench_init(struct bench *b)
+{
+	struct sa laddr;
+	int err;
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	if (err)
+		return err;
+
+	err  = sip_alloc(&b->uas, NULL, 1024, 1024, 1024, "sipbench uas",
+			 NULL, b);
+	err |= sip_alloc(&b->uac, NULL, 1024, 1024, 1024, "sipbench uac",
+			 NULL, b);
+	if (err)
+		return err;
+
+	err  = sip_transp_add(b->uas, b->tp, &laddr);
+	err |= sip_transp_add(b->uac, b->tp, &laddr);
+	if (err)
+		return err;
+
+	sip_set_trace_handler(b->uas, trace_handler);
+	sip_set_trace_handler(b->uac, trace_handler);
+
+	err  = sip_listen(&b->lsnr, b->uas, true, registrar_handler, b);
+	err |= sip_listen(&b->lsnr_uac, b->uac, false, late_handler, b);
+	if (err)
+		return err;
+
+	err  = sipsess_listen(&b->sock_uas, b->uas, 1024, uas_conn_handler,
+			      b);
+	err |= sipsess_listen(&b->sock_uac, b->uac, 1024, NULL, NULL);
+	if (err)
+		return err;
+
+	err  = sipevent_listen(&b->evsock_uas, b->uas, 1024, 1024,
+			       notifier_handler, b);
+	err |= sipevent_listen(&b->evsock_uac, b->uac, 1024, 1024, NULL,
+			       NULL);
+	if (err)
+		return err;
+
+	err = sip_transp_laddr(b->uas, &laddr, b->tp, NULL);
+	if (err)
+		return err;
+
+	if (re_snprintf(b->uri, sizeof(b->uri), "sip:uas@%J%s", &laddr,
+			sip_transp_param(b->tp)) < 0)
+		return ENOMEM;
+
+	b->uasv = mem_zalloc(b->n * sizeof(*b->uasv), NULL);
+	if (!b->uasv)
+		return ENOMEM;
+
+	return 0;
+}
+
+
+static void bench_close(struct bench *b)
+{
+	tmr_cancel(&b->tmr);
+
+	b->uasv     = mem_deref(b->uasv);
+	b->lsnr     = mem_deref(b->lsnr);
+	b->lsnr_uac = mem_deref(b->lsnr_uac);
+
+	sipsess_close_all(b->sock_uac);
+	sipsess_close_all(b->sock_uas);
+	b->sock_uac = mem_deref(b->sock_uac);
+	b->sock_uas = mem_deref(b->sock_uas);
+
+	b->evsock_uac = mem_deref(b->evsock_uac);
+	b->evsock_uas = mem_deref(b->evsock_uas);
+
+	sip_close(b->uac, true);
+	sip_close(b->uas, true);
+	b->uac = mem_deref(b->uac);
+	b->uas = mem_deref(b->uas);
+}
+
+
+/*
+ * Run a phase on fresh SIP stacks, so that transactions left over from
+ * an earlier phase do not count towards its memory
+ */
+static int phase(struct bench *b, uint32_t n, const char *name,
+		 bench_start_h *starth, bool dialogs)
+{
+	int err;
+
+	b->n = n;
+
+	err = bench_init(b);
+	if (err) {
+		DEBUG_WARNING("init failed (%m)\n", err);
+		goto out;
+	}
+
+	err = run(b, name, starth, dialogs);
+
+ out:
+	bench_close(b);
+
+	return err;
+}
+
+
+#ifdef HAVE_GETOPT
+static void usage(void)
+{
+	(void)re_fprintf(stderr, "Usage: sipbench [-h] [-r <n>] [-s <n>]"
+			 " [-c <n>] [-w <n>] [-t udp|tcp]\n");
+
+	(void)re_fprintf(stderr, "\t-r <n>    Number of registrations\n");
+	(void)re_fprintf(stderr, "\t-s <n>    Number of subscriptions\n");
+	(void)re_fprintf(stderr, "\t-c <n>    Number of calls\n");
+	(void)re_fprintf(stderr, "\t-w <n>    Outstanding transactions\n");
+	(void)re_fprintf(stderr, "\t-t <tp>   Transport (udp or tcp)\n");
+	(void)re_fprintf(stderr, "\t-h        Help\n");
+}
+#endif
+
+
+int main(int argc, char *argv[])
+{
+	uint32_t nreg = DEFAULT_COUNT, nsub = DEFAULT_COUNT;
+	uint32_t ncall = DEFAULT_COUNT;
+	struct bench b;
+	int err;
+
+	memset(&b, 0, sizeof(b));
+	b.window = DEFAULT_WINDOW;
+	b.tp     = SIP_TRANSP_UDP;
+
+#ifdef HAVE_GETOPT
+	for (;;) {
+		const int c = getopt(argc, argv, "hr:s:c:w:t:");
+		if (0 > c)
+			break;
+
+		switch (c) {
+
+		case 'r':
+			nreg = atoi(optarg);
+			break;
+
+		case 's':
+			nsub = atoi(optarg);
+			break;
+
+		case 'c':
+			ncall = atoi(optarg);
+			break;
+
+		case 'w':
+			b.window = MAX(atoi(optarg), 1);
+			break;
+
+		case 't':
+			if (!str_casecmp(optarg, "tcp"))
+				b.tp = SIP_TRANSP_TCP;
+			else if (!str_casecmp(optarg, "udp"))
+				b.tp = SIP_TRANSP_UDP;
+			else {
+				usage();
+				return -2;
+			}
+			break;
+
+		case '?':
+		case 'h':
+		default:
+			usage();
+			return -2;
+		}
+	}
+#else
+	(void)argc;
+	(void)argv;
+#endif
+
+	err = libre_init();
+	if (err)
+		return err;
+
+	tmr_init(&b.tmr);
+
+	re_printf("sipbench: %s over loopback, window %u\n",
+		  sip_transp_name(b.tp), b.window);
+
+	if (nreg) {
+		err = phase(&b, nreg, "REGISTER", reg_start, false);
+		if (err)
+			goto out;
+	}
+
+	if (nsub) {
+		err = phase(&b, nsub, "SUBSCRIBE", sub_start, true);
+		if (err)
+			goto out;
+	}
+
+	if (ncall)
+		err = phase(&b, ncall, "INVITE", call_start, true);
+
+ out:
+	libre_close();
+
+	return err;
+}
@@ -439,3 +439,237 @@ int test_sipevent_network(void)
 
 	return err;
 }
+
+
+/*
+ * Fan-out: one notifier updates the state of many subscriptions
+ */
+
+
+enum { FANOUT_SUBS = 4 };
+
+struct fanout_test;
+
+struct fanout_sub {
+	struct fanout_test *t;
+	struct sipsub *sub;
+	uint64_t ts;
+	unsigned notc;
+	char body[8];
+};
+
+struct fanout_test {
+	struct sip *sip_a;
+	struct sip *sip_b;
+	struct sipevent_sock *sock_a;
+	struct sipevent_sock *sock_b;
+	struct sipevent_fanout *fo;
+	struct fanout_sub subv[FANOUT_SUBS];
+	struct sipnot *notv[FANOUT_SUBS];
+	unsigned notc;
+	unsigned subc;
+	int err;
+};
+
+
+static int fanout_send(struct fanout_test *t, const char *body)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(16);
+	if (!mb)
+		return ENOMEM;
+
+	err = mbuf_write_str(mb, body);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+
+	err = sipevent_fanout(t->fo, t->notv, t->subc, mb, SIPEVENT_ACTIVE);
+
+ out:
+	mem_deref(mb);
+	return err;
+}
+
+
+static void fanout_complete(struct fanout_test *t, int err)
+{
+	t->err = err;
+	re_cancel();
+}
+
+
+static bool fanout_subscribe_handler(const struct sip_msg *msg, void *arg)
+{
+	struct fanout_test *t = arg;
+	const struct sip_hdr *hdr;
+	struct sipevent_event se;
+	int err;
+
+	hdr = sip_msg_hdr(msg, SIP_HDR_EVENT);
+	TEST_ASSERT(hdr != NULL);
+
+	err = sipevent_event_decode(&se, &hdr->val);
+	TEST_ERR(err);
+
+	TEST_ASSERT(t->subc < FANOUT_SUBS);
+
+	err = sipevent_accept(&t->notv[t->subc], t->sock_b, msg, NULL, &se,
+			      200, "OK", 600, 600, 600, "b", "text/plain",
+			      NULL, NULL, false, NULL, NULL, NULL);
+	TEST_ERR(err);
+
+	if (++t->subc < FANOUT_SUBS)
+		return true;
+
+	/* the second update replaces the first one in the queue */
+	err  = fanout_send(t, "one");
+	err |= fanout_send(t, "two");
+	TEST_ERR(err);
+
+	TEST_EQUALS(FANOUT_SUBS, sipevent_fanout_pending(t->fo));
+
+ out:
+	if (err)
+		fanout_complete(t, err);
+
+	return true;
+}
+
+
+static void fanout_notify_handler(struct sip *sip, const struct sip_msg *msg,
+				  void *arg)
+{
+	struct fanout_sub *fs = arg;
+	struct fanout_test *t = fs->t;
+	int err = 0;
+
+	(void)sip_treply(NULL, sip, msg, 200, "OK");
+
+	fs->ts = tmr_jiffies();
+	++fs->notc;
+
+	TEST_ASSERT(mbuf_get_left(msg->mb) < sizeof(fs->body));
+	memset(fs->body, 0, sizeof(fs->body));
+	memcpy(fs->body, mbuf_buf(msg->mb), mbuf_get_left(msg->mb));
+
+	if (++t->notc == FANOUT_SUBS) {
+
+		for (size_t i=0; i<FANOUT_SUBS; i++) {
+			TEST_EQUALS(1, t->subv[i].notc);
+			TEST_STRCMP("two", 3U, t->subv[i].body,
+				    strlen(t->subv[i].body));
+		}
+
+		err = fanout_send(t, "three");
+		TEST_ERR(err);
+	}
+	else if (t->notc == 2 * FANOUT_SUBS) {
+
+		for (size_t i=0; i<FANOUT_SUBS; i++) {
+			TEST_EQUALS(2, t->subv[i].notc);
+			TEST_STRCMP("three", 5U, t->subv[i].body,
+				    strlen(t->subv[i].body));
+		}
+
+		/* the first subscriber asked for max. 5 NOTIFYs per second */
+		TEST_ASSERT(t->subv[0].ts >= t->subv[1].ts + 100);
+
+		fanout_complete(t, 0);
+	}
+
+ out:
+	if (err)
+		fanout_complete(t, err);
+}
+
+
+static void fanout_close_handler(int err, const struct sip_msg *msg,
+				 const struct sipevent_substate *substate,
+				 void *arg)
+{
+	struct fanout_sub *fs = arg;
+	(void)msg;
+	(void)substate;
+
+	fanout_complete(fs->t, err ? err : EPROTO);
+}
+
+
+int test_sipevent_fanout(void)
+{
+	struct fanout_test t;
+	struct sa laddr;
+	char uri[256];
+	int err;
+
+	memset(&t, 0, sizeof(t));
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err  = sip_alloc(&t.sip_a, NULL, 32, 32, 32, "a", NULL, NULL);
+	err |= sip_alloc(&t.sip_b, NULL, 32, 32, 32, "b", NULL, NULL);
+	TEST_ERR(err);
+
+	err  = sip_transp_add(t.sip_a, SIP_TRANSP_UDP, &laddr);
+	err |= sip_transp_add(t.sip_b, SIP_TRANSP_UDP, &laddr);
+	TEST_ERR(err);
+
+	err  = sipevent_listen(&t.sock_a, t.sip_a, 32, 32, NULL, NULL);
+	err |= sipevent_listen(&t.sock_b, t.sip_b, 32, 32,
+			       fanout_subscribe_handler, &t);
+	TEST_ERR(err);
+
+	err = sipevent_fanout_alloc(&t.fo, 0);
+	TEST_ERR(err);
+
+	err = sip_transp_laddr(t.sip_b, &laddr, SIP_TRANSP_UDP, NULL);
+	TEST_ERR(err);
+
+	re_snprintf(uri, sizeof(uri), "sip:b@%J", &laddr);
+
+	for (size_t i=0; i<FANOUT_SUBS; i++) {
+
+		struct fanout_sub *fs = &t.subv[i];
+		const char *event = i ? test_event : "my-event;max-rate=5";
+
+		fs->t = &t;
+
+		err = sipevent_subscribe(&fs->sub, t.sock_a, uri, "a",
+					 "sip:a@127.0.0.1", event, NULL, 600,
+					 "a", NULL, 0, NULL, NULL, false,
+					 NULL, fanout_notify_handler,
+					 fanout_close_handler, fs, NULL);
+		TEST_ERR(err);
+	}
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+
+	err = t.err;
+	TEST_ERR(err);
+
+	TEST_EQUALS(2 * FANOUT_SUBS, t.notc);
+	TEST_EQUALS(0, sipevent_fanout_pending(t.fo));
+
+ out:
+	for (size_t i=0; i<FANOUT_SUBS; i++) {
+		mem_deref(t.subv[i].sub);
+		mem_deref(t.notv[i]);
+	}
+
+	mem_deref(t.fo);
+	mem_deref(t.sock_a);
+	mem_deref(t.sock_b);
+
+	sip_close(t.sip_a, true);
+	sip_close(t.sip_b, true);
+	mem_deref(t.sip_a);
+	mem_deref(t.sip_b);
+
+	return err;
+}
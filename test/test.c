@@ -65,14 +65,21 @@ static const struct test tests[] = {
 	TEST(test_conf),
 	TEST(test_crc32),
 	TEST(test_dns_hdr),
+	TEST(test_dns_cache),
+	TEST(test_dns_getaddrinfo),
 	TEST(test_dns_rr),
 	TEST(test_dns_dname),
 	TEST(test_dsp),
 #ifdef USE_TLS
 	TEST(test_dtls),
 	TEST(test_dtls_srtp),
+	TEST(test_dtls_cookie),
+	TEST(test_dtls_limit),
 #endif
 	TEST(test_dtmf),
+	TEST(test_fec),
+	TEST(test_fec_recovery),
+	TEST(test_fec_recovery_perf),
 	TEST(test_fir),
 	TEST(test_fmt_gmtime),
 	TEST(test_fmt_human_time),
@@ -110,6 +117,8 @@ static const struct test tests[] = {
 	TEST(test_http_large_body),
 	TEST(test_http_conn),
 	TEST(test_http_conn_large_body),
+	TEST(test_http_pipeline),
+	TEST(test_http_client_pool),
 #ifdef USE_TLS
 	TEST(test_https_loop),
 	TEST(test_http_client_set_tls),
@@ -157,6 +166,7 @@ static const struct test tests[] = {
 	TEST(test_rtcp_decode),
 	TEST(test_rtcp_packetloss),
 	TEST(test_rtcp_twcc),
+	TEST(test_rtcp_twcc_encode),
 	TEST(test_sa_class),
 	TEST(test_sa_cmp),
 	TEST(test_sa_decode),
@@ -177,11 +187,20 @@ static const struct test tests[] = {
 	TEST(test_sip_hdr),
 	TEST(test_sip_param),
 	TEST(test_sip_parse),
+	TEST(test_sip_parse_fuzz),
+	TEST(test_sip_parse_lazy),
+	TEST(test_sip_overload),
+	TEST(test_sip_parse_perf),
+	TEST(test_sip_reply),
+	TEST(test_sip_retransmit),
+	TEST(test_sip_shard),
+	TEST(test_sip_tcp_framing),
 	TEST(test_sip_via),
 #ifdef USE_TLS
 	TEST(test_sip_transp_add_client_cert),
 #endif
 	TEST(test_sipevent),
+	TEST(test_sipevent_fanout),
 	TEST(test_sipsess),
 	TEST(test_sipsess_reject),
 	TEST(test_sipsess_blind_transfer),
@@ -212,6 +231,8 @@ static const struct test tests[] = {
 #ifdef USE_TLS
 	TEST(test_tls),
 	TEST(test_tls_ec),
+	TEST(test_tls_async),
+	TEST(test_tls_async_perf),
 	TEST(test_tls_selfsigned),
 	TEST(test_tls_certificate),
 	TEST(test_tls_false_cafile_path),
@@ -227,6 +248,7 @@ static const struct test tests[] = {
 	TEST(test_turn),
 	TEST(test_turn_tcp),
 	TEST(test_udp),
+	TEST(test_udp_pkt_class),
 	TEST(test_unixsock),
 	TEST(test_uri),
 	TEST(test_uri_encode),
@@ -239,6 +261,9 @@ static const struct test tests[] = {
 	TEST(test_vidconv_scaling),
 	TEST(test_vidconv_pixel_formats),
 	TEST(test_websock),
+	TEST(test_websock_mask),
+	TEST(test_websock_deflate),
+	TEST(test_websock_deflate_perf),
 	TEST(test_trace),
 	TEST(test_thread),
 
@@ -255,7 +280,12 @@ static const struct test tests_integration[] = {
 	TEST(test_dns_integration),
 	TEST(test_net_dst_source_addr_get),
 	TEST(test_rtp_listen),
+	TEST(test_rtp_rtx),
+	TEST(test_rtp_pacer),
+	TEST(test_rtp_pacer_dst),
+	TEST(test_rtp_pacer_refill),
 	TEST(test_sip_drequestf_network),
+	TEST(test_sip_retransmit_timing),
 	TEST(test_sipevent_network),
 	TEST(test_sipreg_tcp),
 #ifdef USE_TLS
@@ -614,7 +644,7 @@ static int testcase_perf(const struct test *test, double *usec_avgp)
 	if (usec_avgp)
 		*usec_avgp = usec_avg;
 
-	re_printf("%-32s:  %10.2f usec  [%6u repeats]\n",
+	re_printf("%-32s:  %10.2f usec  [%6zu repeats]\n",
 		  test->name, usec_avg, i);
 
 	return 0;
@@ -170,11 +170,16 @@ int test_bfcp_tcp(void);
 int test_conf(void);
 int test_crc32(void);
 int test_dns_hdr(void);
+int test_dns_cache(void);
+int test_dns_getaddrinfo(void);
 int test_dns_integration(void);
 int test_dns_rr(void);
 int test_dns_dname(void);
 int test_dsp(void);
 int test_dtmf(void);
+int test_fec(void);
+int test_fec_recovery(void);
+int test_fec_recovery_perf(void);
 int test_fir(void);
 int test_fmt_gmtime(void);
 int test_fmt_timestamp(void);
@@ -212,6 +217,8 @@ int test_http_loop(void);
 int test_http_large_body(void);
 int test_http_conn(void);
 int test_http_conn_large_body(void);
+int test_http_pipeline(void);
+int test_http_client_pool(void);
 int test_dns_http_integration(void);
 int test_dns_cache_http_integration(void);
 #ifdef USE_TLS
@@ -261,12 +268,17 @@ int test_rtmps_publish(void);
 #endif
 int test_rtp(void);
 int test_rtp_listen(void);
+int test_rtp_rtx(void);
+int test_rtp_pacer(void);
+int test_rtp_pacer_dst(void);
+int test_rtp_pacer_refill(void);
 int test_rtpext(void);
 int test_rtcp_encode(void);
 int test_rtcp_encode_afb(void);
 int test_rtcp_decode(void);
 int test_rtcp_packetloss(void);
 int test_rtcp_twcc(void);
+int test_rtcp_twcc_encode(void);
 int test_sa_class(void);
 int test_sa_cmp(void);
 int test_sa_decode(void);
@@ -288,11 +300,21 @@ int test_sip_hdr(void);
 int test_sip_msg(void);
 int test_sip_param(void);
 int test_sip_parse(void);
+int test_sip_parse_fuzz(void);
+int test_sip_parse_lazy(void);
+int test_sip_overload(void);
+int test_sip_parse_perf(void);
+int test_sip_reply(void);
+int test_sip_retransmit(void);
+int test_sip_retransmit_timing(void);
+int test_sip_shard(void);
+int test_sip_tcp_framing(void);
 int test_sip_via(void);
 #ifdef USE_TLS
 int test_sip_transp_add_client_cert(void);
 #endif
 int test_sipevent(void);
+int test_sipevent_fanout(void);
 int test_sipreg_udp(void);
 int test_sipreg_tcp(void);
 #ifdef USE_TLS
@@ -334,6 +356,7 @@ int test_turn(void);
 int test_turn_tcp(void);
 int test_turn_thread(void);
 int test_udp(void);
+int test_udp_pkt_class(void);
 int test_unixsock(void);
 int test_uri(void);
 int test_uri_encode(void);
@@ -346,12 +369,19 @@ int test_vidconv(void);
 int test_vidconv_scaling(void);
 int test_vidconv_pixel_formats(void);
 int test_websock(void);
+int test_websock_mask(void);
+int test_websock_deflate(void);
+int test_websock_deflate_perf(void);
 int test_trace(void);
 #ifdef USE_TLS
 int test_dtls(void);
 int test_dtls_srtp(void);
+int test_dtls_cookie(void);
+int test_dtls_limit(void);
 int test_tls(void);
 int test_tls_ec(void);
+int test_tls_async(void);
+int test_tls_async_perf(void);
 int test_tls_selfsigned(void);
 int test_tls_certificate(void);
 int test_tls_false_cafile_path(void);
@@ -523,6 +553,7 @@ int sip_server_uri(struct sip_server *srv, char *uri, size_t sz,
 struct fuzz;
 
 int fuzz_register_tcpconn(struct fuzz **fuzzp, struct tcp_conn *tc);
+void fuzz_mbuf(struct mbuf *mb, unsigned nbits);
 
 
 /*
@@ -533,7 +564,9 @@ struct dns_server {
 	struct udp_sock *us;
 	struct sa addr;
 	struct list rrl;
+	uint32_t nq;
 	bool rotate;
+	bool silent;
 };
 
 int dns_server_alloc(struct dns_server **srvp, bool rotate);
@@ -544,4 +577,6 @@ int dns_server_add_aaaa(struct dns_server *srv, const char *name,
 int dns_server_add_srv(struct dns_server *srv, const char *name,
 		       uint16_t pri, uint16_t weight, uint16_t port,
 		       const char *target);
+int dns_server_add_soa(struct dns_server *srv, const char *zone,
+		       uint32_t ttlmin);
 void dns_server_flush(struct dns_server *srv);
@@ -181,8 +181,9 @@ static void server_conn_handler(const struct sa *peer, void *arg)
 
 
 static int test_tls_base(enum tls_keytype keytype, bool add_ca, int exp_verr,
-	bool test_sess_reuse, int forced_version)
+	bool test_sess_reuse, int forced_version, bool async)
 {
+	struct re_async *ra = NULL;
 	struct tls_test tt;
 	struct sa srv;
 	int err, verr;
@@ -221,6 +222,19 @@ static int test_tls_base(enum tls_keytype keytype, bool add_ca, int exp_verr,
 		goto out;
 	}
 
+	if (async) {
+		err = re_async_alloc(&ra, 2);
+		if (err)
+			goto out;
+
+		err = tls_set_async(tt.tls, ra);
+		if (err == ENOSYS) {
+			err = 0;
+			goto out;
+		}
+		TEST_ERR(err);
+	}
+
 	if (add_ca) {
 		char cafile[256];
 
@@ -284,6 +298,10 @@ static int test_tls_base(enum tls_keytype keytype, bool add_ca, int exp_verr,
 				tls_session_reused(tt.sc_cli));
 		}
 
+		/* the server signs once per full handshake */
+		if (async)
+			TEST_EQUALS(1 + i, tls_async_ops(tt.tls));
+
 		tt.sc_cli = mem_deref(tt.sc_cli);
 		tt.sc_srv = mem_deref(tt.sc_srv);
 		tt.tc_cli = mem_deref(tt.tc_cli);
@@ -293,6 +311,14 @@ static int test_tls_base(enum tls_keytype keytype, bool add_ca, int exp_verr,
 		tt.recv_cli = 0;
 	}
 
+	/* the original key is back, it does not use the pool */
+	if (async) {
+		err = tls_set_async(tt.tls, NULL);
+		TEST_ERR(err);
+
+		TEST_EQUALS(1, mem_nrefs(ra));
+	}
+
  out:
 	/* NOTE: close context first */
 	mem_deref(tt.tls);
@@ -302,6 +328,7 @@ static int test_tls_base(enum tls_keytype keytype, bool add_ca, int exp_verr,
 	mem_deref(tt.tc_cli);
 	mem_deref(tt.tc_srv);
 	mem_deref(tt.ts);
+	mem_deref(ra);
 
 	return err;
 }
@@ -310,20 +337,20 @@ static int test_tls_base(enum tls_keytype keytype, bool add_ca, int exp_verr,
 int test_tls_session_reuse_tls_v12(void)
 {
 	return test_tls_base(TLS_KEYTYPE_EC, false, EAUTH, true,
-		TLS1_2_VERSION);
+		TLS1_2_VERSION, false);
 }
 
 
 /* TLS v1.3 session reuse is not yet supported by libre */
 int test_tls_session_reuse(void)
 {
-	return test_tls_base(TLS_KEYTYPE_EC, false, EAUTH, true, -1);
+	return test_tls_base(TLS_KEYTYPE_EC, false, EAUTH, true, -1, false);
 }
 
 
 int test_tls(void)
 {
-	return test_tls_base(TLS_KEYTYPE_EC, false, EAUTH, false, -1);
+	return test_tls_base(TLS_KEYTYPE_EC, false, EAUTH, false, -1, false);
 }
 
 
@@ -331,10 +358,26 @@ int test_tls_ec(void)
 {
 	int err;
 
-	err = test_tls_base(TLS_KEYTYPE_EC, false, EAUTH, false, -1);
+	err = test_tls_base(TLS_KEYTYPE_EC, false, EAUTH, false, -1, false);
+	TEST_ERR(err);
+
+	err = test_tls_base(TLS_KEYTYPE_EC, true, 0, false, -1, false);
+	TEST_ERR(err);
+
+out:
+	return err;
+}
+
+
+int test_tls_async(void)
+{
+	int err;
+
+	err = test_tls_base(TLS_KEYTYPE_EC, false, EAUTH, false,
+			    TLS1_2_VERSION, true);
 	TEST_ERR(err);
 
-	err = test_tls_base(TLS_KEYTYPE_EC, true, 0, false, -1);
+	err = test_tls_base(TLS_KEYTYPE_EC, true, 0, false, -1, true);
 	TEST_ERR(err);
 
 out:
@@ -342,6 +385,386 @@ out:
 }
 
 
+/*
+ * Event loop latency while a TLS server accepts a storm of handshakes.
+ * A client thread starts STORM_RATE handshakes per second, a 1 ms timer
+ * on the server loop measures how late it fires.
+ */
+enum {
+	STORM_HS     = 500,    /* Handshakes per run              */
+	STORM_RATE   = 1000,   /* Handshakes per second           */
+	STORM_WINDOW = 64,     /* Client handshakes in flight     */
+	STORM_IDLE   = 500,    /* Probes without handshakes       */
+	STORM_PROBES = 8192,   /* Timer lag samples               */
+};
+
+struct storm {
+	struct tls *tls;       /* Server context                  */
+	struct tcp_sock *ts;
+	struct list connl;     /* Server connections              */
+	struct sa srv;
+	struct tmr tmr;        /* Latency probe                   */
+	uint64_t due;          /* Probe expiry [us]               */
+	uint32_t lagv[STORM_PROBES];
+	uint32_t n_lag;
+	uint32_t n_hs;
+	mtx_t *mtx;
+	bool done;             /* Written by the client thread    */
+	int err;
+};
+
+struct storm_cli {
+	struct storm *st;
+	struct tls *tls;
+	struct tmr tmr;
+	struct list connl;
+	uint64_t start;        /* [ms]                            */
+	uint32_t n_start;
+	uint32_t n_done;
+	int err;
+};
+
+struct storm_conn {
+	struct le le;
+	struct tcp_conn *tc;
+	struct tls_conn *sc;
+	void *owner;           /* struct storm or storm_cli       */
+	bool estab;
+};
+
+
+static void storm_conn_destructor(void *arg)
+{
+	struct storm_conn *c = arg;
+
+	list_unlink(&c->le);
+	mem_deref(c->sc);
+	mem_deref(c->tc);
+}
+
+
+static void storm_destructor(void *arg)
+{
+	struct storm *st = arg;
+
+	tmr_cancel(&st->tmr);
+	list_flush(&st->connl);
+	mem_deref(st->ts);
+	mem_deref(st->tls);
+	mem_deref(st->mtx);
+}
+
+
+/* the server closes, so it never writes to a closed socket */
+static void storm_srv_estab(void *arg)
+{
+	mem_deref(arg);
+}
+
+
+static void storm_srv_close(int err, void *arg)
+{
+	(void)err;
+
+	mem_deref(arg);
+}
+
+
+static void storm_conn_handler(const struct sa *peer, void *arg)
+{
+	struct storm *st = arg;
+	struct storm_conn *c;
+	int err;
+	(void)peer;
+
+	c = mem_zalloc(sizeof(*c), storm_conn_destructor);
+	if (!c) {
+		tcp_reject(st->ts);
+		return;
+	}
+
+	c->owner = st;
+	list_append(&st->connl, &c->le, c);
+
+	err = tcp_accept(&c->tc, st->ts, storm_srv_estab, NULL,
+			 storm_srv_close, c);
+	if (err) {
+		tcp_reject(st->ts);
+		mem_deref(c);
+		return;
+	}
+
+	err = tls_start_tcp(&c->sc, st->tls, c->tc, 0);
+	if (err)
+		mem_deref(c);
+}
+
+
+static void storm_cli_estab(void *arg)
+{
+	struct storm_conn *c = arg;
+
+	c->estab = true;
+}
+
+
+static void storm_cli_close(int err, void *arg)
+{
+	struct storm_conn *c = arg;
+	struct storm_cli *cli = c->owner;
+
+	if (!c->estab) {
+		cli->err = err ? err : ECONNRESET;
+		re_cancel();
+		return;
+	}
+
+	mem_deref(c);
+
+	if (++cli->n_done == cli->st->n_hs)
+		re_cancel();
+}
+
+
+static int storm_cli_start(struct storm_cli *cli)
+{
+	struct storm_conn *c;
+	int err;
+
+	c = mem_zalloc(sizeof(*c), storm_conn_destructor);
+	if (!c)
+		return ENOMEM;
+
+	c->owner = cli;
+	list_append(&cli->connl, &c->le, c);
+
+	err = tcp_connect(&c->tc, &cli->st->srv, storm_cli_estab, NULL,
+			  storm_cli_close, c);
+	if (err)
+		goto out;
+
+	err = tls_start_tcp(&c->sc, cli->tls, c->tc, 0);
+
+ out:
+	if (err)
+		mem_deref(c);
+
+	return err;
+}
+
+
+static void storm_cli_tmr(void *arg)
+{
+	struct storm_cli *cli = arg;
+	uint64_t due;
+	int err;
+
+	due = (tmr_jiffies() - cli->start) * STORM_RATE / 1000 + 1;
+	due = min(due, (uint64_t)cli->st->n_hs);
+
+	while (cli->n_start < due &&
+	       list_count(&cli->connl) < STORM_WINDOW) {
+
+		err = storm_cli_start(cli);
+		if (err) {
+			cli->err = err;
+			re_cancel();
+			return;
+		}
+
+		++cli->n_start;
+	}
+
+	tmr_start(&cli->tmr, 1, storm_cli_tmr, cli);
+}
+
+
+static int storm_client(void *arg)
+{
+	struct storm *st = arg;
+	struct storm_cli cli;
+	int err;
+
+	memset(&cli, 0, sizeof(cli));
+	cli.st = st;
+
+	err = re_thread_init();
+	if (err)
+		goto out;
+
+	tmr_init(&cli.tmr);
+
+	err = tls_alloc(&cli.tls, TLS_METHOD_SSLV23, NULL, NULL);
+	if (!err) {
+		cli.start = tmr_jiffies();
+		storm_cli_tmr(&cli);
+		err = re_main(NULL);
+		if (!err)
+			err = cli.err;
+	}
+
+	tmr_cancel(&cli.tmr);
+	list_flush(&cli.connl);
+	mem_deref(cli.tls);
+
+	re_thread_close();
+
+ out:
+	mtx_lock(st->mtx);
+	st->done = true;
+	st->err  = err;
+	mtx_unlock(st->mtx);
+
+	return 0;
+}
+
+
+static void storm_probe(void *arg)
+{
+	struct storm *st = arg;
+	uint64_t now = tmr_jiffies_usec();
+	bool done;
+
+	if (st->n_lag < STORM_PROBES)
+		st->lagv[st->n_lag++] = now > st->due ?
+			(uint32_t)(now - st->due) : 0;
+
+	mtx_lock(st->mtx);
+	done = st->done || (!st->n_hs && st->n_lag == STORM_IDLE);
+	mtx_unlock(st->mtx);
+
+	if (done) {
+		re_cancel();
+		return;
+	}
+
+	tmr_start(&st->tmr, 1, storm_probe, st);
+	st->due = st->tmr.jfs * 1000;
+}
+
+
+static int lag_cmp(const void *p1, const void *p2)
+{
+	const uint32_t *v1 = p1;
+	const uint32_t *v2 = p2;
+
+	return (*v1 > *v2) - (*v1 < *v2);
+}
+
+
+static int storm_run(const char *curve, struct re_async *ra, uint32_t n_hs)
+{
+	struct storm *st;
+	uint64_t start, usec;
+	thrd_t thr;
+	int err;
+
+	st = mem_zalloc(sizeof(*st), storm_destructor);
+	if (!st)
+		return ENOMEM;
+
+	tmr_init(&st->tmr);
+	st->n_hs = n_hs;
+
+	err = mutex_alloc(&st->mtx);
+	TEST_ERR(err);
+
+	err = sa_set_str(&st->srv, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err = tls_alloc(&st->tls, TLS_METHOD_SSLV23, NULL, NULL);
+	TEST_ERR(err);
+
+	if (curve)
+		err = tls_set_selfsigned_ec(st->tls, "127.0.0.1", curve);
+	else
+		err = tls_set_selfsigned_rsa(st->tls, "127.0.0.1", 2048);
+	TEST_ERR(err);
+
+	err = tls_set_async(st->tls, ra);
+	TEST_ERR(err);
+
+	err = tcp_listen(&st->ts, &st->srv, storm_conn_handler, st);
+	TEST_ERR(err);
+
+	err = tcp_sock_local_get(st->ts, &st->srv);
+	TEST_ERR(err);
+
+	tmr_start(&st->tmr, 1, storm_probe, st);
+	st->due = st->tmr.jfs * 1000;
+
+	start = tmr_jiffies_usec();
+
+	if (n_hs) {
+		err = thread_create_name(&thr, "tls storm", storm_client, st);
+		TEST_ERR(err);
+	}
+
+	err = re_main_timeout(30000);
+
+	if (n_hs)
+		thrd_join(thr, NULL);
+	TEST_ERR(err);
+
+	err = st->err;
+	TEST_ERR(err);
+
+	usec = tmr_jiffies_usec() - start;
+
+	qsort(st->lagv, st->n_lag, sizeof(st->lagv[0]), lag_cmp);
+
+	re_printf("tls: %-5s %-6s %4u hs/s, timer lag [us]:"
+		  " p50=%5u p99=%6u max=%6u\n",
+		  curve ? "ec" : "rsa", !n_hs ? "idle" :
+		  ra ? "async" : "inline",
+		  (unsigned)(n_hs * 1000000ULL / usec),
+		  st->lagv[st->n_lag / 2],
+		  st->lagv[st->n_lag * 99 / 100],
+		  st->lagv[st->n_lag - 1]);
+
+ out:
+	mem_deref(st);
+
+	return err;
+}
+
+
+/*
+ * Handshake storm with and without private-key offload,
+ * run with "retest -p test_tls_async_perf"
+ */
+int test_tls_async_perf(void)
+{
+	struct re_async *ra = NULL;
+	int err;
+
+	if (test_mode != TEST_PERF)
+		return ESKIPPED;
+
+	err = re_async_alloc(&ra, 4);
+	TEST_ERR(err);
+
+	/* offload needs OpenSSL async support */
+	err = storm_run("prime256v1", ra, 0);
+	if (err == ENOSYS) {
+		err = ESKIPPED;
+		goto out;
+	}
+	TEST_ERR(err);
+
+	err  = storm_run("prime256v1", NULL, STORM_HS);
+	err |= storm_run("prime256v1", ra, STORM_HS);
+	err |= storm_run(NULL, NULL, STORM_HS);
+	err |= storm_run(NULL, ra, STORM_HS);
+	TEST_ERR(err);
+
+ out:
+	mem_deref(ra);
+
+	return err;
+}
+
+
 int test_tls_selfsigned(void)
 {
 	struct tls *tls = NULL;
@@ -213,3 +213,166 @@ int test_udp(void)
 
 	return err;
 }
+
+
+struct class_test {
+	unsigned n_turn;
+	unsigned n_dtls;
+	unsigned n_recv;
+};
+
+
+static bool class_turn_recv(struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct class_test *ct = arg;
+	(void)src;
+
+	++ct->n_turn;
+
+	/* strip a fake ChannelData header */
+	mbuf_advance(mb, 4);
+
+	return false;
+}
+
+
+static bool class_dtls_recv(struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct class_test *ct = arg;
+	(void)src;
+	(void)mb;
+
+	++ct->n_dtls;
+
+	return true;
+}
+
+
+static void class_recv(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct class_test *ct = arg;
+	(void)src;
+	(void)mb;
+
+	++ct->n_recv;
+}
+
+
+static int class_packet(struct udp_sock *us, const struct sa *src,
+			const uint8_t *p, size_t n)
+{
+	struct mbuf *mb = mbuf_alloc(n);
+	int err;
+
+	if (!mb)
+		return ENOMEM;
+
+	err = mbuf_write_mem(mb, p, n);
+	if (!err) {
+		mb->pos = 0;
+		udp_recv_packet(us, src, mb);
+	}
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
+int test_udp_pkt_class(void)
+{
+	static const struct {
+		uint8_t b;
+		enum udp_pkt_class cls;
+	} testv[] = {
+		{  0, UDP_PKT_STUN},  {  3, UDP_PKT_STUN},
+		{  4, UDP_PKT_OTHER}, { 15, UDP_PKT_OTHER},
+		{ 16, UDP_PKT_ZRTP},  { 19, UDP_PKT_ZRTP},
+		{ 20, UDP_PKT_DTLS},  { 63, UDP_PKT_DTLS},
+		{ 64, UDP_PKT_TURN},  { 79, UDP_PKT_TURN},
+		{ 80, UDP_PKT_OTHER}, {127, UDP_PKT_OTHER},
+		{128, UDP_PKT_RTP},   {191, UDP_PKT_RTP},
+		{192, UDP_PKT_OTHER}, {255, UDP_PKT_OTHER},
+	};
+	static const uint8_t rtp[]  = {0x80, 0x00, 0x00, 0x01};
+	static const uint8_t stun[] = {0x00, 0x01, 0x00, 0x00};
+	static const uint8_t dtls[] = {22, 0xfe, 0xfd, 0x00};
+	static const uint8_t chan[] = {0x40, 0x00, 0x00, 0x04,
+				       22, 0xfe, 0xfd, 0x00};
+	struct udp_helper *uh_turn = NULL, *uh_dtls = NULL;
+	struct udp_sock *us = NULL;
+	struct class_test ct;
+	struct sa laddr;
+	struct mbuf mb;
+	uint8_t b;
+	int err;
+
+	memset(&mb, 0, sizeof(mb));
+	TEST_EQUALS(UDP_PKT_OTHER, udp_pkt_classify(&mb));
+
+	mb.buf  = &b;
+	mb.size = 1;
+	mb.end  = 1;
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(testv); i++) {
+		b = testv[i].b;
+		TEST_EQUALS(testv[i].cls, udp_pkt_classify(&mb));
+	}
+
+	memset(&ct, 0, sizeof(ct));
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err = udp_listen(&us, &laddr, class_recv, &ct);
+	TEST_ERR(err);
+
+	err = udp_register_helper(&uh_turn, us, 0, NULL, class_turn_recv,
+				  &ct);
+	TEST_ERR(err);
+
+	err = udp_register_helper(&uh_dtls, us, 1, NULL, class_dtls_recv,
+				  &ct);
+	TEST_ERR(err);
+
+	udp_helper_set_classes(uh_turn, UDP_PKT_TURN);
+	udp_helper_set_classes(uh_dtls, UDP_PKT_DTLS);
+
+	/* neither helper is called for RTP and STUN */
+	err  = class_packet(us, &laddr, rtp, sizeof(rtp));
+	err |= class_packet(us, &laddr, stun, sizeof(stun));
+	TEST_ERR(err);
+
+	TEST_EQUALS(0, ct.n_turn);
+	TEST_EQUALS(0, ct.n_dtls);
+	TEST_EQUALS(2, ct.n_recv);
+
+	err = class_packet(us, &laddr, dtls, sizeof(dtls));
+	TEST_ERR(err);
+
+	TEST_EQUALS(0, ct.n_turn);
+	TEST_EQUALS(1, ct.n_dtls);
+
+	/* DTLS inside ChannelData reaches the DTLS helper */
+	err = class_packet(us, &laddr, chan, sizeof(chan));
+	TEST_ERR(err);
+
+	TEST_EQUALS(1, ct.n_turn);
+	TEST_EQUALS(2, ct.n_dtls);
+
+	/* a helper without classes gets every packet */
+	udp_helper_set_classes(uh_dtls, 0);
+
+	err = class_packet(us, &laddr, rtp, sizeof(rtp));
+	TEST_ERR(err);
+
+	TEST_EQUALS(3, ct.n_dtls);
+	TEST_EQUALS(2, ct.n_recv);
+
+ out:
+	mem_deref(uh_dtls);
+	mem_deref(uh_turn);
+	mem_deref(us);
+
+	return err;
+}
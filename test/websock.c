@@ -15,9 +15,16 @@
 
 
 struct test {
+	char payload[4000];  /* larger than one frame buffer */
+	size_t len;
+	bool json;           /* new JSON message for each send */
+	uint32_t count;      /* messages to echo */
 	struct websock *ws;
 	struct websock_conn *wc_cli;
 	struct websock_conn *wc_srv;
+	struct websock_deflate_stats stats_cli;
+	struct websock_deflate_stats stats_srv;
+	uint64_t usec;
 	uint32_t n_estab_cli;
 	uint32_t n_recv_cli;
 	uint32_t n_recv_srv;
@@ -38,6 +45,11 @@ static void abort_test(struct test *t, int err)
 
 static void done(struct test *t)
 {
+	t->usec = tmr_jiffies_usec() - t->usec;
+
+	(void)websock_deflate_stats(t->wc_cli, &t->stats_cli);
+	(void)websock_deflate_stats(t->wc_srv, &t->stats_srv);
+
 	t->wc_cli = mem_deref(t->wc_cli);
 	t->wc_srv = mem_deref(t->wc_srv);
 
@@ -96,14 +108,66 @@ static void http_req_handler(struct http_conn *conn,
 }
 
 
+static int json_payload(struct test *test)
+{
+	struct odict *od = NULL;
+	int err;
+
+	err = odict_alloc(&od, 8);
+	if (err)
+		return err;
+
+	err |= odict_entry_add(od, "method", ODICT_STRING, "presence.update");
+	err |= odict_entry_add(od, "seq", ODICT_INT,
+			       (int64_t)test->n_recv_cli);
+	err |= odict_entry_add(od, "user", ODICT_STRING, "alice@example.com");
+	err |= odict_entry_add(od, "status", ODICT_STRING, "available");
+	err |= odict_entry_add(od, "note", ODICT_STRING,
+			       "In a meeting until 3pm, call my mobile");
+	err |= odict_entry_add(od, "expires", ODICT_INT,
+			       (int64_t)(3600 + test->n_recv_cli % 7));
+	if (err)
+		goto out;
+
+	if (re_snprintf(test->payload, sizeof(test->payload), "%H",
+			json_encode_odict, od) < 0) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	test->len = strlen(test->payload);
+
+ out:
+	mem_deref(od);
+
+	return err;
+}
+
+
+static int send_payload(struct test *test)
+{
+	int err;
+
+	if (test->json) {
+		err = json_payload(test);
+		if (err)
+			return err;
+	}
+
+	return websock_send(test->wc_cli, WEBSOCK_TEXT, "%b", test->payload,
+			    test->len);
+}
+
+
 static void cli_websock_estab_handler(void *arg)
 {
 	struct test *test = arg;
 	int err;
 
 	test->n_estab_cli++;
+	test->usec = tmr_jiffies_usec();
 
-	err = websock_send(test->wc_cli, WEBSOCK_TEXT, test_payload);
+	err = send_payload(test);
 	if (err)
 		abort_test(test, err);
 }
@@ -119,9 +183,15 @@ static void cli_websock_recv_handler(const struct websock_hdr *hdr,
 
 	TEST_EQUALS(WEBSOCK_TEXT, hdr->opcode);
 
-	TEST_STRCMP(test_payload, strlen(test_payload),
+	TEST_MEMCMP(test->payload, test->len,
 		    mbuf_buf(mb), mbuf_get_left(mb));
 
+	if (test->n_recv_cli < test->count) {
+		err = send_payload(test);
+		TEST_ERR(err);
+		return;
+	}
+
 	done(test);
 
  out:
@@ -143,24 +213,33 @@ static void cli_websock_close_handler(int err, void *arg)
 }
 
 
-static int test_websock_loop(void)
+static int test_websock_loop(struct test *test,
+			     const struct websock_deflate *dfl)
 {
 	struct http_sock *httpsock = NULL;
 	struct http_cli *http_cli = NULL;
 	struct dnsc *dnsc = NULL;
 	struct sa srv, dns;
-	struct test test;
 	char uri[256];
 	int err = 0;
 
-	memset(&test, 0, sizeof(test));
+	if (!test->len) {
+		for (size_t i=0; i<sizeof(test->payload); i++)
+			test->payload[i] =
+				test_payload[i % strlen(test_payload)];
+
+		test->len = sizeof(test->payload);
+	}
+
+	if (!test->count)
+		test->count = 1;
 
 	err |= sa_set_str(&srv, "127.0.0.1", 0);
 	err |= sa_set_str(&dns, "127.0.0.1", 53);    /* note: unused */
 	if (err)
 		goto out;
 
-	err = http_listen(&httpsock, &srv, http_req_handler, &test);
+	err = http_listen(&httpsock, &srv, http_req_handler, test);
 	if (err)
 		goto out;
 
@@ -176,40 +255,46 @@ static int test_websock_loop(void)
 	if (err)
 		goto out;
 
-	err = websock_alloc(&test.ws, websock_shutdown_handler, &test);
+	err = websock_alloc(&test->ws, websock_shutdown_handler, test);
 	if (err)
 		goto out;
 
+	if (dfl) {
+		err = websock_deflate(test->ws, dfl);
+		if (err)
+			goto out;
+	}
+
 	(void)re_snprintf(uri, sizeof(uri),
 			  "http://127.0.0.1:%u/", sa_port(&srv));
-	err = websock_connect_proto(&test.wc_cli, proto, test.ws,
+	err = websock_connect_proto(&test->wc_cli, proto, test->ws,
 			      http_cli, uri, 0,
 			      cli_websock_estab_handler,
 			      cli_websock_recv_handler,
-			      cli_websock_close_handler, &test,
+			      cli_websock_close_handler, test,
 			      "User-Agent: %s\r\n", custom_useragent);
 	if (err)
 		goto out;
 
-	err = re_main_timeout(500);
+	err = re_main_timeout(500 + test->count);
 	if (err)
 		goto out;
 
-	if (test.err) {
-		err = test.err;
+	if (test->err) {
+		err = test->err;
 		goto out;
 	}
 
 	/* verify results after traffic is successfully done */
-	TEST_EQUALS(1, test.n_estab_cli);
-	TEST_EQUALS(1, test.n_recv_cli);
-	TEST_EQUALS(1, test.n_recv_srv);
+	TEST_EQUALS(1, test->n_estab_cli);
+	TEST_EQUALS(test->count, test->n_recv_cli);
+	TEST_EQUALS(test->count, test->n_recv_srv);
 
  out:
 	mem_deref(httpsock);
-	mem_deref(test.wc_cli);
-	mem_deref(test.ws);
-	mem_deref(test.wc_srv);
+	mem_deref(test->wc_cli);
+	mem_deref(test->ws);
+	mem_deref(test->wc_srv);
 	mem_deref(http_cli);
 	mem_deref(dnsc);
 
@@ -219,9 +304,161 @@ static int test_websock_loop(void)
 
 int test_websock(void)
 {
+	struct test test;
+	int err;
+
+	memset(&test, 0, sizeof(test));
+
+	err = test_websock_loop(&test, NULL);
+	TEST_ERR(err);
+
+	/* not negotiated */
+	TEST_EQUALS(0, test.stats_cli.tx_raw);
+	TEST_EQUALS(0, test.stats_srv.tx_raw);
+
+ out:
+	return err;
+}
+
+
+int test_websock_deflate(void)
+{
+	static const struct websock_deflate dflv[] = {
+		{0, 0, 0, false, false},
+		{1, 10, 9, false, false},
+		{9, 0, 0, true, true},
+		{6, 9, 12, true, false},
+	};
+	struct test test;
 	int err = 0;
 
-	err |= test_websock_loop();
+	for (size_t i=0; i<RE_ARRAY_SIZE(dflv); i++) {
+
+		memset(&test, 0, sizeof(test));
+		test.count = 3;
 
+		err = test_websock_loop(&test, &dflv[i]);
+		if (err == ENOSYS)
+			return ESKIPPED;
+		TEST_ERR(err);
+
+		TEST_EQUALS(3 * sizeof(test.payload), test.stats_cli.tx_raw);
+		TEST_EQUALS(test.stats_cli.tx_raw, test.stats_srv.rx_raw);
+		TEST_EQUALS(test.stats_cli.tx_comp, test.stats_srv.rx_comp);
+		TEST_EQUALS(test.stats_srv.tx_raw, test.stats_cli.rx_raw);
+		TEST_EQUALS(test.stats_srv.tx_comp, test.stats_cli.rx_comp);
+
+		TEST_ASSERT(test.stats_cli.tx_comp * 10 <
+			    test.stats_cli.tx_raw);
+		TEST_ASSERT(test.stats_srv.tx_comp * 10 <
+			    test.stats_srv.tx_raw);
+	}
+
+ out:
+	return err;
+}
+
+
+/*
+ * Bytes on the wire and round-trip time of small JSON messages,
+ * run with "retest -p test_websock_deflate_perf"
+ */
+int test_websock_deflate_perf(void)
+{
+	enum { N = 500 };
+	static const struct {
+		const char *name;
+		struct websock_deflate dfl;
+	} v[] = {
+		{"level 1",              {1, 0, 0, false, false}},
+		{"level 6",              {6, 0, 0, false, false}},
+		{"level 6, no takeover", {6, 0, 0, true,  true}},
+		{"level 6, 9 bit window", {6, 9, 9, false, false}},
+	};
+	struct test test;
+	int err;
+
+	memset(&test, 0, sizeof(test));
+	test.json  = true;
+	test.count = N;
+
+	err = test_websock_loop(&test, NULL);
+	TEST_ERR(err);
+
+	re_printf("websock off: %zu bytes/msg, %u usec/msg\n",
+		  test.len, (unsigned)(test.usec / N));
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(v); i++) {
+
+		memset(&test, 0, sizeof(test));
+		test.json  = true;
+		test.count = N;
+
+		err = test_websock_loop(&test, &v[i].dfl);
+		if (err == ENOSYS)
+			return ESKIPPED;
+		TEST_ERR(err);
+
+		TEST_ASSERT(test.stats_cli.tx_comp < test.stats_cli.tx_raw);
+
+		re_printf("websock deflate %s: %llu bytes/msg (%llu raw),"
+			  " %u usec/msg\n", v[i].name,
+			  test.stats_cli.tx_comp / N,
+			  test.stats_cli.tx_raw / N,
+			  (unsigned)(test.usec / N));
+	}
+
+ out:
+	return err;
+}
+
+
+static int mask_check(const uint8_t *src, size_t len, size_t off,
+		      size_t pos)
+{
+	static const uint8_t mkey[4] = {0x12, 0x9a, 0x00, 0xff};
+	uint8_t ref[300], buf[320];
+	int err = 0;
+
+	for (size_t i=0; i<len; i++)
+		ref[i] = src[i] ^ mkey[(pos + i) % 4];
+
+	/* copying */
+	memset(buf, 0x55, sizeof(buf));
+	websock_mask(buf + off, src, len, mkey, pos);
+	TEST_MEMCMP(ref, len, buf + off, len);
+	TEST_EQUALS(0x55, buf[off + len]);
+
+	/* in place */
+	memcpy(buf + off, src, len);
+	websock_mask(buf + off, buf + off, len, mkey, pos);
+	TEST_MEMCMP(ref, len, buf + off, len);
+
+ out:
+	return err;
+}
+
+
+int test_websock_mask(void)
+{
+	uint8_t src[300];
+	int err = 0;
+
+	rand_bytes(src, sizeof(src));
+
+	for (size_t len=0; len<=280; len += (len < 70 ? 1 : 13)) {
+
+		/* all alignments and key positions */
+		for (size_t off=0; off<20; off++) {
+
+			for (size_t pos=0; pos<4; pos++) {
+
+				err = mask_check(src, len, off, pos);
+				TEST_ERR(err);
+			}
+		}
+	}
+
+ out:
 	return err;
 }